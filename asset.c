@@ -0,0 +1,265 @@
+// The functions in this file draw the images built into the kernel (see
+// asset.h). An image stays QOI encoded in .rodata, which for drawings and
+// backgrounds with large plain areas is a small part of the 4 bytes per
+// pixel it covers on the canvas, and is decoded a row at a time as it is
+// drawn: each row is decoded into a one-row buffer, and its visible,
+// opaque spans are copied into the canvas with canvasWrite(), so
+// no full-size copy of the image is ever made. Rows above the screen are
+// decoded and thrown away (the QOI operations can only be read in order),
+// and decoding stops at the bottom of the screen.
+//
+// Drawing an image is a drawing operation like any other: the pixels it
+// overwrites are saved for undo through undo_record_pixels(), and redo
+// draws the image again.
+
+#include "framebuffer.h"
+#include "systimer.h"
+#include "qoi.h"
+#include "kprintf.h"
+#include "stream.h"
+#include "undo.h"
+#include "compose.h"
+#include "canvas.h"
+#include "asset.h"
+
+// An image. The symbols are weak, so that an image whose file is missing
+// has a start of 0 instead of stopping the link.
+struct asset {
+    const char *name;
+    const unsigned char *start, *end;
+};
+
+extern const unsigned char _binary_assets_background_qoi_start[] __attribute__((weak));
+extern const unsigned char _binary_assets_background_qoi_end[] __attribute__((weak));
+extern const unsigned char _binary_assets_stamp_qoi_start[] __attribute__((weak));
+extern const unsigned char _binary_assets_stamp_qoi_end[] __attribute__((weak));
+
+static const struct asset assets[ASSET_COUNT] = {
+    { "background", _binary_assets_background_qoi_start,
+      _binary_assets_background_qoi_end },
+    { "stamp", _binary_assets_stamp_qoi_start, _binary_assets_stamp_qoi_end },
+};
+
+// The image row being drawn
+static unsigned int line[ASSET_MAX_WIDTH];
+
+// Statistics
+static unsigned int draws, failures;
+static unsigned long pixelsDecoded, lastDrawTicks, longestDrawTicks;
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       get32
+//
+//  Arguments:      p:           A pointer to four bytes
+//
+//  Returns:        The big-endian 32-bit value at p
+//
+//  Description:    This function reads an unaligned 32-bit value from a
+//                  QOI header, which is big-endian unlike the rest of the
+//                  project's formats.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned int get32(const unsigned char *p)
+{
+    return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       asset_size
+//
+//  Arguments:      asset:       The image, ASSET_*
+//                  width:       Set to its width, if not 0
+//                  height:      Set to its height, if not 0
+//
+//  Returns:        TRUE if the image is built in and its header is valid
+//
+//  Description:    This function checks an image's QOI header.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int asset_size(unsigned int asset, unsigned int *width, unsigned int *height)
+{
+    const struct asset *a;
+    unsigned int w, h;
+
+    if (asset >= ASSET_COUNT) {
+        return 0;
+    }
+    a = &assets[asset];
+    if (!a->start || a->end - a->start < ASSET_HEADER_SIZE + ASSET_END_SIZE ||
+        get32(a->start) != ASSET_MAGIC) {
+        return 0;
+    }
+
+    w = get32(a->start + 4);
+    h = get32(a->start + 8);
+    if (w == 0 || w > ASSET_MAX_WIDTH || h == 0 ||
+        (a->start[12] != 3 && a->start[12] != 4)) {
+        return 0;
+    }
+
+    if (width) {
+        *width = w;
+    }
+    if (height) {
+        *height = h;
+    }
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       draw_row
+//
+//  Arguments:      x:           Where the image's left edge goes (may be
+//                               off the screen)
+//                  y:           The canvas row (on the screen)
+//                  width:       The image width, the pixels in line[]
+//
+//  Returns:        void
+//
+//  Description:    This function copies each run of opaque pixels of the
+//                  decoded row in line[] that falls on the screen into the
+//                  canvas, after saving what it overwrites for undo.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void draw_row(int x, int y, int width)
+{
+    int first = 0, last, end = width;
+
+    // Clip to the screen; line[i] goes to x + i
+    if (x < 0) {
+        first = -x;
+    }
+    if (x + width > (int)frameBufferWidth) {
+        end = (int)frameBufferWidth - x;
+    }
+
+    while (first < end) {
+        if ((line[first] >> 24) < ASSET_ALPHA_THRESHOLD) {
+            first++;
+            continue;
+        }
+        for (last = first; last < end && (line[last] >> 24) >= ASSET_ALPHA_THRESHOLD; last++) {
+            line[last] &= 0x00FFFFFF;
+        }
+
+        undo_record_pixels(x + first, x + last - 1, y, line + first);
+        canvasWrite(x + first, x + last - 1, y, line + first);
+        stream_damage(x + first, x + last - 1, y);
+        compose_damage(x + first, x + last - 1, y);
+
+        first = last;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       asset_draw
+//
+//  Arguments:      asset:       The image, ASSET_*
+//                  x, y:        Where its top left corner goes (the image
+//                               is clipped to the screen)
+//
+//  Returns:        TRUE if the image was drawn
+//
+//  Description:    This function decodes an image into the canvas a row at
+//                  a time. An image whose data runs out before its last
+//                  row is drawn as far as it goes, and counted as a
+//                  failure.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int asset_draw(unsigned int asset, int x, int y)
+{
+    struct qoi_state state;
+    const unsigned char *data;
+    unsigned long start = timer_ticks(), ticks;
+    unsigned int width, height, length, used, decoded, row;
+
+    if (!frameBuffer || !asset_size(asset, &width, &height)) {
+        return 0;
+    }
+
+    // Nothing to decode if the image is off the screen
+    if (x >= (int)frameBufferWidth || x + (int)width <= 0 ||
+        y >= (int)frameBufferHeight || y + (int)height <= 0) {
+        return 1;
+    }
+
+    data = assets[asset].start + ASSET_HEADER_SIZE;
+    length = assets[asset].end - data - ASSET_END_SIZE;
+    qoi_reset(&state);
+
+    for (row = 0; row < height && y + (int)row < (int)frameBufferHeight; row++) {
+        decoded = qoi_decode(&state, data, length, &used, line, width);
+        data += used;
+        length -= used;
+        pixelsDecoded += decoded;
+
+        if (decoded < width) {
+            failures++;
+            log_warn("Assets: %s is damaged at row %u\n", assets[asset].name,
+                     row);
+            return 0;
+        }
+        if (y + (int)row >= 0) {
+            draw_row(x, y + (int)row, width);
+        }
+    }
+
+    ticks = timer_ticks() - start;
+    lastDrawTicks = ticks;
+    if (ticks > longestDrawTicks) {
+        longestDrawTicks = ticks;
+    }
+    draws++;
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       asset_report
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes the built-in images and the drawing
+//                  statistics to the console terminal.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void asset_report()
+{
+    unsigned int i, width, height;
+
+    for (i = 0; i < ASSET_COUNT; i++) {
+        if (asset_size(i, &width, &height)) {
+            log_info("Assets: %s %ux%u, %u bytes (%u%% of raw)\n",
+                     assets[i].name, width, height,
+                     (unsigned int)(assets[i].end - assets[i].start),
+                     (unsigned int)(100UL * (assets[i].end - assets[i].start) /
+                                    (4UL * width * height)));
+        }
+    }
+
+    log_info("Assets: %u draws, %u failures, %lu pixels decoded, last draw "
+             "%lu us, longest %lu us\n", draws, failures, pixelsDecoded,
+             ticks_to_us(lastDrawTicks), ticks_to_us(longestDrawTicks));
+}
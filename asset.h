@@ -0,0 +1,35 @@
+// Images built into the kernel. The Makefile turns each file
+// assets/NAME.qoi into an object file that puts its bytes in .rodata,
+// between the symbols _binary_assets_NAME_qoi_start and
+// _binary_assets_NAME_qoi_end. asset.c lists the names it knows; an asset
+// whose file is not there is left out of the kernel, and drawing it does
+// nothing.
+#define ASSET_BACKGROUND            0   // Drawn over the canvas at boot
+#define ASSET_STAMP                 1   // For COMMAND_IMAGE
+#define ASSET_COUNT                 2
+
+// The files are standard QOI images. The header (values big-endian) is
+//
+//     magic           4 bytes, ASSET_MAGIC
+//     width, height   4 bytes each
+//     channels        1 byte, 3 (RGB) or 4 (RGBA)
+//     colour space    1 byte, not used
+//
+// followed by the QOI operations (see qoi.c) and an end marker of
+// ASSET_END_SIZE bytes.
+#define ASSET_MAGIC                 0x716F6966      // "qoif"
+#define ASSET_HEADER_SIZE           14
+#define ASSET_END_SIZE              8
+
+// Widest image that can be drawn
+#define ASSET_MAX_WIDTH             2048
+
+// Pixels with less alpha than this are transparent and leave the canvas
+// as it is. The others are drawn with their alpha byte cleared, like the
+// rest of the canvas.
+#define ASSET_ALPHA_THRESHOLD       0x80
+
+// Function prototypes
+int asset_size(unsigned int asset, unsigned int *width, unsigned int *height);
+int asset_draw(unsigned int asset, int x, int y);
+void asset_report();
@@ -0,0 +1,291 @@
+// The functions in this file keep recently used SD card blocks in memory,
+// so that the save slots (see save.c) can read and write the card a block
+// at a time while the card sees transfers of a whole line of
+// BCACHE_LINE_BLOCKS consecutive blocks.
+//
+// The cache is write-back: a write only changes the cached copy and marks
+// the block dirty. Dirty blocks go to the card when their line is evicted,
+// or when bcache_flush_line() is called, one line per call so the caller
+// can spread a flush over several frames. A line is only read from the
+// card when a block is read that is not cached, so writing new data never
+// reads the old. The least recently used line is evicted.
+
+#include "emmc.h"
+#include "mmu.h"
+#include "kprintf.h"
+#include "bcache.h"
+
+// A cache line. valid and dirty have a bit for each block, and a line
+// with no valid blocks is free. The data is aligned to the data cache's
+// lines, as the DMA transfers need (see emmc.c).
+struct bcache_line {
+    unsigned int first;             // The first block, a multiple of
+                                    // BCACHE_LINE_BLOCKS
+    unsigned int valid, dirty;
+    unsigned long lastUsed;         // useCount when it was last used
+    unsigned int data[BCACHE_LINE_BLOCKS * EMMC_BLOCK_SIZE / 4]
+        __attribute__((aligned(MMU_CACHE_LINE)));
+};
+
+static struct bcache_line lines[BCACHE_LINES];
+static unsigned long useCount;
+
+// Statistics
+static unsigned int hits, misses, writeBacks;
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       copy_block
+//
+//  Arguments:      to:          Where to copy the block, 4-byte aligned
+//                  from:        The block, 4-byte aligned
+//
+//  Returns:        void
+//
+//  Description:    This function copies a block a word at a time.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void copy_block(unsigned int *to, const unsigned int *from)
+{
+    unsigned int i;
+
+    for (i = 0; i < EMMC_BLOCK_SIZE / 4; i++) {
+        to[i] = from[i];
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       write_back
+//
+//  Arguments:      line:        A cache line
+//
+//  Returns:        TRUE if its dirty blocks were written to the card
+//
+//  Description:    This function writes each run of consecutive dirty
+//                  blocks of a line to the card in one transfer.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int write_back(struct bcache_line *line)
+{
+    unsigned int start, end;
+
+    for (start = 0; start < BCACHE_LINE_BLOCKS; start = end) {
+        if ((line->dirty & (1 << start)) == 0) {
+            end = start + 1;
+            continue;
+        }
+        for (end = start + 1; end < BCACHE_LINE_BLOCKS && (line->dirty & (1 << end)); end++) {
+        }
+        if (!emmc_write(line->first + start, end - start,
+                        line->data + start * EMMC_BLOCK_SIZE / 4)) {
+            return 0;
+        }
+    }
+
+    line->dirty = 0;
+    writeBacks++;
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       find_line
+//
+//  Arguments:      block:       A block number
+//                  allocate:    TRUE to free a line for the block if it has
+//                               none
+//
+//  Returns:        The line holding the block's line of blocks, or 0 if
+//                  there is none (or no line could be freed)
+//
+//  Description:    This function looks a block up. When allocating, a
+//                  free line is used if there is one, or else the least
+//                  recently used line is written back and emptied.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static struct bcache_line *find_line(unsigned int block, int allocate)
+{
+    struct bcache_line *line, *victim = lines;
+    unsigned int first = block & ~(BCACHE_LINE_BLOCKS - 1);
+
+    for (line = lines; line < lines + BCACHE_LINES; line++) {
+        if (line->valid && line->first == first) {
+            line->lastUsed = ++useCount;
+            return line;
+        }
+        if (victim->valid && (!line->valid || line->lastUsed < victim->lastUsed)) {
+            victim = line;
+        }
+    }
+
+    if (!allocate || (victim->dirty && !write_back(victim))) {
+        return 0;
+    }
+
+    victim->first = first;
+    victim->valid = 0;
+    victim->lastUsed = ++useCount;
+    return victim;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       bcache_read
+//
+//  Arguments:      block:       The block number
+//                  data:        Where to put the block, 4-byte aligned
+//
+//  Returns:        TRUE if the block was read
+//
+//  Description:    This function reads a block, from the cache if it is
+//                  there. Otherwise the rest of its line is read as well,
+//                  except for blocks the cache already holds.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int bcache_read(unsigned int block, void *data)
+{
+    struct bcache_line *line = find_line(block, 1);
+    unsigned int offset = block & (BCACHE_LINE_BLOCKS - 1);
+    unsigned int i;
+
+    if (!line) {
+        return 0;
+    }
+
+    if (line->valid & (1 << offset)) {
+        hits++;
+    } else {
+        misses++;
+        if (line->valid == 0) {
+            // A new line: read all of it
+            if (!emmc_read(line->first, BCACHE_LINE_BLOCKS, line->data)) {
+                return 0;
+            }
+            line->valid = (1 << BCACHE_LINE_BLOCKS) - 1;
+        } else {
+            // Some of it has been written: read just the blocks missing
+            for (i = 0; i < BCACHE_LINE_BLOCKS; i++) {
+                if ((line->valid & (1 << i)) == 0) {
+                    if (!emmc_read(line->first + i, 1,
+                                   line->data + i * EMMC_BLOCK_SIZE / 4)) {
+                        return 0;
+                    }
+                    line->valid |= 1 << i;
+                }
+            }
+        }
+    }
+
+    copy_block(data, line->data + offset * EMMC_BLOCK_SIZE / 4);
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       bcache_write
+//
+//  Arguments:      block:       The block number
+//                  data:        The new contents of the block, 4-byte
+//                               aligned
+//
+//  Returns:        TRUE if the block was stored in the cache
+//
+//  Description:    This function replaces the contents of a block in the
+//                  cache. It only fails if a line has to be evicted and
+//                  cannot be written back.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int bcache_write(unsigned int block, const void *data)
+{
+    struct bcache_line *line = find_line(block, 1);
+    unsigned int offset = block & (BCACHE_LINE_BLOCKS - 1);
+
+    if (!line) {
+        return 0;
+    }
+
+    copy_block(line->data + offset * EMMC_BLOCK_SIZE / 4, data);
+    line->valid |= 1 << offset;
+    line->dirty |= 1 << offset;
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       bcache_flush_line
+//
+//  Arguments:      none
+//
+//  Returns:        1 if a line was written back, 0 if no line is dirty, or
+//                  -1 if a write failed
+//
+//  Description:    This function writes back the dirty line with the
+//                  lowest block number, so that a flush writes the card in
+//                  order. Calling it until it returns 0 flushes the cache.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int bcache_flush_line()
+{
+    struct bcache_line *line, *lowest = 0;
+
+    for (line = lines; line < lines + BCACHE_LINES; line++) {
+        if (line->dirty && (!lowest || line->first < lowest->first)) {
+            lowest = line;
+        }
+    }
+
+    if (!lowest) {
+        return 0;
+    }
+    return write_back(lowest) ? 1 : -1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       bcache_report
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes the cache statistics to the console
+//                  terminal.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void bcache_report()
+{
+    struct bcache_line *line;
+    unsigned int used = 0, dirty = 0;
+
+    for (line = lines; line < lines + BCACHE_LINES; line++) {
+        used += line->valid != 0;
+        dirty += line->dirty != 0;
+    }
+
+    log_info("Block cache: %u of %u lines used, %u dirty, %u hits %u misses "
+             "%u write-backs\n", used, BCACHE_LINES, dirty, hits, misses,
+             writeBacks);
+}
@@ -0,0 +1,11 @@
+// Blocks in a cache line, which are read from the card together
+#define BCACHE_LINE_BLOCKS          8
+
+// Lines in the cache
+#define BCACHE_LINES                32
+
+// Function prototypes
+int bcache_read(unsigned int block, void *data);
+int bcache_write(unsigned int block, const void *data);
+int bcache_flush_line();
+void bcache_report();
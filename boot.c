@@ -0,0 +1,85 @@
+// The functions in this file time the boot sequence. start.s notes the
+// generic timer count when core 0 starts and when it has filled its
+// stacks, turned on the caches and cleared .bss; main() marks the end of
+// each later phase with boot_mark(), up to the first frame, and then
+// writes the breakdown to the console terminal with boot_report(). The
+// timer counts from when the SoC was reset, so the count at _start is the
+// time the firmware took.
+
+#include "systimer.h"
+#include "kprintf.h"
+#include "boot.h"
+
+// Defined in start.s
+extern volatile unsigned long boot_start_ticks, boot_bss_ticks;
+
+// The phases marked so far, and the timer count at the end of each
+static const char *phaseNames[BOOT_MAX_PHASES];
+static unsigned long phaseTicks[BOOT_MAX_PHASES];
+static unsigned int phases;
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       boot_mark
+//
+//  Arguments:      phase:       The name of the phase that has just ended
+//
+//  Returns:        void
+//
+//  Description:    This function notes the end of a boot phase. It only
+//                  reads the timer, so it can be called before
+//                  timer_init(). Phases after the first BOOT_MAX_PHASES
+//                  are not recorded.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void boot_mark(const char *phase)
+{
+    if (phases == BOOT_MAX_PHASES) {
+        return;
+    }
+
+    phaseNames[phases] = phase;
+    phaseTicks[phases] = timer_ticks();
+    phases++;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       boot_report
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes how long the firmware, setting up
+//                  the stacks and .bss, and each marked phase took, and
+//                  the total from _start to the last mark, to the console
+//                  terminal.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void boot_report()
+{
+    unsigned long previous = boot_bss_ticks;
+    unsigned int i;
+
+    log_info("Boot: %-16s %8lu us\n", "firmware",
+             ticks_to_us(boot_start_ticks));
+    log_info("Boot: %-16s %8lu us\n", "stacks, .bss",
+             ticks_to_us(boot_bss_ticks - boot_start_ticks));
+
+    for (i = 0; i < phases; i++) {
+        log_info("Boot: %-16s %8lu us\n", phaseNames[i],
+                 ticks_to_us(phaseTicks[i] - previous));
+        previous = phaseTicks[i];
+    }
+
+    log_info("Boot: %-16s %8lu us\n", "total",
+             ticks_to_us(previous - boot_start_ticks));
+}
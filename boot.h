@@ -0,0 +1,6 @@
+// Most boot phases boot_mark() records
+#define BOOT_MAX_PHASES             16
+
+// Function prototypes
+void boot_mark(const char *phase);
+void boot_report();
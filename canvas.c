@@ -0,0 +1,499 @@
+// The functions in this file keep the canvas as a grid of 32 x 32 tiles.
+// A tile is either solid, one colour held in a single word, or a block of
+// pixels. Clearing the canvas or filling a rectangle makes the tiles it
+// covers whole solid instead of writing their pixels, and so does a flood
+// fill for the tiles it covers completely. Drawing into a solid tile
+// writes its pixels out first. The compositor and the live view read a
+// solid tile as its colour, so a cleared canvas only becomes pixels in
+// the frame buffer, when it is composed.
+//
+// A tile's pixels live in a 4 KB block of its own (one page, 32 rows of
+// 128 bytes), taken from a pool when the tile is written out and given
+// back when it is made solid again. The pool has a block for every tile
+// of the largest canvas, so taking one never fails, but only the tiles
+// that are not solid hold one: a canvas that is mostly plain keeps its
+// pixels in a few blocks at the front of the pool, in fewer cache lines
+// and TLB entries than rows spread over the whole canvas. The fill's
+// cores take and give back blocks at the same time, so the pool is
+// guarded by a spin lock (exclusive accesses work now that the data
+// cache is on, see mmu.c). If the canvas is the screen itself (see
+// initFrameBuffer()), tiles use the screen's rows instead.
+//
+// A row of the canvas is only contiguous within a tile, so code that
+// works on a row of pixels copies it with canvasRead(), which leaves
+// solid tiles solid, and canvasWrite(), or fills it with canvasFill().
+// Code that works on a tile's pixels in place asks canvasSpan() for the
+// part of a row in one tile.
+//
+// The tiles of different tile rows are independent, so cores may work on
+// different tile rows at the same time.
+//
+// The functions that may write the canvas tell the region index (see
+// region.c) which rows they touch.
+
+#include "framebuffer.h"
+#include "kprintf.h"
+#include "region.h"
+#include "canvas.h"
+
+// Pixels in a block
+#define CANVAS_BLOCK_PIXELS         (CANVAS_TILE_SIZE * CANVAS_TILE_SIZE)
+
+// The colour of each solid tile, and whether it is solid
+static unsigned int tileColour[CANVAS_MAX_TILE_ROWS][CANVAS_MAX_TILE_COLUMNS];
+static unsigned char tileSolid[CANVAS_MAX_TILE_ROWS][CANVAS_MAX_TILE_COLUMNS];
+
+// The block holding the pixels of each tile that is not solid
+static unsigned short tileBlock[CANVAS_MAX_TILE_ROWS][CANVAS_MAX_TILE_COLUMNS];
+
+// The pool of blocks, the free ones (the next to be taken last), and the
+// lock that guards the free list
+static unsigned int blocks[CANVAS_BLOCKS][CANVAS_BLOCK_PIXELS]
+    __attribute__((aligned(4096)));
+static unsigned short freeBlocks[CANVAS_BLOCKS];
+static unsigned int freeCount;
+static volatile unsigned int poolLock;
+
+// Statistics
+static unsigned int tilesFilled, tilesWritten, mostBlocks;
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       canvasInit
+//
+//  Arguments:      none
+//
+//  Returns:        The pool of blocks (for frameBuffer), or 0 if the canvas
+//                  has more tiles than the pool has blocks
+//
+//  Description:    This function makes every tile of the canvas solid
+//                  black, holding no block, and puts every block in the
+//                  free list. initFrameBuffer() calls it when the
+//                  compositor is used.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int *canvasInit()
+{
+    unsigned int columns = (frameBufferWidth + CANVAS_TILE_SIZE - 1) >> CANVAS_TILE_SHIFT;
+    unsigned int rows = (frameBufferHeight + CANVAS_TILE_SIZE - 1) >> CANVAS_TILE_SHIFT;
+    unsigned int tx, ty, i;
+
+    if (columns > CANVAS_MAX_TILE_COLUMNS || rows > CANVAS_MAX_TILE_ROWS ||
+        columns * rows > CANVAS_BLOCKS) {
+        log_error("Canvas: %u x %u tiles do not fit\n", columns, rows);
+        return 0;
+    }
+
+    for (ty = 0; ty < rows; ty++) {
+        for (tx = 0; tx < columns; tx++) {
+            tileColour[ty][tx] = BLACK;
+            tileSolid[ty][tx] = 1;
+        }
+    }
+
+    for (i = 0; i < CANVAS_BLOCKS; i++) {
+        freeBlocks[i] = CANVAS_BLOCKS - 1 - i;
+    }
+    freeCount = CANVAS_BLOCKS;
+
+    return blocks[0];
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       takeBlock
+//
+//  Arguments:      none
+//
+//  Returns:        A free block
+//
+//  Description:    This function takes a block from the pool. There is a
+//                  block for every tile, so one is always free when a
+//                  solid tile needs it.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned int takeBlock()
+{
+    unsigned int block, used;
+
+    while (__atomic_exchange_n(&poolLock, 1, __ATOMIC_ACQUIRE)) {
+    }
+    block = freeBlocks[--freeCount];
+    used = CANVAS_BLOCKS - freeCount;
+    if (used > mostBlocks) {
+        mostBlocks = used;
+    }
+    __atomic_store_n(&poolLock, 0, __ATOMIC_RELEASE);
+
+    return block;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       giveBlock
+//
+//  Arguments:      block:       A block no tile holds any more
+//
+//  Returns:        void
+//
+//  Description:    This function puts a block back in the pool, where it is
+//                  the next one taken.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void giveBlock(unsigned int block)
+{
+    while (__atomic_exchange_n(&poolLock, 1, __ATOMIC_ACQUIRE)) {
+    }
+    freeBlocks[freeCount++] = block;
+    __atomic_store_n(&poolLock, 0, __ATOMIC_RELEASE);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       tileRow
+//
+//  Arguments:      tx:          A tile that is not solid
+//                  y:           A row of the tile (on the screen)
+//
+//  Returns:        The row, addressed with screen x coordinates: element x
+//                  is pixel x for the x of the tile
+//
+//  Description:    This function finds a row of a tile's pixels, in its
+//                  block or, if the canvas is the screen, on the screen.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned int *tileRow(unsigned int tx, unsigned int y)
+{
+    if (frameBuffer == screenBuffer) {
+        return frameBufferRow(y);
+    }
+
+    return blocks[tileBlock[y >> CANVAS_TILE_SHIFT][tx]] +
+           ((y & (CANVAS_TILE_SIZE - 1)) << CANVAS_TILE_SHIFT) -
+           (tx << CANVAS_TILE_SHIFT);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       writeTile
+//
+//  Arguments:      tx, ty:      A solid tile
+//
+//  Returns:        void
+//
+//  Description:    This function writes a solid tile's colour to its
+//                  pixels, in a block taken from the pool, which makes it
+//                  a block.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void writeTile(unsigned int tx, unsigned int ty)
+{
+    unsigned int colour = tileColour[ty][tx], *row, *pixels;
+    unsigned int x0 = tx << CANVAS_TILE_SHIFT, y0 = ty << CANVAS_TILE_SHIFT;
+    unsigned int x1 = x0 + CANVAS_TILE_SIZE, y1 = y0 + CANVAS_TILE_SIZE, x, y, i;
+
+    if (frameBuffer != screenBuffer) {
+        tileBlock[ty][tx] = takeBlock();
+        pixels = blocks[tileBlock[ty][tx]];
+        for (i = 0; i < CANVAS_BLOCK_PIXELS; i++) {
+            pixels[i] = colour;
+        }
+        tileSolid[ty][tx] = 0;
+        tilesWritten++;
+        return;
+    }
+
+    if (x1 > frameBufferWidth) {
+        x1 = frameBufferWidth;
+    }
+    if (y1 > frameBufferHeight) {
+        y1 = frameBufferHeight;
+    }
+
+    for (y = y0; y < y1; y++) {
+        row = frameBufferRow(y);
+        for (x = x0; x < x1; x++) {
+            row[x] = colour;
+        }
+    }
+
+    tileSolid[ty][tx] = 0;
+    tilesWritten++;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       canvasSpan
+//
+//  Arguments:      x0, x1:      The first and last pixel of a span (on the
+//                               screen), both in the same tile
+//                  y:           The row
+//
+//  Returns:        The row of the tile, addressed with screen x
+//                  coordinates: element x is pixel x, for x0 to x1 only
+//
+//  Description:    This function writes out the pixels of the tile the
+//                  span is in if it is solid, so that the span can be read
+//                  and written directly.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int *canvasSpan(int x0, int x1, int y)
+{
+    unsigned int tx = x0 >> CANVAS_TILE_SHIFT;
+
+    regionDamage(y, y);
+    if (tileSolid[y >> CANVAS_TILE_SHIFT][tx]) {
+        writeTile(tx, y >> CANVAS_TILE_SHIFT);
+    }
+
+    return tileRow(tx, y);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       canvasRead
+//
+//  Arguments:      x0, x1:      The first and last pixel of a span (on the
+//                               screen)
+//                  y:           The row
+//                  pixels:      Where to copy the x1 - x0 + 1 pixels
+//
+//  Returns:        void
+//
+//  Description:    This function copies a span of the canvas, reading
+//                  solid tiles as their colour.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void canvasRead(int x0, int x1, int y, unsigned int *pixels)
+{
+    unsigned int ty = y >> CANVAS_TILE_SHIFT, tx, colour;
+    const unsigned int *row;
+    int x = x0, end;
+
+    while (x <= x1) {
+        tx = x >> CANVAS_TILE_SHIFT;
+        end = x | (CANVAS_TILE_SIZE - 1);
+        if (end > x1) {
+            end = x1;
+        }
+
+        if (tileSolid[ty][tx]) {
+            colour = tileColour[ty][tx];
+            for (; x <= end; x++) {
+                *pixels++ = colour;
+            }
+        } else {
+            row = tileRow(tx, y);
+            for (; x <= end; x++) {
+                *pixels++ = row[x];
+            }
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       canvasWrite
+//
+//  Arguments:      x0, x1:      The first and last pixel of a span (on the
+//                               screen)
+//                  y:           The row
+//                  pixels:      The x1 - x0 + 1 new pixels
+//
+//  Returns:        void
+//
+//  Description:    This function copies pixels into a span of the canvas,
+//                  writing out the solid tiles it covers first.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void canvasWrite(int x0, int x1, int y, const unsigned int *pixels)
+{
+    unsigned int ty = y >> CANVAS_TILE_SHIFT, tx, *row;
+    int x = x0, end;
+
+    regionDamage(y, y);
+    while (x <= x1) {
+        tx = x >> CANVAS_TILE_SHIFT;
+        end = x | (CANVAS_TILE_SIZE - 1);
+        if (end > x1) {
+            end = x1;
+        }
+
+        if (tileSolid[ty][tx]) {
+            writeTile(tx, ty);
+        }
+        row = tileRow(tx, y);
+        for (; x <= end; x++) {
+            row[x] = *pixels++;
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       canvasFill
+//
+//  Arguments:      x0, x1:      The first and last pixel of a span (on the
+//                               screen)
+//                  y:           The row
+//                  colour:      The new colour of the span
+//
+//  Returns:        void
+//
+//  Description:    This function makes a span of the canvas one colour,
+//                  writing out the solid tiles it covers first (unless
+//                  they are already that colour).
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void canvasFill(int x0, int x1, int y, unsigned int colour)
+{
+    unsigned int ty = y >> CANVAS_TILE_SHIFT, tx, *row;
+    int x = x0, end;
+
+    regionDamage(y, y);
+    while (x <= x1) {
+        tx = x >> CANVAS_TILE_SHIFT;
+        end = x | (CANVAS_TILE_SIZE - 1);
+        if (end > x1) {
+            end = x1;
+        }
+
+        if (tileSolid[ty][tx]) {
+            if (tileColour[ty][tx] == colour) {
+                x = end + 1;
+                continue;
+            }
+            writeTile(tx, ty);
+        }
+        row = tileRow(tx, y);
+        for (; x <= end; x++) {
+            row[x] = colour;
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       canvasSolidTile
+//
+//  Arguments:      tx, ty:      A tile
+//                  colour:      Where to store its colour
+//
+//  Returns:        TRUE if the tile is solid
+//
+//  Description:    This function tells whether a tile is one colour
+//                  without reading its pixels. A block tile may be one
+//                  colour too; it is not reported.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int canvasSolidTile(unsigned int tx, unsigned int ty, unsigned int *colour)
+{
+    if (!tileSolid[ty][tx]) {
+        return 0;
+    }
+
+    *colour = tileColour[ty][tx];
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       canvasFillTile
+//
+//  Arguments:      tx, ty:      A tile
+//                  colour:      Its new colour
+//
+//  Returns:        void
+//
+//  Description:    This function makes every pixel of a tile one colour by
+//                  making it solid, and gives its block back to the pool.
+//                  The caller saves what it overwrites for undo and
+//                  reports the change. If the canvas is the
+//                  frame buffer itself (see initFrameBuffer()), the pixels
+//                  are written at once, since nothing composes the tiles.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void canvasFillTile(unsigned int tx, unsigned int ty, unsigned int colour)
+{
+    if (!tileSolid[ty][tx] && frameBuffer != screenBuffer) {
+        giveBlock(tileBlock[ty][tx]);
+    }
+
+    tileColour[ty][tx] = colour;
+    tileSolid[ty][tx] = 1;
+    tilesFilled++;
+    regionDamageTile(ty);
+
+    if (frameBuffer == screenBuffer) {
+        writeTile(tx, ty);
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       canvasReport
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes the number of solid tiles, how
+//                  often tiles were made solid and written out, and the
+//                  blocks in use, to the console terminal. (Tiles written
+//                  out by the fill's other cores may be missed in the
+//                  count.)
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void canvasReport()
+{
+    unsigned int solid = 0, tx, ty;
+
+    for (ty = 0; ty < (frameBufferHeight + CANVAS_TILE_SIZE - 1) >> CANVAS_TILE_SHIFT; ty++) {
+        for (tx = 0; tx < (frameBufferWidth + CANVAS_TILE_SIZE - 1) >> CANVAS_TILE_SHIFT; tx++) {
+            solid += tileSolid[ty][tx];
+        }
+    }
+
+    log_info("Canvas: %u tiles solid, %u made solid, %u written out, "
+             "%u blocks used (most %u)\n",
+             solid, tilesFilled, tilesWritten,
+             frameBuffer == screenBuffer ? 0 : CANVAS_BLOCKS - freeCount,
+             mostBlocks);
+}
@@ -0,0 +1,22 @@
+// Tile size of the canvas, in pixels (a power of two, the same as the
+// compositor's and the stream's)
+#define CANVAS_TILE_SHIFT           5
+#define CANVAS_TILE_SIZE            (1 << CANVAS_TILE_SHIFT)
+
+// Most tile columns and rows (enough for 2048 x 2048)
+#define CANVAS_MAX_TILE_COLUMNS     64
+#define CANVAS_MAX_TILE_ROWS        64
+
+// Blocks of tile pixels in the pool: one for every tile of the largest
+// screen the compositor handles (1024 x 768, see compose.h)
+#define CANVAS_BLOCKS               768
+
+// Function prototypes
+unsigned int *canvasInit();
+unsigned int *canvasSpan(int x0, int x1, int y);
+void canvasRead(int x0, int x1, int y, unsigned int *pixels);
+void canvasWrite(int x0, int x1, int y, const unsigned int *pixels);
+void canvasFill(int x0, int x1, int y, unsigned int colour);
+int canvasSolidTile(unsigned int tx, unsigned int ty, unsigned int *colour);
+void canvasFillTile(unsigned int tx, unsigned int ty, unsigned int colour);
+void canvasReport();
@@ -0,0 +1,581 @@
+// The functions in this file implement a binary command protocol over the
+// UART, so a host script can draw on the canvas. Bytes arrive in the
+// interrupt driven receive ring, and command_poll() (called once per
+// frame) assembles them into frames, checks their CRC and sequence
+// number, executes every complete batch of drawing commands, and answers
+// each frame with an ACK. The frame layout is described in command.h.
+//
+// Frames carry a 16-bit sequence number. A batch is only executed if it
+// has the next expected sequence number; a repeated batch (because its
+// ACK was lost) is acknowledged again without being executed, and a
+// batch that arrives after a lost one is rejected, so the host can go
+// back and resend from the first unacknowledged frame.
+
+#include "uart.h"
+#include "framebuffer.h"
+#include "systimer.h"
+#include "crc32.h"
+#include "trace.h"
+#include "kprintf.h"
+#include "command.h"
+#include "snapshot.h"
+#include "stream.h"
+#include "input.h"
+#include "save.h"
+#include "undo.h"
+#include "raster.h"
+#include "asset.h"
+
+// A partly received frame is discarded if no byte arrives for this long
+#define COMMAND_TIMEOUT_US          100000
+
+// The frame being received, and how many of its bytes have arrived
+static unsigned char frame[COMMAND_HEADER_SIZE + COMMAND_MAX_PAYLOAD + 4];
+static unsigned int received, frameSize;
+static unsigned long lastReceiveTime;
+
+// The next expected sequence number. Until the first RESET or BATCH
+// frame arrives, any sequence number is accepted.
+static unsigned int expectedSequence;
+static int synchronized;
+
+// The ACK payload: status, next expected sequence, and query results
+static unsigned char reply[4 + 4 * COMMAND_MAX_RESULTS];
+
+// The current drawing colour, set with SET_COLOUR
+static unsigned int drawColour;
+
+// The vertices of a POLYGON command
+static int polygon[2 * RASTER_MAX_POINTS];
+
+// Statistics
+static unsigned int framesExecuted, commandsExecuted;
+static unsigned int crcErrors, sequenceErrors, badCommands, timeouts;
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       get16
+//
+//  Arguments:      p:           A pointer to two bytes
+//
+//  Returns:        The little-endian 16-bit value at p
+//
+//  Description:    This function reads a 16-bit value one byte at a time,
+//                  since protocol fields are not aligned.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned int get16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       get32
+//
+//  Arguments:      p:           A pointer to four bytes
+//
+//  Returns:        The little-endian 32-bit value at p
+//
+//  Description:    This function reads a 32-bit value one byte at a time.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned int get32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       put32
+//
+//  Arguments:      p:           Where to store the value
+//                  value:       The 32-bit value
+//
+//  Returns:        void
+//
+//  Description:    This function stores a little-endian 32-bit value.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline void put32(unsigned char *p, unsigned int value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       command_init
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function switches the UART to interrupt driven
+//                  operation and resets the protocol state.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void command_init()
+{
+    received = 0;
+    synchronized = 0;
+    drawColour = 0;     // BLACK, like drawPoint()
+
+    uart_enable_interrupts();
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       command_send_frame
+//
+//  Arguments:      type:        The frame type (COMMAND_FRAME_*)
+//                  sequence:    The sequence number
+//                  payload:     The payload bytes
+//                  length:      The payload length
+//
+//  Returns:        void
+//
+//  Description:    This function writes a frame, with its CRC, to the UART.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void command_send_frame(unsigned int type, unsigned int sequence,
+                        const unsigned char *payload, unsigned int length)
+{
+    unsigned char header[COMMAND_HEADER_SIZE], trailer[4];
+    unsigned int crc;
+
+    header[0] = COMMAND_SYNC;
+    header[1] = type;
+    header[2] = sequence;
+    header[3] = sequence >> 8;
+    header[4] = length;
+    header[5] = length >> 8;
+
+    crc = crc32(0, header + 1, COMMAND_HEADER_SIZE - 1);
+    crc = crc32(crc, payload, length);
+    put32(trailer, crc);
+
+    uart_write(header, COMMAND_HEADER_SIZE);
+    uart_write(payload, length);
+    uart_write(trailer, 4);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       send_ack
+//
+//  Arguments:      sequence:    The sequence number of the frame answered
+//                  status:      COMMAND_OK or an error status
+//                  results:     The number of query results in reply
+//
+//  Returns:        void
+//
+//  Description:    This function sends an ACK frame.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void send_ack(unsigned int sequence, unsigned int status,
+                     unsigned int results)
+{
+    reply[0] = status;
+    reply[1] = 0;
+    reply[2] = expectedSequence;
+    reply[3] = expectedSequence >> 8;
+
+    command_send_frame(COMMAND_FRAME_ACK, sequence, reply, 4 + 4 * results);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       execute
+//
+//  Arguments:      p:           The batch payload
+//                  length:      The payload length
+//                  results:     Set to the number of query results stored
+//                               in reply
+//
+//  Returns:        COMMAND_OK, or COMMAND_BAD_COMMAND if an unknown or
+//                  truncated command was found
+//
+//  Description:    This function executes every command in a batch, in
+//                  order. Queries are answered in the reply buffer.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned int execute(const unsigned char *p, unsigned int length,
+                            unsigned int *results)
+{
+    const unsigned char *end = p + length;
+    unsigned int count = 0, n;
+    short x, y;
+
+    *results = 0;
+
+    // A batch is undone and redone as one step
+    undo_begin();
+
+    while (p < end) {
+        switch (*p) {
+        case COMMAND_CLEAR:
+            p += 1;
+            undo_draw(UNDO_OP_CLEAR, 0, 0, 0, 0, 0);
+            break;
+
+        case COMMAND_SET_COLOUR:
+            if (end - p < 5) {
+                goto truncated;
+            }
+            drawColour = get32(p + 1);
+            p += 5;
+            break;
+
+        case COMMAND_POINT:
+            if (end - p < 5) {
+                goto truncated;
+            }
+            undo_draw(UNDO_OP_POINT, (short)get16(p + 1), (short)get16(p + 3),
+                      0, 0, drawColour);
+            p += 5;
+            break;
+
+        case COMMAND_LINE:
+            if (end - p < 9) {
+                goto truncated;
+            }
+            undo_draw(UNDO_OP_LINE, (short)get16(p + 1), (short)get16(p + 3),
+                      (short)get16(p + 5), (short)get16(p + 7), drawColour);
+            p += 9;
+            break;
+
+        case COMMAND_FILL_RECT:
+            if (end - p < 9) {
+                goto truncated;
+            }
+            undo_draw(UNDO_OP_RECT, (short)get16(p + 1), (short)get16(p + 3),
+                      get16(p + 5), get16(p + 7), drawColour);
+            p += 9;
+            break;
+
+        case COMMAND_FLOOD:
+            if (end - p < 5) {
+                goto truncated;
+            }
+            x = get16(p + 1);
+            y = get16(p + 3);
+            p += 5;
+
+            // The same fill as the X button: everything around the
+            // point up to a black boundary, in black
+            if ((unsigned short)x < frameBufferWidth &&
+                (unsigned short)y < frameBufferHeight) {
+                trace(TRACE_FILL_BEGIN, x, y);
+                undo_draw(UNDO_OP_POINT, x, y, 0, 0, WHITE);
+                undo_draw(UNDO_OP_FLOOD, x, y, BLACK, UNDO_FLOOD_4_BOUNDARY, BLACK);
+                trace(TRACE_FILL_END, 0, 0);
+            }
+            break;
+
+        case COMMAND_FILL:
+            if (end - p < 11) {
+                goto truncated;
+            }
+            x = get16(p + 1);
+            y = get16(p + 3);
+            trace(TRACE_FILL_BEGIN, x, y);
+            undo_draw(UNDO_OP_FLOOD, x, y, get32(p + 5),
+                      p[9] | ((p[10] == 8 ? 8 : 4) << 8), drawColour);
+            trace(TRACE_FILL_END, 0, 0);
+            p += 11;
+            break;
+
+        case COMMAND_CIRCLE:
+            if (end - p < 7) {
+                goto truncated;
+            }
+            undo_draw(UNDO_OP_CIRCLE, (short)get16(p + 1), (short)get16(p + 3),
+                      get16(p + 5), 0, drawColour);
+            p += 7;
+            break;
+
+        case COMMAND_ROUND_RECT:
+            if (end - p < 11) {
+                goto truncated;
+            }
+            undo_draw(UNDO_OP_ROUND_RECT, (short)get16(p + 1), (short)get16(p + 3),
+                      get16(p + 5) | (get16(p + 7) << 16), get16(p + 9),
+                      drawColour);
+            p += 11;
+            break;
+
+        case COMMAND_POLYGON:
+            if (end - p < 4) {
+                goto truncated;
+            }
+            n = get16(p + 2);
+            if (n > RASTER_MAX_POINTS || end - p < 4 + 4 * n) {
+                goto truncated;
+            }
+            for (x = 0; x < 2 * (int)n; x++) {
+                polygon[x] = (short)get16(p + 4 + 2 * x);
+            }
+            undo_polygon(polygon, n, p[1] ? RASTER_NON_ZERO : RASTER_EVEN_ODD,
+                         drawColour);
+            p += 4 + 4 * n;
+            break;
+
+        case COMMAND_IMAGE:
+            if (end - p < 6 || !asset_size(p[1], 0, 0)) {
+                goto truncated;
+            }
+            undo_draw(UNDO_OP_IMAGE, (short)get16(p + 2), (short)get16(p + 4),
+                      p[1], 0, 0);
+            p += 6;
+            break;
+
+        case COMMAND_QUERY_PIXEL:
+            if (end - p < 5 || *results == COMMAND_MAX_RESULTS) {
+                goto truncated;
+            }
+            put32(reply + 4 + 4 * *results,
+                  getPixel((short)get16(p + 1), (short)get16(p + 3)));
+            (*results)++;
+            p += 5;
+            break;
+
+        case COMMAND_UNDO:
+        case COMMAND_REDO:
+            if (end - p < 3) {
+                goto truncated;
+            }
+            // Steps drawn after this in the same batch are separate ones
+            for (n = get16(p + 1); n; n--) {
+                if (!((*p == COMMAND_UNDO) ? undo_step() : redo_step())) {
+                    break;
+                }
+            }
+            p += 3;
+            break;
+
+        default:
+            goto truncated;
+        }
+
+        count++;
+    }
+
+    undo_end();
+    commandsExecuted += count;
+    return COMMAND_OK;
+
+truncated:
+    undo_end();
+    commandsExecuted += count;
+    badCommands++;
+    return COMMAND_BAD_COMMAND;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       handle_frame
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function checks a complete frame, executes it if it
+//                  is the next one in sequence, and acknowledges it.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void handle_frame()
+{
+    unsigned int type = frame[1];
+    unsigned int sequence = get16(frame + 2);
+    unsigned int length = get16(frame + 4);
+    unsigned int status, results = 0, behind;
+
+    if (crc32(0, frame + 1, COMMAND_HEADER_SIZE - 1 + length) !=
+        get32(frame + COMMAND_HEADER_SIZE + length)) {
+        crcErrors++;
+        send_ack(sequence, COMMAND_BAD_CRC, 0);
+        return;
+    }
+
+    switch (type) {
+    case COMMAND_FRAME_RESET:
+        expectedSequence = (sequence + 1) & 0xFFFF;
+        synchronized = 1;
+        send_ack(sequence, COMMAND_OK, 0);
+        break;
+
+    case COMMAND_FRAME_BATCH:
+    case COMMAND_FRAME_SNAPSHOT:
+    case COMMAND_FRAME_RESTORE:
+    case COMMAND_FRAME_STREAM:
+    case COMMAND_FRAME_INPUT:
+    case COMMAND_FRAME_SAVE:
+        if (!synchronized) {
+            expectedSequence = sequence;
+            synchronized = 1;
+        }
+
+        // How far behind the expected sequence number this frame is,
+        // modulo 2^16: 0 means it is the next one, small values mean it
+        // is a repeat, and anything else means frames were lost
+        behind = (expectedSequence - sequence) & 0xFFFF;
+        if (behind == 0) {
+            trace(TRACE_COMMAND_BEGIN, sequence, length);
+            if (type == COMMAND_FRAME_BATCH) {
+                status = execute(frame + COMMAND_HEADER_SIZE, length, &results);
+            } else if (type == COMMAND_FRAME_SNAPSHOT) {
+                status = snapshot_start(frame + COMMAND_HEADER_SIZE, length);
+            } else if (type == COMMAND_FRAME_RESTORE) {
+                status = snapshot_restore(frame + COMMAND_HEADER_SIZE, length);
+            } else if (type == COMMAND_FRAME_STREAM) {
+                status = stream_control(frame + COMMAND_HEADER_SIZE, length);
+            } else if (type == COMMAND_FRAME_INPUT) {
+                status = input_control(frame + COMMAND_HEADER_SIZE, length);
+            } else {
+                status = save_control(frame + COMMAND_HEADER_SIZE, length);
+            }
+            trace(TRACE_COMMAND_END, sequence, status);
+
+            expectedSequence = (sequence + 1) & 0xFFFF;
+            framesExecuted++;
+            send_ack(sequence, status, results);
+        } else if (behind < 0x8000) {
+            send_ack(sequence, COMMAND_DUPLICATE, 0);
+        } else {
+            sequenceErrors++;
+            send_ack(sequence, COMMAND_BAD_SEQUENCE, 0);
+        }
+        break;
+
+    default:
+        // Frames of other types are not for us
+        break;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       command_poll
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function is called once per frame. It takes every
+//                  byte waiting in the receive ring, and handles each frame
+//                  that is completed, so all of the batches that arrived
+//                  during the last frame are drawn in this one. It never
+//                  waits for more bytes.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void command_poll()
+{
+    unsigned int wanted, count, length;
+    unsigned long now = get_timer_counter();
+
+    // Drop a partly received frame if the rest of it never came
+    if (received && now - lastReceiveTime > COMMAND_TIMEOUT_US) {
+        timeouts++;
+        received = 0;
+    }
+
+    while (1) {
+        if (received == 0) {
+            // Hunt for the sync byte; console text never contains it
+            if (uart_read(frame, 1) == 0) {
+                break;
+            }
+            if (frame[0] == COMMAND_SYNC) {
+                received = 1;
+                frameSize = COMMAND_HEADER_SIZE;
+                lastReceiveTime = now;
+            }
+            continue;
+        }
+
+        wanted = frameSize - received;
+        count = uart_read(frame + received, wanted);
+        if (count == 0) {
+            break;
+        }
+        received += count;
+        lastReceiveTime = now;
+
+        if (received < frameSize) {
+            continue;
+        }
+
+        if (frameSize == COMMAND_HEADER_SIZE) {
+            // The header is complete, so now we know the frame size
+            length = get16(frame + 4);
+            if (length > COMMAND_MAX_PAYLOAD) {
+                crcErrors++;
+                received = 0;
+            } else {
+                frameSize = COMMAND_HEADER_SIZE + length + 4;
+            }
+            continue;
+        }
+
+        handle_frame();
+        received = 0;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       command_report
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes the protocol statistics to the
+//                  console terminal.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void command_report()
+{
+    if (!synchronized) {
+        return;
+    }
+
+    log_info("Commands: batches %u commands %u crc errors %u sequence errors %u "
+             "bad commands %u timeouts %u rx dropped %u\n",
+             framesExecuted, commandsExecuted, crcErrors, sequenceErrors,
+             badCommands, timeouts, uart_rx_dropped());
+}
@@ -0,0 +1,89 @@
+// Serial frame layout (all values little-endian):
+//
+//     sync        1 byte, COMMAND_SYNC
+//     type        1 byte, COMMAND_FRAME_*
+//     sequence    2 bytes
+//     length      2 bytes, the payload length
+//     payload     length bytes
+//     CRC-32      4 bytes, over the type, sequence, length and payload
+#define COMMAND_SYNC                0xA5
+#define COMMAND_HEADER_SIZE         6
+#define COMMAND_MAX_PAYLOAD         8192
+
+// Frame types. Host to Pi: RESET sets the next expected sequence number
+// to its own plus one, BATCH carries drawing commands, SNAPSHOT asks for
+// a range of the canvas, RESTORE carries a chunk of an image to draw
+// (see snapshot.h), STREAM starts or stops the live view (see stream.h),
+// INPUT controls the input recorder (see input.h), and SAVE saves the
+// canvas to the SD card or loads it (see save.h). Pi to host: ACK
+// answers every host frame, SNAPSHOT_DATA and STREAM_DATA carry canvas
+// data, and INPUT_DATA carries a recording, each numbered by its own
+// sequence.
+#define COMMAND_FRAME_RESET         'R'
+#define COMMAND_FRAME_BATCH         'C'
+#define COMMAND_FRAME_SNAPSHOT      'S'
+#define COMMAND_FRAME_RESTORE       'W'
+#define COMMAND_FRAME_STREAM        'V'
+#define COMMAND_FRAME_INPUT         'I'
+#define COMMAND_FRAME_SAVE          'F'
+#define COMMAND_FRAME_ACK           'A'
+#define COMMAND_FRAME_SNAPSHOT_DATA 'D'
+#define COMMAND_FRAME_STREAM_DATA   'T'
+#define COMMAND_FRAME_INPUT_DATA    'N'
+
+// ACK payload: status (1 byte), 1 unused byte, the next expected
+// sequence number (2 bytes), then one 4-byte result per QUERY_PIXEL
+#define COMMAND_OK                  0   // Executed
+#define COMMAND_DUPLICATE           1   // Already executed, not repeated
+#define COMMAND_BAD_CRC             2   // Corrupted frame, resend
+#define COMMAND_BAD_SEQUENCE        3   // A frame was lost, resend from
+                                        // the next expected sequence
+#define COMMAND_BAD_COMMAND         4   // Unknown opcode or image, or
+                                        // truncated arguments; the rest
+                                        // of the batch was skipped
+#define COMMAND_BAD_IMAGE           5   // A restore chunk did not decode
+                                        // to its pixel count and CRC
+#define COMMAND_BUSY                6   // The last request of this kind
+                                        // is still in progress, resend
+                                        // later
+#define COMMAND_MAX_RESULTS         256
+
+// Opcodes in a BATCH payload, each followed by its arguments.
+// Coordinates are signed 16-bit, sizes unsigned 16-bit, colours 32-bit.
+// The drawing in a batch is undone and redone as one step (see undo.c);
+// UNDO and REDO end the step, and later drawing in the same batch is
+// recorded one operation per step.
+#define COMMAND_CLEAR               0x01    // (none)
+#define COMMAND_SET_COLOUR          0x02    // colour
+#define COMMAND_POINT               0x03    // x, y
+#define COMMAND_LINE                0x04    // x0, y0, x1, y1
+#define COMMAND_FILL_RECT           0x05    // x, y, width, height
+#define COMMAND_FLOOD               0x06    // x, y; like the X button,
+                                            // whitens the point and fills
+                                            // everything around it with
+                                            // black, up to a black
+                                            // boundary
+#define COMMAND_QUERY_PIXEL         0x07    // x, y
+#define COMMAND_UNDO                0x08    // step count (16-bit)
+#define COMMAND_REDO                0x09    // step count (16-bit)
+#define COMMAND_FILL                0x0A    // x, y, target colour, tolerance
+                                            // (1 byte), connectivity (1
+                                            // byte, 4 or 8); fills the
+                                            // region of the target colour
+                                            // around x, y with the colour
+#define COMMAND_CIRCLE              0x0B    // x, y, radius
+#define COMMAND_ROUND_RECT          0x0C    // x, y, width, height, radius
+#define COMMAND_POLYGON             0x0D    // fill rule (1 byte, 0 even-odd,
+                                            // 1 non-zero), vertex count
+                                            // (16-bit, at most 256), then
+                                            // x, y per vertex
+#define COMMAND_IMAGE               0x0E    // asset (1 byte, ASSET_*), x, y;
+                                            // draws an image built into
+                                            // the kernel (see asset.h)
+
+// Function prototypes
+void command_init();
+void command_poll();
+void command_send_frame(unsigned int type, unsigned int sequence,
+                        const unsigned char *payload, unsigned int length);
+void command_report();
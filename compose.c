@@ -0,0 +1,541 @@
+// The functions in this file compose the screen from layers, bottom to
+// top: the canvas the drawing functions draw on, the overlay with the
+// on-screen text, the magnifier, and the cursor that marks the pen. Each
+// layer has a buffer of its own in RAM, so drawing the cursor or the text
+// never touches the drawing, and the drawing can be redrawn without them.
+//
+// The screen is divided into 32 x 32 tiles. Anything that changes a
+// layer marks the tiles it covers as dirty, and once per frame
+// compose_frame() recomposes only the dirty tiles into the screen page
+// that is shown next (see present.c). A tile changed in one frame is out
+// of date on both pages, so it is composed again the frame after, into
+// the other page. A run of dirty tiles in a tile row is composed one
+// pixel row at a time into a line buffer, which is then copied to the
+// frame buffer with 64-bit stores, so the frame buffer is never read.
+//
+// The layer buffers are cached (see mmu.c), and a layer row is read in
+// order, so each cache line brought in serves 16 pixels. The screen is
+// not cached, since the display reads it from RAM; the line buffer is
+// written out to it with wide stores, which the write buffer merges. The
+// overlay only covers the corner the text is in, so the rest of the
+// screen is composed from the canvas alone.
+
+#include "framebuffer.h"
+#include "kprintf.h"
+#include "compose.h"
+#include "canvas.h"
+#include "present.h"
+
+// The layer buffers. The canvas has its own, in tile blocks (see canvas.c).
+static unsigned int overlayPixels[COMPOSE_HUD_WIDTH * COMPOSE_HUD_HEIGHT]
+    __attribute__((aligned(16)));
+static unsigned int cursorPixels[COMPOSE_CURSOR_SIZE * COMPOSE_CURSOR_SIZE];
+static unsigned int zoomPixels[COMPOSE_ZOOM_SIZE * COMPOSE_ZOOM_SIZE]
+    __attribute__((aligned(16)));
+
+static struct compose_layer layers[COMPOSE_LAYERS];
+
+// Set once the layers are set up
+static int composing;
+
+// One bit per tile that needs composing, bit n of word m for the tile in
+// column n of tile row m
+static unsigned long dirtyTiles[COMPOSE_MAX_TILE_ROWS];
+
+// The tiles composed last frame, which the page being composed into
+// missed, in the same form
+static unsigned long staleTiles[COMPOSE_MAX_TILE_ROWS];
+
+// The screen page being composed into
+static unsigned int *page;
+
+// A pixel row of a run of tiles, being composed
+static unsigned int line[COMPOSE_MAX_WIDTH] __attribute__((aligned(16)));
+
+// Statistics
+static unsigned int framesComposed, tilesComposed;
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       compose_init
+//
+//  Arguments:      none
+//
+//  Returns:        TRUE, or FALSE if the screen is larger than the
+//                  compositor handles
+//
+//  Description:    This function sets up the layers for the screen
+//                  initFrameBuffer() allocated (screenBuffer). The overlay
+//                  starts out transparent, the magnifier hidden, and the
+//                  cursor off the screen.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int compose_init()
+{
+    int centre = COMPOSE_CURSOR_SIZE / 2, dx, dy;
+    unsigned int i;
+
+    if (frameBufferWidth > COMPOSE_MAX_WIDTH ||
+        frameBufferHeight > COMPOSE_MAX_HEIGHT) {
+        log_error("Compose: %u x %u screen is too large\n",
+                  frameBufferWidth, frameBufferHeight);
+        return 0;
+    }
+
+    layers[COMPOSE_LAYER_CANVAS].pixels = 0;
+    layers[COMPOSE_LAYER_CANVAS].width = frameBufferWidth;
+    layers[COMPOSE_LAYER_CANVAS].height = frameBufferHeight;
+    layers[COMPOSE_LAYER_CANVAS].blend = COMPOSE_OPAQUE;
+    layers[COMPOSE_LAYER_CANVAS].visible = 1;
+
+    layers[COMPOSE_LAYER_OVERLAY].pixels = overlayPixels;
+    layers[COMPOSE_LAYER_OVERLAY].width = COMPOSE_HUD_WIDTH;
+    layers[COMPOSE_LAYER_OVERLAY].height = COMPOSE_HUD_HEIGHT;
+    layers[COMPOSE_LAYER_OVERLAY].x = COMPOSE_HUD_X;
+    layers[COMPOSE_LAYER_OVERLAY].y = COMPOSE_HUD_Y;
+    layers[COMPOSE_LAYER_OVERLAY].blend = COMPOSE_COLOUR_KEY;
+    layers[COMPOSE_LAYER_OVERLAY].visible = 1;
+    for (i = 0; i < COMPOSE_HUD_WIDTH * COMPOSE_HUD_HEIGHT; i++) {
+        overlayPixels[i] = COMPOSE_TRANSPARENT;
+    }
+
+    // The cursor is a cross hair with a gap in the middle, so the pixel
+    // under the pen stays visible: black arms edged in translucent white
+    for (dy = -centre; dy <= centre; dy++) {
+        for (dx = -centre; dx <= centre; dx++) {
+            i = (dy + centre) * COMPOSE_CURSOR_SIZE + dx + centre;
+            if ((dx == 0 || dy == 0) && dx * dx + dy * dy > 4) {
+                cursorPixels[i] = 0xE0000000;
+            } else if ((dx == 1 || dx == -1 || dy == 1 || dy == -1) &&
+                       dx * dx + dy * dy > 5) {
+                cursorPixels[i] = 0x80FFFFFF;
+            } else {
+                cursorPixels[i] = 0;
+            }
+        }
+    }
+    layers[COMPOSE_LAYER_CURSOR].pixels = cursorPixels;
+    layers[COMPOSE_LAYER_CURSOR].width = COMPOSE_CURSOR_SIZE;
+    layers[COMPOSE_LAYER_CURSOR].height = COMPOSE_CURSOR_SIZE;
+    layers[COMPOSE_LAYER_CURSOR].x = -COMPOSE_CURSOR_SIZE;
+    layers[COMPOSE_LAYER_CURSOR].y = -COMPOSE_CURSOR_SIZE;
+    layers[COMPOSE_LAYER_CURSOR].blend = COMPOSE_ALPHA;
+    layers[COMPOSE_LAYER_CURSOR].visible = 1;
+
+    // zoom.c draws the magnifier when it is turned on
+    layers[COMPOSE_LAYER_ZOOM].pixels = zoomPixels;
+    layers[COMPOSE_LAYER_ZOOM].width = COMPOSE_ZOOM_SIZE;
+    layers[COMPOSE_LAYER_ZOOM].height = COMPOSE_ZOOM_SIZE;
+    layers[COMPOSE_LAYER_ZOOM].blend = COMPOSE_OPAQUE;
+    layers[COMPOSE_LAYER_ZOOM].visible = 0;
+
+    composing = 1;
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       compose_layer
+//
+//  Arguments:      layer:       COMPOSE_LAYER_*
+//
+//  Returns:        The layer, for drawing on. Call compose_damage_layer()
+//                  for what was drawn.
+//
+//  Description:    This function gives access to a layer's buffer.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+struct compose_layer *compose_layer(unsigned int layer)
+{
+    return &layers[layer];
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       compose_damage
+//
+//  Arguments:      x0, x1:      The first and last pixel changed in the row
+//                               (already clipped to the screen)
+//                  y:           The row
+//
+//  Returns:        void
+//
+//  Description:    This function marks the tiles a changed span of pixels
+//                  falls in, for the next compose_frame(). It is called by
+//                  everything that writes to the canvas, and is cheap
+//                  enough to be called per pixel. Cores may call it at the
+//                  same time for spans in different tile rows.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void compose_damage(int x0, int x1, int y)
+{
+    unsigned int first = x0 >> COMPOSE_TILE_SHIFT;
+    unsigned int last = x1 >> COMPOSE_TILE_SHIFT;
+
+    if (!composing) {
+        return;
+    }
+
+    dirtyTiles[y >> COMPOSE_TILE_SHIFT] |= (~0UL >> (63 - last)) & (~0UL << first);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       compose_damage_layer
+//
+//  Arguments:      layer:       COMPOSE_LAYER_*
+//                  x, y:        The top left corner of the changed
+//                               rectangle, in the layer's pixels
+//                  width:       Its width in pixels
+//                  height:      Its height in pixels
+//
+//  Returns:        void
+//
+//  Description:    This function marks the tiles a changed rectangle of a
+//                  layer covers on the screen.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void compose_damage_layer(unsigned int layer, int x, int y, int width,
+                          int height)
+{
+    int x0 = layers[layer].x + x, y0 = layers[layer].y + y;
+    int x1 = x0 + width - 1, y1 = y0 + height - 1;
+
+    if (x0 < 0) {
+        x0 = 0;
+    }
+    if (y0 < 0) {
+        y0 = 0;
+    }
+    if (x1 >= (int)frameBufferWidth) {
+        x1 = frameBufferWidth - 1;
+    }
+    if (y1 >= (int)frameBufferHeight) {
+        y1 = frameBufferHeight - 1;
+    }
+
+    for (y = y0; y <= y1; y = (y | (COMPOSE_TILE_SIZE - 1)) + 1) {
+        if (x0 <= x1) {
+            compose_damage(x0, x1, y);
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       compose_move
+//
+//  Arguments:      layer:       COMPOSE_LAYER_*
+//                  x, y:        The new position of its top left corner on
+//                               the screen
+//
+//  Returns:        void
+//
+//  Description:    This function moves a layer. The tiles it covered and
+//                  the tiles it now covers are composed again; nothing
+//                  else is.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void compose_move(unsigned int layer, int x, int y)
+{
+    struct compose_layer *moved = &layers[layer];
+
+    if (moved->x == x && moved->y == y) {
+        return;
+    }
+
+    compose_damage_layer(layer, 0, 0, moved->width, moved->height);
+    moved->x = x;
+    moved->y = y;
+    compose_damage_layer(layer, 0, 0, moved->width, moved->height);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       compose_show
+//
+//  Arguments:      layer:       COMPOSE_LAYER_*
+//                  visible:     TRUE to show the layer, FALSE to hide it
+//
+//  Returns:        void
+//
+//  Description:    This function shows or hides a layer, and has the tiles
+//                  it covers composed again if that changed anything.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void compose_show(unsigned int layer, int visible)
+{
+    if (layers[layer].visible == visible) {
+        return;
+    }
+
+    layers[layer].visible = visible;
+    compose_damage_layer(layer, 0, 0, layers[layer].width, layers[layer].height);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       compose_dirty
+//
+//  Arguments:      x0, y0:      The top left corner of a rectangle of the
+//                               screen
+//                  x1, y1:      Its bottom right corner (inclusive)
+//
+//  Returns:        TRUE if any tile the rectangle covers will be composed
+//                  by the next compose_frame()
+//
+//  Description:    This function tells whether any layer has changed in a
+//                  part of the screen since the last frame was composed.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int compose_dirty(int x0, int y0, int x1, int y1)
+{
+    unsigned long mask;
+    int row;
+
+    if (x0 < 0) {
+        x0 = 0;
+    }
+    if (y0 < 0) {
+        y0 = 0;
+    }
+    if (x1 >= (int)frameBufferWidth) {
+        x1 = frameBufferWidth - 1;
+    }
+    if (y1 >= (int)frameBufferHeight) {
+        y1 = frameBufferHeight - 1;
+    }
+    if (x0 > x1 || y0 > y1) {
+        return 0;
+    }
+
+    mask = (~0UL >> (63 - (x1 >> COMPOSE_TILE_SHIFT))) &
+           (~0UL << (x0 >> COMPOSE_TILE_SHIFT));
+    for (row = y0 >> COMPOSE_TILE_SHIFT; row <= y1 >> COMPOSE_TILE_SHIFT; row++) {
+        if (dirtyTiles[row] & mask) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       blend
+//
+//  Arguments:      over:        A pixel with its opacity in the top byte
+//                  under:       The pixel below it
+//
+//  Returns:        The pixel seen
+//
+//  Description:    This function blends two pixels, the red and blue
+//                  channels together and then the green one.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned int blend(unsigned int over, unsigned int under)
+{
+    unsigned int alpha = over >> 24, rb, g;
+
+    // Scale 0 - 255 to 0 - 256, so that 255 is fully opaque
+    alpha += alpha >> 7;
+
+    rb = ((over & 0x00FF00FF) * alpha + (under & 0x00FF00FF) * (256 - alpha)) >> 8;
+    g = ((over & 0x0000FF00) * alpha + (under & 0x0000FF00) * (256 - alpha)) >> 8;
+
+    return (rb & 0x00FF00FF) | (g & 0x0000FF00);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       composeRow
+//
+//  Arguments:      x0, x1:      The first and last pixel to compose
+//                  y:           The row
+//
+//  Returns:        void
+//
+//  Description:    This function composes part of a pixel row from every
+//                  visible layer that covers it into the line buffer, and
+//                  copies the result to the frame buffer.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void composeRow(int x0, int x1, int y)
+{
+    struct compose_layer *layer;
+    const unsigned int *source;
+    unsigned int *screen, i;
+    unsigned long *wide;
+    int left, right, x;
+
+    for (i = 0; i < COMPOSE_LAYERS; i++) {
+        layer = &layers[i];
+        if (!layer->visible || y < layer->y || y >= layer->y + (int)layer->height) {
+            continue;
+        }
+        left = (x0 > layer->x) ? x0 : layer->x;
+        right = (x1 < layer->x + (int)layer->width - 1) ? x1 : layer->x + (int)layer->width - 1;
+
+        // The canvas is read from its tile blocks, and solid tiles as
+        // their colour (see canvas.c)
+        if (i == COMPOSE_LAYER_CANVAS) {
+            canvasRead(left, right, y, line + left);
+            continue;
+        }
+        source = layer->pixels + (y - layer->y) * layer->width - layer->x;
+
+        switch (layer->blend) {
+        case COMPOSE_OPAQUE:
+            for (x = left; x <= right; x++) {
+                line[x] = source[x];
+            }
+            break;
+        case COMPOSE_COLOUR_KEY:
+            for (x = left; x <= right; x++) {
+                if (source[x] != COMPOSE_TRANSPARENT) {
+                    line[x] = source[x];
+                }
+            }
+            break;
+        case COMPOSE_ALPHA:
+            for (x = left; x <= right; x++) {
+                if (source[x] >> 24) {
+                    line[x] = blend(source[x], line[x]);
+                }
+            }
+            break;
+        }
+    }
+
+    // Copy the row to the frame buffer, two pixels per store where the
+    // frame buffer is aligned for it
+    screen = (unsigned int *)((unsigned char *)page + y * screenPitch);
+    x = x0;
+    if ((x & 1) && x <= x1) {
+        screen[x] = line[x];
+        x++;
+    }
+    if (((unsigned long)(screen + x) & 7) == 0) {
+        wide = (unsigned long *)(screen + x);
+        for (; x + 1 <= x1; x += 2) {
+            *wide++ = *(const unsigned long *)(line + x);
+        }
+    }
+    for (; x <= x1; x++) {
+        screen[x] = line[x];
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       compose_frame
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function composes every dirty tile, and every tile
+//                  composed into the other page last frame, into the back
+//                  page. It is called once per frame, after present_wait()
+//                  and before the frame is presented. Adjacent tiles in a
+//                  tile row are composed together.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void compose_frame()
+{
+    unsigned long bits;
+    unsigned int row, first, last;
+    int x0, x1, y, bottom;
+
+    if (!composing) {
+        return;
+    }
+
+    page = present_back_buffer();
+    for (row = 0; row < COMPOSE_MAX_TILE_ROWS; row++) {
+        bits = dirtyTiles[row] | staleTiles[row];
+        staleTiles[row] = (screenPages > 1) ? dirtyTiles[row] : 0;
+        if (!bits) {
+            continue;
+        }
+        dirtyTiles[row] = 0;
+
+        y = row << COMPOSE_TILE_SHIFT;
+        bottom = y + COMPOSE_TILE_SIZE;
+        if (bottom > (int)frameBufferHeight) {
+            bottom = frameBufferHeight;
+        }
+
+        while (bits) {
+            // The next run of dirty tiles
+            first = __builtin_ctzl(bits);
+            last = first;
+            while (last < 63 && (bits >> (last + 1)) & 1) {
+                last++;
+            }
+            bits &= (last == 63) ? 0 : ~0UL << (last + 1);
+            tilesComposed += last - first + 1;
+
+            x0 = first << COMPOSE_TILE_SHIFT;
+            x1 = ((last + 1) << COMPOSE_TILE_SHIFT) - 1;
+            if (x1 >= (int)frameBufferWidth) {
+                x1 = frameBufferWidth - 1;
+            }
+            for (y = row << COMPOSE_TILE_SHIFT; y < bottom; y++) {
+                composeRow(x0, x1, y);
+            }
+        }
+    }
+
+    framesComposed++;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       compose_report
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes the number of tiles composed to
+//                  the console terminal.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void compose_report()
+{
+    log_info("Compose: %u tiles in %u frames\n", tilesComposed, framesComposed);
+}
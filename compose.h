@@ -0,0 +1,63 @@
+// Largest screen the layer buffers are sized for
+#define COMPOSE_MAX_WIDTH           1024
+#define COMPOSE_MAX_HEIGHT          768
+
+// Tile size for change tracking, in pixels (a power of two, the same as
+// the stream's, so that the fill's bands never share a tile row)
+#define COMPOSE_TILE_SHIFT          5
+#define COMPOSE_TILE_SIZE           (1 << COMPOSE_TILE_SHIFT)
+#define COMPOSE_MAX_TILE_ROWS       (COMPOSE_MAX_HEIGHT / COMPOSE_TILE_SIZE)
+
+// Layers, bottom to top
+#define COMPOSE_LAYER_CANVAS        0   // The drawing (see canvas.c)
+#define COMPOSE_LAYER_OVERLAY       1   // On-screen text (see hud.c)
+#define COMPOSE_LAYER_ZOOM          2   // The magnifier (see zoom.c)
+#define COMPOSE_LAYER_CURSOR        3   // The pen position
+#define COMPOSE_LAYERS              4
+
+// How a layer's pixels cover the layers below it
+#define COMPOSE_OPAQUE              0   // Every pixel
+#define COMPOSE_COLOUR_KEY          1   // Every pixel but the key colour
+#define COMPOSE_ALPHA               2   // Blended by the pixel's top byte
+                                        // (0 transparent, 255 opaque)
+
+// The key colour of the overlay, which no drawing uses (the alpha byte of
+// drawing colours is 0)
+#define COMPOSE_TRANSPARENT         0xFF000000
+
+// Size and position of the overlay layer, in pixels: room for two lines
+// of HUD_LINE_SIZE characters in the top left corner (see hud.c)
+#define COMPOSE_HUD_WIDTH           512
+#define COMPOSE_HUD_HEIGHT          32
+#define COMPOSE_HUD_X               0
+#define COMPOSE_HUD_Y               0
+
+// Size of the cursor layer, in pixels
+#define COMPOSE_CURSOR_SIZE         15
+
+// Size of the zoom layer, in pixels: ZOOM_VIEW_SIZE plus a border of
+// ZOOM_BORDER on each side (see zoom.h). Its rows are a multiple of 16
+// bytes long, so they can be written with 128-bit stores.
+#define COMPOSE_ZOOM_SIZE           264
+
+// A layer: a buffer of width x height pixels (rows width pixels apart),
+// shown with its top left corner at x, y on the screen
+struct compose_layer {
+    unsigned int *pixels;
+    unsigned int width, height;
+    int x, y;
+    unsigned int blend;
+    int visible;
+};
+
+// Function prototypes
+int compose_init();
+struct compose_layer *compose_layer(unsigned int layer);
+void compose_damage(int x0, int x1, int y);
+void compose_damage_layer(unsigned int layer, int x, int y, int width,
+                          int height);
+void compose_move(unsigned int layer, int x, int y);
+void compose_show(unsigned int layer, int visible);
+int compose_dirty(int x0, int y0, int x1, int y1);
+void compose_frame();
+void compose_report();
@@ -0,0 +1,55 @@
+// The function in this file computes the CRC-32 checksum (the IEEE 802.3
+// polynomial, as used by zlib and PNG) that protects binary data sent
+// over the serial link.
+
+#include "crc32.h"
+
+// The reflected CRC-32 polynomial
+#define CRC32_POLYNOMIAL  0xEDB88320
+
+// A lookup table with the CRC of every byte value. It is built the first
+// time crc32() is called.
+static unsigned int crcTable[256];
+static int crcTableReady;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       crc32
+//
+//  Arguments:      crc:         The CRC of the preceding data, or 0
+//                  data:        A pointer to the data
+//                  length:      The number of bytes of data
+//
+//  Returns:        The CRC of the preceding data followed by this data
+//
+//  Description:    This function computes a CRC-32 one byte at a time using
+//                  a 256-entry table. Long data can be processed in pieces
+//                  by passing the result of one call to the next.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int crc32(unsigned int crc, const unsigned char *data, unsigned int length)
+{
+    unsigned int c;
+    int i, j;
+
+    if (!crcTableReady) {
+        for (i = 0; i < 256; i++) {
+            c = i;
+            for (j = 0; j < 8; j++) {
+                c = (c & 1) ? (c >> 1) ^ CRC32_POLYNOMIAL : (c >> 1);
+            }
+            crcTable[i] = c;
+        }
+        crcTableReady = 1;
+    }
+
+    crc = ~crc;
+    while (length--) {
+        crc = crcTable[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
@@ -0,0 +1,2 @@
+// Function prototype
+unsigned int crc32(unsigned int crc, const unsigned char *data, unsigned int length);
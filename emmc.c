@@ -0,0 +1,816 @@
+// The functions in this file drive the SD card through the EMMC host
+// controller (an Arasan SDHCI), so that canvases can be kept on the card
+// (see save.c). The firmware leaves the card on its own SD host
+// controller, so emmc_init() switches GPIO pins 48 - 53 over to the EMMC
+// controller first. QEMU's raspi3 machine emulates the EMMC controller,
+// with the card image given by -drive if=sd.
+//
+// Bringing a card up takes up to a second, most of it waiting for the card
+// to power up, so emmc_init() only starts it, and emmc_poll(), called once
+// per frame, asks the card whether it is ready and finishes the set-up
+// when it is. The card is then run at 25 MHz with a 4-bit bus.
+//
+// Data moves in multi-block transfers (CMD18 and CMD25, ended by an
+// automatic CMD12) by a DMA channel paced by the EMMC controller's DREQ,
+// rather than by the CPU reading or writing the data register a word at a
+// time. The DMA control block is uncached (see mmu.c), and the data
+// buffer is cleaned from the data cache before a write and invalidated
+// around a read, so the DMA channel and the core see the same data. The
+// buffer must therefore be aligned to a cache line and hold whole lines.
+// The calling core waits for a transfer to
+// finish, which for the few kilobytes the block cache moves at a time is
+// a fraction of a millisecond.
+
+#include "gpio.h"
+#include "systimer.h"
+#include "mailbox.h"
+#include "kprintf.h"
+#include "mmu.h"
+#include "emmc.h"
+
+// EMMC controller registers
+#define EMMC_BASE                   (MMIO_BASE + 0x00300000)
+#define EMMC_BLKSIZECNT             ((volatile unsigned int *)(EMMC_BASE + 0x04))
+#define EMMC_ARG1                   ((volatile unsigned int *)(EMMC_BASE + 0x08))
+#define EMMC_CMDTM                  ((volatile unsigned int *)(EMMC_BASE + 0x0C))
+#define EMMC_RESP0                  ((volatile unsigned int *)(EMMC_BASE + 0x10))
+#define EMMC_STATUS                 ((volatile unsigned int *)(EMMC_BASE + 0x24))
+#define EMMC_CONTROL0               ((volatile unsigned int *)(EMMC_BASE + 0x28))
+#define EMMC_CONTROL1               ((volatile unsigned int *)(EMMC_BASE + 0x2C))
+#define EMMC_INTERRUPT              ((volatile unsigned int *)(EMMC_BASE + 0x30))
+#define EMMC_IRPT_MASK              ((volatile unsigned int *)(EMMC_BASE + 0x34))
+#define EMMC_IRPT_EN                ((volatile unsigned int *)(EMMC_BASE + 0x38))
+#define EMMC_CONTROL2               ((volatile unsigned int *)(EMMC_BASE + 0x3C))
+
+// The data register, at the bus address the DMA controller uses
+#define EMMC_DATA_BUS_ADDRESS       0x7E300020
+
+// CMDTM fields
+#define CMD_INDEX(n)                ((n) << 24)
+#define CMD_RESPONSE_136            (1 << 16)
+#define CMD_RESPONSE_48             (2 << 16)
+#define CMD_RESPONSE_48_BUSY        (3 << 16)
+#define CMD_RESPONSE_MASK           (3 << 16)
+#define CMD_CRC_CHECK               (1 << 19)
+#define CMD_INDEX_CHECK             (1 << 20)
+#define CMD_IS_DATA                 (1 << 21)
+#define TM_BLOCK_COUNT              (1 << 1)
+#define TM_AUTO_CMD12               (1 << 2)
+#define TM_READ                     (1 << 4)
+#define TM_MULTI_BLOCK              (1 << 5)
+
+// Response types
+#define RESPONSE_R1                 (CMD_RESPONSE_48 | CMD_CRC_CHECK | CMD_INDEX_CHECK)
+#define RESPONSE_R1B                (CMD_RESPONSE_48_BUSY | CMD_CRC_CHECK | CMD_INDEX_CHECK)
+#define RESPONSE_R2                 (CMD_RESPONSE_136 | CMD_CRC_CHECK)
+#define RESPONSE_R3                 CMD_RESPONSE_48
+
+// The commands used. SET_BUS_WIDTH and SEND_OP_COND are application
+// commands, sent after APP_CMD.
+#define GO_IDLE_STATE               CMD_INDEX(0)
+#define ALL_SEND_CID                (CMD_INDEX(2) | RESPONSE_R2)
+#define SEND_RELATIVE_ADDR          (CMD_INDEX(3) | RESPONSE_R1)
+#define SET_BUS_WIDTH               (CMD_INDEX(6) | RESPONSE_R1)
+#define SELECT_CARD                 (CMD_INDEX(7) | RESPONSE_R1B)
+#define SEND_IF_COND                (CMD_INDEX(8) | RESPONSE_R1)
+#define SET_BLOCKLEN                (CMD_INDEX(16) | RESPONSE_R1)
+#define READ_SINGLE_BLOCK           (CMD_INDEX(17) | RESPONSE_R1 | CMD_IS_DATA | TM_READ)
+#define READ_MULTIPLE_BLOCK         (CMD_INDEX(18) | RESPONSE_R1 | CMD_IS_DATA | TM_READ | \
+                                     TM_MULTI_BLOCK | TM_BLOCK_COUNT | TM_AUTO_CMD12)
+#define WRITE_BLOCK                 (CMD_INDEX(24) | RESPONSE_R1 | CMD_IS_DATA)
+#define WRITE_MULTIPLE_BLOCK        (CMD_INDEX(25) | RESPONSE_R1 | CMD_IS_DATA | \
+                                     TM_MULTI_BLOCK | TM_BLOCK_COUNT | TM_AUTO_CMD12)
+#define SEND_OP_COND                (CMD_INDEX(41) | RESPONSE_R3)
+#define APP_CMD                     (CMD_INDEX(55) | RESPONSE_R1)
+
+// SEND_IF_COND argument (2.7 - 3.6 V, check pattern 0xAA) and
+// SEND_OP_COND argument (SDHC supported, 2.7 - 3.6 V)
+#define IF_COND_PATTERN             0x1AA
+#define OP_COND_HCS                 (1 << 30)
+#define OP_COND_VOLTAGE             0x00FF8000
+
+// SEND_OP_COND response bits
+#define OCR_READY                   (1U << 31)
+#define OCR_CCS                     (1 << 30)
+
+// STATUS bits
+#define STATUS_CMD_INHIBIT          (1 << 0)
+#define STATUS_DAT_INHIBIT          (1 << 1)
+
+// CONTROL0 bits
+#define CONTROL0_4BIT               (1 << 1)
+
+// CONTROL1 bits
+#define CONTROL1_CLK_INTLEN         (1 << 0)
+#define CONTROL1_CLK_STABLE         (1 << 1)
+#define CONTROL1_CLK_EN             (1 << 2)
+#define CONTROL1_CLK_MASK           0xFFE0
+#define CONTROL1_DATA_TIMEOUT       (0xE << 16)
+#define CONTROL1_SRST_HC            (1 << 24)
+#define CONTROL1_SRST_CMD           (1 << 25)
+#define CONTROL1_SRST_DATA          (1 << 26)
+
+// INTERRUPT bits
+#define INT_CMD_DONE                (1 << 0)
+#define INT_DATA_DONE               (1 << 1)
+#define INT_ERROR                   (1 << 15)
+#define INT_CMD_TIMEOUT             (1 << 16)
+#define INT_ERRORS                  0xFFFF8000
+
+// DMA controller registers, for the channel the EMMC transfers use
+// (one the firmware leaves to the ARM)
+#define EMMC_DMA_CHANNEL            5
+#define DMA_BASE                    (MMIO_BASE + 0x00007000 + 0x100 * EMMC_DMA_CHANNEL)
+#define DMA_CS                      ((volatile unsigned int *)(DMA_BASE + 0x00))
+#define DMA_CONBLK_AD               ((volatile unsigned int *)(DMA_BASE + 0x04))
+#define DMA_DEBUG                   ((volatile unsigned int *)(DMA_BASE + 0x20))
+#define DMA_ENABLE                  ((volatile unsigned int *)(MMIO_BASE + 0x00007FF0))
+
+// DMA_CS bits
+#define DMA_CS_ACTIVE               (1 << 0)
+#define DMA_CS_END                  (1 << 1)
+#define DMA_CS_INT                  (1 << 2)
+#define DMA_CS_ERROR                (1 << 8)
+#define DMA_CS_PRIORITY             (8 << 16)
+#define DMA_CS_PANIC_PRIORITY       (15 << 20)
+#define DMA_CS_WAIT_WRITES          (1 << 28)
+#define DMA_CS_RESET                (1U << 31)
+
+// Transfer information bits of a DMA control block
+#define DMA_TI_WAIT_RESP            (1 << 3)
+#define DMA_TI_DEST_INC             (1 << 4)
+#define DMA_TI_DEST_DREQ            (1 << 6)
+#define DMA_TI_SRC_INC              (1 << 8)
+#define DMA_TI_SRC_DREQ             (1 << 10)
+#define DMA_TI_PERMAP(n)            ((n) << 16)
+
+// The EMMC controller's DREQ
+#define DMA_DREQ_EMMC               11
+
+// The bus address of ARM memory, through the uncached alias
+#define BUS_ADDRESS(p)              ((unsigned int)(unsigned long)(p) | 0xC0000000)
+
+// Clock rates, in Hz
+#define EMMC_IDENTIFY_CLOCK         400000
+#define EMMC_TRANSFER_CLOCK         25000000
+#define EMMC_DEFAULT_BASE_CLOCK     200000000
+
+// Time limits, in microseconds
+#define EMMC_RESET_TIMEOUT_US       100000
+#define EMMC_COMMAND_TIMEOUT_US     100000
+#define EMMC_DATA_TIMEOUT_US        1000000
+#define EMMC_POWER_UP_TIMEOUT_US    1000000
+
+// A DMA control block, which must be 32-byte aligned and uncached
+struct emmc_dma_block {
+    unsigned int info;
+    unsigned int source;
+    unsigned int destination;
+    unsigned int length;
+    unsigned int stride;
+    unsigned int next;
+    unsigned int reserved[2];
+};
+
+static struct emmc_dma_block dmaBlock __attribute__((aligned(32))) MMU_UNCACHED;
+
+// The card's state, its relative address, whether it is addressed in
+// blocks (SDHC and SDXC) rather than bytes, and when emmc_init() started
+static unsigned int state = EMMC_FAILED;
+static unsigned int relativeAddress;
+static int highCapacity, version2;
+static unsigned long startTime;
+
+// The controller's base clock, and the delay the controller needs
+// between register writes at the current card clock
+static unsigned int baseClock, writeDelay;
+
+// Statistics
+static unsigned int reads, writes, errors;
+static unsigned long blocksRead, blocksWritten, busyTicks;
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       timed_out
+//
+//  Arguments:      start:       The timer count when the wait started
+//                  limit:       The time limit in microseconds
+//
+//  Returns:        TRUE if more than limit microseconds have passed
+//
+//  Description:    This function bounds the waits for the controller.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int timed_out(unsigned long start, unsigned int limit)
+{
+    return ticks_to_us(timer_ticks() - start) > limit;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       get_clock_rate
+//
+//  Arguments:      id:          A clock id, such as CLOCK_EMMC
+//
+//  Returns:        The clock's rate in Hz, or 0 on failure
+//
+//  Description:    This function makes a blocking mailbox query for the
+//                  rate of a clock.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned int get_clock_rate(unsigned int id)
+{
+    mailbox_buffer[0] = 8 * 4;
+    mailbox_buffer[1] = MAILBOX_REQUEST;
+
+    mailbox_buffer[2] = TAG_GET_CLOCK_RATE;
+    mailbox_buffer[3] = 8;
+    mailbox_buffer[4] = 0;
+    mailbox_buffer[5] = id;
+    mailbox_buffer[6] = 0;     // Response: rate
+
+    mailbox_buffer[7] = TAG_LAST;
+
+    if (mailbox_query(CHANNEL_PROPERTY_TAGS_ARMTOVC)) {
+        return mailbox_buffer[6];
+    }
+
+    return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       put_register
+//
+//  Arguments:      reg:         A controller register
+//                  value:       The value to write
+//
+//  Returns:        void
+//
+//  Description:    This function writes a controller register. Writes must
+//                  be two card clock cycles apart, which matters while the
+//                  card is clocked at 400 kHz.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void put_register(volatile unsigned int *reg, unsigned int value)
+{
+    *reg = value;
+    microsecond_delay(writeDelay);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       reset_lines
+//
+//  Arguments:      lines:       CONTROL1_SRST_CMD, CONTROL1_SRST_DATA or both
+//
+//  Returns:        void
+//
+//  Description:    This function resets the controller's command or data
+//                  circuits after an error, so the next command can start.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void reset_lines(unsigned int lines)
+{
+    unsigned long start = timer_ticks();
+
+    *EMMC_CONTROL1 |= lines;
+    while ((*EMMC_CONTROL1 & lines) && !timed_out(start, EMMC_RESET_TIMEOUT_US)) {
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       command
+//
+//  Arguments:      code:        The command, with its response type and
+//                               transfer mode bits
+//                  argument:    The command argument
+//
+//  Returns:        TRUE if the card answered without errors
+//
+//  Description:    This function sends a command to the card and waits for
+//                  its response, which is left in EMMC_RESP0 - 3. For a
+//                  command with busy signalling, it also waits until the
+//                  card is no longer busy. Data commands only wait for the
+//                  response; the caller waits for the data.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int command(unsigned int code, unsigned int argument)
+{
+    unsigned long start = timer_ticks();
+    unsigned int inhibit = STATUS_CMD_INHIBIT, status;
+
+    if ((code & CMD_IS_DATA) || (code & CMD_RESPONSE_MASK) == CMD_RESPONSE_48_BUSY) {
+        inhibit |= STATUS_DAT_INHIBIT;
+    }
+    while (*EMMC_STATUS & inhibit) {
+        if (timed_out(start, EMMC_COMMAND_TIMEOUT_US)) {
+            log_warn("EMMC: CMD%u: controller busy\n", code >> 24);
+            return 0;
+        }
+    }
+
+    *EMMC_INTERRUPT = *EMMC_INTERRUPT;
+    put_register(EMMC_ARG1, argument);
+    put_register(EMMC_CMDTM, code);
+
+    do {
+        status = *EMMC_INTERRUPT;
+        if (timed_out(start, EMMC_COMMAND_TIMEOUT_US)) {
+            status |= INT_ERROR | INT_CMD_TIMEOUT;
+            break;
+        }
+    } while ((status & (INT_CMD_DONE | INT_ERROR)) == 0);
+    *EMMC_INTERRUPT = status & (INT_CMD_DONE | INT_ERRORS);
+
+    if (status & INT_ERROR) {
+        reset_lines(CONTROL1_SRST_CMD);
+        // SEND_IF_COND timing out only means an older card
+        if (code != SEND_IF_COND) {
+            errors++;
+            log_warn("EMMC: CMD%u failed, interrupt 0x%x\n", code >> 24, status);
+        }
+        return 0;
+    }
+
+    if ((code & CMD_RESPONSE_MASK) == CMD_RESPONSE_48_BUSY) {
+        while ((*EMMC_INTERRUPT & (INT_DATA_DONE | INT_ERROR)) == 0) {
+            if (timed_out(start, EMMC_DATA_TIMEOUT_US)) {
+                break;
+            }
+        }
+        *EMMC_INTERRUPT = INT_DATA_DONE;
+    }
+
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       app_command
+//
+//  Arguments:      code:        The application command
+//                  argument:    The command argument
+//
+//  Returns:        TRUE if the card answered both commands without errors
+//
+//  Description:    This function sends APP_CMD, and then an application
+//                  specific command.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int app_command(unsigned int code, unsigned int argument)
+{
+    return command(APP_CMD, relativeAddress << 16) && command(code, argument);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       set_clock
+//
+//  Arguments:      rate:        The highest card clock wanted, in Hz
+//
+//  Returns:        TRUE if the clock started
+//
+//  Description:    This function divides the controller's base clock down
+//                  to at most rate (by an even divisor of up to 2046, as
+//                  in SD host controller version 3) and waits for it to be
+//                  stable.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int set_clock(unsigned int rate)
+{
+    unsigned long start = timer_ticks();
+    unsigned int divisor = (baseClock + 2 * rate - 1) / (2 * rate);
+    unsigned int control;
+
+    if (divisor > 0x3FF) {
+        divisor = 0x3FF;
+    }
+
+    control = *EMMC_CONTROL1 & ~(CONTROL1_CLK_EN | CONTROL1_CLK_MASK);
+    *EMMC_CONTROL1 = control;
+    control |= CONTROL1_CLK_INTLEN | ((divisor & 0xFF) << 8) | ((divisor >> 8) << 6);
+    *EMMC_CONTROL1 = control;
+
+    while ((*EMMC_CONTROL1 & CONTROL1_CLK_STABLE) == 0) {
+        if (timed_out(start, EMMC_RESET_TIMEOUT_US)) {
+            log_warn("EMMC: clock not stable\n");
+            return 0;
+        }
+    }
+    *EMMC_CONTROL1 = control | CONTROL1_CLK_EN;
+
+    // Two cycles of the new clock, rounded up
+    rate = divisor ? baseClock / (2 * divisor) : baseClock;
+    writeDelay = (2000000 + rate - 1) / rate;
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       init_pins
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function connects GPIO pins 48 - 53 (the SD card's
+//                  clock, command and four data lines) to the EMMC
+//                  controller (alternate function 3), and pulls up the
+//                  command and data lines.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void init_pins()
+{
+    unsigned int r;
+
+    // Pins 48 and 49 are in GPFSEL4, pins 50 - 53 in GPFSEL5
+    r = *GPFSEL4;
+    r &= ~((7 << 24) | (7 << 27));
+    r |= (7 << 24) | (7 << 27);
+    *GPFSEL4 = r;
+
+    r = *GPFSEL5;
+    r &= ~((7 << 0) | (7 << 3) | (7 << 6) | (7 << 9));
+    r |= (7 << 0) | (7 << 3) | (7 << 6) | (7 << 9);
+    *GPFSEL5 = r;
+
+    // Enable the pull-ups on pins 49 - 53
+    *GPPUD = 0x2;
+
+    // Wait 150 cycles to provide the required set-up time
+    // for the control signal
+    r = 150;
+    while (r--) {
+        asm volatile("nop");
+    }
+
+    *GPPUDCLK1 = (1 << 17) | (1 << 18) | (1 << 19) | (1 << 20) | (1 << 21);
+
+    // Wait 150 cycles to provide the required hold time
+    // for the control signal
+    r = 150;
+    while (r--) {
+        asm volatile("nop");
+    }
+
+    *GPPUD = 0;
+    *GPPUDCLK1 = 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       emmc_init
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function resets the EMMC controller, identifies the
+//                  card at 400 kHz and asks it to power up. emmc_poll()
+//                  finishes bringing it up. It takes a few milliseconds.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void emmc_init()
+{
+    unsigned long start = timer_ticks();
+
+    state = EMMC_FAILED;
+    relativeAddress = 0;
+    writeDelay = 0;
+
+    init_pins();
+
+    // The DMA channel must be enabled before it can be used
+    *DMA_ENABLE |= 1 << EMMC_DMA_CHANNEL;
+
+    baseClock = get_clock_rate(CLOCK_EMMC);
+    if (baseClock == 0) {
+        baseClock = EMMC_DEFAULT_BASE_CLOCK;
+    }
+
+    // Reset the whole controller
+    *EMMC_CONTROL0 = 0;
+    *EMMC_CONTROL2 = 0;
+    *EMMC_CONTROL1 = CONTROL1_SRST_HC;
+    while (*EMMC_CONTROL1 & CONTROL1_SRST_HC) {
+        if (timed_out(start, EMMC_RESET_TIMEOUT_US)) {
+            log_warn("EMMC: controller did not reset\n");
+            return;
+        }
+    }
+
+    *EMMC_CONTROL1 = CONTROL1_DATA_TIMEOUT;
+    if (!set_clock(EMMC_IDENTIFY_CLOCK)) {
+        return;
+    }
+
+    // Report every event in EMMC_INTERRUPT, but raise no interrupts
+    *EMMC_IRPT_EN = 0;
+    *EMMC_IRPT_MASK = 0xFFFFFFFF;
+
+    // Reset the card, and find out whether it is version 2 or later,
+    // which may be high capacity
+    if (!command(GO_IDLE_STATE, 0)) {
+        return;
+    }
+    version2 = command(SEND_IF_COND, IF_COND_PATTERN) &&
+               (*EMMC_RESP0 & 0xFFF) == IF_COND_PATTERN;
+
+    state = EMMC_STARTING;
+    startTime = start;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       finish_init
+//
+//  Arguments:      none
+//
+//  Returns:        TRUE if the card is ready for transfers
+//
+//  Description:    This function is called once the card has powered up.
+//                  It gives the card an address, selects it, switches to
+//                  the 4-bit bus and the transfer clock, and sets the
+//                  block size of a standard capacity card.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int finish_init()
+{
+    if (!command(ALL_SEND_CID, 0) || !command(SEND_RELATIVE_ADDR, 0)) {
+        return 0;
+    }
+    relativeAddress = *EMMC_RESP0 >> 16;
+
+    if (!set_clock(EMMC_TRANSFER_CLOCK) ||
+        !command(SELECT_CARD, relativeAddress << 16) ||
+        !app_command(SET_BUS_WIDTH, 2)) {
+        return 0;
+    }
+    *EMMC_CONTROL0 |= CONTROL0_4BIT;
+
+    if (!highCapacity && !command(SET_BLOCKLEN, EMMC_BLOCK_SIZE)) {
+        return 0;
+    }
+
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       emmc_poll
+//
+//  Arguments:      none
+//
+//  Returns:        EMMC_STARTING while the card is powering up,
+//                  EMMC_READY once it can be read and written, or
+//                  EMMC_FAILED if there is no card, or it did not start
+//
+//  Description:    This function is called once per frame until the card
+//                  is ready. Each call asks the card once whether it has
+//                  powered up, and finishes bringing it up if it has.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int emmc_poll()
+{
+    unsigned int ocr;
+
+    if (state != EMMC_STARTING) {
+        return state;
+    }
+
+    if (!app_command(SEND_OP_COND, OP_COND_VOLTAGE | (version2 ? OP_COND_HCS : 0))) {
+        state = EMMC_FAILED;
+        return state;
+    }
+
+    ocr = *EMMC_RESP0;
+    if ((ocr & OCR_READY) == 0) {
+        if (timed_out(startTime, EMMC_POWER_UP_TIMEOUT_US)) {
+            log_warn("EMMC: card did not power up\n");
+            state = EMMC_FAILED;
+        }
+        return state;
+    }
+
+    highCapacity = (ocr & OCR_CCS) != 0;
+    if (!finish_init()) {
+        state = EMMC_FAILED;
+        return state;
+    }
+
+    state = EMMC_READY;
+    log_info("EMMC: %s card ready after %u ms\n", highCapacity ? "SDHC" : "SDSC",
+             (unsigned int)(ticks_to_us(timer_ticks() - startTime) / 1000));
+    return state;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       transfer
+//
+//  Arguments:      block:       The first block
+//                  count:       The number of blocks (1 to EMMC_MAX_BLOCKS)
+//                  buffer:      The memory to read into or write from,
+//                               aligned to MMU_CACHE_LINE
+//                  write:       TRUE to write to the card
+//
+//  Returns:        TRUE if the blocks were transferred
+//
+//  Description:    This function starts the DMA channel, paced by the EMMC
+//                  controller, sends the read or write command, and waits
+//                  until the controller and the DMA channel are both
+//                  done.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int transfer(unsigned int block, unsigned int count, void *buffer, int write)
+{
+    unsigned long start = timer_ticks();
+    unsigned int code, status = 0;
+    int ok;
+
+    if (state != EMMC_READY || count == 0 || count > EMMC_MAX_BLOCKS ||
+        ((unsigned long)buffer & (MMU_CACHE_LINE - 1))) {
+        return 0;
+    }
+
+    if (write) {
+        dmaBlock.info = DMA_TI_WAIT_RESP | DMA_TI_SRC_INC | DMA_TI_DEST_DREQ |
+                        DMA_TI_PERMAP(DMA_DREQ_EMMC);
+        dmaBlock.source = BUS_ADDRESS(buffer);
+        dmaBlock.destination = EMMC_DATA_BUS_ADDRESS;
+        code = (count == 1) ? WRITE_BLOCK : WRITE_MULTIPLE_BLOCK;
+    } else {
+        dmaBlock.info = DMA_TI_WAIT_RESP | DMA_TI_DEST_INC | DMA_TI_SRC_DREQ |
+                        DMA_TI_PERMAP(DMA_DREQ_EMMC);
+        dmaBlock.source = EMMC_DATA_BUS_ADDRESS;
+        dmaBlock.destination = BUS_ADDRESS(buffer);
+        code = (count == 1) ? READ_SINGLE_BLOCK : READ_MULTIPLE_BLOCK;
+    }
+    dmaBlock.length = count * EMMC_BLOCK_SIZE;
+    dmaBlock.stride = 0;
+    dmaBlock.next = 0;
+
+    // Put the data in RAM for a write. For a read, keep the cache from
+    // writing dirty lines back over what the DMA channel stores.
+    if (write) {
+        mmu_clean(buffer, count * EMMC_BLOCK_SIZE);
+    } else {
+        mmu_clean_invalidate(buffer, count * EMMC_BLOCK_SIZE);
+    }
+
+    // Start the DMA channel. It waits for the controller's DREQ.
+    *DMA_CS = DMA_CS_RESET;
+    *DMA_DEBUG = 7;
+    *DMA_CONBLK_AD = BUS_ADDRESS(&dmaBlock);
+    asm volatile("dsb sy" ::: "memory");
+    *DMA_CS = DMA_CS_ACTIVE | DMA_CS_END | DMA_CS_INT | DMA_CS_PRIORITY |
+              DMA_CS_PANIC_PRIORITY | DMA_CS_WAIT_WRITES;
+
+    put_register(EMMC_BLKSIZECNT, (count << 16) | EMMC_BLOCK_SIZE);
+    ok = command(code, highCapacity ? block : block * EMMC_BLOCK_SIZE);
+
+    // Wait for the last block, and for the DMA channel to move it
+    while (ok) {
+        status = *EMMC_INTERRUPT;
+        if (status & INT_ERROR) {
+            ok = 0;
+        } else if ((status & INT_DATA_DONE) && (*DMA_CS & DMA_CS_ACTIVE) == 0) {
+            break;
+        } else if (timed_out(start, EMMC_DATA_TIMEOUT_US)) {
+            ok = 0;
+        }
+    }
+    *EMMC_INTERRUPT = status & (INT_DATA_DONE | INT_ERRORS);
+
+    // Drop any lines of the buffer the core fetched during the read
+    if (!write) {
+        mmu_invalidate(buffer, count * EMMC_BLOCK_SIZE);
+    }
+
+    if (!ok || (*DMA_CS & DMA_CS_ERROR)) {
+        *DMA_CS = DMA_CS_RESET;
+        reset_lines(CONTROL1_SRST_CMD | CONTROL1_SRST_DATA);
+        errors++;
+        log_warn("EMMC: %s of %u blocks at %u failed, interrupt 0x%x\n",
+                 write ? "write" : "read", count, block, status);
+        return 0;
+    }
+
+    if (write) {
+        writes++;
+        blocksWritten += count;
+    } else {
+        reads++;
+        blocksRead += count;
+    }
+    busyTicks += timer_ticks() - start;
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       emmc_read
+//
+//  Arguments:      block:       The first block
+//                  count:       The number of blocks (1 to EMMC_MAX_BLOCKS)
+//                  buffer:      Where to put them, aligned to
+//                               MMU_CACHE_LINE
+//
+//  Returns:        TRUE if the blocks were read
+//
+//  Description:    This function reads consecutive blocks from the card in
+//                  one transfer.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int emmc_read(unsigned int block, unsigned int count, void *buffer)
+{
+    return transfer(block, count, buffer, 0);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       emmc_write
+//
+//  Arguments:      block:       The first block
+//                  count:       The number of blocks (1 to EMMC_MAX_BLOCKS)
+//                  buffer:      The data, aligned to MMU_CACHE_LINE
+//
+//  Returns:        TRUE if the blocks were written
+//
+//  Description:    This function writes consecutive blocks to the card in
+//                  one transfer.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int emmc_write(unsigned int block, unsigned int count, const void *buffer)
+{
+    return transfer(block, count, (void *)buffer, 1);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       emmc_report
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes the card's state and the transfer
+//                  statistics to the console terminal.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void emmc_report()
+{
+    static const char *const states[] = { "starting", "ready", "no card" };
+
+    log_info("EMMC: %s, %u reads (%lu KB), %u writes (%lu KB), %lu ms busy, "
+             "%u errors\n", states[state], reads, blocksRead / 2, writes,
+             blocksWritten / 2, ticks_to_us(busyTicks) / 1000, errors);
+}
@@ -0,0 +1,17 @@
+// Size of an SD card block in bytes
+#define EMMC_BLOCK_SIZE             512
+
+// Most blocks one transfer can move (the block count is 16 bits)
+#define EMMC_MAX_BLOCKS             65535
+
+// The card's state, as returned by emmc_poll()
+#define EMMC_STARTING               0
+#define EMMC_READY                  1
+#define EMMC_FAILED                 2
+
+// Function prototypes
+void emmc_init();
+unsigned int emmc_poll();
+int emmc_read(unsigned int block, unsigned int count, void *buffer);
+int emmc_write(unsigned int block, unsigned int count, const void *buffer);
+void emmc_report();
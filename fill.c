@@ -0,0 +1,827 @@
+// The functions in this file implement the flood fill. It replaces the
+// region of pixels that match a target colour (within a per-channel
+// tolerance) and are 4- or 8-connected to a seed pixel. A boundary fill
+// (FILL_BOUNDARY) turns the match around: it replaces the pixels that do
+// not match the target, up to a boundary of pixels that do.
+//
+// Filled pixels are marked in a bitmap of one bit per pixel rather than
+// recognized by their colour, so the replacement may be any colour. The
+// fill runs in three phases:
+//
+//   1. Find the region. The screen is divided into one horizontal band
+//      per core (see smp.c), and each core fills the spans of its own
+//      band: it extends a seed left and right into a span, marks it in
+//      the bitmap, and pushes seeds for the runs above and below it on
+//      its own stack. When a span is next to a row of another band, the
+//      row range to scan is handed to that band's core through a
+//      single-producer, single-consumer queue. A core never reads or
+//      writes another band's rows or bitmap words.
+//   2. Save the pixels about to change in the undo journal (core 0).
+//   3. Paint the marked spans and clear the bitmap, each core its own
+//      band. Canvas tiles the region covers whole are made solid instead
+//      of painted (see canvas.c).
+//
+// The region is the same however it is divided, so the result is
+// identical to filling it on one core. The search reads the canvas a tile
+// at a time in place, which writes out solid tiles (canvasSpan()); bands
+// are a multiple of the tile height, so each core only touches the tiles
+// of its own band.
+//
+// Phase 1 is over when every core is idle and no row range is in
+// flight. Core 0 detects this with the four-counter method: each core
+// counts the ranges it has sent and received, and the fill is finished
+// if two consecutive sweeps over all cores see every core idle, the same
+// counts, and as many ranges received as sent.
+//
+// An exact, 4-connected target fill skips the search: the region index (see
+// region.c) already knows the region's spans, and phase 1 only marks them
+// in the bitmap. The index is told the region's new colour afterwards.
+// Other fills, or a canvas the index cannot hold, search as above.
+
+#include "framebuffer.h"
+#include "stream.h"
+#include "undo.h"
+#include "smp.h"
+#include "compose.h"
+#include "canvas.h"
+#include "region.h"
+
+// The visited bitmap covers up to this many pixels (96 KB at 1024 x 768)
+#define FILL_MAX_PIXELS        (1024 * 768)
+
+// Seeds each core can hold before it has to rescan for the ones it dropped.
+// At least SMP_QUEUE_SIZE, so that scanning a row range from a neighbour
+// (with an empty stack) never drops a seed: the rescan would not find it.
+#define FILL_STACK_SIZE        8192
+
+// Bands are a multiple of this many rows high, so that no two cores mark
+// the same tile row of the stream or the compositor, or use the same row
+// of canvas tiles (see stream.c, compose.c and canvas.c, which use the
+// same tile size)
+#define FILL_BAND_ALIGN        STREAM_TILE_SIZE
+
+// The part of the screen one core fills
+struct fill_band {
+    int top, bottom;                    // Rows top to bottom - 1
+    int minY, maxY;                     // Rows filled so far
+    unsigned int filled;                // Pixels filled
+    unsigned int depth, overflow;       // The seed stack
+    unsigned int stack[FILL_STACK_SIZE];
+    struct smp_queue fromAbove;         // Row ranges to scan, from the
+    struct smp_queue fromBelow;         // neighbouring bands
+    volatile unsigned int idle;         // For termination detection
+    volatile unsigned int sent, received;
+};
+
+static unsigned long fillVisited[FILL_MAX_PIXELS / 64];
+static struct fill_band fillBands[SMP_CORES];
+static unsigned int fillBandCount, fillBandHeight, fillWords;
+static unsigned int fillTarget, fillColour;
+static int fillTolerance, fillReach, fillBoundary;
+static volatile unsigned int fillFinished;
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillNear
+//
+//  Arguments:      pixel:       A pixel colour
+//
+//  Returns:        TRUE if the pixel is within the fill tolerance of the
+//                  fill target colour
+//
+//  Description:    This function compares the red, green and blue channels
+//                  of a pixel with the target colour of the fill in
+//                  progress. The alpha byte is ignored.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline int fillNear(unsigned int pixel)
+{
+    int difference;
+
+    if (((pixel ^ fillTarget) & 0x00FFFFFF) == 0) {
+        return 1;
+    }
+    if (fillTolerance == 0) {
+        return 0;
+    }
+
+    difference = (int)((pixel >> 16) & 0xFF) - (int)((fillTarget >> 16) & 0xFF);
+    if (difference > fillTolerance || difference < -fillTolerance) {
+        return 0;
+    }
+    difference = (int)((pixel >> 8) & 0xFF) - (int)((fillTarget >> 8) & 0xFF);
+    if (difference > fillTolerance || difference < -fillTolerance) {
+        return 0;
+    }
+    difference = (int)(pixel & 0xFF) - (int)(fillTarget & 0xFF);
+    return difference <= fillTolerance && difference >= -fillTolerance;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillMatches
+//
+//  Arguments:      pixel:       A pixel colour
+//
+//  Returns:        TRUE if the fill in progress replaces the pixel
+//
+//  Description:    This function tells whether a pixel belongs to the
+//                  region: one near the target colour, or for a boundary
+//                  fill, one that is not.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline int fillMatches(unsigned int pixel)
+{
+    return fillNear(pixel) != fillBoundary;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillPixel
+//
+//  Arguments:      row:         The row of the tile read last, or 0
+//                  tileEnd:     The last pixel of that tile, or -1
+//                  x, y:        The pixel, to the right of any read before
+//                               with the same row and tileEnd
+//
+//  Returns:        The pixel's colour
+//
+//  Description:    This function reads a pixel of a row in place, moving
+//                  row and tileEnd on to the pixel's tile (and writing it
+//                  out, if solid) when it is past the tile read last.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned int fillPixel(unsigned int **row, int *tileEnd, int x, int y)
+{
+    if (x > *tileEnd) {
+        *tileEnd = x | (CANVAS_TILE_SIZE - 1);
+        *row = canvasSpan(x, x, y);
+    }
+
+    return (*row)[x];
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillTest
+//
+//  Arguments:      visited:     A row of the visited bitmap
+//                  x:           The pixel
+//
+//  Returns:        TRUE if the pixel has been filled
+//
+//  Description:    This function reads a bit of the visited bitmap.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline int fillTest(const unsigned long *visited, int x)
+{
+    return (visited[x >> 6] >> (x & 63)) & 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillPush
+//
+//  Arguments:      band:        The band the seed is in
+//                  x, y:        A seed pixel
+//
+//  Returns:        void
+//
+//  Description:    This function pushes a seed on a band's stack. If the
+//                  stack is full, the seed is dropped and the band notes
+//                  that it must look for dropped seeds again later.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline void fillPush(struct fill_band *band, int x, int y)
+{
+    if (band->depth == FILL_STACK_SIZE) {
+        band->overflow = 1;
+        return;
+    }
+    band->stack[band->depth++] = x | (y << 16);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillSend
+//
+//  Arguments:      band:        The sending band
+//                  queue:       The queue of the neighbouring band
+//                  x0, x1:      The pixels to scan
+//                  y:           The row, in the neighbouring band
+//
+//  Returns:        void
+//
+//  Description:    This function hands a row range to a neighbouring band.
+//                  The range is counted as sent before it is queued, so it
+//                  is always counted while it is in flight. A band sends
+//                  at most one range per span of its edge row, at most
+//                  (width + 1) / 2 per fill, so the queue cannot fill up
+//                  for screens narrower than 2 * SMP_QUEUE_SIZE.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void fillSend(struct fill_band *band, struct smp_queue *queue,
+                     int x0, int x1, int y)
+{
+    band->sent++;
+    smp_barrier();
+
+    while (!smp_queue_put(queue, x0 | ((unsigned long)x1 << 16) |
+                                 ((unsigned long)y << 32))) {
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillScanRow
+//
+//  Arguments:      band:        The band doing the scan
+//                  x0, x1:      The pixels to look at (clipped to the screen)
+//                  y:           The row (on the screen)
+//
+//  Returns:        void
+//
+//  Description:    This function looks along part of a row next to a span
+//                  that was just filled, and pushes one seed for every run
+//                  of pixels that still need filling. Words of the visited
+//                  bitmap that are full are skipped 64 pixels at a time.
+//                  Rows of another band are handed to that band instead.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void fillScanRow(struct fill_band *band, int x0, int x1, int y)
+{
+    unsigned long *visited = fillVisited + y * fillWords;
+    unsigned int *row = 0;
+    int x = x0, tileEnd = -1;
+
+    if (y < band->top) {
+        fillSend(band, &(band - 1)->fromBelow, x0, x1, y);
+        return;
+    }
+    if (y >= band->bottom) {
+        fillSend(band, &(band + 1)->fromAbove, x0, x1, y);
+        return;
+    }
+
+    while (x <= x1) {
+        if (visited[x >> 6] == ~0UL) {
+            x = (x | 63) + 1;
+            continue;
+        }
+
+        if (fillTest(visited, x) || !fillMatches(fillPixel(&row, &tileEnd, x, y))) {
+            x++;
+            continue;
+        }
+
+        fillPush(band, x, y);
+
+        // Skip the rest of the run; the span fill will find its ends
+        do {
+            x++;
+        } while (x <= x1 && !fillTest(visited, x) &&
+                 fillMatches(fillPixel(&row, &tileEnd, x, y)));
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillMark
+//
+//  Arguments:      x0, x1:      The first and last pixel of a span
+//                  y:           The row
+//
+//  Returns:        void
+//
+//  Description:    This function sets the visited bits of a span, a word
+//                  at a time.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void fillMark(int x0, int x1, int y)
+{
+    unsigned long *visited = fillVisited + y * fillWords;
+    unsigned int first = x0 >> 6, last = x1 >> 6, i;
+    unsigned long head = ~0UL << (x0 & 63), tail = ~0UL >> (63 - (x1 & 63));
+
+    if (first == last) {
+        visited[first] |= head & tail;
+        return;
+    }
+
+    visited[first] |= head;
+    for (i = first + 1; i < last; i++) {
+        visited[i] = ~0UL;
+    }
+    visited[last] |= tail;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillIndexed
+//
+//  Arguments:      x0, x1:      The first and last pixel of a span of the
+//                               region
+//                  y:           The row
+//
+//  Returns:        void
+//
+//  Description:    This function is called by regionComponent() for each
+//                  span of the region, on core 0. It marks the span as if
+//                  its band's core had filled it.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void fillIndexed(int x0, int x1, int y)
+{
+    struct fill_band *band = &fillBands[y / fillBandHeight];
+
+    fillMark(x0, x1, y);
+    band->filled += x1 - x0 + 1;
+    if (y < band->minY) {
+        band->minY = y;
+    }
+    if (y > band->maxY) {
+        band->maxY = y;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillNextRun
+//
+//  Arguments:      visited:     A row of the visited bitmap
+//                  x:           Where to start looking
+//                  end:         Where to store the last pixel of the run
+//
+//  Returns:        The first pixel of the next run of filled pixels at or
+//                  after x, or -1 if there is none
+//
+//  Description:    This function finds runs of set bits a word at a time.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int fillNextRun(const unsigned long *visited, int x, int *end)
+{
+    int width = frameBufferWidth;
+    unsigned long word;
+
+    // Find the next set bit
+    while (1) {
+        if (x >= width) {
+            return -1;
+        }
+        word = visited[x >> 6] & (~0UL << (x & 63));
+        if (word) {
+            x = (x & ~63) + __builtin_ctzl(word);
+            break;
+        }
+        x = (x | 63) + 1;
+    }
+
+    // Find the next clear bit (bits past the width are always clear)
+    *end = x;
+    while (1) {
+        word = ~visited[*end >> 6] & (~0UL << (*end & 63));
+        if (word) {
+            *end = (*end & ~63) + __builtin_ctzl(word) - 1;
+            return x;
+        }
+        *end = (*end | 63) + 1;
+        if (*end >= width) {
+            *end = width - 1;
+            return x;
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillSeed
+//
+//  Arguments:      band:        The band the seed is in
+//                  x, y:        The seed
+//
+//  Returns:        void
+//
+//  Description:    This function extends a seed left and right into the
+//                  longest span of pixels that need filling, marks it, and
+//                  scans the rows above and below it (diagonally one pixel
+//                  further for 8-connectivity).
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void fillSeed(struct fill_band *band, int x, int y)
+{
+    unsigned long *visited = fillVisited + y * fillWords;
+    unsigned int *row;
+    int left = x, right = x;
+
+    if (fillTest(visited, x)) {
+        return;
+    }
+
+    // Write out solid tiles one at a time as the span reaches them, and
+    // move on to the next tile's row there
+    row = canvasSpan(x, x, y);
+    while (left > 0 && !fillTest(visited, left - 1)) {
+        if ((left & (CANVAS_TILE_SIZE - 1)) == 0) {
+            row = canvasSpan(left - 1, left - 1, y);
+        }
+        if (!fillMatches(row[left - 1])) {
+            break;
+        }
+        left--;
+    }
+    row = canvasSpan(x, x, y);
+    while (right + 1 < (int)frameBufferWidth && !fillTest(visited, right + 1)) {
+        if (((right + 1) & (CANVAS_TILE_SIZE - 1)) == 0) {
+            row = canvasSpan(right + 1, right + 1, y);
+        }
+        if (!fillMatches(row[right + 1])) {
+            break;
+        }
+        right++;
+    }
+
+    fillMark(left, right, y);
+    band->filled += right - left + 1;
+    if (y < band->minY) {
+        band->minY = y;
+    }
+    if (y > band->maxY) {
+        band->maxY = y;
+    }
+
+    left = (left - fillReach < 0) ? 0 : left - fillReach;
+    right = (right + fillReach < (int)frameBufferWidth) ? right + fillReach : right;
+    if (y > 0) {
+        fillScanRow(band, left, right, y - 1);
+    }
+    if (y + 1 < (int)frameBufferHeight) {
+        fillScanRow(band, left, right, y + 1);
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillRescan
+//
+//  Arguments:      band:        The band
+//
+//  Returns:        void
+//
+//  Description:    This function finds the seeds a band dropped when its
+//                  stack was full. It looks next to every span the band has
+//                  filled so far and pushes seeds for the pixels in the
+//                  band that still need filling. (Ranges for the
+//                  neighbouring bands were never dropped.)
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void fillRescan(struct fill_band *band)
+{
+    int x0, x1, y, left, right;
+
+    band->overflow = 0;
+
+    for (y = band->minY; y <= band->maxY; y++) {
+        for (x0 = fillNextRun(fillVisited + y * fillWords, 0, &x1); x0 >= 0;
+             x0 = fillNextRun(fillVisited + y * fillWords, x1 + 1, &x1)) {
+            left = (x0 - fillReach < 0) ? 0 : x0 - fillReach;
+            right = (x1 + fillReach < (int)frameBufferWidth) ? x1 + fillReach : x1;
+            if (y > band->top) {
+                fillScanRow(band, left, right, y - 1);
+            }
+            if (y + 1 < band->bottom) {
+                fillScanRow(band, left, right, y + 1);
+            }
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillQuiescent
+//
+//  Arguments:      none
+//
+//  Returns:        TRUE if the region has been found
+//
+//  Description:    This function checks, twice, that every band is idle
+//                  and that their counts of ranges sent and received have
+//                  not changed and balance. A band only stops being idle
+//                  when it receives a range, which changes its count, so
+//                  this cannot miss a range in flight.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int fillQuiescent()
+{
+    unsigned int sent[SMP_CORES], received[SMP_CORES];
+    unsigned int totalSent = 0, totalReceived = 0, i;
+
+    for (i = 0; i < fillBandCount; i++) {
+        if (!fillBands[i].idle) {
+            return 0;
+        }
+        sent[i] = fillBands[i].sent;
+        received[i] = fillBands[i].received;
+    }
+
+    smp_barrier();
+
+    for (i = 0; i < fillBandCount; i++) {
+        if (!fillBands[i].idle || fillBands[i].sent != sent[i] ||
+            fillBands[i].received != received[i]) {
+            return 0;
+        }
+        totalSent += sent[i];
+        totalReceived += received[i];
+    }
+
+    return totalSent == totalReceived;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillWork
+//
+//  Arguments:      core:        The core, which fills the band of the same
+//                               number
+//
+//  Returns:        void
+//
+//  Description:    This function is phase 1 of the fill, run on every core
+//                  by smp_run(). It fills seeds from its stack, rescans if
+//                  seeds were dropped, and takes row ranges from its
+//                  neighbours, until core 0 finds that all the bands are
+//                  done.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void fillWork(unsigned int core)
+{
+    struct fill_band *band = &fillBands[core];
+    unsigned long item;
+    unsigned int seed;
+
+    if (core >= fillBandCount) {
+        return;
+    }
+
+    while (!fillFinished) {
+        if (band->depth) {
+            seed = band->stack[--band->depth];
+            fillSeed(band, seed & 0xFFFF, seed >> 16);
+            continue;
+        }
+        if (band->overflow) {
+            fillRescan(band);
+            continue;
+        }
+
+        // The stack is empty, so none of the seeds found here are dropped
+        if (smp_queue_get(&band->fromAbove, &item) ||
+            smp_queue_get(&band->fromBelow, &item)) {
+            band->idle = 0;
+            smp_barrier();
+            band->received++;
+            fillScanRow(band, item & 0xFFFF, (item >> 16) & 0xFFFF, item >> 32);
+            continue;
+        }
+
+        // Nothing to do until a neighbour sends a range
+        if (!band->idle) {
+            smp_barrier();
+            band->idle = 1;
+        }
+        if (core == 0 && fillQuiescent()) {
+            fillFinished = 1;
+            smp_barrier();
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillPaint
+//
+//  Arguments:      core:        The core, which paints the band of the same
+//                               number
+//
+//  Returns:        void
+//
+//  Description:    This function is phase 3 of the fill, run on every core
+//                  by smp_run(). It makes the canvas tiles its band's
+//                  region covers whole solid, writes the replacement colour
+//                  to the rest of the marked spans, reports them to the
+//                  stream and the compositor, and clears the band's rows of
+//                  the bitmap.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void fillPaint(unsigned int core)
+{
+    struct fill_band *band = &fillBands[core];
+    unsigned long *visited, mask;
+    unsigned int i, tx, ty, width;
+    int x0, x1, y, top, bottom;
+
+    if (core >= fillBandCount || band->minY > band->maxY) {
+        return;
+    }
+
+    // The whole tiles, found from their 32 bits in each row of the bitmap
+    // (a tile cut off by the edge of the screen has fewer)
+    for (ty = band->minY >> CANVAS_TILE_SHIFT;
+         ty <= (unsigned int)band->maxY >> CANVAS_TILE_SHIFT; ty++) {
+        top = ty << CANVAS_TILE_SHIFT;
+        bottom = (top + CANVAS_TILE_SIZE < band->bottom) ? top + CANVAS_TILE_SIZE - 1
+                                                         : band->bottom - 1;
+
+        for (tx = 0; tx << CANVAS_TILE_SHIFT < frameBufferWidth; tx++) {
+            x0 = tx << CANVAS_TILE_SHIFT;
+            width = (x0 + CANVAS_TILE_SIZE < (int)frameBufferWidth) ? CANVAS_TILE_SIZE
+                                                                     : frameBufferWidth - x0;
+            mask = (~0UL >> (64 - width)) << (x0 & 63);
+
+            for (y = top; y <= bottom; y++) {
+                if ((fillVisited[y * fillWords + (x0 >> 6)] & mask) != mask) {
+                    break;
+                }
+            }
+            if (y <= bottom) {
+                continue;
+            }
+
+            canvasFillTile(tx, ty, fillColour);
+            for (y = top; y <= bottom; y++) {
+                fillVisited[y * fillWords + (x0 >> 6)] &= ~mask;
+            }
+            stream_damage(x0, x0 + width - 1, top);
+            compose_damage(x0, x0 + width - 1, top);
+        }
+    }
+
+    for (y = band->minY; y <= band->maxY; y++) {
+        visited = fillVisited + y * fillWords;
+
+        for (x0 = fillNextRun(visited, 0, &x1); x0 >= 0;
+             x0 = fillNextRun(visited, x1 + 1, &x1)) {
+            canvasFill(x0, x1, y, fillColour);
+            stream_damage(x0, x1, y);
+            compose_damage(x0, x1, y);
+        }
+
+        for (i = 0; i < fillWords; i++) {
+            visited[i] = 0;
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       floodFill
+//
+//  Arguments:      x, y:        The seed pixel
+//                  target:      The colour to replace, or with
+//                               FILL_BOUNDARY, the colour to stop at
+//                  colour:      The replacement colour
+//                  tolerance:   How far each of the red, green and blue
+//                               channels may be from the target's (0 for
+//                               an exact match)
+//                  connectivity: 4 to spread to the pixels left, right,
+//                               above and below, or 8 to also spread
+//                               diagonally, plus FILL_BOUNDARY for a
+//                               boundary fill
+//
+//  Returns:        The number of pixels filled
+//
+//  Description:    This function fills the region of pixels that match the
+//                  target colour (or for a boundary fill, do not) and are
+//                  connected to the seed, on all the cores smp_init()
+//                  started. It must be called on core 0.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int floodFill(int x, int y, unsigned int target, unsigned int colour,
+                       unsigned int tolerance, unsigned int connectivity)
+{
+    struct fill_band *band;
+    unsigned int height, filled = 0, i;
+    int row, x0, x1, indexed;
+
+    if ((unsigned int)x >= frameBufferWidth ||
+        (unsigned int)y >= frameBufferHeight) {
+        return 0;
+    }
+
+    fillWords = (frameBufferWidth + 63) >> 6;
+    if (fillWords * frameBufferHeight > FILL_MAX_PIXELS / 64) {
+        return 0;
+    }
+
+    fillTarget = target;
+    fillColour = colour;
+    fillTolerance = (tolerance > 255) ? 255 : tolerance;
+    fillReach = ((connectivity & ~FILL_BOUNDARY) == 8);
+    fillBoundary = (connectivity & FILL_BOUNDARY) != 0;
+
+    if (!fillMatches(getPixel(x, y))) {
+        return 0;
+    }
+
+    // One band per core. Screens too wide for the queues are filled by
+    // core 0 alone.
+    fillBandCount = (frameBufferWidth < 2 * SMP_QUEUE_SIZE) ? smp_cores() : 1;
+    height = (frameBufferHeight + fillBandCount * FILL_BAND_ALIGN - 1) /
+             (fillBandCount * FILL_BAND_ALIGN) * FILL_BAND_ALIGN;
+
+    for (i = 0; i < fillBandCount; i++) {
+        band = &fillBands[i];
+        band->top = (i * height < frameBufferHeight) ? i * height : frameBufferHeight;
+        band->bottom = (band->top + height < frameBufferHeight) ?
+                       band->top + height : frameBufferHeight;
+        band->minY = band->bottom;
+        band->maxY = band->top - 1;
+        band->filled = 0;
+        band->depth = 0;
+        band->overflow = 0;
+        band->idle = 0;
+        band->sent = 0;
+        band->received = 0;
+        smp_queue_reset(&band->fromAbove);
+        smp_queue_reset(&band->fromBelow);
+    }
+    fillFinished = 0;
+    fillBandHeight = height;
+
+    // Phase 1: find the region, in the index if it can be used
+    indexed = fillTolerance == 0 && !fillReach && !fillBoundary &&
+              regionComponent(x, y, fillIndexed);
+    if (!indexed) {
+        fillPush(&fillBands[y / height], x, y);
+        smp_run(fillWork);
+    }
+
+    // Phase 2: let the undo journal save the pixels that will change
+    for (i = 0; i < fillBandCount; i++) {
+        band = &fillBands[i];
+        for (row = band->minY; row <= band->maxY; row++) {
+            for (x0 = fillNextRun(fillVisited + row * fillWords, 0, &x1); x0 >= 0;
+                 x0 = fillNextRun(fillVisited + row * fillWords, x1 + 1, &x1)) {
+                undo_record(x0, x1, row, colour);
+            }
+        }
+        filled += band->filled;
+    }
+
+    // Phase 3: paint it
+    smp_run(fillPaint);
+    if (indexed) {
+        regionRecolour(colour);
+    }
+
+    return filled;
+}
@@ -0,0 +1,302 @@
+// The functions in this file draw text in a built-in 8 x 8 bitmap font
+// (printable ASCII, public domain glyphs in the style of the IBM PC BIOS
+// font).
+//
+// Drawing a glyph one bit at a time costs a test and a branch per pixel.
+// Instead, initFont() expands every possible glyph row (one byte, one
+// bit per pixel) into eight mask words, and the masks are combined with
+// the text colours into ready-made rows of pixels whenever the colours
+// change. A glyph is then drawn as eight row copies of 32 bytes each, as
+// four 64-bit stores per row.
+//
+// Text is drawn on a layer of the compositor (see compose.c), normally the
+// overlay, rather than on the canvas, so it is not part of the drawing.
+
+#include "compose.h"
+#include "font.h"
+
+// One byte per row, bit 0 is the leftmost pixel
+static const unsigned char fontGlyphs[FONT_LAST - FONT_FIRST + 1][FONT_HEIGHT] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // space
+    { 0x18, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x18, 0x00 },   // !
+    { 0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // "
+    { 0x36, 0x36, 0x7F, 0x36, 0x7F, 0x36, 0x36, 0x00 },   // #
+    { 0x0C, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x0C, 0x00 },   // $
+    { 0x00, 0x63, 0x33, 0x18, 0x0C, 0x66, 0x63, 0x00 },   // %
+    { 0x1C, 0x36, 0x1C, 0x6E, 0x3B, 0x33, 0x6E, 0x00 },   // &
+    { 0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00 },   // '
+    { 0x18, 0x0C, 0x06, 0x06, 0x06, 0x0C, 0x18, 0x00 },   // (
+    { 0x06, 0x0C, 0x18, 0x18, 0x18, 0x0C, 0x06, 0x00 },   // )
+    { 0x00, 0x66, 0x3C, 0xFF, 0x3C, 0x66, 0x00, 0x00 },   // *
+    { 0x00, 0x0C, 0x0C, 0x3F, 0x0C, 0x0C, 0x00, 0x00 },   // +
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x06 },   // ,
+    { 0x00, 0x00, 0x00, 0x3F, 0x00, 0x00, 0x00, 0x00 },   // -
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00 },   // .
+    { 0x60, 0x30, 0x18, 0x0C, 0x06, 0x03, 0x01, 0x00 },   // /
+    { 0x3E, 0x63, 0x73, 0x7B, 0x6F, 0x67, 0x3E, 0x00 },   // 0
+    { 0x0C, 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x3F, 0x00 },   // 1
+    { 0x1E, 0x33, 0x30, 0x1C, 0x06, 0x33, 0x3F, 0x00 },   // 2
+    { 0x1E, 0x33, 0x30, 0x1C, 0x30, 0x33, 0x1E, 0x00 },   // 3
+    { 0x38, 0x3C, 0x36, 0x33, 0x7F, 0x30, 0x78, 0x00 },   // 4
+    { 0x3F, 0x03, 0x1F, 0x30, 0x30, 0x33, 0x1E, 0x00 },   // 5
+    { 0x1C, 0x06, 0x03, 0x1F, 0x33, 0x33, 0x1E, 0x00 },   // 6
+    { 0x3F, 0x33, 0x30, 0x18, 0x0C, 0x0C, 0x0C, 0x00 },   // 7
+    { 0x1E, 0x33, 0x33, 0x1E, 0x33, 0x33, 0x1E, 0x00 },   // 8
+    { 0x1E, 0x33, 0x33, 0x3E, 0x30, 0x18, 0x0E, 0x00 },   // 9
+    { 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x00 },   // :
+    { 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x06 },   // ;
+    { 0x18, 0x0C, 0x06, 0x03, 0x06, 0x0C, 0x18, 0x00 },   // <
+    { 0x00, 0x00, 0x3F, 0x00, 0x00, 0x3F, 0x00, 0x00 },   // =
+    { 0x06, 0x0C, 0x18, 0x30, 0x18, 0x0C, 0x06, 0x00 },   // >
+    { 0x1E, 0x33, 0x30, 0x18, 0x0C, 0x00, 0x0C, 0x00 },   // ?
+    { 0x3E, 0x63, 0x7B, 0x7B, 0x7B, 0x03, 0x1E, 0x00 },   // @
+    { 0x0C, 0x1E, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x00 },   // A
+    { 0x3F, 0x66, 0x66, 0x3E, 0x66, 0x66, 0x3F, 0x00 },   // B
+    { 0x3C, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3C, 0x00 },   // C
+    { 0x1F, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1F, 0x00 },   // D
+    { 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x46, 0x7F, 0x00 },   // E
+    { 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x06, 0x0F, 0x00 },   // F
+    { 0x3C, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7C, 0x00 },   // G
+    { 0x33, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x33, 0x00 },   // H
+    { 0x1E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },   // I
+    { 0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E, 0x00 },   // J
+    { 0x67, 0x66, 0x36, 0x1E, 0x36, 0x66, 0x67, 0x00 },   // K
+    { 0x0F, 0x06, 0x06, 0x06, 0x46, 0x66, 0x7F, 0x00 },   // L
+    { 0x63, 0x77, 0x7F, 0x7F, 0x6B, 0x63, 0x63, 0x00 },   // M
+    { 0x63, 0x67, 0x6F, 0x7B, 0x73, 0x63, 0x63, 0x00 },   // N
+    { 0x1C, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00 },   // O
+    { 0x3F, 0x66, 0x66, 0x3E, 0x06, 0x06, 0x0F, 0x00 },   // P
+    { 0x1E, 0x33, 0x33, 0x33, 0x3B, 0x1E, 0x38, 0x00 },   // Q
+    { 0x3F, 0x66, 0x66, 0x3E, 0x36, 0x66, 0x67, 0x00 },   // R
+    { 0x1E, 0x33, 0x07, 0x0E, 0x38, 0x33, 0x1E, 0x00 },   // S
+    { 0x3F, 0x2D, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },   // T
+    { 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x3F, 0x00 },   // U
+    { 0x33, 0x33, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 },   // V
+    { 0x63, 0x63, 0x63, 0x6B, 0x7F, 0x77, 0x63, 0x00 },   // W
+    { 0x63, 0x63, 0x36, 0x1C, 0x1C, 0x36, 0x63, 0x00 },   // X
+    { 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x0C, 0x1E, 0x00 },   // Y
+    { 0x7F, 0x63, 0x31, 0x18, 0x4C, 0x66, 0x7F, 0x00 },   // Z
+    { 0x1E, 0x06, 0x06, 0x06, 0x06, 0x06, 0x1E, 0x00 },   // [
+    { 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x40, 0x00 },   // backslash
+    { 0x1E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1E, 0x00 },   // ]
+    { 0x08, 0x1C, 0x36, 0x63, 0x00, 0x00, 0x00, 0x00 },   // ^
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF },   // _
+    { 0x0C, 0x0C, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 },   // `
+    { 0x00, 0x00, 0x1E, 0x30, 0x3E, 0x33, 0x6E, 0x00 },   // a
+    { 0x07, 0x06, 0x06, 0x3E, 0x66, 0x66, 0x3B, 0x00 },   // b
+    { 0x00, 0x00, 0x1E, 0x33, 0x03, 0x33, 0x1E, 0x00 },   // c
+    { 0x38, 0x30, 0x30, 0x3E, 0x33, 0x33, 0x6E, 0x00 },   // d
+    { 0x00, 0x00, 0x1E, 0x33, 0x3F, 0x03, 0x1E, 0x00 },   // e
+    { 0x1C, 0x36, 0x06, 0x0F, 0x06, 0x06, 0x0F, 0x00 },   // f
+    { 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x1F },   // g
+    { 0x07, 0x06, 0x36, 0x6E, 0x66, 0x66, 0x67, 0x00 },   // h
+    { 0x0C, 0x00, 0x0E, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },   // i
+    { 0x30, 0x00, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E },   // j
+    { 0x07, 0x06, 0x66, 0x36, 0x1E, 0x36, 0x67, 0x00 },   // k
+    { 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },   // l
+    { 0x00, 0x00, 0x33, 0x7F, 0x7F, 0x6B, 0x63, 0x00 },   // m
+    { 0x00, 0x00, 0x1F, 0x33, 0x33, 0x33, 0x33, 0x00 },   // n
+    { 0x00, 0x00, 0x1E, 0x33, 0x33, 0x33, 0x1E, 0x00 },   // o
+    { 0x00, 0x00, 0x3B, 0x66, 0x66, 0x3E, 0x06, 0x0F },   // p
+    { 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x78 },   // q
+    { 0x00, 0x00, 0x3B, 0x6E, 0x66, 0x06, 0x0F, 0x00 },   // r
+    { 0x00, 0x00, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x00 },   // s
+    { 0x08, 0x0C, 0x3E, 0x0C, 0x0C, 0x2C, 0x18, 0x00 },   // t
+    { 0x00, 0x00, 0x33, 0x33, 0x33, 0x33, 0x6E, 0x00 },   // u
+    { 0x00, 0x00, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 },   // v
+    { 0x00, 0x00, 0x63, 0x6B, 0x7F, 0x7F, 0x36, 0x00 },   // w
+    { 0x00, 0x00, 0x63, 0x36, 0x1C, 0x36, 0x63, 0x00 },   // x
+    { 0x00, 0x00, 0x33, 0x33, 0x33, 0x3E, 0x30, 0x1F },   // y
+    { 0x00, 0x00, 0x3F, 0x19, 0x0C, 0x26, 0x3F, 0x00 },   // z
+    { 0x38, 0x0C, 0x0C, 0x07, 0x0C, 0x0C, 0x38, 0x00 },   // {
+    { 0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x18, 0x00 },   // |
+    { 0x07, 0x0C, 0x0C, 0x38, 0x0C, 0x0C, 0x07, 0x00 },   // }
+    { 0x6E, 0x3B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // ~
+};
+
+// Every possible glyph row, expanded to one mask word per pixel
+static unsigned int rowMasks[256][FONT_WIDTH];
+
+// The same rows in the current colours, two pixels per 64-bit word (the
+// left one in the low half)
+static unsigned long rowPixels[256][FONT_WIDTH / 2];
+static unsigned int pixelColour, pixelBackground;
+static int pixelsValid;
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       initFont
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function expands every possible glyph row into
+//                  its pixel masks.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void initFont()
+{
+    unsigned int bits, i;
+
+    for (bits = 0; bits < 256; bits++) {
+        for (i = 0; i < FONT_WIDTH; i++) {
+            rowMasks[bits][i] = ((bits >> i) & 1) ? 0xFFFFFFFF : 0;
+        }
+    }
+    pixelsValid = 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       setColours
+//
+//  Arguments:      colour:      The text colour
+//                  background:  The colour behind it
+//
+//  Returns:        void
+//
+//  Description:    This function rebuilds the rows of pixels for a new
+//                  pair of colours. Overlays usually draw in one pair, so
+//                  this happens rarely.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void setColours(unsigned int colour, unsigned int background)
+{
+    const unsigned int *masks;
+    unsigned int bits, i;
+    unsigned long left, right;
+
+    for (bits = 0; bits < 256; bits++) {
+        masks = rowMasks[bits];
+        for (i = 0; i < FONT_WIDTH / 2; i++) {
+            left = (colour & masks[2 * i]) | (background & ~masks[2 * i]);
+            right = (colour & masks[2 * i + 1]) | (background & ~masks[2 * i + 1]);
+            rowPixels[bits][i] = left | (right << 32);
+        }
+    }
+
+    pixelColour = colour;
+    pixelBackground = background;
+    pixelsValid = 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       drawChar
+//
+//  Arguments:      layer:       The layer to draw on
+//                  x, y:        The top left corner of the glyph, in the
+//                               layer's pixels
+//                  c:           The character
+//                  colour:      The text colour
+//                  background:  The colour of the rest of the glyph box
+//
+//  Returns:        The x of the next character
+//
+//  Description:    This function draws one glyph, clipped to the layer.
+//                  initFont() must be called first. The caller reports
+//                  the change with compose_damage_layer().
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int drawChar(struct compose_layer *layer, int x, int y, char c,
+             unsigned int colour, unsigned int background)
+{
+    const unsigned char *glyph;
+    const unsigned long *pixels;
+    unsigned long *wide;
+    unsigned int *row, i, j;
+
+    if ((unsigned char)c < FONT_FIRST || (unsigned char)c > FONT_LAST) {
+        c = '?';
+    }
+    glyph = fontGlyphs[(unsigned char)c - FONT_FIRST];
+
+    if (!pixelsValid || colour != pixelColour || background != pixelBackground) {
+        setColours(colour, background);
+    }
+
+    // Glyphs partly off the layer are clipped one pixel at a time
+    if (x < 0 || y < 0 || x + FONT_WIDTH > (int)layer->width ||
+        y + FONT_HEIGHT > (int)layer->height) {
+        for (i = 0; i < FONT_HEIGHT; i++) {
+            if ((unsigned int)(y + i) >= layer->height) {
+                continue;
+            }
+            row = layer->pixels + (y + i) * layer->width;
+            pixels = rowPixels[glyph[i]];
+            for (j = 0; j < FONT_WIDTH; j++) {
+                if ((unsigned int)(x + j) < layer->width) {
+                    row[x + j] = pixels[j / 2] >> (32 * (j & 1));
+                }
+            }
+        }
+        return x + FONT_WIDTH;
+    }
+
+    for (i = 0; i < FONT_HEIGHT; i++) {
+        row = layer->pixels + (y + i) * layer->width + x;
+        pixels = rowPixels[glyph[i]];
+
+        // Use 64-bit stores where the address is aligned for them
+        if (((unsigned long)row & 7) == 0) {
+            wide = (unsigned long *)row;
+            wide[0] = pixels[0];
+            wide[1] = pixels[1];
+            wide[2] = pixels[2];
+            wide[3] = pixels[3];
+        } else {
+            for (j = 0; j < FONT_WIDTH; j++) {
+                row[j] = pixels[j / 2] >> (32 * (j & 1));
+            }
+        }
+    }
+
+    return x + FONT_WIDTH;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       drawText
+//
+//  Arguments:      layer:       The layer to draw on
+//                  x, y:        The top left corner of the first glyph
+//                  text:        The string (a newline starts a new line
+//                               at the original x)
+//                  colour:      The text colour
+//                  background:  The colour of the rest of the glyph boxes
+//
+//  Returns:        The x after the last character
+//
+//  Description:    This function draws a string, clipped to the layer.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int drawText(struct compose_layer *layer, int x, int y, const char *text,
+             unsigned int colour, unsigned int background)
+{
+    int left = x;
+
+    for (; *text; text++) {
+        if (*text == '\n') {
+            x = left;
+            y += FONT_HEIGHT;
+            continue;
+        }
+        x = drawChar(layer, x, y, *text, colour, background);
+    }
+
+    return x;
+}
@@ -0,0 +1,15 @@
+// Size of a glyph of the built-in font, in pixels
+#define FONT_WIDTH                  8
+#define FONT_HEIGHT                 8
+
+// Characters the font has glyphs for (printable ASCII). Others are drawn
+// as '?'.
+#define FONT_FIRST                  0x20
+#define FONT_LAST                   0x7E
+
+// Function prototypes (compose.h must be included first)
+void initFont();
+int drawChar(struct compose_layer *layer, int x, int y, char c,
+             unsigned int colour, unsigned int background);
+int drawText(struct compose_layer *layer, int x, int y, const char *text,
+             unsigned int colour, unsigned int background);
@@ -2,11 +2,16 @@
 // Needed header files
 #include "uart.h"
 #include "mailbox.h"
+#include "kprintf.h"
+#include "framebuffer.h"
+#include "stream.h"
+#include "undo.h"
+#include "compose.h"
+#include "canvas.h"
+#include "mmu.h"
 
 // HTML RGB color codes.  These can be found at:
-// https://htmlcolorcodes.com/
-#define BLACK     0x00000000
-#define WHITE     0x00FFFFFF
+// https://htmlcolorcodes.com/ (BLACK and WHITE are in framebuffer.h)
 #define RED       0x00FF0000
 #define LIME      0x0000FF00
 #define BLUE      0x000000FF
@@ -30,11 +35,14 @@
 #define VIRTUAL_X_OFFSET       0
 #define VIRTUAL_Y_OFFSET       0
 #define PIXEL_ORDER_BGR        0     // needed for the above color codes
+#define FRAMEBUFFER_PAGES      2     // screen pages, for flipping at vsync
 
-// Frame buffer global variables
+// Frame buffer global variables. frameBuffer is the canvas (see
+// framebuffer.h); screenBuffer is the frame buffer the display shows.
 unsigned int frameBufferWidth, frameBufferHeight, frameBufferPitch;
 unsigned int frameBufferDepth, frameBufferPixelOrder, frameBufferSize;
 unsigned int *frameBuffer;
+unsigned int *screenBuffer, screenPitch, screenPages = 1;
 
 
 
@@ -75,7 +83,7 @@ void initFrameBuffer()
     mailbox_buffer[8] = 8;
     mailbox_buffer[9] = 0;
     mailbox_buffer[10] = FRAMEBUFFER_WIDTH;
-    mailbox_buffer[11] = FRAMEBUFFER_HEIGHT;
+    mailbox_buffer[11] = FRAMEBUFFER_HEIGHT * FRAMEBUFFER_PAGES;
     
     mailbox_buffer[12] = TAG_SET_VIRTUAL_OFFSET;
     mailbox_buffer[13] = 8;
@@ -114,98 +122,359 @@ void initFrameBuffer()
 
 	// Get the returned frame buffer address, masking out 2 upper bits
         mailbox_buffer[28] &= 0x3FFFFFFF;
-        frameBuffer = (void *)((unsigned long)mailbox_buffer[28]);
+        screenBuffer = (void *)((unsigned long)mailbox_buffer[28]);
 
 	// Read the frame buffer settings from the mailbox buffer
         frameBufferWidth = mailbox_buffer[5];
         frameBufferHeight = mailbox_buffer[6];
-        frameBufferPitch = mailbox_buffer[33];
+        screenPitch = mailbox_buffer[33];
 	frameBufferDepth = mailbox_buffer[20];
 	frameBufferPixelOrder = mailbox_buffer[24];
 	frameBufferSize = mailbox_buffer[29];
 
-	// Display frame buffer settings to the terminal
-	uart_puts("Frame buffer settings:\n");
+        // The display reads the screen from RAM, so keep it out of the
+        // data cache
+        mmu_uncached(screenBuffer, frameBufferSize);
+
+        // The firmware may not grant the extra page, in which case frames
+        // are composed into the page on show
+        if (mailbox_buffer[11] >= frameBufferHeight * FRAMEBUFFER_PAGES) {
+            screenPages = FRAMEBUFFER_PAGES;
+        }
+
+	// The settings are written to the terminal after the first frame
+	// (see frameBufferReport())
+
+        // Draw on the canvas layer, which the compositor copies to the
+        // screen. If the screen is too large for it, draw on the screen.
+        frameBuffer = compose_init() ? canvasInit() : 0;
+        if (!frameBuffer) {
+            frameBuffer = screenBuffer;
+            frameBufferPitch = screenPitch;
+            screenPages = 1;
+        }
+	
+    } else {
+        log_error("Cannot initialize frame buffer\n");
+    }
+}
 
-	uart_puts("    width:       0x");
-	uart_puthex(frameBufferWidth);
-	uart_puts(" pixels\n");
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       frameBufferReport
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes the frame buffer settings the
+//                  firmware returned to the console terminal. main() calls
+//                  it once the first frame is shown, so the output does not
+//                  hold up booting.
+//
+////////////////////////////////////////////////////////////////////////////////
 
-	uart_puts("    height:      0x");
-	uart_puthex(frameBufferHeight);
-	uart_puts(" pixels\n");
+void frameBufferReport()
+{
+    if (!screenBuffer) {
+        return;
+    }
 
-	uart_puts("    pitch:       0x");
-	uart_puthex(frameBufferPitch);
-	uart_puts(" bytes per row\n");
+    log_info("Frame buffer settings:\n");
+    log_info("    width:       %u pixels\n", frameBufferWidth);
+    log_info("    height:      %u pixels\n", frameBufferHeight);
+    log_info("    pitch:       %u bytes per row\n", screenPitch);
+    log_info("    pages:       %u\n", screenPages);
+    log_info("    depth:       %u bits per pixel\n", frameBufferDepth);
+    log_info("    pixel order: %u (0=BGR, 1=RGB)\n", frameBufferPixelOrder);
+    log_info("    address:     0x%08x\n", (unsigned int)(unsigned long)screenBuffer);
+    log_info("    size:        %u bytes\n", frameBufferSize);
+}
 
-	uart_puts("    depth:       0x");
-	uart_puthex(frameBufferDepth);
-	uart_puts(" bits per pixel\n");
 
-	uart_puts("    pixel order: 0x");
-	uart_puthex(frameBufferPixelOrder);
-	uart_puts(" (0=BGR, 1=RGB)\n");
 
-	uart_puts("    address:     0x");
-	uart_puthex(mailbox_buffer[28]);
-	uart_puts("\n");
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       getPixel
+//
+//  Arguments:      x, y:        The pixel coordinates
+//
+//  Returns:        The colour of the pixel, or BLACK if it is off screen
+//
+//  Description:    This function reads a pixel from the canvas. Solid
+//                  tiles (see canvas.c) are read as their colour.
+//
+////////////////////////////////////////////////////////////////////////////////
 
-	uart_puts("    size:        0x");
-	uart_puthex(frameBufferSize);
-	uart_puts(" bytes\n");
-	
-    } else {
-        uart_puts("Cannot initialize frame buffer\n");
+unsigned int getPixel(int x, int y)
+{
+    unsigned int colour;
+
+    if ((unsigned int)x >= frameBufferWidth ||
+        (unsigned int)y >= frameBufferHeight) {
+        return BLACK;
     }
-}
 
-void drawPoint(int x, int y){
-    unsigned int *pixel = frameBuffer;
-    pixel[(y * frameBufferWidth) + x] = BLACK;
+    canvasRead(x, x, y, &colour);
+    return colour;
 }
 
-void clearPoint(int x, int y){
-    unsigned int *pixel = frameBuffer;
-    pixel[(y * frameBufferWidth) + x] = WHITE;
 
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       setPixel
+//
+//  Arguments:      x, y:        The pixel coordinates
+//                  colour:      The new colour of the pixel
+//
+//  Returns:        void
+//
+//  Description:    This function writes a pixel to the frame buffer.
+//                  Pixels that are off screen are ignored.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void setPixel(int x, int y, unsigned int colour)
+{
+    if ((unsigned int)x >= frameBufferWidth ||
+        (unsigned int)y >= frameBufferHeight) {
+        return;
+    }
+
+    undo_record(x, x, y, colour);
+    canvasSpan(x, x, y)[x] = colour;
+    stream_damage(x, x, y);
+    compose_damage(x, x, y);
 }
 
 
-void clearScreen(){
-    int x,y;
-    // Draw the square row by row, from the top down
-    for (x = 0; x < frameBufferWidth; x++) {
-        // Draw each pixel in the row from left to right
-         for (y = 0; y < frameBufferHeight; y++) {
-            // Draw the individual pixel by setting its
-            // RGB value in the frame buffer
-             clearPoint(x,y);
-         }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillSpan
+//
+//  Arguments:      x0, x1:      The first and last pixel of the span
+//                  y:           The row
+//                  colour:      The fill colour
+//
+//  Returns:        void
+//
+//  Description:    This function fills the pixels x0 to x1 (inclusive) of a
+//                  row, clipped to the screen. It is the row fill kernel
+//                  used by the other drawing functions.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void fillSpan(int x0, int x1, int y, unsigned int colour)
+{
+    if ((unsigned int)y >= frameBufferHeight) {
+        return;
+    }
+    if (x0 < 0) {
+        x0 = 0;
+    }
+    if (x1 >= (int)frameBufferWidth) {
+        x1 = frameBufferWidth - 1;
+    }
+    if (x0 > x1) {
+        return;
     }
+
+    undo_record(x0, x1, y, colour);
+    canvasFill(x0, x1, y, colour);
+    stream_damage(x0, x1, y);
+    compose_damage(x0, x1, y);
 }
 
 
-void floodFill(int x, int y){ //From https://guide.freecodecamp.org/algorithms/flood-fill/
-    unsigned int *pixel = frameBuffer;
-    if( pixel[(y * frameBufferWidth) + x] == BLACK){ //If it has been filled we don't do anything we already
-          return;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillTile
+//
+//  Arguments:      tx, ty:      A canvas tile
+//                  colour:      The fill colour
+//
+//  Returns:        void
+//
+//  Description:    This function fills a whole canvas tile by making it
+//                  solid, after saving its pixels for undo. A tile that is
+//                  already solid in the colour is left alone.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void fillTile(unsigned int tx, unsigned int ty, unsigned int colour)
+{
+    int x0 = tx << CANVAS_TILE_SHIFT, x1 = x0 + CANVAS_TILE_SIZE - 1;
+    int y0 = ty << CANVAS_TILE_SHIFT, y1 = y0 + CANVAS_TILE_SIZE - 1, y;
+    unsigned int solid;
+
+    if (canvasSolidTile(tx, ty, &solid) && solid == colour) {
+        return;
+    }
+    if (x1 >= (int)frameBufferWidth) {
+        x1 = frameBufferWidth - 1;
+    }
+    if (y1 >= (int)frameBufferHeight) {
+        y1 = frameBufferHeight - 1;
     }
 
-    drawPoint(x,y);
+    for (y = y0; y <= y1; y++) {
+        undo_record(x0, x1, y, colour);
+    }
+    canvasFillTile(tx, ty, colour);
+
+    // One row marks the tile in both damage maps
+    stream_damage(x0, x1, y0);
+    compose_damage(x0, x1, y0);
+}
+
+
 
-    if(x > 0){
-        floodFill(x-1, y);
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillRect
+//
+//  Arguments:      x, y:        The top left corner of the rectangle
+//                  width:       The width of the rectangle in pixels
+//                  height:      The height of the rectangle in pixels
+//                  colour:      The fill colour
+//
+//  Returns:        void
+//
+//  Description:    This function fills a rectangle, clipped to the screen.
+//                  Canvas tiles it covers whole are made solid (see
+//                  canvas.c); the rest is filled one row span at a time.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void fillRect(int x, int y, int width, int height, unsigned int colour)
+{
+    int x0 = x, x1 = x + width - 1, y0 = y, y1 = y + height - 1;
+    int row, top, bottom, left, right;
+    unsigned int tx, ty;
+
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+    if (x0 < 0) {
+        x0 = 0;
+    }
+    if (y0 < 0) {
+        y0 = 0;
     }
-    if(x + 1 < frameBufferWidth){
-        floodFill(x+1,y);
+    if (x1 >= (int)frameBufferWidth) {
+        x1 = frameBufferWidth - 1;
     }
-    if(y > 0){
-        floodFill(x, y-1);
+    if (y1 >= (int)frameBufferHeight) {
+        y1 = frameBufferHeight - 1;
     }
-    if(y + 1 < frameBufferHeight){
-        floodFill(x, y+1);
+    if (x0 > x1 || y0 > y1) {
+        return;
     }
 
-    return;
-}
\ No newline at end of file
+    // The whole tiles are those from left to right, counting a tile cut
+    // off by the edge of the screen as whole
+    left = (x0 + CANVAS_TILE_SIZE - 1) >> CANVAS_TILE_SHIFT;
+    right = (x1 == (int)frameBufferWidth - 1) ? x1 >> CANVAS_TILE_SHIFT
+                                              : ((x1 + 1) >> CANVAS_TILE_SHIFT) - 1;
+
+    for (row = y0; row <= y1; row++) {
+        ty = row >> CANVAS_TILE_SHIFT;
+        top = ty << CANVAS_TILE_SHIFT;
+        bottom = top + CANVAS_TILE_SIZE - 1;
+        if (bottom >= (int)frameBufferHeight) {
+            bottom = frameBufferHeight - 1;
+        }
+
+        if (left > right || top < y0 || bottom > y1) {
+            fillSpan(x0, x1, row, colour);
+            continue;
+        }
+
+        // The parts of the row outside the whole tiles
+        if (x0 < left << CANVAS_TILE_SHIFT) {
+            fillSpan(x0, (left << CANVAS_TILE_SHIFT) - 1, row, colour);
+        }
+        if (x1 >= (right + 1) << CANVAS_TILE_SHIFT) {
+            fillSpan((right + 1) << CANVAS_TILE_SHIFT, x1, row, colour);
+        }
+
+        // The whole tiles, once per tile row
+        if (row == top) {
+            for (tx = left; tx <= (unsigned int)right; tx++) {
+                fillTile(tx, ty, colour);
+            }
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       drawLine
+//
+//  Arguments:      x0, y0:      The start of the line
+//                  x1, y1:      The end of the line (inclusive)
+//                  colour:      The line colour
+//
+//  Returns:        void
+//
+//  Description:    This function draws a line using Bresenham's algorithm.
+//                  Horizontal lines are drawn as a single span.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void drawLine(int x0, int y0, int x1, int y1, unsigned int colour)
+{
+    int dx, dy, sx, sy, error, e2;
+
+    if (y0 == y1) {
+        if (x0 > x1) {
+            fillSpan(x1, x0, y0, colour);
+        } else {
+            fillSpan(x0, x1, y0, colour);
+        }
+        return;
+    }
+
+    dx = (x1 > x0) ? x1 - x0 : x0 - x1;
+    dy = (y1 > y0) ? y0 - y1 : y1 - y0;      // Negative
+    sx = (x0 < x1) ? 1 : -1;
+    sy = (y0 < y1) ? 1 : -1;
+    error = dx + dy;
+
+    while (1) {
+        setPixel(x0, y0, colour);
+        if (x0 == x1 && y0 == y1) {
+            break;
+        }
+
+        e2 = 2 * error;
+        if (e2 >= dy) {
+            error += dy;
+            x0 += sx;
+        }
+        if (e2 <= dx) {
+            error += dx;
+            y0 += sy;
+        }
+    }
+}
+
+
+void drawPoint(int x, int y){
+    setPixel(x, y, BLACK);
+}
+
+void clearPoint(int x, int y){
+    setPixel(x, y, WHITE);
+}
+
+
+void clearScreen(){
+    // Fill the whole screen with white, which makes every tile solid
+    fillRect(0, 0, frameBufferWidth, frameBufferHeight, WHITE);
+}
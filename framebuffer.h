@@ -1,5 +1,40 @@
+// Frame buffer settings returned by the firmware (see framebuffer.c).
+// frameBuffer is the canvas, which all the drawing functions draw on: the
+// pool of tile blocks (see canvas.c) that is the bottom layer of the
+// compositor (see compose.c), which copies it to screenBuffer, the frame
+// buffer the display shows. If the screen is too large to compose, the
+// canvas is the screen itself. The screen has
+// screenPages pages of frameBufferHeight rows one after the other; with two,
+// frames are composed into the page not on show (see present.c).
+extern unsigned int frameBufferWidth, frameBufferHeight, frameBufferPitch;
+extern unsigned int *frameBuffer;
+extern unsigned int *screenBuffer, screenPitch, screenPages;
+
+// The pen's colour and the canvas background
+#define BLACK       0x00000000
+#define WHITE       0x00FFFFFF
+
+// The address of the first pixel of row y, when the canvas is the screen.
+// Rows are frameBufferPitch bytes apart, which may be more than the
+// width. Only canvas.c uses it: the canvas is otherwise made of tile
+// blocks, and parts of it may be solid tiles whose pixels are stale, so
+// use canvasRead(), canvasWrite() and the like to access it.
+#define frameBufferRow(y) \
+    ((unsigned int *)((unsigned char *)frameBuffer + (y) * frameBufferPitch))
+
+// Added to the connectivity of floodFill() to fill up to a boundary of
+// the target colour, rather than over the target colour
+#define FILL_BOUNDARY  0x100
+
 void initFrameBuffer();
+void frameBufferReport();
 void drawPoint(int x, int y);
 void clearPoint(int x, int y);
 void clearScreen();
-void floodFill(int x, int y);
+unsigned int floodFill(int x, int y, unsigned int target, unsigned int colour,
+                       unsigned int tolerance, unsigned int connectivity);
+unsigned int getPixel(int x, int y);
+void setPixel(int x, int y, unsigned int colour);
+void fillSpan(int x0, int x1, int y, unsigned int colour);
+void fillRect(int x, int y, int width, int height, unsigned int colour);
+void drawLine(int x0, int y0, int x1, int y1, unsigned int colour);
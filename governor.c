@@ -0,0 +1,310 @@
+// The functions in this file manage the CPU clock. The firmware starts
+// the ARM cores below their maximum clock rate, so governor_init() asks
+// for the maximum ARM and core clock rates. The core clock also drives
+// the Mini UART, so its Baud rate divisor is recalculated to match.
+//
+// governor_update() is called once per frame. Every GOVERNOR_INTERVAL_US
+// it samples the SoC temperature with an asynchronous mailbox request,
+// and steps the ARM clock down as the temperature approaches the
+// firmware's limit, before the firmware throttles the clock hard on
+// its own. The clock is stepped back up once the SoC has cooled down.
+
+#include "uart.h"
+#include "kprintf.h"
+#include "mailbox.h"
+#include "mmu.h"
+#include "systimer.h"
+#include "governor.h"
+#include "trace.h"
+
+// Clock rates (in Hz) and temperatures (in thousandths of a degree C)
+static unsigned int armClock, armMinClock, armMaxClock;
+static unsigned int coreClock;
+static unsigned int maxTemperature;
+static volatile unsigned int temperature;
+
+// Time of the last temperature sample, and the tokens of the requests
+// in flight (-1 if there are none)
+static unsigned long lastSample;
+static int temperatureToken = -1;
+static int clockToken = -1;
+
+// Request buffers for the asynchronous requests. They must be quadword
+// aligned, since the channel is encoded in the low 4 bits of the address,
+// and uncached, like all mailbox buffers (see mailbox.c).
+static volatile unsigned int __attribute__((aligned(16))) MMU_UNCACHED temperatureBuffer[8];
+static volatile unsigned int __attribute__((aligned(16))) MMU_UNCACHED clockBuffer[12];
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       get_property
+//
+//  Arguments:      tag:         A property tag with an id/value pair
+//                  id:          The clock or sensor id
+//
+//  Returns:        The value returned by the firmware, or 0 on failure
+//
+//  Description:    This function makes a blocking mailbox query for a tag
+//                  that takes an id and returns a value, such as
+//                  TAG_GET_MAX_CLOCK_RATE or TAG_GET_MAX_TEMPERATURE.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned int get_property(unsigned int tag, unsigned int id)
+{
+    mailbox_buffer[0] = 8 * 4;
+    mailbox_buffer[1] = MAILBOX_REQUEST;
+
+    mailbox_buffer[2] = tag;
+    mailbox_buffer[3] = 8;
+    mailbox_buffer[4] = 0;
+    mailbox_buffer[5] = id;
+    mailbox_buffer[6] = 0;     // Response: value
+
+    mailbox_buffer[7] = TAG_LAST;
+
+    if (mailbox_query(CHANNEL_PROPERTY_TAGS_ARMTOVC)) {
+        return mailbox_buffer[6];
+    }
+
+    return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       set_clock
+//
+//  Arguments:      id:          The clock id (CLOCK_ARM, CLOCK_CORE, ...)
+//                  rate:        The requested rate in Hz
+//
+//  Returns:        The rate actually set by the firmware, or 0 on failure
+//
+//  Description:    This function makes a blocking mailbox query to change
+//                  the rate of a clock.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned int set_clock(unsigned int id, unsigned int rate)
+{
+    mailbox_buffer[0] = 9 * 4;
+    mailbox_buffer[1] = MAILBOX_REQUEST;
+
+    mailbox_buffer[2] = TAG_SET_CLOCK_RATE;
+    mailbox_buffer[3] = 12;
+    mailbox_buffer[4] = 0;
+    mailbox_buffer[5] = id;
+    mailbox_buffer[6] = rate;  // Response: rate actually set
+    mailbox_buffer[7] = 0;     // Do not skip setting turbo
+
+    mailbox_buffer[8] = TAG_LAST;
+
+    if (mailbox_query(CHANNEL_PROPERTY_TAGS_ARMTOVC)) {
+        return mailbox_buffer[6];
+    }
+
+    return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       governor_init
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function raises the ARM and core clocks to their
+//                  maximum rates, and recalculates the Mini UART Baud rate
+//                  divisor for the new core clock. It also reads the
+//                  temperature limit used by governor_update().
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void governor_init()
+{
+    unsigned int rate;
+
+    armMaxClock = get_property(TAG_GET_MAX_CLOCK_RATE, CLOCK_ARM);
+    armMinClock = get_property(TAG_GET_MIN_CLOCK_RATE, CLOCK_ARM);
+    maxTemperature = get_property(TAG_GET_MAX_TEMPERATURE, 0);
+
+    // Raise the ARM clock to its maximum
+    if (armMaxClock) {
+        armClock = set_clock(CLOCK_ARM, armMaxClock);
+    }
+
+    // Raise the core clock to its maximum. The Mini UART runs from this
+    // clock, so we let the transmitter drain first, and then set the
+    // Baud rate divisor for the rate the firmware actually chose.
+    rate = get_property(TAG_GET_MAX_CLOCK_RATE, CLOCK_CORE);
+    if (rate) {
+        uart_flush();
+        coreClock = set_clock(CLOCK_CORE, rate);
+        uart_set_clock(coreClock);
+    }
+
+    lastSample = get_timer_counter();
+
+    log_info("Governor: ARM clock %u Hz, core clock %u Hz\n",
+             armClock, coreClock);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       temperature_done
+//
+//  Arguments:      buffer:      The completed request buffer
+//                  success:     TRUE if the firmware gave a valid response
+//                  context:     Unused
+//
+//  Returns:        void
+//
+//  Description:    This is the mailbox completion callback for the
+//                  temperature sample. It runs in the mailbox interrupt.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void temperature_done(volatile unsigned int *buffer, int success,
+                             void *context)
+{
+    if (success) {
+        temperature = buffer[6];
+        trace(TRACE_TEMPERATURE, temperature, 0);
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       clock_done
+//
+//  Arguments:      buffer:      The completed request buffer
+//                  success:     TRUE if the firmware gave a valid response
+//                  context:     Unused
+//
+//  Returns:        void
+//
+//  Description:    This is the mailbox completion callback for an ARM clock
+//                  change. It records the rate the firmware actually set.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void clock_done(volatile unsigned int *buffer, int success, void *context)
+{
+    if (success && buffer[6]) {
+        armClock = buffer[6];
+        trace(TRACE_CLOCK_CHANGE, armClock, 0);
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       governor_update
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function is called once per frame. It acts on the
+//                  last temperature sample, stepping the ARM clock down if
+//                  the SoC is close to its temperature limit, or back up if
+//                  it has cooled down. Then, once every GOVERNOR_INTERVAL_US,
+//                  it starts the next temperature sample. Neither request
+//                  is waited for, so this never stalls the frame.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void governor_update()
+{
+    unsigned long now = get_timer_counter();
+    unsigned int target;
+
+    if (now - lastSample < GOVERNOR_INTERVAL_US || !maxTemperature) {
+        return;
+    }
+
+    // Skip this interval if the previous requests are still in flight
+    if (mailbox_poll(temperatureToken) == MAILBOX_PENDING ||
+        mailbox_poll(clockToken) == MAILBOX_PENDING) {
+        return;
+    }
+    lastSample = now;
+
+    // Choose the ARM clock rate for the last temperature sample
+    target = armClock;
+    if (temperature >= maxTemperature - GOVERNOR_HOT_MARGIN) {
+        if (armClock >= armMinClock + GOVERNOR_STEP) {
+            target = armClock - GOVERNOR_STEP;
+        } else {
+            target = armMinClock;
+        }
+    } else if (temperature && temperature < maxTemperature - GOVERNOR_COOL_MARGIN) {
+        if (armClock + GOVERNOR_STEP <= armMaxClock) {
+            target = armClock + GOVERNOR_STEP;
+        } else {
+            target = armMaxClock;
+        }
+    }
+
+    if (target && target != armClock) {
+        clockBuffer[0] = 9 * 4;
+        clockBuffer[1] = MAILBOX_REQUEST;
+        clockBuffer[2] = TAG_SET_CLOCK_RATE;
+        clockBuffer[3] = 12;
+        clockBuffer[4] = 0;
+        clockBuffer[5] = CLOCK_ARM;
+        clockBuffer[6] = target;
+        clockBuffer[7] = 0;
+        clockBuffer[8] = TAG_LAST;
+
+        clockToken = mailbox_submit(clockBuffer, CHANNEL_PROPERTY_TAGS_ARMTOVC,
+                                    clock_done, 0);
+    }
+
+    // Start the next temperature sample
+    temperatureBuffer[0] = 8 * 4;
+    temperatureBuffer[1] = MAILBOX_REQUEST;
+    temperatureBuffer[2] = TAG_GET_TEMPERATURE;
+    temperatureBuffer[3] = 8;
+    temperatureBuffer[4] = 0;
+    temperatureBuffer[5] = 0;
+    temperatureBuffer[6] = 0;
+    temperatureBuffer[7] = TAG_LAST;
+
+    temperatureToken = mailbox_submit(temperatureBuffer,
+                                      CHANNEL_PROPERTY_TAGS_ARMTOVC,
+                                      temperature_done, 0);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       governor_report
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes the current ARM clock rate and the
+//                  last temperature sample to the console terminal.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void governor_report()
+{
+    log_info("Governor: ARM clock %u Hz, temperature %u (limit %u)\n",
+             armClock, temperature, maxTemperature);
+}
@@ -0,0 +1,15 @@
+// How often the governor samples the SoC temperature, in microseconds
+#define GOVERNOR_INTERVAL_US   250000
+
+// The ARM clock is stepped down when the temperature comes within
+// GOVERNOR_HOT_MARGIN of the firmware's limit, and stepped back up once
+// it is more than GOVERNOR_COOL_MARGIN below it (in thousandths of a
+// degree Celsius). Each step changes the clock by GOVERNOR_STEP Hz.
+#define GOVERNOR_HOT_MARGIN    5000
+#define GOVERNOR_COOL_MARGIN   10000
+#define GOVERNOR_STEP          100000000
+
+// Function prototypes
+void governor_init();
+void governor_update();
+void governor_report();
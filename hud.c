@@ -0,0 +1,188 @@
+// The functions in this file draw a heads-up display: lines of text such
+// as the frame rate and the pen position, given afresh every frame
+// between hud_begin() and hud_end().
+//
+// The text is drawn on the overlay layer of the compositor, above the
+// canvas, so it never touches the drawing. hud_end() compares the
+// characters with the ones shown in the previous frame and only erases
+// and redraws those that changed, so text that stays the same costs
+// nothing to draw or to compose. Lines should not overlap.
+
+#include "compose.h"
+#include "font.h"
+#include "kprintf.h"
+#include "hud.h"
+
+// A character of the overlay
+struct hud_cell {
+    int x, y;
+    char c;
+};
+
+// The characters given this frame, and those on the overlay now
+static struct hud_cell cells[HUD_MAX_CHARS], shown[HUD_MAX_CHARS];
+static unsigned int cellCount, shownCount;
+
+// Statistics
+static unsigned int charsDrawn, charsCut;
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       hud_begin
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function starts the text of a new frame.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void hud_begin()
+{
+    cellCount = 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       hud_text
+//
+//  Arguments:      x, y:        The top left corner of the first character
+//                  text:        The text (one line)
+//
+//  Returns:        void
+//
+//  Description:    This function adds a line of text to the frame.
+//                  Characters not wholly on the screen, and those past the
+//                  HUD_MAX_CHARS of the frame, are left out.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void hud_text(int x, int y, const char *text)
+{
+    struct compose_layer *overlay = compose_layer(COMPOSE_LAYER_OVERLAY);
+
+    if (y < 0 || y + FONT_HEIGHT > (int)overlay->height) {
+        return;
+    }
+
+    for (; *text; text++, x += FONT_WIDTH) {
+        if (x < 0 || x + FONT_WIDTH > (int)overlay->width) {
+            continue;
+        }
+        if (cellCount == HUD_MAX_CHARS) {
+            charsCut++;
+            continue;
+        }
+
+        cells[cellCount].x = x;
+        cells[cellCount].y = y;
+        cells[cellCount].c = *text;
+        cellCount++;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       hud_printf
+//
+//  Arguments:      x, y:        The top left corner of the first character
+//                  format:      A kprintf() format string, for one line
+//                  ...:         Its arguments
+//
+//  Returns:        void
+//
+//  Description:    This function formats a line of text (cut at
+//                  HUD_LINE_SIZE - 1 characters) and adds it to the frame.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void hud_printf(int x, int y, const char *format, ...)
+{
+    char line[HUD_LINE_SIZE];
+    __builtin_va_list args;
+
+    __builtin_va_start(args, format);
+    kvsnprintf(line, sizeof(line), format, args);
+    __builtin_va_end(args);
+
+    hud_text(x, y, line);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       hud_end
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function updates the overlay to the text of the
+//                  frame: first it erases the characters that changed or
+//                  went away, then it draws the new ones.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void hud_end()
+{
+    struct compose_layer *overlay = compose_layer(COMPOSE_LAYER_OVERLAY);
+    unsigned int *row, i, j, k;
+
+    for (i = 0; i < shownCount; i++) {
+        if (i < cellCount && cells[i].x == shown[i].x &&
+            cells[i].y == shown[i].y && cells[i].c == shown[i].c) {
+            continue;
+        }
+        for (j = 0; j < FONT_HEIGHT; j++) {
+            row = overlay->pixels + (shown[i].y + j) * overlay->width + shown[i].x;
+            for (k = 0; k < FONT_WIDTH; k++) {
+                row[k] = COMPOSE_TRANSPARENT;
+            }
+        }
+        compose_damage_layer(COMPOSE_LAYER_OVERLAY, shown[i].x, shown[i].y,
+                             FONT_WIDTH, FONT_HEIGHT);
+    }
+
+    for (i = 0; i < cellCount; i++) {
+        if (i < shownCount && cells[i].x == shown[i].x &&
+            cells[i].y == shown[i].y && cells[i].c == shown[i].c) {
+            continue;
+        }
+        drawChar(overlay, cells[i].x, cells[i].y, cells[i].c,
+                 HUD_COLOUR, HUD_BACKGROUND);
+        compose_damage_layer(COMPOSE_LAYER_OVERLAY, cells[i].x, cells[i].y,
+                             FONT_WIDTH, FONT_HEIGHT);
+        charsDrawn++;
+        shown[i] = cells[i];
+    }
+    shownCount = cellCount;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       hud_report
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes the overlay statistics to the
+//                  console terminal.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void hud_report()
+{
+    log_info("HUD: %u characters drawn, %u cut\n", charsDrawn, charsCut);
+}
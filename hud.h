@@ -0,0 +1,20 @@
+// Most characters the overlay shows per frame. Characters that change
+// cost a glyph erase and a glyph draw each in the overlay layer, so this
+// bounds the time the overlay takes per frame. Text past the limit is
+// cut.
+#define HUD_MAX_CHARS               128
+
+// Longest line hud_printf() formats
+#define HUD_LINE_SIZE               64
+
+// Overlay colours
+#define HUD_COLOUR                  0x00FFFF00
+#define HUD_BACKGROUND              0x00000000
+
+// Function prototypes
+void hud_begin();
+void hud_text(int x, int y, const char *text);
+void hud_printf(int x, int y, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+void hud_end();
+void hud_report();
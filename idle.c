@@ -0,0 +1,188 @@
+// The functions in this file let a core sleep while it waits, instead of
+// spinning at full power. idle_wait_interrupt() executes wfi, which
+// sleeps until an interrupt is pending. idle_wait_event() executes wfe,
+// which sleeps until an event arrives. The generic timer event stream
+// is enabled so that an event arrives every ~10 microseconds, which lets
+// polling loops on peripherals without interrupts (such as the UART
+// transmitter) sleep between polls.
+//
+// The time spent sleeping is accumulated per core, so the idle fraction
+// of each core can be reported.
+
+#include "uart.h"
+#include "kprintf.h"
+#include "irq.h"
+#include "systimer.h"
+#include "idle.h"
+
+// Period of the generic timer event stream, in microseconds
+#define EVENT_STREAM_US   10
+
+// Bits of the CNTKCTL_EL1 register
+#define CNTKCTL_EVNTEN    (0x1 << 2)
+#define CNTKCTL_EVNTI(n)  ((n) << 4)
+
+// Ticks each core has spent in wfi or wfe, and the totals at the last
+// report
+static volatile unsigned long idleTicks[4];
+static unsigned long reportIdle[4], reportTime;
+
+// TRUE once the event stream is running on a core. Until then wfe could
+// sleep forever, so idle_wait_event() returns at once.
+static int eventStream[4];
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       idle_init
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function enables the generic timer event stream on
+//                  the calling core. An event is generated every time the
+//                  selected counter bit changes from 0 to 1, that is every
+//                  2^(n+1) ticks, and n is chosen so that this is about
+//                  EVENT_STREAM_US. timer_init() must be called first.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void idle_init()
+{
+    unsigned long ticks = us_to_ticks(EVENT_STREAM_US);
+    unsigned long control;
+    unsigned int n = 0;
+
+    while (n < 15 && (2UL << (n + 1)) <= ticks) {
+        n++;
+    }
+
+    asm volatile("mrs %0, cntkctl_el1" : "=r"(control));
+    control &= ~(0xFUL << 4);
+    control |= CNTKCTL_EVNTEN | CNTKCTL_EVNTI(n);
+    asm volatile("msr cntkctl_el1, %0" :: "r"(control));
+    eventStream[get_core_id()] = 1;
+
+    if (get_core_id() == 0) {
+        reportTime = timer_ticks();
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       idle_wait_event
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function sleeps the calling core until the next
+//                  event: an event stream tick, a sev from another core, or
+//                  an interrupt. Polling loops call it between polls.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void idle_wait_event()
+{
+    unsigned int core = get_core_id();
+    unsigned long start;
+
+    if (!eventStream[core]) {
+        return;
+    }
+
+    start = timer_ticks();
+    asm volatile("wfe" ::: "memory");
+    idleTicks[core] += timer_ticks() - start;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       idle_wait_interrupt
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function sleeps the calling core until an interrupt
+//                  is pending. This also works with IRQs masked: the core
+//                  wakes up, and the interrupt is taken once the caller
+//                  unmasks IRQs again. The caller must make sure that the
+//                  interrupt it waits for is enabled.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void idle_wait_interrupt()
+{
+    unsigned long start = timer_ticks();
+
+    asm volatile("dsb sy; wfi" ::: "memory");
+
+    idleTicks[get_core_id()] += timer_ticks() - start;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       idle_ticks
+//
+//  Arguments:      core:        The core number (0 - 3)
+//
+//  Returns:        The number of ticks the core has spent asleep
+//
+//  Description:    This function returns the idle time accounting counter
+//                  of a core.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned long idle_ticks(unsigned int core)
+{
+    return idleTicks[core & 0x3];
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       idle_report
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes the percentage of time each core
+//                  spent asleep since the last report to the console.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void idle_report()
+{
+    unsigned long now = timer_ticks();
+    unsigned long elapsed = now - reportTime;
+    unsigned long idle;
+    unsigned int percent[4];
+    int i;
+
+    if (elapsed == 0) {
+        return;
+    }
+
+    for (i = 0; i < 4; i++) {
+        idle = idleTicks[i] - reportIdle[i];
+        reportIdle[i] += idle;
+        percent[i] = idle * 100 / elapsed;
+    }
+
+    log_info("Idle %%: %u %u %u %u\n",
+             percent[0], percent[1], percent[2], percent[3]);
+
+    reportTime = now;
+}
@@ -0,0 +1,10 @@
+// Delays shorter than this (in microseconds) spin instead of waiting for
+// events, since an event stream wake-up could overshoot them
+#define IDLE_SPIN_THRESHOLD_US  20
+
+// Function prototypes
+void idle_init();
+void idle_wait_event();
+void idle_wait_interrupt();
+unsigned long idle_ticks(unsigned int core);
+void idle_report();
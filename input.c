@@ -0,0 +1,441 @@
+// The functions in this file record the SNES controller's buttons frame by
+// frame, and play a recording back in place of the controller, so that a
+// session can be run again exactly, on the Pi or under QEMU, to measure
+// it. The main loop passes the buttons it reads to input_next() and uses
+// what it returns.
+//
+// A recording only stores the frames where the buttons change, and how
+// long each state was held (see input.h), so a long drag costs a few
+// bytes. It is kept in RAM, and is sent to the host or loaded from it with
+// COMMAND_FRAME_INPUT requests; tools/input.py drives them.
+//
+// Replays are deterministic as long as nothing else draws: drawing
+// commands, restores and pen moves from the host are not recorded.
+
+#include "uart.h"
+#include "systimer.h"
+#include "kprintf.h"
+#include "command.h"
+#include "input.h"
+
+// What input_next() does with the buttons
+#define INPUT_IDLE                  0
+#define INPUT_RECORDING             1
+#define INPUT_REPLAYING             2
+
+// The longest change entry: a 5-byte frame count and 2 bytes of changes
+#define INPUT_MAX_ENTRY             7
+
+// The recording, and its length in bytes
+static unsigned char recording[INPUT_BUFFER_SIZE];
+static unsigned int recordingLength;
+
+// The session in progress, and the one to start at the next frame
+static unsigned int mode, pending;
+static int started;
+
+// The button state, the frames it has been held (recording) or is still to
+// be held (replay), where the next entry is read, and the frames so far
+static unsigned int state, held, position, frames;
+static unsigned long sessionStart;
+
+// The recording being sent to the host
+static int exporting;
+static unsigned int exportNext, exportSequence;
+static unsigned char chunk[INPUT_DATA_HEADER_SIZE + INPUT_CHUNK_SIZE];
+
+// Statistics
+static unsigned int recordings, replays, overflows;
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       get32
+//
+//  Arguments:      p:           A pointer to four bytes
+//
+//  Returns:        The little-endian 32-bit value at p
+//
+//  Description:    This function reads an unaligned 32-bit value.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned int get32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       put32
+//
+//  Arguments:      p:           Where to store the value
+//                  value:       The 32-bit value
+//
+//  Returns:        void
+//
+//  Description:    This function stores a little-endian 32-bit value.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline void put32(unsigned char *p, unsigned int value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       append_change
+//
+//  Arguments:      count:       The frames the old state was held
+//                  changed:     The buttons that changed, or 0 to end the
+//                               recording
+//
+//  Returns:        void
+//
+//  Description:    This function adds an entry to the recording. The
+//                  caller makes sure it fits.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void append_change(unsigned int count, unsigned int changed)
+{
+    while (count >= 0x80) {
+        recording[recordingLength++] = (count & 0x7F) | 0x80;
+        count >>= 7;
+    }
+    recording[recordingLength++] = count;
+    recording[recordingLength++] = changed;
+    recording[recordingLength++] = changed >> 8;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       read_count
+//
+//  Arguments:      count:       Where to store the frame count
+//
+//  Returns:        TRUE if a whole frame count was read
+//
+//  Description:    This function reads the frame count of the next entry
+//                  of the recording being replayed.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int read_count(unsigned int *count)
+{
+    unsigned int value = 0, shift = 0, byte;
+
+    do {
+        if (position == recordingLength || shift > 28) {
+            return 0;
+        }
+        byte = recording[position++];
+        value |= (byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    *count = value;
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       stop
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function ends the session in progress, and any
+//                  that was about to start. A recording is ended with the
+//                  frames its last state was held for; a replay reports
+//                  how long it took.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void stop()
+{
+    if (mode == INPUT_RECORDING) {
+        append_change(held, 0);
+        log_info("Input: recorded %u frames in %u bytes\n", frames,
+                 recordingLength);
+    } else if (mode == INPUT_REPLAYING) {
+        log_info("Input: replayed %u frames in %u ms\n", frames,
+                 (unsigned int)(ticks_to_us(timer_ticks() - sessionStart) / 1000));
+    }
+
+    mode = INPUT_IDLE;
+    pending = INPUT_IDLE;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       input_control
+//
+//  Arguments:      request:     The request payload (see input.h)
+//                  length:      The payload length
+//
+//  Returns:        COMMAND_OK, or COMMAND_BAD_COMMAND if the request is
+//                  malformed or a loaded part does not follow on from the
+//                  last one or does not fit
+//
+//  Description:    This function starts or stops recording or replaying,
+//                  starts sending the recording to the host, or stores
+//                  part of a recording from the host. Anything but a stop
+//                  ends the session in progress first, and a new session
+//                  or load also cancels an export in progress.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int input_control(const unsigned char *request, unsigned int length)
+{
+    unsigned int offset, i;
+
+    if (length < 1) {
+        return COMMAND_BAD_COMMAND;
+    }
+
+    switch (request[0]) {
+    case INPUT_STOP:
+        stop();
+        break;
+
+    case INPUT_RECORD:
+    case INPUT_REPLAY:
+        stop();
+        exporting = 0;
+        pending = (request[0] == INPUT_RECORD) ? INPUT_RECORDING : INPUT_REPLAYING;
+        break;
+
+    case INPUT_EXPORT:
+        stop();
+        exportNext = 0;
+        exporting = 1;
+        break;
+
+    case INPUT_LOAD:
+        if (length < INPUT_LOAD_HEADER_SIZE) {
+            return COMMAND_BAD_COMMAND;
+        }
+        offset = get32(request + 1);
+        length -= INPUT_LOAD_HEADER_SIZE;
+        if ((offset != 0 && offset != recordingLength) ||
+            length > INPUT_BUFFER_SIZE - offset) {
+            return COMMAND_BAD_COMMAND;
+        }
+
+        stop();
+        exporting = 0;
+        for (i = 0; i < length; i++) {
+            recording[offset + i] = request[INPUT_LOAD_HEADER_SIZE + i];
+        }
+        recordingLength = offset + length;
+        break;
+
+    default:
+        return COMMAND_BAD_COMMAND;
+    }
+
+    return COMMAND_OK;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       input_next
+//
+//  Arguments:      buttons:     The buttons read from the controller this
+//                               frame (bit n set if button n is pressed)
+//
+//  Returns:        The buttons to act on this frame
+//
+//  Description:    This function is called once per frame with the
+//                  controller's buttons. While recording, it adds them to
+//                  the recording; while replaying, it returns the
+//                  recorded buttons instead, until the recording ends.
+//                  A recording that fills the buffer is ended there.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int input_next(unsigned int buttons)
+{
+    unsigned int changed;
+
+    buttons &= 0xFFFF;
+    started = 0;
+
+    if (pending != INPUT_IDLE) {
+        mode = pending;
+        pending = INPUT_IDLE;
+        started = 1;
+        state = 0;
+        held = 0;
+        position = 0;
+        frames = 0;
+        sessionStart = timer_ticks();
+
+        if (mode == INPUT_RECORDING) {
+            recordingLength = 0;
+            recordings++;
+        } else {
+            replays++;
+            if (!read_count(&held)) {
+                stop();
+                return buttons;
+            }
+        }
+    }
+
+    if (mode == INPUT_RECORDING) {
+        if (buttons != state) {
+            // Leave room for this entry and the one that ends the recording
+            if (recordingLength + 2 * INPUT_MAX_ENTRY > INPUT_BUFFER_SIZE) {
+                overflows++;
+                log_warn("Input: recording full\n");
+                stop();
+                return buttons;
+            }
+            append_change(held, state ^ buttons);
+            state = buttons;
+            held = 0;
+        }
+        held++;
+        frames++;
+        return buttons;
+    }
+
+    if (mode == INPUT_REPLAYING) {
+        while (held == 0) {
+            if (recordingLength - position < 2) {
+                stop();
+                return buttons;
+            }
+            changed = recording[position] | (recording[position + 1] << 8);
+            position += 2;
+            if (changed == 0 || !read_count(&held)) {
+                stop();
+                return buttons;
+            }
+            state ^= changed;
+        }
+        held--;
+        frames++;
+        return state;
+    }
+
+    return buttons;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       input_started
+//
+//  Arguments:      none
+//
+//  Returns:        TRUE if a recording or replay started this frame
+//
+//  Description:    This function tells the main loop to put the canvas,
+//                  the undo journal and the pen back in their initial
+//                  state, after calling input_next().
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int input_started()
+{
+    return started;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       input_update
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function is called once per frame. It sends the
+//                  next chunk of a recording being exported, if it fits in
+//                  the UART transmit ring, so it never waits for the UART.
+//                  An empty recording is sent as one empty chunk.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void input_update()
+{
+    unsigned int count, i;
+
+    if (!exporting ||
+        uart_tx_space() < COMMAND_HEADER_SIZE + sizeof(chunk) + 4) {
+        return;
+    }
+
+    // Stop if the recording has been cut short under the export (only an
+    // empty recording is sent from where it ends)
+    if (exportNext > recordingLength || (exportNext == recordingLength && exportNext)) {
+        exporting = 0;
+        return;
+    }
+
+    count = recordingLength - exportNext;
+    if (count > INPUT_CHUNK_SIZE) {
+        count = INPUT_CHUNK_SIZE;
+    }
+
+    put32(chunk, exportNext);
+    put32(chunk + 4, recordingLength);
+    for (i = 0; i < count; i++) {
+        chunk[INPUT_DATA_HEADER_SIZE + i] = recording[exportNext + i];
+    }
+    command_send_frame(COMMAND_FRAME_INPUT_DATA, exportSequence++,
+                       chunk, INPUT_DATA_HEADER_SIZE + count);
+
+    exportNext += count;
+    if (exportNext == recordingLength) {
+        exporting = 0;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       input_report
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes the recorder's state and
+//                  statistics to the console terminal.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void input_report()
+{
+    static const char *const modes[] = { "idle", "recording", "replaying" };
+
+    log_info("Input: %s, %u frames, recording %u bytes, %u recordings "
+             "%u replays %u overflows\n", modes[mode], frames,
+             recordingLength, recordings, replays, overflows);
+}
@@ -0,0 +1,50 @@
+// Bytes of recorded input held in RAM. A change of the buttons takes 3
+// bytes, and holding them steady for up to 127 frames costs nothing more,
+// so this holds over 20000 presses and releases.
+#define INPUT_BUFFER_SIZE           65536
+
+// Input control request payload (all values little-endian), sent by the
+// host in COMMAND_FRAME_INPUT frames:
+//
+//     action          1 byte, INPUT_*
+//     offset          4 bytes, INPUT_LOAD only: where the data goes in the
+//                     recording (0 starts a new one)
+//     data            INPUT_LOAD only: bytes of a recording
+//
+// RECORD and REPLAY start at the next frame, and both first reset the
+// canvas, the undo journal and the pen, so that a replay starts from the
+// same state the recording did.
+#define INPUT_STOP                  0   // Stop recording or replaying
+#define INPUT_RECORD                1   // Record the buttons
+#define INPUT_REPLAY                2   // Use the recording instead of the
+                                        // controller until it ends
+#define INPUT_EXPORT                3   // Send the recording to the host
+#define INPUT_LOAD                  4   // Store part of a recording
+#define INPUT_LOAD_HEADER_SIZE      5
+
+// A recording is a list of changes of the 16-bit button state, which
+// starts out as 0 (no buttons pressed). Each change is:
+//
+//     frames          the number of frames the state before it was held,
+//                     as an unsigned LEB128 number (7 bits per byte, low
+//                     bits first, top bit set on all but the last byte)
+//     changed         2 bytes, the buttons that changed (the old state XOR
+//                     the new one)
+//
+// The last entry has changed 0 and ends the recording.
+//
+// Recording data payload, sent by the Pi in COMMAND_FRAME_INPUT_DATA
+// frames:
+//
+//     offset          4 bytes, of the data in the recording
+//     length          4 bytes, of the whole recording
+//     data            at most INPUT_CHUNK_SIZE bytes of the recording
+#define INPUT_DATA_HEADER_SIZE      8
+#define INPUT_CHUNK_SIZE            1024
+
+// Function prototypes
+unsigned int input_control(const unsigned char *request, unsigned int length);
+unsigned int input_next(unsigned int buttons);
+int input_started();
+void input_update();
+void input_report();
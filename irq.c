@@ -0,0 +1,386 @@
+// The functions in this file set up and dispatch interrupts. The
+// exception vector table in vectors.s saves the interrupted context
+// and calls irq_handler(), which finds the pending interrupt sources
+// and calls the handler registered for each of them.
+
+#include "gpio.h"
+#include "uart.h"
+#include "irq.h"
+
+// The addresses of the ARM interrupt controller registers.
+//
+// These are defined on page 112 of the Broadcom BCM2837 ARM Peripherals
+// Manual. Note that we specify the ARM physical addresses of the
+// peripherals, which have the address range 0x3F000000 to 0x3FFFFFFF.
+#define IRQ_BASIC_PENDING   ((volatile unsigned int *)(MMIO_BASE + 0x0000B200))
+#define IRQ_PENDING_1       ((volatile unsigned int *)(MMIO_BASE + 0x0000B204))
+#define IRQ_PENDING_2       ((volatile unsigned int *)(MMIO_BASE + 0x0000B208))
+#define FIQ_CONTROL         ((volatile unsigned int *)(MMIO_BASE + 0x0000B20C))
+#define ENABLE_IRQS_1       ((volatile unsigned int *)(MMIO_BASE + 0x0000B210))
+#define ENABLE_IRQS_2       ((volatile unsigned int *)(MMIO_BASE + 0x0000B214))
+#define ENABLE_BASIC_IRQS   ((volatile unsigned int *)(MMIO_BASE + 0x0000B218))
+#define DISABLE_IRQS_1      ((volatile unsigned int *)(MMIO_BASE + 0x0000B21C))
+#define DISABLE_IRQS_2      ((volatile unsigned int *)(MMIO_BASE + 0x0000B220))
+#define DISABLE_BASIC_IRQS  ((volatile unsigned int *)(MMIO_BASE + 0x0000B224))
+
+// The addresses of the BCM2836/7 local peripheral registers. These are
+// per-core, and are described in the "ARM Quad A7 core" document (QA7).
+#define LOCAL_BASE          0x40000000UL
+#define CORE_TIMER_IRQCNTL(core) \
+    ((volatile unsigned int *)(LOCAL_BASE + 0x40 + 4 * (core)))
+#define CORE_IRQ_SOURCE(core) \
+    ((volatile unsigned int *)(LOCAL_BASE + 0x60 + 4 * (core)))
+
+// Bit 8 of the core IRQ source register is set when a GPU interrupt
+// is pending (these are routed to core 0)
+#define CORE_IRQ_SOURCE_GPU  (0x1 << 8)
+
+
+// The handler registered for each interrupt source
+static void (*irq_handlers[IRQ_COUNT])(void);
+
+// The GPU and basic interrupts that are currently enabled. The pending
+// registers are masked with these before dispatching.
+static unsigned int enabled_irqs_1, enabled_irqs_2, enabled_basic_irqs;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       irq_init
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function disables all interrupt sources in the ARM
+//                  interrupt controller and in the local peripherals block,
+//                  and clears the handler table. Interrupts remain masked
+//                  on the CPU until enable_interrupts() is called.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void irq_init()
+{
+    int i;
+
+    // Mask IRQs on this core while we reconfigure the controller
+    disable_interrupts();
+
+    // Disable every GPU and basic interrupt, and make sure that no
+    // interrupt is routed to the FIQ line
+    *DISABLE_IRQS_1 = 0xFFFFFFFF;
+    *DISABLE_IRQS_2 = 0xFFFFFFFF;
+    *DISABLE_BASIC_IRQS = 0xFFFFFFFF;
+    *FIQ_CONTROL = 0;
+    enabled_irqs_1 = enabled_irqs_2 = enabled_basic_irqs = 0;
+
+    // Disable the per-core timer interrupts for all four cores
+    for (i = 0; i < 4; i++) {
+        *CORE_TIMER_IRQCNTL(i) = 0;
+    }
+
+    // No handlers are registered yet
+    for (i = 0; i < IRQ_COUNT; i++) {
+        irq_handlers[i] = 0;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       irq_register
+//
+//  Arguments:      source:      The interrupt source number (see irq.h)
+//                  handler:     The function to call when the source
+//                               interrupts
+//
+//  Returns:        void
+//
+//  Description:    This function records the handler for an interrupt
+//                  source. The handler runs with IRQs masked, and must
+//                  clear the interrupt condition in its peripheral.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void irq_register(unsigned int source, void (*handler)(void))
+{
+    if (source < IRQ_COUNT) {
+        irq_handlers[source] = handler;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       irq_enable
+//
+//  Arguments:      source:      The interrupt source number (see irq.h)
+//
+//  Returns:        void
+//
+//  Description:    This function enables an interrupt source in the ARM
+//                  interrupt controller. Local (per-core) sources are
+//                  enabled for the calling core.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void irq_enable(unsigned int source)
+{
+    unsigned long flags = irq_save();
+
+    if (source < 32) {
+        enabled_irqs_1 |= (0x1 << source);
+        *ENABLE_IRQS_1 = (0x1 << source);
+    } else if (source < IRQ_BASIC_BASE) {
+        enabled_irqs_2 |= (0x1 << (source - 32));
+        *ENABLE_IRQS_2 = (0x1 << (source - 32));
+    } else if (source < IRQ_LOCAL_BASE) {
+        enabled_basic_irqs |= (0x1 << (source - IRQ_BASIC_BASE));
+        *ENABLE_BASIC_IRQS = (0x1 << (source - IRQ_BASIC_BASE));
+    } else if (source < IRQ_LOCAL_BASE + 4) {
+        // The four generic timer interrupts are enabled in the core
+        // timer interrupt control register (bits 0 - 3)
+        *CORE_TIMER_IRQCNTL(get_core_id()) |= (0x1 << (source - IRQ_LOCAL_BASE));
+    }
+
+    irq_restore(flags);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       irq_disable
+//
+//  Arguments:      source:      The interrupt source number (see irq.h)
+//
+//  Returns:        void
+//
+//  Description:    This function disables an interrupt source in the ARM
+//                  interrupt controller.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void irq_disable(unsigned int source)
+{
+    unsigned long flags = irq_save();
+
+    if (source < 32) {
+        enabled_irqs_1 &= ~(0x1 << source);
+        *DISABLE_IRQS_1 = (0x1 << source);
+    } else if (source < IRQ_BASIC_BASE) {
+        enabled_irqs_2 &= ~(0x1 << (source - 32));
+        *DISABLE_IRQS_2 = (0x1 << (source - 32));
+    } else if (source < IRQ_LOCAL_BASE) {
+        enabled_basic_irqs &= ~(0x1 << (source - IRQ_BASIC_BASE));
+        *DISABLE_BASIC_IRQS = (0x1 << (source - IRQ_BASIC_BASE));
+    } else if (source < IRQ_LOCAL_BASE + 4) {
+        *CORE_TIMER_IRQCNTL(get_core_id()) &= ~(0x1 << (source - IRQ_LOCAL_BASE));
+    }
+
+    irq_restore(flags);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       dispatch
+//
+//  Arguments:      base:        The source number of bit 0 in pending
+//                  pending:     A bit mask of pending interrupt sources
+//
+//  Returns:        void
+//
+//  Description:    This function calls the registered handler for each
+//                  bit set in the pending mask, lowest bit first.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void dispatch(unsigned int base, unsigned int pending)
+{
+    unsigned int bit;
+
+    while (pending) {
+        bit = __builtin_ctz(pending);
+        pending &= pending - 1;
+
+        if (irq_handlers[base + bit]) {
+            irq_handlers[base + bit]();
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       irq_handler
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function is called from the IRQ vector (vectors.s)
+//                  with the interrupted context already saved. It reads the
+//                  core's local interrupt source register, and dispatches
+//                  local and GPU interrupts to their handlers.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void irq_handler()
+{
+    unsigned int source = *CORE_IRQ_SOURCE(get_core_id());
+
+    // Dispatch the local sources, except the GPU interrupt bit
+    dispatch(IRQ_LOCAL_BASE, source & ~CORE_IRQ_SOURCE_GPU & 0xFFF);
+
+    // Dispatch the GPU and basic interrupts, if one of them is pending.
+    // We read both pending registers instead of relying on the bits 8
+    // and 9 of the basic pending register, since some GPU interrupts
+    // only appear there as "shortcut" bits.
+    if (source & CORE_IRQ_SOURCE_GPU) {
+        dispatch(IRQ_BASIC_BASE, *IRQ_BASIC_PENDING & enabled_basic_irqs & 0xFF);
+        dispatch(IRQ_GPU_BASE, *IRQ_PENDING_1 & enabled_irqs_1);
+        dispatch(IRQ_GPU_BASE + 32, *IRQ_PENDING_2 & enabled_irqs_2);
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       exception_handler
+//
+//  Arguments:      type:        The vector table entry number (0 - 15)
+//                  esr:         The exception syndrome register
+//                  elr:         The exception link register
+//                  far:         The fault address register
+//
+//  Returns:        Never returns
+//
+//  Description:    This function is called from the vector table for every
+//                  exception other than an IRQ. These are unrecoverable, so
+//                  the registers are reported over the UART and the core
+//                  is halted.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void exception_handler(unsigned long type, unsigned long esr,
+                       unsigned long elr, unsigned long far)
+{
+    uart_puts("\nUnhandled exception: type 0x");
+    uart_puthex(type);
+    uart_puts(" ESR 0x");
+    uart_puthex(esr);
+    uart_puts(" ELR 0x");
+    uart_puthex(elr >> 32);
+    uart_puthex(elr);
+    uart_puts(" FAR 0x");
+    uart_puthex(far >> 32);
+    uart_puthex(far);
+    uart_puts("\n");
+
+    // Halt this core
+    while (1) {
+        asm volatile("wfe");
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       enable_interrupts / disable_interrupts
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    These functions unmask and mask IRQs on the calling core
+//                  by clearing or setting the I bit in the DAIF register.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void enable_interrupts()
+{
+    asm volatile("msr daifclr, #2" ::: "memory");
+}
+
+void disable_interrupts()
+{
+    asm volatile("msr daifset, #2" ::: "memory");
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       irq_save
+//
+//  Arguments:      none
+//
+//  Returns:        The previous contents of the DAIF register
+//
+//  Description:    This function masks IRQs on the calling core and returns
+//                  the previous mask state, so that a critical section can
+//                  be nested inside code that may already have IRQs masked.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned long irq_save()
+{
+    unsigned long flags;
+
+    asm volatile("mrs %0, daif" : "=r"(flags));
+    asm volatile("msr daifset, #2" ::: "memory");
+
+    return flags;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       irq_restore
+//
+//  Arguments:      flags:       The value returned by irq_save()
+//
+//  Returns:        void
+//
+//  Description:    This function restores the IRQ mask state saved by
+//                  irq_save().
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void irq_restore(unsigned long flags)
+{
+    asm volatile("msr daif, %0" :: "r"(flags) : "memory");
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       get_core_id
+//
+//  Arguments:      none
+//
+//  Returns:        The number (0 - 3) of the calling CPU core
+//
+//  Description:    This function reads the rightmost 2 bits of the
+//                  multiprocessor affinity register.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int get_core_id()
+{
+    unsigned long mpidr;
+
+    asm volatile("mrs %0, mpidr_el1" : "=r"(mpidr));
+
+    return mpidr & 0x3;
+}
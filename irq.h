@@ -0,0 +1,28 @@
+// Interrupt source numbers used with irq_register() and irq_enable().
+//
+// Sources 0 - 63 are the GPU peripheral interrupts (IRQ pending
+// registers 1 and 2), sources 64 - 71 are the ARM specific interrupts
+// in the basic pending register, and sources 72 - 83 are the per-core
+// interrupts of the BCM2836/7 local peripherals block.
+#define IRQ_GPU_BASE                    0
+#define IRQ_BASIC_BASE                  64
+#define IRQ_LOCAL_BASE                  72
+#define IRQ_COUNT                       84
+
+#define IRQ_AUX                         (IRQ_GPU_BASE + 29)
+#define IRQ_GPIO0                       (IRQ_GPU_BASE + 49)
+#define IRQ_ARM_TIMER                   (IRQ_BASIC_BASE + 0)
+#define IRQ_ARM_MAILBOX                 (IRQ_BASIC_BASE + 1)
+#define IRQ_LOCAL_CNTPNS                (IRQ_LOCAL_BASE + 1)
+#define IRQ_LOCAL_CNTV                  (IRQ_LOCAL_BASE + 3)
+
+// Function prototypes
+void irq_init();
+void irq_register(unsigned int source, void (*handler)(void));
+void irq_enable(unsigned int source);
+void irq_disable(unsigned int source);
+void enable_interrupts();
+void disable_interrupts();
+unsigned long irq_save();
+void irq_restore(unsigned long flags);
+unsigned int get_core_id();
@@ -0,0 +1,388 @@
+// The functions in this file implement formatted output. kprintf() renders
+// the whole message into a buffer on the stack, and then hands it to the
+// UART with a single uart_write() call, instead of a chain of uart_puts()
+// and uart_puthex() calls. Numbers are converted with lookup tables: hex
+// digits come from a 16-entry table, and decimal numbers are converted
+// two digits at a time using a 100-entry table of digit pairs.
+//
+// The supported conversions are %c, %s, %d, %i, %u, %x, %X, %p and %%,
+// with the '-' and '0' flags, a field width, and the 'l' length modifier.
+
+#include "uart.h"
+#include "kprintf.h"
+
+// Digit lookup tables
+static const char hexDigits[] = "0123456789abcdef";
+static const char hexDigitsUpper[] = "0123456789ABCDEF";
+static const char decimalPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// The output buffer being formatted into. If crlf is TRUE, each newline
+// is preceded by a carriage return, as uart_puts() does.
+struct output {
+    char *buffer;
+    unsigned int length;
+    unsigned int size;
+    int crlf;
+};
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       put
+//
+//  Arguments:      out:         The output buffer
+//                  c:           The character to append
+//
+//  Returns:        void
+//
+//  Description:    This function appends a character to the output buffer,
+//                  always leaving room for the terminating null character.
+//                  A '\r' is only put before a newline if both fit, so a
+//                  full buffer still ends its last line.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline void put(struct output *out, char c)
+{
+    if (c == '\n' && out->crlf && out->length + 2 < out->size) {
+        out->buffer[out->length++] = '\r';
+    }
+
+    if (out->length + 1 < out->size) {
+        out->buffer[out->length++] = c;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       convert
+//
+//  Arguments:      end:         Points just past a scratch buffer of at
+//                               least 24 characters
+//                  value:       The number to convert
+//                  base:        10 or 16
+//                  digits:      The hex digit table to use
+//
+//  Returns:        A pointer to the first digit
+//
+//  Description:    This function writes the digits of a number backwards,
+//                  ending at end. Hex numbers take one table lookup per
+//                  digit; decimal numbers take one division and one table
+//                  lookup per pair of digits.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static char *convert(char *end, unsigned long value, int base, const char *digits)
+{
+    char *p = end;
+    unsigned long q;
+    unsigned int r;
+
+    if (base == 16) {
+        do {
+            *--p = digits[value & 0xF];
+            value >>= 4;
+        } while (value);
+        return p;
+    }
+
+    while (value >= 100) {
+        q = value / 100;
+        r = (value - q * 100) * 2;
+        *--p = decimalPairs[r + 1];
+        *--p = decimalPairs[r];
+        value = q;
+    }
+
+    if (value >= 10) {
+        r = value * 2;
+        *--p = decimalPairs[r + 1];
+        *--p = decimalPairs[r];
+    } else {
+        *--p = '0' + value;
+    }
+
+    return p;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       render
+//
+//  Arguments:      out:         The output buffer
+//                  format:      The format string
+//                  args:        The arguments
+//
+//  Returns:        void
+//
+//  Description:    This function does the formatting for kprintf(),
+//                  ksnprintf() and kvsnprintf().
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void render(struct output *out, const char *format, __builtin_va_list args)
+{
+    char scratch[24];
+    char *end = scratch + sizeof(scratch);
+    const char *digits;
+    char *s;
+    char sign;
+    int leftAlign, zeroPad, width, isLong, length, base;
+    unsigned long value;
+    long signedValue;
+
+    while (*format) {
+        if (*format != '%') {
+            put(out, *format++);
+            continue;
+        }
+        format++;
+
+        // Flags
+        leftAlign = zeroPad = 0;
+        while (*format == '-' || *format == '0') {
+            if (*format == '-') {
+                leftAlign = 1;
+            } else {
+                zeroPad = 1;
+            }
+            format++;
+        }
+
+        // Field width
+        width = 0;
+        while (*format >= '0' && *format <= '9') {
+            width = width * 10 + (*format++ - '0');
+        }
+
+        // Length modifier
+        isLong = 0;
+        while (*format == 'l') {
+            isLong = 1;
+            format++;
+        }
+
+        sign = 0;
+        base = 10;
+        digits = hexDigits;
+
+        switch (*format) {
+        case 'c':
+            scratch[0] = (char)__builtin_va_arg(args, int);
+            s = scratch;
+            length = 1;
+            zeroPad = 0;
+            break;
+
+        case 's':
+            s = __builtin_va_arg(args, char *);
+            if (!s) {
+                s = "(null)";
+            }
+            for (length = 0; s[length]; length++)
+                ;
+            zeroPad = 0;
+            break;
+
+        case 'd':
+        case 'i':
+            signedValue = isLong ? __builtin_va_arg(args, long) :
+                                   __builtin_va_arg(args, int);
+            if (signedValue < 0) {
+                sign = '-';
+                value = -(unsigned long)signedValue;
+            } else {
+                value = signedValue;
+            }
+            s = convert(end, value, 10, digits);
+            length = end - s;
+            break;
+
+        case 'X':
+            digits = hexDigitsUpper;
+            // Fall through
+        case 'x':
+            base = 16;
+            // Fall through
+        case 'u':
+            value = isLong ? __builtin_va_arg(args, unsigned long) :
+                             __builtin_va_arg(args, unsigned int);
+            s = convert(end, value, base, digits);
+            length = end - s;
+            break;
+
+        case 'p':
+            value = (unsigned long)__builtin_va_arg(args, void *);
+            s = convert(end, value, 16, digits);
+            length = end - s;
+            put(out, '0');
+            put(out, 'x');
+            break;
+
+        case '%':
+            put(out, '%');
+            format++;
+            continue;
+
+        default:
+            // Unknown conversion: copy it through unchanged
+            put(out, '%');
+            if (*format) {
+                put(out, *format++);
+            }
+            continue;
+        }
+        format++;
+
+        if (sign) {
+            width--;
+        }
+
+        // Pad on the left with spaces, or with zeros after the sign
+        if (!leftAlign && !zeroPad) {
+            while (width-- > length) {
+                put(out, ' ');
+            }
+        }
+        if (sign) {
+            put(out, sign);
+        }
+        if (!leftAlign && zeroPad) {
+            while (width-- > length) {
+                put(out, '0');
+            }
+        }
+
+        while (length > 0) {
+            put(out, *s++);
+            length--;
+            width--;
+        }
+
+        // Pad on the right with spaces
+        while (leftAlign && width-- > 0) {
+            put(out, ' ');
+        }
+    }
+
+    out->buffer[out->length] = '\0';
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       kvsnprintf
+//
+//  Arguments:      buffer:      Where to write the formatted string
+//                  size:        The size of the buffer, in characters
+//                  format:      The format string
+//                  args:        The arguments
+//
+//  Returns:        The number of characters written (not counting the
+//                  terminating null character)
+//
+//  Description:    This function formats a string into a buffer. Output
+//                  that does not fit is cut, and the buffer is always null
+//                  terminated.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int kvsnprintf(char *buffer, unsigned int size, const char *format,
+               __builtin_va_list args)
+{
+    struct output out;
+
+    if (size == 0) {
+        return 0;
+    }
+
+    out.buffer = buffer;
+    out.length = 0;
+    out.size = size;
+    out.crlf = 0;
+
+    render(&out, format, args);
+
+    return out.length;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       ksnprintf
+//
+//  Arguments:      buffer:      Where to write the formatted string
+//                  size:        The size of the buffer, in characters
+//                  format:      The format string, followed by arguments
+//
+//  Returns:        The number of characters written
+//
+//  Description:    This function formats a string into a buffer.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int ksnprintf(char *buffer, unsigned int size, const char *format, ...)
+{
+    __builtin_va_list args;
+    int length;
+
+    __builtin_va_start(args, format);
+    length = kvsnprintf(buffer, size, format, args);
+    __builtin_va_end(args);
+
+    return length;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       kprintf
+//
+//  Arguments:      format:      The format string, followed by arguments
+//
+//  Returns:        The number of characters written
+//
+//  Description:    This function formats a message into a buffer on the
+//                  stack, converting each newline to a carriage return and
+//                  newline, and writes it to the UART in one call.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int kprintf(const char *format, ...)
+{
+    char buffer[KPRINTF_BUFFER_SIZE];
+    struct output out;
+    __builtin_va_list args;
+
+    out.buffer = buffer;
+    out.length = 0;
+    out.size = sizeof(buffer);
+    out.crlf = 1;
+
+    __builtin_va_start(args, format);
+    render(&out, format, args);
+    __builtin_va_end(args);
+
+    uart_write((const unsigned char *)buffer, out.length);
+
+    return out.length;
+}
@@ -0,0 +1,27 @@
+// Size of the stack buffer kprintf() formats into. Longer output is cut.
+#define KPRINTF_BUFFER_SIZE     256
+
+// Log levels. Log statements above LOG_LEVEL are removed at compile
+// time, so disabled statements cost nothing (their arguments are not
+// even evaluated). Build with -DLOG_LEVEL=LOG_LEVEL_DEBUG to see them.
+#define LOG_LEVEL_NONE          0
+#define LOG_LEVEL_ERROR         1
+#define LOG_LEVEL_WARN          2
+#define LOG_LEVEL_INFO          3
+#define LOG_LEVEL_DEBUG         4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL               LOG_LEVEL_INFO
+#endif
+
+#define log_error(...)  do { if (LOG_LEVEL >= LOG_LEVEL_ERROR) kprintf(__VA_ARGS__); } while (0)
+#define log_warn(...)   do { if (LOG_LEVEL >= LOG_LEVEL_WARN) kprintf(__VA_ARGS__); } while (0)
+#define log_info(...)   do { if (LOG_LEVEL >= LOG_LEVEL_INFO) kprintf(__VA_ARGS__); } while (0)
+#define log_debug(...)  do { if (LOG_LEVEL >= LOG_LEVEL_DEBUG) kprintf(__VA_ARGS__); } while (0)
+
+// Function prototypes
+int kprintf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+int ksnprintf(char *buffer, unsigned int size, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+int kvsnprintf(char *buffer, unsigned int size, const char *format,
+               __builtin_va_list args);
@@ -0,0 +1,274 @@
+// The functions in this file measure input-to-photon latency: how long a
+// button press takes to become visible. A measurement follows one press
+// through three stages:
+//
+//   1. The SNES sample that first shows the press (latency_input(), with
+//      the time the main loop latched the controller).
+//   2. The write of the frame that handles it into the frame buffer the
+//      display shows (latency_drawn(), after compose_frame()).
+//   3. The vsync at which that frame is shown (latency_submitted() once
+//      present_frame() submits it, then latency_vsync() from the mailbox
+//      interrupt when the vsync comes).
+//
+// One press is followed at a time; presses made while one is followed are
+// not measured. The time from the sample to the frame buffer write, from
+// the write to the vsync, and the total are each kept in a histogram, and
+// latency_report() writes their percentiles to the console terminal.
+
+#include "systimer.h"
+#include "kprintf.h"
+#include "trace.h"
+#include "latency.h"
+
+// How far the press being followed has got
+#define LATENCY_IDLE                0   // No press followed
+#define LATENCY_PRESSED             1   // Sampled, not drawn yet
+#define LATENCY_DRAWN               2   // In the frame buffer, not presented
+#define LATENCY_SUBMITTED           3   // Presented, waiting for the vsync
+
+// The stages measured
+#define LATENCY_DRAW                0   // Sample to frame buffer write
+#define LATENCY_DISPLAY             1   // Frame buffer write to vsync
+#define LATENCY_TOTAL               2   // Sample to vsync
+#define LATENCY_STAGES              3
+
+struct latency_histogram {
+    unsigned int counts[LATENCY_BUCKETS];
+    unsigned int samples;
+    unsigned int max;
+};
+
+static const char *const stageNames[LATENCY_STAGES] = {
+    "draw", "display", "total"
+};
+
+// The press being followed. stage is changed by latency_vsync() in the
+// mailbox interrupt once it is LATENCY_SUBMITTED.
+static volatile unsigned int stage;
+static unsigned long pressTime, drawTime;
+static unsigned int previousButtons;
+
+static struct latency_histogram histograms[LATENCY_STAGES];
+
+// Statistics
+static volatile unsigned int pressesSkipped;
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       add_sample
+//
+//  Arguments:      histogram:   The histogram
+//                  us:          A latency in microseconds
+//
+//  Returns:        void
+//
+//  Description:    This function counts a latency in its bucket.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void add_sample(struct latency_histogram *histogram, unsigned int us)
+{
+    unsigned int bucket = us / LATENCY_BUCKET_US;
+
+    if (bucket >= LATENCY_BUCKETS) {
+        bucket = LATENCY_BUCKETS - 1;
+    }
+    histogram->counts[bucket]++;
+    histogram->samples++;
+    if (us > histogram->max) {
+        histogram->max = us;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       percentile
+//
+//  Arguments:      histogram:   The histogram
+//                  percent:     The percentile wanted (1 - 100)
+//
+//  Returns:        The upper edge of the bucket holding the percentile, in
+//                  microseconds (at most the largest latency seen)
+//
+//  Description:    This function finds the latency that the given
+//                  percentage of the samples do not exceed.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned int percentile(const struct latency_histogram *histogram,
+                               unsigned int percent)
+{
+    unsigned int wanted, seen = 0, bucket, edge;
+
+    // The rank of the sample, rounded up
+    wanted = (histogram->samples * percent + 99) / 100;
+
+    for (bucket = 0; bucket < LATENCY_BUCKETS - 1; bucket++) {
+        seen += histogram->counts[bucket];
+        if (seen >= wanted) {
+            break;
+        }
+    }
+
+    edge = (bucket + 1) * LATENCY_BUCKET_US;
+    return (edge < histogram->max) ? edge : histogram->max;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       latency_input
+//
+//  Arguments:      buttons:     The buttons the main loop acts on this frame
+//                  sampleTime:  When the controller was latched, in
+//                               microseconds
+//
+//  Returns:        void
+//
+//  Description:    This function starts following a press if a button
+//                  went down since the last frame and no other press is
+//                  being followed. It is called once per frame, right after
+//                  the controller is read.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void latency_input(unsigned int buttons, unsigned long sampleTime)
+{
+    unsigned int pressed = buttons & ~previousButtons;
+
+    previousButtons = buttons;
+    if (!pressed) {
+        return;
+    }
+
+    if (stage != LATENCY_IDLE) {
+        pressesSkipped++;
+        return;
+    }
+
+    pressTime = sampleTime;
+    stage = LATENCY_PRESSED;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       latency_drawn
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function is called once per frame when the frame
+//                  has been written to the frame buffer the display shows.
+//                  A press sampled this frame has then been drawn.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void latency_drawn()
+{
+    if (stage != LATENCY_PRESSED) {
+        return;
+    }
+
+    drawTime = get_timer_counter();
+    stage = LATENCY_DRAWN;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       latency_submitted
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function is called by present_frame() once it has
+//                  submitted a present, with no other present in flight and
+//                  the completion interrupt held off, so the next vsync
+//                  reported is the one that shows a drawn press.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void latency_submitted()
+{
+    if (stage == LATENCY_DRAWN) {
+        stage = LATENCY_SUBMITTED;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       latency_vsync
+//
+//  Arguments:      now:         The time of the vsync, in microseconds
+//
+//  Returns:        void
+//
+//  Description:    This function is called from the mailbox interrupt for
+//                  every completed present. If the present showed the press
+//                  being followed, the press's latencies are added to the
+//                  histograms, and the next press can be followed.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void latency_vsync(unsigned long now)
+{
+    if (stage != LATENCY_SUBMITTED) {
+        return;
+    }
+
+    add_sample(&histograms[LATENCY_DRAW], drawTime - pressTime);
+    add_sample(&histograms[LATENCY_DISPLAY], now - drawTime);
+    add_sample(&histograms[LATENCY_TOTAL], now - pressTime);
+    trace(TRACE_LATENCY, drawTime - pressTime, now - pressTime);
+
+    stage = LATENCY_IDLE;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       latency_report
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes the 50th, 90th and 99th percentile
+//                  and the largest latency of each stage to the console
+//                  terminal, in microseconds, if any presses have been
+//                  measured. The histograms cover every press since boot.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void latency_report()
+{
+    const struct latency_histogram *histogram;
+    unsigned int i;
+
+    if (histograms[LATENCY_TOTAL].samples == 0) {
+        return;
+    }
+
+    for (i = 0; i < LATENCY_STAGES; i++) {
+        histogram = &histograms[i];
+        log_info("Latency %s: p50 %u p90 %u p99 %u max %u us\n", stageNames[i],
+                 percentile(histogram, 50), percentile(histogram, 90),
+                 percentile(histogram, 99), histogram->max);
+    }
+    log_info("Latency: %u presses measured, %u skipped\n",
+             histograms[LATENCY_TOTAL].samples, pressesSkipped);
+}
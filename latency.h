@@ -0,0 +1,12 @@
+// Latency histogram resolution and range: LATENCY_BUCKETS buckets of
+// LATENCY_BUCKET_US microseconds each (64 ms in all); longer latencies
+// are counted in the last one
+#define LATENCY_BUCKET_US           250
+#define LATENCY_BUCKETS             256
+
+// Function prototypes
+void latency_input(unsigned int buttons, unsigned long sampleTime);
+void latency_drawn();
+void latency_submitted();
+void latency_vsync(unsigned long now);
+void latency_report();
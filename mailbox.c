@@ -1,5 +1,10 @@
 //Source: Manzara's examples
 #include "gpio.h"
+#include "irq.h"
+#include "idle.h"
+#include "mailbox.h"
+#include "mmu.h"
+#include "trace.h"
 
 // Define mailbox registers. These can be found at:
 // https://github.com/raspberrypi/firmware/wiki/Mailboxes
@@ -25,8 +30,271 @@
 
 // Allocate memory for the global mailbox buffer. It has to be
 // quadword aligned, since the channel is encoded using the low-order
-// 4 bits of its address.
-volatile unsigned int  __attribute__((aligned(16))) mailbox_buffer[36];
+// 4 bits of its address, and uncached, since the VideoCore reads and
+// writes it in RAM.
+volatile unsigned int  __attribute__((aligned(16))) MMU_UNCACHED mailbox_buffer[36];
+
+// Bookkeeping for a request that has been written to mailbox 1. The
+// message is the value written (buffer address combined with the
+// channel), which the VideoCore echoes back in mailbox 0 when the
+// response is ready. The generation number is incremented each time
+// the slot is reused, and makes stale tokens detectable.
+struct mailbox_slot {
+    volatile unsigned int *buffer;
+    unsigned int message;
+    mailbox_callback callback;
+    void *context;
+    unsigned int generation;
+    volatile int status;
+    volatile int inUse;
+};
+
+static struct mailbox_slot slots[MAILBOX_SLOTS];
+
+// TRUE once responses are signalled by the mailbox interrupt
+static int interruptDriven;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mailbox_init
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function discards any stale responses in mailbox 0,
+//                  and enables the ARM mailbox interrupt, which fires when
+//                  mailbox 0 has data available. Responses to asynchronous
+//                  requests are then collected by the interrupt handler.
+//                  irq_init() must be called first.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void mailbox_init()
+{
+    unsigned int discard;
+
+    // Empty mailbox 0
+    while (!(*MAILBOX0_STATUS & MAILBOX_EMPTY)) {
+        discard = *MAILBOX0_READ;
+        (void)discard;
+    }
+
+    // Interrupt when mailbox 0 has data available (bit 0 of the
+    // mailbox 0 configuration register)
+    irq_register(IRQ_ARM_MAILBOX, mailbox_service);
+    *MAILBOX0_CONFIG = 0x1;
+    irq_enable(IRQ_ARM_MAILBOX);
+    interruptDriven = 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mailbox_submit
+//
+//  Arguments:      buffer:      The request buffer (16-byte aligned). It
+//                               must not be touched until the request has
+//                               completed.
+//                  channel:     The mailbox channel number to use
+//                  callback:    Function to call on completion, or 0
+//                  context:     Passed unchanged to the callback
+//
+//  Returns:        A token for mailbox_poll() and mailbox_wait(), or -1 if
+//                  the request could not be submitted (no free slot, bad
+//                  alignment, or the buffer is already in flight).
+//
+//  Description:    This function starts a mailbox request without waiting
+//                  for the response. Several requests may be in flight at
+//                  once, as long as each one uses its own buffer. The
+//                  response is collected by mailbox_service(), normally
+//                  from the mailbox interrupt.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int mailbox_submit(volatile unsigned int *buffer, unsigned char channel,
+                   mailbox_callback callback, void *context)
+{
+    unsigned int message;
+    unsigned long flags;
+    int i, token, free = -1;
+
+    // The channel is encoded in the low 4 bits of the buffer address
+    if ((unsigned long)buffer & 0xF) {
+        return -1;
+    }
+    message = (unsigned int)((unsigned long)buffer) | (channel & 0xF);
+
+    flags = irq_save();
+
+    // Find a free slot, making sure the same message is not already in
+    // flight (its response would be indistinguishable)
+    for (i = 0; i < MAILBOX_SLOTS; i++) {
+        if (slots[i].inUse) {
+            if (slots[i].message == message) {
+                irq_restore(flags);
+                return -1;
+            }
+        } else if (free < 0) {
+            free = i;
+        }
+    }
+
+    if (free < 0) {
+        irq_restore(flags);
+        return -1;
+    }
+
+    slots[free].buffer = buffer;
+    slots[free].message = message;
+    slots[free].callback = callback;
+    slots[free].context = context;
+    slots[free].generation++;
+    slots[free].status = MAILBOX_PENDING;
+    slots[free].inUse = 1;
+
+    // Keep polling mailbox 1 until it can accept a request
+    while (*MAILBOX1_STATUS & MAILBOX_FULL)
+	;
+
+    // Write the address of our request to mailbox 1 with channel identifier
+    *MAILBOX1_WRITE = message;
+
+    irq_restore(flags);
+
+    token = (int)((slots[free].generation & 0xFFFFFF) << 4) | free;
+    trace(TRACE_MAILBOX_SUBMIT, message, token);
+
+    return token;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mailbox_poll
+//
+//  Arguments:      token:       A token returned by mailbox_submit()
+//
+//  Returns:        MAILBOX_PENDING while the request is in flight,
+//                  MAILBOX_DONE or MAILBOX_FAILED once it has completed,
+//                  and MAILBOX_INVALID if the token is unknown (or its
+//                  slot has since been reused by another request).
+//
+//  Description:    This function reports the state of an asynchronous
+//                  request without blocking.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int mailbox_poll(int token)
+{
+    int slot = token & 0xF;
+
+    if (token < 0 || slot >= MAILBOX_SLOTS ||
+        (slots[slot].generation & 0xFFFFFF) != ((unsigned int)token >> 4)) {
+        return MAILBOX_INVALID;
+    }
+
+    return slots[slot].status;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mailbox_wait
+//
+//  Arguments:      token:       A token returned by mailbox_submit()
+//
+//  Returns:        TRUE (non-zero) if the request produced a valid
+//                  response, FALSE (zero) otherwise.
+//
+//  Description:    This function blocks until an asynchronous request has
+//                  completed. It services mailbox 0 itself, so it also
+//                  works while IRQs are masked or before mailbox_init().
+//                  While the request is pending, the core sleeps until the
+//                  mailbox interrupt (or, before mailbox_init(), the next
+//                  event) wakes it up.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int mailbox_wait(int token)
+{
+    unsigned long flags;
+    int status;
+
+    while ((status = mailbox_poll(token)) == MAILBOX_PENDING) {
+        flags = irq_save();
+        mailbox_service();
+
+        // Sleep with IRQs masked, so the interrupt cannot slip in between
+        // the check and the wfi. It is taken once IRQs are restored.
+        if (mailbox_poll(token) == MAILBOX_PENDING) {
+            if (interruptDriven) {
+                idle_wait_interrupt();
+            } else {
+                idle_wait_event();
+            }
+        }
+
+        irq_restore(flags);
+    }
+
+    return status == MAILBOX_DONE;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mailbox_service
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function reads every response waiting in mailbox 0,
+//                  matches it with the request that is in flight with the
+//                  same message, marks that request as completed, and calls
+//                  its callback. It is the ARM mailbox interrupt handler,
+//                  and must be called with IRQs masked.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void mailbox_service()
+{
+    unsigned int message;
+    struct mailbox_slot *slot;
+    int i;
+
+    while (!(*MAILBOX0_STATUS & MAILBOX_EMPTY)) {
+        message = *MAILBOX0_READ;
+
+        // Find the request that this is a response to. Responses that
+        // do not match any request in flight are discarded.
+        for (i = 0; i < MAILBOX_SLOTS; i++) {
+            slot = &slots[i];
+
+            if (slot->inUse && slot->message == message) {
+                // The request buffer belongs to the caller again
+                slot->inUse = 0;
+                slot->status = (slot->buffer[1] == MAILBOX_RESPONSE) ?
+                               MAILBOX_DONE : MAILBOX_FAILED;
+                trace(TRACE_MAILBOX_DONE, message, slot->status);
+
+                if (slot->callback) {
+                    slot->callback(slot->buffer,
+                                   slot->status == MAILBOX_DONE,
+                                   slot->context);
+                }
+                break;
+            }
+        }
+    }
+}
 
 
 
@@ -45,47 +313,27 @@ volatile unsigned int  __attribute__((aligned(16))) mailbox_buffer[36];
 //                  global mailbox buffer, which also has room for any
 //                  response. The request is encoded using the address of the
 //                  mailbox buffer combined with the mailbox channel number.
-//                  Once we confirm that mailbox 1 can accept a request, we
-//                  make the request by writing this address to the mailbox 1
-//                  write register. The video core then processes the request,
-//                  and provides a response using mailbox 0. Once the response
-//                  arrives, we make sure it is a response to our original
-//                  request. If it is, we check to see if the video core was
-//                  able to reply with a valid response. If so, we return
-//                  a TRUE to calling code, which then can read the response
-//                  in particular fields withing the global mailbox buffer.
+//                  The request is submitted with mailbox_submit(), and we
+//                  then wait for the video core to respond in mailbox 0.
+//                  If the video core was able to reply with a valid
+//                  response, we return a TRUE to calling code, which then
+//                  can read the response in particular fields withing the
+//                  global mailbox buffer.
 //
 ////////////////////////////////////////////////////////////////////////////////
 
 int mailbox_query(unsigned char channel)
 {
-    unsigned int address;
+    unsigned long flags;
+    int token;
 
-    // Combine the address of the mailbox buffer with the channel number
-    address = (unsigned int)((unsigned long)&mailbox_buffer[0]) & 0xFFFFFFF0;
-    address |= (channel & 0xF);
-
-    // Keep polling mailbox 1 until it can accept a request
-    while (*MAILBOX1_STATUS & MAILBOX_FULL)
-	;
-
-    // Write the address of our request to mailbox 1 with channel identifier
-    *MAILBOX1_WRITE = address;
-
-    // Wait for a response in mailbox 0
-    while (1) {
-	// Keep polling mailbox 0 until a response appears there
-	while (*MAILBOX0_STATUS & MAILBOX_EMPTY)
-	    ;
-
-        // Make sure it is a response to our original request,
-	// otherwise keep waiting for a response
-        if (*MAILBOX0_READ == address) {
-            // Return TRUE if is it a valid response, otherwise return FALSE
-            return (mailbox_buffer[1] == MAILBOX_RESPONSE);
-	}
+    // Submit the request. If all slots are in use, or the global buffer
+    // is still in flight, collect responses until it can be submitted.
+    while ((token = mailbox_submit(mailbox_buffer, channel, 0, 0)) < 0) {
+        flags = irq_save();
+        mailbox_service();
+        irq_restore(flags);
     }
 
-    // We should never arrive here, but if we do, return FALSE (invalid message)
-    return 0;
+    return mailbox_wait(token);
 }
@@ -127,15 +127,38 @@
 #define TAG_GET_PALETTE                 0x0004000B
 #define TAG_TEST_PALETTE                0x0004400B
 #define TAG_SET_PALETTE                 0x0004800B
+#define TAG_WAIT_FOR_VSYNC              0x0004800E
 #define TAG_SET_CURSOR_INFO             0x00008010
 #define TAG_SET_CURSOR_STATE            0x00008011
 
 #define TAG_LAST                        0
 
 
+// Number of mailbox requests that may be in flight at the same time
+#define MAILBOX_SLOTS                   4
+
+// Status values returned by mailbox_poll()
+#define MAILBOX_PENDING                 0
+#define MAILBOX_DONE                    1
+#define MAILBOX_FAILED                  2
+#define MAILBOX_INVALID                 3
+
+// Completion callback for asynchronous requests. It is called (from the
+// mailbox interrupt handler, with IRQs masked) with the request buffer,
+// TRUE if the VideoCore returned a valid response, and the context
+// pointer given to mailbox_submit().
+typedef void (*mailbox_callback)(volatile unsigned int *buffer, int success,
+                                 void *context);
+
 // External declaration for the mailbox buffer.
 // It is allocated in mailbox.c
 extern volatile unsigned int mailbox_buffer[36];
 
-// Function prototype
+// Function prototypes
+void mailbox_init();
 int mailbox_query(unsigned char channel);
+int mailbox_submit(volatile unsigned int *buffer, unsigned char channel,
+                   mailbox_callback callback, void *context);
+int mailbox_poll(int token);
+int mailbox_wait(int token);
+void mailbox_service();
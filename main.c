@@ -7,10 +7,48 @@
 #include "framebuffer.h"
 #include "gpio.h"
 #include "systimer.h"
+#include "irq.h"
+#include "mailbox.h"
+#include "present.h"
+#include "governor.h"
+#include "idle.h"
+#include "trace.h"
+#include "kprintf.h"
+#include "command.h"
+#include "snapshot.h"
+#include "stream.h"
+#include "undo.h"
+#include "smp.h"
+#include "compose.h"
+#include "font.h"
+#include "hud.h"
+#include "canvas.h"
+#include "region.h"
+#include "input.h"
+#include "latency.h"
+#include "boot.h"
+#include "stack.h"
+#include "emmc.h"
+#include "bcache.h"
+#include "save.h"
+#include "asset.h"
+#include "zoom.h"
 
 #define false 0
 #define true 1
 
+// SNES buttons held together to dump the trace buffer (Select + L + R)
+#define TRACE_DUMP_BUTTONS  ((0x1 << 2) | (0x1 << 10) | (0x1 << 11))
+
+// SNES buttons for undo (L) and redo (R), the direction buttons that
+// move the pen, and the button that steps through the magnifier's zoom
+// levels (Y)
+#define SELECT_BUTTON       (0x1 << 2)
+#define UNDO_BUTTON         (0x1 << 10)
+#define REDO_BUTTON         (0x1 << 11)
+#define PEN_BUTTONS         (0xF << 4)
+#define ZOOM_BUTTON         (0x1 << 1)
+
 // Function prototypes
 unsigned short get_SNES();
 void init_GPIO(int pinNumber, _Bool isInput);
@@ -63,13 +101,47 @@ struct Point createPoint(int x, int y){
 void main()
 {
     unsigned short data = 0xFFFF;
+    unsigned short previous = 0;
+    unsigned int frame = 0, moves;
+    unsigned long frameStart, sampleTime;
+    struct present_stats stats;
 
     // Set up the UART serial port
     uart_init();
+    boot_mark("uart");
+
+    // Set up the interrupt controller and the generic timer, and let
+    // mailbox responses arrive through the ARM mailbox interrupt
+    irq_init();
+    timer_init();
+    idle_init();
+    mailbox_init();
+    enable_interrupts();
+    boot_mark("timer, irq");
+
+    // Release the other three cores, which help with flood fills. They
+    // start while core 0 carries on, and are waited for after the first
+    // frame.
+    smp_init();
+
+    // Run the ARM and core clocks at their maximum rates
+    governor_init();
+    boot_mark("clocks");
 
     // Initialize the frame buffer
     initFrameBuffer();
+    boot_mark("frame buffer");
     clearScreen();
+    initFont();
+    boot_mark("canvas");
+
+    // Draw the background image, if one is built in
+    if (asset_draw(ASSET_BACKGROUND, 0, 0)) {
+        boot_mark("background");
+    }
+
+    // Accept drawing commands from the host over the UART
+    command_init();
 
     // Set up GPIO pin #9 for output (LATCH output)
     init_GPIO(9,false);
@@ -85,6 +157,7 @@ void main()
 
     // Set CLOCK line (GPIO 11) to high
     set_GPIO(11);
+    boot_mark("controller");
 
     struct Button buttons[6];
     buttons[0] = createButton("Start",3);
@@ -101,46 +174,107 @@ void main()
     // Print out a message to the console
     uart_puts("SNES Controller Program starting.\n");
 
-    // Loop forever, reading from the SNES controller 30 times per second
+    // Loop forever, reading from the SNES controller once per frame
     while (1) {
-    	// Read data from the SNES controller
-    	data = get_SNES();
+        trace(TRACE_FRAME, frame, 0);
+        frameStart = timer_ticks();
+
+    	// Read data from the SNES controller, or take it from the
+        // recording being replayed, and time any new press until it is
+        // shown
+        sampleTime = get_timer_counter();
+    	data = input_next(get_SNES());
+        trace(TRACE_INPUT, data, 0);
+        latency_input(data, sampleTime);
+
+        // Recordings and replays start from a cleared canvas (with the
+        // background image, if any), an empty undo journal and the pen
+        // in the middle of the screen
+        if (input_started()) {
+            undo_reset();
+            clearScreen();
+            asset_draw(ASSET_BACKGROUND, 0, 0);
+            character = createPoint(512, 384);
+            previous = 0;
+        }
 
+        // Dump the trace buffer when the button combination is pressed
+        if ((data & TRACE_DUMP_BUTTONS) == TRACE_DUMP_BUTTONS &&
+            (previous & TRACE_DUMP_BUTTONS) != TRACE_DUMP_BUTTONS) {
+            trace_dump();
+        }
+
+        // Undo or redo one step per press of L or R (not while Select is
+        // held for the trace dump)
+        moves = undo_moves();
+        if (!(data & SELECT_BUTTON)) {
+            if ((data & UNDO_BUTTON) && !(previous & UNDO_BUTTON)) {
+                undo_step();
+            }
+            if ((data & REDO_BUTTON) && !(previous & REDO_BUTTON)) {
+                redo_step();
+            }
+        }
+
+        // Step through the magnifier's zoom levels per press of Y
+        if ((data & ZOOM_BUTTON) && !(previous & ZOOM_BUTTON)) {
+            zoom_cycle();
+        }
+        previous = data;
+
+        // Draw every command batch that arrived over the UART, and send
+        // the next chunks of a snapshot or recording in progress
+        command_poll();
+        snapshot_update();
+        input_update();
+
+        struct Point last = character;
         for(int i = 0; i < 6; i++){
             if((0x1 << buttons[i].shiftValue) & data){
                 switch(buttons[i].shiftValue){
                     case 3://Start
-                        uart_puts("Start\n");
-                        clearScreen();
+                        log_debug("Start\n");
+                        trace(TRACE_CLEAR_BEGIN, 0, 0);
+                        undo_begin();
+                        undo_draw(UNDO_OP_CLEAR, 0, 0, 0, 0, WHITE);
+                        undo_end();
+                        trace(TRACE_CLEAR_END, 0, 0);
                         break;
                     case 4://UP
-                        uart_puts("UP\n");
+                        log_debug("UP\n");
                         if(character.y > 0){
                             character.y -= 1;
                         }
                         break;
                     case 5://Down
-                        uart_puts("Down\n");
+                        log_debug("Down\n");
                         if(character.y<767){
                             character.y += 1;
                         }
                         break;
                     case 6://Left
-                        uart_puts("Left\n");
+                        log_debug("Left\n");
                         if(character.x > 0){
                             character.x -= 1;
                         }
                         break;
                     case 7://Right
-                        uart_puts("Right\n");
+                        log_debug("Right\n");
                         if(character.x < 1023){
                             character.x += 1;
                         }
                         break;
                     case 9://X  FILL
-                        uart_puts("X\n");
-                        clearPoint(character.x,character.y);
-                        floodFill(character.x,character.y);
+                        log_debug("X\n");
+                        trace(TRACE_FILL_BEGIN, character.x, character.y);
+                        // Fill everything under the pen up to a black
+                        // boundary with black
+                        undo_begin();
+                        undo_draw(UNDO_OP_POINT, character.x, character.y, 0, 0, WHITE);
+                        undo_draw(UNDO_OP_FLOOD, character.x, character.y,
+                                  BLACK, UNDO_FLOOD_4_BOUNDARY, BLACK);
+                        undo_end();
+                        trace(TRACE_FILL_END, 0, 0);
                         break;
                     default:
                         break;
@@ -149,20 +283,112 @@ void main()
         }
 
         printPoint(&character);
-        drawPoint(character.x,character.y);
 
+        // While the pen moves, its trail is recorded as one step, which
+        // is ended when it stops (or by any other step). The pen only inks
+        // inside that step, and not in a frame where a step was undone or
+        // redone: a step of its own would throw away the steps that can
+        // still be redone. Pixels that are already black are left alone,
+        // so the magnifier is not drawn again for nothing.
+        if ((data & PEN_BUTTONS) && undo_moves() == moves) {
+            if (!undo_active()) {
+                undo_begin();
+                if (getPixel(last.x, last.y) != BLACK) {
+                    undo_draw(UNDO_OP_POINT, last.x, last.y, 0, 0, BLACK);
+                }
+            }
+            if (getPixel(character.x, character.y) != BLACK) {
+                undo_draw(UNDO_OP_POINT, character.x, character.y, 0, 0, BLACK);
+            }
+        } else {
+            undo_end();
+        }
+
+
+        // Send the tiles that changed to a connected viewer
+        stream_update(frame);
+
+        // Show the frame rate, the pen position, and the time this
+        // frame's work took on the overlay, and the cursor at the pen
+        present_get_stats(&stats);
+        hud_begin();
+        if (stats.lastFrameTime) {
+            hud_printf(8, 8, "FPS %u.%u  X %d Y %d",
+                       10000000 / stats.lastFrameTime / 10,
+                       10000000 / stats.lastFrameTime % 10,
+                       character.x, character.y);
+        }
+        hud_printf(8, 18, "Work %u us  Frame max %u us",
+                   (unsigned int)ticks_to_us(timer_ticks() - frameStart),
+                   stats.maxFrameTime);
+        hud_end();
+        compose_move(COMPOSE_LAYER_CURSOR, character.x - COMPOSE_CURSOR_SIZE / 2,
+                     character.y - COMPOSE_CURSOR_SIZE / 2);
+        zoom_update(character.x, character.y);
+
+        // Compose the layers into the tiles that changed, once the
+        // previous frame is on show and the page it replaced is free
+        present_wait();
+        trace(TRACE_COMPOSE_BEGIN, frame, 0);
+        compose_frame();
+        trace(TRACE_COMPOSE_END, 0, 0);
+        latency_drawn();
+
+        // Present the frame at the next vsync. The wait for the
+        // previous present paces the loop to the refresh rate.
+        trace(TRACE_PRESENT, frame, 0);
+        present_frame();
+
+        // Once the first frame is submitted, finish what booting left
+        // for later, and report how long it took
+        if (frame == 0) {
+            boot_mark("first frame");
+            smp_wait();
+            frameBufferReport();
+            boot_report();
+
+            // Start bringing the SD card up for the save slots;
+            // save_update() finishes it over the next frames
+            emmc_init();
+        }
 
-    	// Delay 1/30th of a second
-    	microsecond_delay(10000);
+        // Keep the ARM clock below the firmware's thermal limit
+        governor_update();
+
+        // Carry on with a save or load to the SD card
+        save_update();
+
+        // Catch a stack that has run into its guard
+        stack_check();
+
+        // Report the frame timing every few seconds
+        if (++frame % 300 == 0) {
+            present_report();
+            governor_report();
+            idle_report();
+            command_report();
+            stream_report();
+            undo_report();
+            smp_report();
+            hud_report();
+            compose_report();
+            canvasReport();
+            regionReport();
+            input_report();
+            latency_report();
+            stack_report();
+            emmc_report();
+            bcache_report();
+            save_report();
+            asset_report();
+            zoom_report();
+        }
     }
 }
 
 void printPoint(struct Point *p){
-    uart_puts("Position: x = ");
-    uart_puthex(p->x);
-    uart_puts(" y = ");
-    uart_puthex(p->y);
-    uart_puts("\n");
+    // Printed every frame, so only in debug builds
+    log_debug("Position: x = %d y = %d\n", p->x, p->y);
 }
 
 
@@ -0,0 +1,399 @@
+// The functions in this file set up the translation tables the MMU uses,
+// so that the data and instruction caches can be turned on. Addresses are
+// identity mapped: a virtual address is the physical address.
+//
+// The tables use the 4 KB granule and a 4 GB address space, so the walk
+// starts at level 1, with one entry per gigabyte. The first gigabyte is
+// mapped with 2 MB blocks: ARM RAM (everything below the peripherals,
+// including the GPU's memory) as normal write-back memory, and the
+// peripherals at 0x3F000000 as device memory. The second gigabyte holds
+// the local peripherals of the BCM2837 at 0x40000000, also device memory.
+// A 2 MB block that needs finer control is split into 4 KB pages, from a
+// small pool of level 3 tables.
+//
+// The guard page below each stack (see link.ld) is left unmapped, so a
+// stack that runs into its guard faults at once, and the fault address
+// reported by exception_handler() is in the guard.
+//
+// Memory the GPU or a DMA channel reads or writes behind the caches' back
+// is either mapped non-cacheable, or kept coherent by hand:
+//
+//   - The .uncached section (see link.ld), which holds the mailbox request
+//     buffers and the DMA control blocks, is non-cacheable.
+//   - The frame buffer is made non-cacheable once the firmware has
+//     allocated it (mmu_uncached()).
+//   - The SD card's data buffers are cleaned and invalidated around each
+//     transfer (mmu_clean() and mmu_invalidate(), see emmc.c).
+//
+// mmu_init() builds the tables on core 0 with the MMU still off, so they
+// are in memory when the other cores walk them. mmu_on in start.s loads
+// them and turns on the MMU and caches, on each core in turn. Core 0 does
+// this before .bss is cleared, so mmu_init() must not rely on .bss.
+
+#include "kprintf.h"
+#include "mmu.h"
+
+// Sizes of the things the tables map
+#define MMU_ENTRIES                 512
+#define MMU_PAGE_SIZE               0x1000
+#define MMU_BLOCK_SIZE              0x200000
+
+// Where the peripherals start, in the first and second gigabyte
+#define MMU_PERIPHERALS             0x3F000000UL
+#define MMU_LOCAL_PERIPHERALS       0x40000000UL
+
+// Level 3 tables available for splitting 2 MB blocks into pages
+#define MMU_PAGE_TABLES             8
+
+// Translation table descriptor fields
+#define DESC_BLOCK                  0x1
+#define DESC_TABLE                  0x3
+#define DESC_PAGE                   0x3
+#define DESC_TYPE_MASK              0x3
+#define DESC_ATTR(n)                ((n) << 2)
+#define DESC_INNER_SHAREABLE        (3 << 8)
+#define DESC_ACCESS_FLAG            (1 << 10)
+#define DESC_EXECUTE_NEVER          ((1UL << 53) | (1UL << 54))
+#define DESC_ADDRESS_MASK           0x0000FFFFFFFFF000UL
+
+// The attributes of each kind of mapping
+#define ATTR_NORMAL         (DESC_ATTR(MMU_NORMAL) | DESC_INNER_SHAREABLE | \
+                             DESC_ACCESS_FLAG)
+#define ATTR_NONCACHEABLE   (DESC_ATTR(MMU_NONCACHEABLE) | DESC_INNER_SHAREABLE | \
+                             DESC_ACCESS_FLAG | DESC_EXECUTE_NEVER)
+#define ATTR_DEVICE         (DESC_ATTR(MMU_DEVICE) | DESC_ACCESS_FLAG | \
+                             DESC_EXECUTE_NEVER)
+
+// Defined in link.ld. The stack sizes are symbols with no storage, whose
+// addresses are their values.
+extern unsigned char __uncached_start[], __uncached_end[];
+extern unsigned char __stacks_start[];
+extern unsigned char STACK_CORES[], STACK_GUARD_SIZE[], STACK_SIZE[];
+extern unsigned char STACK_BLOCK_SIZE[];
+
+// The translation tables: level 1, which start.s loads into TTBR0_EL1, a
+// level 2 table for each of the first two gigabytes, and the pool of
+// level 3 tables. They have a section of their own, which is neither
+// loaded nor cleared with .bss (see link.ld).
+#define MMU_TABLE __attribute__((section(".pagetables"), aligned(MMU_PAGE_SIZE)))
+unsigned long mmu_table[MMU_ENTRIES] MMU_TABLE;
+static unsigned long lowBlocks[MMU_ENTRIES] MMU_TABLE;
+static unsigned long highBlocks[MMU_ENTRIES] MMU_TABLE;
+static unsigned long pageTables[MMU_PAGE_TABLES][MMU_ENTRIES] MMU_TABLE;
+static unsigned int pageTablesUsed __attribute__((section(".pagetables")));
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mmu_replace
+//
+//  Arguments:      entry:       A translation table entry
+//                  descriptor:  Its new value
+//
+//  Returns:        void
+//
+//  Description:    This function changes a translation table entry. It
+//                  makes the entry invalid and drops it from every core's
+//                  TLB before writing the new descriptor, as the
+//                  architecture requires when a live mapping changes. The
+//                  memory the entry maps must not be used meanwhile.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void mmu_replace(unsigned long *entry, unsigned long descriptor)
+{
+    *(volatile unsigned long *)entry = 0;
+    asm volatile("dsb ishst; tlbi vmalle1is; dsb ish; isb" ::: "memory");
+    *(volatile unsigned long *)entry = descriptor;
+    asm volatile("dsb ishst; isb" ::: "memory");
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mmu_page
+//
+//  Arguments:      address:     An address in RAM
+//
+//  Returns:        The level 3 entry that maps the page, or 0 if the pool
+//                  of level 3 tables has run out
+//
+//  Description:    This function finds the entry for a 4 KB page, first
+//                  splitting its 2 MB block into pages with the same
+//                  attributes if it is not split yet.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned long *mmu_page(unsigned long address)
+{
+    unsigned long *block = &lowBlocks[address / MMU_BLOCK_SIZE];
+    unsigned long *table, base, attributes;
+    unsigned int i;
+
+    if ((*block & DESC_TYPE_MASK) == DESC_TABLE) {
+        table = (unsigned long *)(*block & DESC_ADDRESS_MASK);
+        return &table[(address / MMU_PAGE_SIZE) % MMU_ENTRIES];
+    }
+
+    if (pageTablesUsed == MMU_PAGE_TABLES) {
+        return 0;
+    }
+    table = pageTables[pageTablesUsed++];
+
+    base = address & ~(MMU_BLOCK_SIZE - 1);
+    attributes = *block & ~DESC_ADDRESS_MASK & ~DESC_TYPE_MASK;
+    for (i = 0; i < MMU_ENTRIES; i++) {
+        table[i] = (*block & DESC_TYPE_MASK) == DESC_BLOCK ?
+                   (base + i * MMU_PAGE_SIZE) | attributes | DESC_PAGE : 0;
+    }
+    mmu_replace(block, (unsigned long)table | DESC_TABLE);
+
+    return &table[(address / MMU_PAGE_SIZE) % MMU_ENTRIES];
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mmu_map
+//
+//  Arguments:      start, end:  The memory to map, rounded out to whole
+//                               pages (RAM only)
+//                  attributes:  ATTR_*, or 0 to leave it unmapped
+//
+//  Returns:        TRUE if the memory was mapped
+//
+//  Description:    This function changes the mapping of part of RAM. Whole
+//                  2 MB blocks are changed as blocks, and the blocks at
+//                  the ends are split into pages if needed.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int mmu_map(unsigned long start, unsigned long end,
+                   unsigned long attributes)
+{
+    unsigned long address = start & ~(MMU_PAGE_SIZE - 1), *entry;
+
+    if (end > MMU_PERIPHERALS) {
+        return 0;
+    }
+
+    while (address < end) {
+        entry = &lowBlocks[address / MMU_BLOCK_SIZE];
+        if ((address & (MMU_BLOCK_SIZE - 1)) == 0 &&
+            address + MMU_BLOCK_SIZE <= end &&
+            (*entry & DESC_TYPE_MASK) != DESC_TABLE) {
+            mmu_replace(entry, attributes ? address | attributes | DESC_BLOCK : 0);
+            address += MMU_BLOCK_SIZE;
+            continue;
+        }
+
+        entry = mmu_page(address);
+        if (!entry) {
+            return 0;
+        }
+        mmu_replace(entry, attributes ? address | attributes | DESC_PAGE : 0);
+        address += MMU_PAGE_SIZE;
+    }
+
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mmu_init
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function builds the translation tables. start.s
+//                  calls it on core 0 with the MMU off, before mmu_on. The
+//                  stack guards are left unmapped, unless the pool of
+//                  level 3 tables runs out.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void mmu_init()
+{
+    unsigned long address, guard;
+    unsigned int i;
+
+    pageTablesUsed = 0;
+
+    for (i = 0; i < MMU_ENTRIES; i++) {
+        address = (unsigned long)i * MMU_BLOCK_SIZE;
+        lowBlocks[i] = address | DESC_BLOCK |
+                       (address < MMU_PERIPHERALS ? ATTR_NORMAL : ATTR_DEVICE);
+        highBlocks[i] = 0;
+        mmu_table[i] = 0;
+    }
+    highBlocks[0] = MMU_LOCAL_PERIPHERALS | ATTR_DEVICE | DESC_BLOCK;
+
+    mmu_table[0] = (unsigned long)lowBlocks | DESC_TABLE;
+    mmu_table[1] = (unsigned long)highBlocks | DESC_TABLE;
+
+    mmu_map((unsigned long)__uncached_start, (unsigned long)__uncached_end,
+            ATTR_NONCACHEABLE);
+
+    // Unmap the guards below each core's stack and interrupt stack
+    for (i = 0; i < (unsigned long)STACK_CORES; i++) {
+        guard = (unsigned long)__stacks_start +
+                i * (unsigned long)STACK_BLOCK_SIZE;
+        mmu_map(guard, guard + (unsigned long)STACK_GUARD_SIZE, 0);
+
+        guard += (unsigned long)STACK_GUARD_SIZE + (unsigned long)STACK_SIZE;
+        mmu_map(guard, guard + (unsigned long)STACK_GUARD_SIZE, 0);
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mmu_mapped
+//
+//  Arguments:      address:     An address in RAM
+//
+//  Returns:        TRUE if the address can be read and written, FALSE if
+//                  using it faults
+//
+//  Description:    This function looks an address up in the translation
+//                  tables. stack.c uses it to tell whether a stack guard
+//                  was unmapped, or has to be checked by reading it.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int mmu_mapped(const void *address)
+{
+    unsigned long entry = lowBlocks[(unsigned long)address / MMU_BLOCK_SIZE];
+    unsigned long *table;
+
+    if ((entry & DESC_TYPE_MASK) == DESC_TABLE) {
+        table = (unsigned long *)(entry & DESC_ADDRESS_MASK);
+        entry = table[((unsigned long)address / MMU_PAGE_SIZE) % MMU_ENTRIES];
+    }
+
+    return (entry & DESC_BLOCK) != 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mmu_uncached
+//
+//  Arguments:      start:       The memory to make non-cacheable
+//                  size:        Its size in bytes
+//
+//  Returns:        void
+//
+//  Description:    This function maps memory the GPU reads, such as the
+//                  frame buffer, as non-cacheable, so that what the CPU
+//                  writes reaches it without cache maintenance. Any lines
+//                  of it already in the caches are written back and
+//                  dropped. The memory must not be in use meanwhile, and
+//                  must not share a 2 MB block with the code or stacks.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void mmu_uncached(void *start, unsigned long size)
+{
+    if (!mmu_map((unsigned long)start, (unsigned long)start + size,
+                 ATTR_NONCACHEABLE)) {
+        log_warn("MMU: cannot map 0x%08x - 0x%08x as non-cacheable\n",
+                 (unsigned int)(unsigned long)start,
+                 (unsigned int)((unsigned long)start + size));
+        return;
+    }
+
+    mmu_clean_invalidate(start, size);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mmu_clean
+//
+//  Arguments:      start:       The memory a DMA channel is to read
+//                  size:        Its size in bytes
+//
+//  Returns:        void
+//
+//  Description:    This function writes the lines of the data cache that
+//                  hold the memory back to RAM.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void mmu_clean(const void *start, unsigned long size)
+{
+    unsigned long address = (unsigned long)start & ~(MMU_CACHE_LINE - 1UL);
+
+    for (; address < (unsigned long)start + size; address += MMU_CACHE_LINE) {
+        asm volatile("dc cvac, %0" :: "r"(address) : "memory");
+    }
+    asm volatile("dsb sy" ::: "memory");
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mmu_invalidate
+//
+//  Arguments:      start:       Memory a DMA channel has written, aligned
+//                               to MMU_CACHE_LINE
+//                  size:        Its size in bytes, a multiple of
+//                               MMU_CACHE_LINE
+//
+//  Returns:        void
+//
+//  Description:    This function drops the lines of the data cache that
+//                  hold the memory without writing them back, so the next
+//                  reads see what is in RAM.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void mmu_invalidate(void *start, unsigned long size)
+{
+    unsigned long address = (unsigned long)start;
+
+    for (; address < (unsigned long)start + size; address += MMU_CACHE_LINE) {
+        asm volatile("dc ivac, %0" :: "r"(address) : "memory");
+    }
+    asm volatile("dsb sy" ::: "memory");
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mmu_clean_invalidate
+//
+//  Arguments:      start:       The memory
+//                  size:        Its size in bytes
+//
+//  Returns:        void
+//
+//  Description:    This function writes the lines of the data cache that
+//                  hold the memory back to RAM and drops them. Before a DMA
+//                  channel writes memory, this keeps a dirty line from
+//                  being written back over the new data.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void mmu_clean_invalidate(void *start, unsigned long size)
+{
+    unsigned long address = (unsigned long)start & ~(MMU_CACHE_LINE - 1UL);
+
+    for (; address < (unsigned long)start + size; address += MMU_CACHE_LINE) {
+        asm volatile("dc civac, %0" :: "r"(address) : "memory");
+    }
+    asm volatile("dsb sy" ::: "memory");
+}
@@ -0,0 +1,23 @@
+// Memory attribute indexes, the fields of MAIR_EL1 that start.s sets
+// (must match MMU_MAIR in start.s)
+#define MMU_DEVICE                  0   // Device-nGnRnE: peripherals
+#define MMU_NORMAL                  1   // Normal, write-back cacheable
+#define MMU_NONCACHEABLE            2   // Normal, not cacheable
+
+// The data cache line size of the Cortex-A53, in bytes. Buffers that DMA
+// reads or writes are aligned to it, so cache maintenance on them never
+// touches a neighbour.
+#define MMU_CACHE_LINE              64
+
+// Puts a variable in the .uncached section (see link.ld), which is mapped
+// non-cacheable: for buffers the GPU or a DMA channel reads or writes in
+// place, such as mailbox requests and DMA control blocks
+#define MMU_UNCACHED                __attribute__((section(".uncached")))
+
+// Function prototypes
+void mmu_init();
+void mmu_uncached(void *start, unsigned long size);
+int mmu_mapped(const void *address);
+void mmu_clean(const void *start, unsigned long size);
+void mmu_invalidate(void *start, unsigned long size);
+void mmu_clean_invalidate(void *start, unsigned long size);
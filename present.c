@@ -0,0 +1,338 @@
+// The functions in this file present frames in step with the display's
+// vertical sync. Each present is an asynchronous mailbox request with the
+// wait-for-vsync property tag, which the firmware only answers once the
+// vsync has happened. The completion interrupt timestamps the vsync, so
+// rendering of the next frame can overlap the wait. Firmware without the
+// vsync tag (such as Qemu) is detected, and presents are then paced with
+// the timer instead.
+//
+// When the screen has two pages (see framebuffer.c), each frame is composed
+// into the page not on show, the back page, and the same request that
+// waits for the vsync moves the display's virtual offset to it, so the
+// display never scans out a page that is being written. Because the
+// firmware handles the tags in order, the flip takes effect at the vsync
+// that ends the request.
+
+#include "uart.h"
+#include "kprintf.h"
+#include "mailbox.h"
+#include "systimer.h"
+#include "present.h"
+#include "trace.h"
+#include "latency.h"
+#include "framebuffer.h"
+#include "irq.h"
+#include "mmu.h"
+
+// Index of the response code word of the wait-for-vsync tag in the
+// request buffer. Bit 31 is set by the firmware if it handled the tag.
+#define VSYNC_TAG_RESPONSE     9
+#define TAG_RESPONSE           0x80000000
+
+// The request buffer for the present in flight. It must be quadword
+// aligned, since the channel is encoded in the low 4 bits of its address,
+// and uncached, like all mailbox buffers (see mailbox.c).
+static volatile unsigned int __attribute__((aligned(16))) MMU_UNCACHED presentBuffer[12];
+
+// Token of the present in flight, or -1 if there is none
+static int presentToken = -1;
+
+// The screen page the next frame is composed into. The display starts on
+// page 0, so with two pages the first frame goes to page 1.
+static unsigned int backPage = 1;
+
+// Presents the mailbox could not queue. The frame is then not shown.
+static unsigned int failedPresents;
+
+// Time the current present was submitted, and of the last vsync
+static unsigned long submitTime;
+static volatile unsigned long lastVsync;
+
+// Presentation statistics. These are updated from the mailbox interrupt.
+static volatile struct present_stats stats = { .vsyncSupported = 1 };
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       record_vsync
+//
+//  Arguments:      now:         The time of the vsync, in microseconds
+//
+//  Returns:        void
+//
+//  Description:    This function updates the presentation statistics for a
+//                  present that completed at the given time. Vsyncs missed
+//                  since the previous present are counted by rounding the
+//                  interval to a whole number of display periods.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void record_vsync(unsigned long now)
+{
+    unsigned int interval, periods, presentTime;
+
+    if (lastVsync) {
+        interval = now - lastVsync;
+        stats.lastFrameTime = interval;
+        if (interval > stats.maxFrameTime) {
+            stats.maxFrameTime = interval;
+        }
+
+        periods = (interval + PRESENT_PERIOD_US / 2) / PRESENT_PERIOD_US;
+        if (periods > 1) {
+            stats.missedVsyncs += periods - 1;
+        }
+    }
+
+    presentTime = now - submitTime;
+    stats.lastPresentTime = presentTime;
+    if (presentTime > stats.maxPresentTime) {
+        stats.maxPresentTime = presentTime;
+    }
+
+    stats.frames++;
+    lastVsync = now;
+
+    trace(TRACE_VSYNC, presentTime, 0);
+    latency_vsync(now);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       vsync_done
+//
+//  Arguments:      buffer:      The completed request buffer
+//                  success:     TRUE if the firmware gave a valid response
+//                  context:     Unused
+//
+//  Returns:        void
+//
+//  Description:    This is the mailbox completion callback for a present.
+//                  It runs in the mailbox interrupt as soon as the firmware
+//                  answers, which is at vsync if the tag is supported.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void vsync_done(volatile unsigned int *buffer, int success, void *context)
+{
+    // If the firmware did not handle the tag, the response came back
+    // without waiting, so switch over to timer pacing
+    if (!success || !(buffer[VSYNC_TAG_RESPONSE] & TAG_RESPONSE)) {
+        stats.vsyncSupported = 0;
+    }
+
+    record_vsync(get_timer_counter());
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       present_wait
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function waits for the present in flight, if there
+//                  is one, to reach its vsync. Once it returns, the page the
+//                  display showed before that vsync is free to be composed
+//                  into, so main() calls it before compose_frame().
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void present_wait()
+{
+    if (presentToken >= 0) {
+        mailbox_wait(presentToken);
+        presentToken = -1;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       present_back_buffer
+//
+//  Arguments:      none
+//
+//  Returns:        The address of the first pixel of the back page
+//
+//  Description:    This function returns the screen page the next frame is
+//                  composed into. With a single page, this is the page on
+//                  show.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int *present_back_buffer()
+{
+    if (screenPages < 2) {
+        return screenBuffer;
+    }
+
+    return (unsigned int *)((unsigned char *)screenBuffer +
+                            backPage * frameBufferHeight * screenPitch);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       present_frame
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function presents the frame that has just been
+//                  composed into the back page. It first waits for the
+//                  previous present to reach its vsync, so at most one
+//                  present is ever in flight, and then submits a new one
+//                  that flips to the back page and returns immediately.
+//                  Calling it once per iteration of the main loop therefore
+//                  paces the loop to the display refresh rate. If the
+//                  present cannot be submitted, the loop is paced with the
+//                  timer instead, and the pages are not flipped.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void present_frame()
+{
+    unsigned long now, target, flags;
+    int token;
+
+    // Wait for the previous present to complete
+    present_wait();
+
+    // Without a vsync from the firmware, wait until one display
+    // period has passed since the previous frame
+    if (!stats.vsyncSupported) {
+        now = get_timer_counter();
+        target = lastVsync + PRESENT_PERIOD_US;
+        if (now < target) {
+            microsecond_delay(target - now);
+        }
+    }
+
+    // Show the back page, then wait for vsync
+    presentBuffer[0] = 12 * 4;
+    presentBuffer[1] = MAILBOX_REQUEST;
+
+    presentBuffer[2] = TAG_SET_VIRTUAL_OFFSET;
+    presentBuffer[3] = 8;
+    presentBuffer[4] = 0;
+    presentBuffer[5] = 0;
+    presentBuffer[6] = screenPages < 2 ? 0 : backPage * frameBufferHeight;
+
+    presentBuffer[7] = TAG_WAIT_FOR_VSYNC;
+    presentBuffer[8] = 4;
+    presentBuffer[9] = 0;
+    presentBuffer[10] = 0;
+
+    presentBuffer[11] = TAG_LAST;
+
+    // Keep the completion interrupt out until the present is recorded as
+    // submitted, so it cannot report the vsync first
+    flags = irq_save();
+    now = get_timer_counter();
+    token = mailbox_submit(presentBuffer, CHANNEL_PROPERTY_TAGS_ARMTOVC,
+                           vsync_done, 0);
+    if (token >= 0) {
+        submitTime = now;
+        latency_submitted();
+    }
+    irq_restore(flags);
+
+    if (token < 0) {
+        // Nothing will report this frame's vsync, so wait out the
+        // display period here rather than run the loop flat out
+        failedPresents++;
+        target = lastVsync + PRESENT_PERIOD_US;
+        if (now < target) {
+            microsecond_delay(target - now);
+        }
+        lastVsync = get_timer_counter();
+        return;
+    }
+
+    presentToken = token;
+    backPage ^= 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       present_last_vsync
+//
+//  Arguments:      none
+//
+//  Returns:        The time of the most recent vsync, in microseconds
+//
+//  Description:    This function returns when the last presented frame
+//                  became visible.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned long present_last_vsync()
+{
+    return lastVsync;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       present_get_stats
+//
+//  Arguments:      out:         Where to copy the statistics
+//
+//  Returns:        void
+//
+//  Description:    This function copies the current presentation statistics.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void present_get_stats(struct present_stats *out)
+{
+    out->frames = stats.frames;
+    out->missedVsyncs = stats.missedVsyncs;
+    out->lastPresentTime = stats.lastPresentTime;
+    out->maxPresentTime = stats.maxPresentTime;
+    out->lastFrameTime = stats.lastFrameTime;
+    out->maxFrameTime = stats.maxFrameTime;
+    out->vsyncSupported = stats.vsyncSupported;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       present_report
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes the presentation statistics to the
+//                  console terminal, and resets the worst-case times.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void present_report()
+{
+    log_info("Present: frames %u missed vsyncs %u frame us %u (max %u) "
+             "present us %u (max %u) failed %u%s\n",
+             stats.frames, stats.missedVsyncs,
+             stats.lastFrameTime, stats.maxFrameTime,
+             stats.lastPresentTime, stats.maxPresentTime, failedPresents,
+             stats.vsyncSupported ? "" : " timer paced");
+
+    stats.maxFrameTime = 0;
+    stats.maxPresentTime = 0;
+}
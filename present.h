@@ -0,0 +1,23 @@
+// Nominal display refresh period, in microseconds (60 Hz)
+#define PRESENT_PERIOD_US      16667
+
+// Frame presentation statistics. Times are in microseconds. A present
+// starts when present_frame() submits it, and ends at the vertical sync
+// that makes the frame visible.
+struct present_stats {
+    unsigned int frames;           // Presents completed
+    unsigned int missedVsyncs;     // Vsyncs that passed without a present
+    unsigned int lastPresentTime;  // Submit-to-vsync time of the last frame
+    unsigned int maxPresentTime;   // Worst submit-to-vsync time
+    unsigned int lastFrameTime;    // Time between the last two vsyncs
+    unsigned int maxFrameTime;     // Worst time between two vsyncs
+    unsigned int vsyncSupported;   // FALSE if the firmware ignores the tag
+};
+
+// Function prototypes
+void present_wait();
+unsigned int *present_back_buffer();
+void present_frame();
+unsigned long present_last_vsync();
+void present_get_stats(struct present_stats *stats);
+void present_report();
@@ -0,0 +1,315 @@
+// The functions in this file implement the operations of the QOI ("Quite
+// OK Image") format: runs of the previous pixel, references into a
+// 64-entry table of recently seen pixels, small per-channel differences,
+// and literal pixels. Line art and flat colour areas mostly become runs
+// and table references, so they compress well, and both directions take
+// a single pass with no buffering.
+//
+// Only the operation stream is handled here, without the file header and
+// end marker, so the same code can encode a chunk of the framebuffer for
+// the serial link, or decode an image straight into framebuffer rows.
+// The encoder and decoder can both stop and resume at any pixel, which
+// lets callers work one row (or part of a row) at a time.
+
+#include "qoi.h"
+
+// Operation tags
+#define QOI_OP_INDEX    0x00    // 00xxxxxx
+#define QOI_OP_DIFF     0x40    // 01xxxxxx
+#define QOI_OP_LUMA     0x80    // 10xxxxxx
+#define QOI_OP_RUN      0xC0    // 11xxxxxx
+#define QOI_OP_RGB      0xFE
+#define QOI_OP_RGBA     0xFF
+
+// Runs are 1 to 62 pixels long (63 and 64 would collide with the RGB and
+// RGBA tags)
+#define QOI_MAX_RUN     62
+
+// Channel extraction
+#define RED(p)          (((p) >> 16) & 0xFF)
+#define GREEN(p)        (((p) >> 8) & 0xFF)
+#define BLUE(p)         ((p) & 0xFF)
+#define ALPHA(p)        ((p) >> 24)
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       hash
+//
+//  Arguments:      pixel:       A 0xAARRGGBB pixel
+//
+//  Returns:        The pixel's position in the index table
+//
+//  Description:    This function computes the QOI colour hash.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned int hash(unsigned int pixel)
+{
+    return (RED(pixel) * 3 + GREEN(pixel) * 5 + BLUE(pixel) * 7 +
+            ALPHA(pixel) * 11) & 63;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       qoi_reset
+//
+//  Arguments:      state:       The encoder or decoder state
+//
+//  Returns:        void
+//
+//  Description:    This function resets the state to the start of a QOI
+//                  stream: an empty index, and an opaque black previous
+//                  pixel.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void qoi_reset(struct qoi_state *state)
+{
+    int i;
+
+    for (i = 0; i < 64; i++) {
+        state->index[i] = 0;
+    }
+    state->previous = 0xFF000000;
+    state->run = 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       qoi_encode
+//
+//  Arguments:      state:       The encoder state
+//                  pixels:      The pixels to encode
+//                  count:       The number of pixels
+//                  consumed:    Set to the number of pixels encoded
+//                  out:         Where to write the operations
+//                  space:       The number of bytes available at out
+//
+//  Returns:        The number of bytes written
+//
+//  Description:    This function encodes pixels until they have all been
+//                  encoded, or fewer than QOI_MAX_OP + 1 bytes of space are
+//                  left (one more byte is kept for the final run). A run
+//                  may still be pending when it returns; it is continued by
+//                  the next call, or written by qoi_encode_flush().
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int qoi_encode(struct qoi_state *state, const unsigned int *pixels,
+                        unsigned int count, unsigned int *consumed,
+                        unsigned char *out, unsigned int space)
+{
+    unsigned char *p = out, *end = out + space;
+    unsigned int previous = state->previous;
+    unsigned int run = state->run;
+    unsigned int pixel, h, i;
+    int dr, dg, db, drg, dbg;
+
+    for (i = 0; i < count; i++) {
+        if (end - p < QOI_MAX_OP + 1) {
+            break;
+        }
+
+        pixel = pixels[i];
+
+        if (pixel == previous) {
+            if (++run == QOI_MAX_RUN) {
+                *p++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+            continue;
+        }
+
+        if (run) {
+            *p++ = QOI_OP_RUN | (run - 1);
+            run = 0;
+        }
+
+        h = hash(pixel);
+        if (state->index[h] == pixel) {
+            *p++ = QOI_OP_INDEX | h;
+        } else {
+            state->index[h] = pixel;
+
+            if (ALPHA(pixel) == ALPHA(previous)) {
+                dr = (signed char)(RED(pixel) - RED(previous));
+                dg = (signed char)(GREEN(pixel) - GREEN(previous));
+                db = (signed char)(BLUE(pixel) - BLUE(previous));
+                drg = dr - dg;
+                dbg = db - dg;
+
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 &&
+                    db >= -2 && db <= 1) {
+                    *p++ = QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2);
+                } else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 &&
+                           dbg >= -8 && dbg <= 7) {
+                    *p++ = QOI_OP_LUMA | (dg + 32);
+                    *p++ = ((drg + 8) << 4) | (dbg + 8);
+                } else {
+                    *p++ = QOI_OP_RGB;
+                    *p++ = RED(pixel);
+                    *p++ = GREEN(pixel);
+                    *p++ = BLUE(pixel);
+                }
+            } else {
+                *p++ = QOI_OP_RGBA;
+                *p++ = RED(pixel);
+                *p++ = GREEN(pixel);
+                *p++ = BLUE(pixel);
+                *p++ = ALPHA(pixel);
+            }
+        }
+
+        previous = pixel;
+    }
+
+    state->previous = previous;
+    state->run = run;
+    *consumed = i;
+
+    return p - out;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       qoi_encode_flush
+//
+//  Arguments:      state:       The encoder state
+//                  out:         Where to write the operation (1 byte)
+//
+//  Returns:        The number of bytes written (0 or 1)
+//
+//  Description:    This function writes the pending run, if there is one.
+//                  It is called at the end of a stream or chunk.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int qoi_encode_flush(struct qoi_state *state, unsigned char *out)
+{
+    if (state->run == 0) {
+        return 0;
+    }
+
+    *out = QOI_OP_RUN | (state->run - 1);
+    state->run = 0;
+
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       qoi_decode
+//
+//  Arguments:      state:       The decoder state
+//                  in:          The operations to decode
+//                  length:      The number of bytes at in
+//                  used:        Set to the number of bytes decoded
+//                  pixels:      Where to write the pixels
+//                  count:       The number of pixels wanted
+//
+//  Returns:        The number of pixels written
+//
+//  Description:    This function decodes pixels until count pixels have
+//                  been written, or the input runs out. A run that goes
+//                  past count is kept in the state and continued by the
+//                  next call. An operation cut short by the end of the
+//                  input is left unused.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int qoi_decode(struct qoi_state *state, const unsigned char *in,
+                        unsigned int length, unsigned int *used,
+                        unsigned int *pixels, unsigned int count)
+{
+    const unsigned char *p = in, *end = in + length;
+    unsigned int pixel = state->previous;
+    unsigned int run = state->run;
+    unsigned int n = 0, b, b2;
+    int dg;
+
+    while (n < count) {
+        // Write out the rest of a run
+        if (run) {
+            while (run && n < count) {
+                pixels[n++] = pixel;
+                run--;
+            }
+            continue;
+        }
+
+        if (p >= end) {
+            break;
+        }
+        b = *p;
+
+        if (b == QOI_OP_RGB) {
+            if (end - p < 4) {
+                break;
+            }
+            pixel = (pixel & 0xFF000000) | (p[1] << 16) | (p[2] << 8) | p[3];
+            p += 4;
+        } else if (b == QOI_OP_RGBA) {
+            if (end - p < 5) {
+                break;
+            }
+            pixel = ((unsigned int)p[4] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+            p += 5;
+        } else {
+            switch (b & 0xC0) {
+            case QOI_OP_INDEX:
+                pixel = state->index[b];
+                p++;
+                break;
+
+            case QOI_OP_DIFF:
+                pixel = (pixel & 0xFF000000) |
+                        (((RED(pixel) + ((b >> 4) & 3) - 2) & 0xFF) << 16) |
+                        (((GREEN(pixel) + ((b >> 2) & 3) - 2) & 0xFF) << 8) |
+                        ((BLUE(pixel) + (b & 3) - 2) & 0xFF);
+                p++;
+                break;
+
+            case QOI_OP_LUMA:
+                if (end - p < 2) {
+                    goto done;
+                }
+                b2 = p[1];
+                dg = (int)(b & 0x3F) - 32;
+                pixel = (pixel & 0xFF000000) |
+                        (((RED(pixel) + dg + (int)(b2 >> 4) - 8) & 0xFF) << 16) |
+                        (((GREEN(pixel) + dg) & 0xFF) << 8) |
+                        ((BLUE(pixel) + dg + (int)(b2 & 0xF) - 8) & 0xFF);
+                p += 2;
+                break;
+
+            default:    // QOI_OP_RUN
+                run = (b & 0x3F) + 1;
+                p++;
+                break;
+            }
+        }
+
+        state->index[hash(pixel)] = pixel;
+        if (!run) {
+            pixels[n++] = pixel;
+        }
+    }
+
+done:
+    state->previous = pixel;
+    state->run = run;
+    *used = p - in;
+
+    return n;
+}
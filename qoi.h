@@ -0,0 +1,22 @@
+// The largest number of bytes a single QOI operation can produce
+#define QOI_MAX_OP              5
+
+// The state shared by consecutive calls when encoding or decoding a
+// stream of pixels in pieces (for example, one framebuffer row at a
+// time). Pixels are 32-bit 0xAARRGGBB values, as in the framebuffer.
+struct qoi_state {
+    unsigned int index[64];         // Recently seen pixels, by hash
+    unsigned int previous;          // The last pixel
+    unsigned int run;               // Pixels repeating previous not yet
+                                    // written (encoder) or returned (decoder)
+};
+
+// Function prototypes
+void qoi_reset(struct qoi_state *state);
+unsigned int qoi_encode(struct qoi_state *state, const unsigned int *pixels,
+                        unsigned int count, unsigned int *consumed,
+                        unsigned char *out, unsigned int space);
+unsigned int qoi_encode_flush(struct qoi_state *state, unsigned char *out);
+unsigned int qoi_decode(struct qoi_state *state, const unsigned char *in,
+                        unsigned int length, unsigned int *used,
+                        unsigned int *pixels, unsigned int count);
@@ -0,0 +1,324 @@
+// The functions in this file fill shapes: polygons, circles and rounded
+// rectangles. Each is drawn as horizontal spans passed to fillSpan(), so
+// a filled shape costs one write per pixel and reads nothing back, unlike
+// drawing an outline and flood filling it.
+//
+// A pixel belongs to a polygon if its centre is inside. Polygons are
+// scan converted with an active-edge table: the edges are sorted by their
+// top row, and each row the edges that cross it are kept sorted by where
+// they cross, so the spans are the stretches between crossings that the
+// fill rule counts as inside. Each edge steps down one row at a time with
+// an exact integer DDA, so pixels whose centres lie exactly on an edge are
+// decided the same way on every row.
+
+#include "framebuffer.h"
+#include "raster.h"
+
+// A polygon edge, directed downwards. On each row it crosses, the pixels
+// from x onwards have their centres at or right of the edge. x + remainder /
+// denominator is where the edge crosses the centre line of the row, less
+// half a pixel.
+struct raster_edge {
+    int top, bottom;                // It crosses rows top to bottom - 1
+    int winding;                    // +1 if drawn downwards, -1 if upwards
+    int x, remainder;               // The whole part, and the fraction
+    int step, stepRemainder;        // The change per row
+    int denominator;
+};
+
+static struct raster_edge edges[RASTER_MAX_POINTS];
+static struct raster_edge *active[RASTER_MAX_POINTS];
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       edgeStart
+//
+//  Arguments:      edge:        The edge, with top and bottom set
+//                  xa, xb:      The x of its top and bottom ends
+//                  y:           The first row to fill
+//
+//  Returns:        void
+//
+//  Description:    This function works out where an edge crosses row y,
+//                  and how far it moves from row to row, as fractions
+//                  with a denominator of twice its height.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void edgeStart(struct raster_edge *edge, int xa, int xb, int y)
+{
+    long height = edge->bottom - edge->top, denominator = 2 * height;
+    long position, step = 2 * (long)(xb - xa);
+
+    // 2 * height * (xa - 1/2 + (y - top + 1/2) * (xb - xa) / height)
+    position = 2 * xa * height - height + (2 * (long)(y - edge->top) + 1) * (xb - xa);
+
+    edge->denominator = denominator;
+    edge->x = position / denominator;
+    edge->remainder = position % denominator;
+    if (edge->remainder < 0) {
+        edge->x--;
+        edge->remainder += denominator;
+    }
+    edge->step = step / denominator;
+    edge->stepRemainder = step % denominator;
+    if (edge->stepRemainder < 0) {
+        edge->step--;
+        edge->stepRemainder += denominator;
+    }
+
+    // Round up to the first pixel centre at or right of the edge
+    if (edge->remainder) {
+        edge->x++;
+        edge->remainder -= denominator;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       edgeStep
+//
+//  Arguments:      edge:        The edge
+//
+//  Returns:        void
+//
+//  Description:    This function moves an edge down one row.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline void edgeStep(struct raster_edge *edge)
+{
+    // remainder is kept in (-denominator, 0], so that x is always rounded
+    // up
+    edge->x += edge->step;
+    edge->remainder += edge->stepRemainder;
+    if (edge->remainder > 0) {
+        edge->x++;
+        edge->remainder -= edge->denominator;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillPolygon
+//
+//  Arguments:      points:      The vertices, as x, y pairs (-32768 to
+//                               32767); the last is joined to the first
+//                  count:       The number of vertices (3 to
+//                               RASTER_MAX_POINTS)
+//                  rule:        RASTER_EVEN_ODD or RASTER_NON_ZERO
+//                  colour:      The fill colour
+//
+//  Returns:        void
+//
+//  Description:    This function fills a polygon, which may be concave or
+//                  cross itself, clipped to the screen.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void fillPolygon(const int *points, unsigned int count, unsigned int rule,
+                 unsigned int colour)
+{
+    struct raster_edge *edge, swap;
+    unsigned int edgeCount = 0, activeCount = 0, next = 0, i, j;
+    int xa, ya, xb, yb, y, winding, inside, wasInside, left = 0;
+
+    if (count < 3 || count > RASTER_MAX_POINTS) {
+        return;
+    }
+
+    // Build the edge table, leaving out horizontal edges, which cross no
+    // row centres
+    for (i = 0; i < count; i++) {
+        j = (i + 1 == count) ? 0 : i + 1;
+        xa = points[2 * i];
+        ya = points[2 * i + 1];
+        xb = points[2 * j];
+        yb = points[2 * j + 1];
+        if (ya == yb) {
+            continue;
+        }
+
+        edge = &edges[edgeCount++];
+        edge->winding = 1;
+        if (ya > yb) {
+            xa = points[2 * j];
+            ya = points[2 * j + 1];
+            xb = points[2 * i];
+            yb = points[2 * i + 1];
+            edge->winding = -1;
+        }
+        edge->top = ya;
+        edge->bottom = yb;
+        edgeStart(edge, xa, xb, (ya < 0) ? 0 : ya);
+    }
+
+    if (edgeCount == 0) {
+        return;
+    }
+
+    // Sort it by top row
+    for (i = 1; i < edgeCount; i++) {
+        swap = edges[i];
+        for (j = i; j > 0 && edges[j - 1].top > swap.top; j--) {
+            edges[j] = edges[j - 1];
+        }
+        edges[j] = swap;
+    }
+
+    for (y = (edges[0].top < 0) ? 0 : edges[0].top; y < (int)frameBufferHeight; y++) {
+        // Add the edges that start on this row (or above the screen)
+        while (next < edgeCount && edges[next].top <= y) {
+            edge = &edges[next++];
+            if (edge->bottom > y) {
+                active[activeCount++] = edge;
+            }
+        }
+
+        // Drop the edges that ended on the row above
+        for (i = j = 0; i < activeCount; i++) {
+            if (active[i]->bottom > y) {
+                active[j++] = active[i];
+            }
+        }
+        activeCount = j;
+
+        if (activeCount == 0) {
+            if (next == edgeCount) {
+                break;
+            }
+            y = edges[next].top - 1;
+            continue;
+        }
+
+        // Sort the active edges by x. They were sorted on the row above
+        // and only swap where edges cross, so this is nearly linear.
+        for (i = 1; i < activeCount; i++) {
+            edge = active[i];
+            for (j = i; j > 0 && active[j - 1]->x > edge->x; j--) {
+                active[j] = active[j - 1];
+            }
+            active[j] = edge;
+        }
+
+        // Fill between the crossings where the rule says the row is inside
+        winding = 0;
+        wasInside = 0;
+        for (i = 0; i < activeCount; i++) {
+            edge = active[i];
+            winding += (rule == RASTER_NON_ZERO) ? edge->winding : 1;
+            inside = (rule == RASTER_NON_ZERO) ? winding != 0 : winding & 1;
+            if (inside && !wasInside) {
+                left = edge->x;
+            } else if (!inside && wasInside) {
+                fillSpan(left, edge->x - 1, y, colour);
+            }
+            wasInside = inside;
+
+            edgeStep(edge);
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillCircle
+//
+//  Arguments:      x, y:        The centre of the circle
+//                  radius:      The radius in pixels
+//                  colour:      The fill colour
+//
+//  Returns:        void
+//
+//  Description:    This function fills the pixels within radius + 1/2 of
+//                  the centre, clipped to the screen, one span per row. The
+//                  half widths are found incrementally, without square
+//                  roots.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void fillCircle(int x, int y, int radius, unsigned int colour)
+{
+    long limit = (long)radius * radius + radius;
+    int dx = radius, dy;
+
+    if (radius < 0) {
+        return;
+    }
+
+    for (dy = 0; dy <= radius; dy++) {
+        while ((long)dx * dx + (long)dy * dy > limit) {
+            dx--;
+        }
+        fillSpan(x - dx, x + dx, y - dy, colour);
+        if (dy != 0) {
+            fillSpan(x - dx, x + dx, y + dy, colour);
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fillRoundRect
+//
+//  Arguments:      x, y:        The top left corner of the rectangle
+//                  width:       The width of the rectangle in pixels
+//                  height:      The height of the rectangle in pixels
+//                  radius:      The radius of the corners, at most half
+//                               the width and height
+//                  colour:      The fill colour
+//
+//  Returns:        void
+//
+//  Description:    This function fills a rectangle with corners rounded
+//                  like fillCircle() rounds a circle, clipped to the screen,
+//                  one span per row.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void fillRoundRect(int x, int y, int width, int height, int radius,
+                   unsigned int colour)
+{
+    long limit;
+    int dx, dy;
+
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+    if (radius > width / 2) {
+        radius = width / 2;
+    }
+    if (radius > height / 2) {
+        radius = height / 2;
+    }
+    if (radius < 0) {
+        radius = 0;
+    }
+
+    // The corner rows, working outwards from the centres of the corners
+    limit = (long)radius * radius + radius;
+    dx = radius;
+    for (dy = 1; dy <= radius; dy++) {
+        while ((long)dx * dx + (long)dy * dy > limit) {
+            dx--;
+        }
+        fillSpan(x + radius - dx, x + width - 1 - radius + dx,
+                 y + radius - dy, colour);
+        fillSpan(x + radius - dx, x + width - 1 - radius + dx,
+                 y + height - 1 - radius + dy, colour);
+    }
+
+    // The straight part between them
+    fillRect(x, y + radius, width, height - 2 * radius, colour);
+}
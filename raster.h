@@ -0,0 +1,15 @@
+// Fill rules for fillPolygon(): a pixel is inside if a ray from it crosses
+// the outline an odd number of times (EVEN_ODD), or if the outline winds
+// around it a non-zero number of times (NON_ZERO)
+#define RASTER_EVEN_ODD             0
+#define RASTER_NON_ZERO             1
+
+// Most vertices of a polygon
+#define RASTER_MAX_POINTS           256
+
+// Function prototypes
+void fillPolygon(const int *points, unsigned int count, unsigned int rule,
+                 unsigned int colour);
+void fillCircle(int x, int y, int radius, unsigned int colour);
+void fillRoundRect(int x, int y, int width, int height, int radius,
+                   unsigned int colour);
@@ -0,0 +1,559 @@
+// The functions in this file keep an index of the connected regions of
+// the canvas, so that a flood fill (see fill.c) can look its region up
+// instead of exploring it pixel by pixel.
+//
+// Each canvas row is kept as its runs of one colour (spans), and the
+// spans are grouped into regions by union-find: two spans belong to the
+// same region if they are next to each other in a row, or overlap in
+// neighbouring rows, and have the same colour. These are the regions an
+// exact, 4-connected fill replaces. As in the fill, the alpha byte is
+// ignored.
+//
+// The index is brought up to date when a fill asks for it, not every time
+// the canvas changes. The canvas functions that write pixels mark the
+// rows they may write (regionDamage(), regionDamageTile()); only the
+// marked rows are read back and run-length encoded again, and the spans
+// of the other rows are copied over. A change can split a region, which
+// union-find cannot undo, so after one the spans are grouped again from
+// scratch, in time proportional to the number of spans rather than of
+// pixels. A fill can only merge regions, so after one the index recolours
+// the region's spans itself, without reading its rows back.
+//
+// A canvas with more spans than the index holds is not read in whole
+// again after every change, which would make each fill slower than
+// searching. Instead the index keeps the number of spans in each row, and
+// only counts the spans of the rows marked since, until the canvas would
+// fit again (after a clear, say). A snapshot restore or a load, which
+// rewrites every row, starts the index afresh (regionReset()).
+
+#include "framebuffer.h"
+#include "kprintf.h"
+#include "canvas.h"
+#include "region.h"
+
+// A run of pixels of one colour in a row
+struct region_span {
+    unsigned short x0, x1;          // The first and last pixel
+    unsigned int colour;            // Without the alpha byte
+};
+
+// Two copies of the spans, each with the index of the first span of every
+// row (and one past the last row): the current one, and the one the next
+// update builds from it
+static struct region_span spans[2][REGION_MAX_SPANS];
+static unsigned int rowStart[2][REGION_MAX_ROWS + 1];
+static unsigned int current;
+
+// The union-find forest over the current spans. Once grouping is done,
+// every span's parent is the root of its region.
+static unsigned int parent[REGION_MAX_SPANS];
+
+// Rows written since they were last read, a byte each, so that cores can
+// mark rows of their own bands at the same time (see fill.c)
+static volatile unsigned char dirtyRows[REGION_MAX_ROWS];
+static volatile int dirty;
+
+// The state of the index: every row has been read into the current
+// spans; parent[] groups the current spans; the canvas had too many spans
+// the last time it was read
+static int built, grouped, tooMany;
+
+// While the canvas has too many spans, the spans in each row and in all
+static unsigned int rowSpans[REGION_MAX_ROWS];
+static unsigned int totalSpans;
+
+// The region regionComponent() last returned
+static unsigned int lastRoot;
+
+// A row of the canvas being read
+static unsigned int line[CANVAS_MAX_TILE_COLUMNS * CANVAS_TILE_SIZE];
+
+// Statistics
+static unsigned int lookups, fallbacks, rowsRead, groupings;
+static unsigned int wastedRebuilds, skippedRebuilds;
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       regionFind
+//
+//  Arguments:      i:           A span
+//
+//  Returns:        The root of its region
+//
+//  Description:    This function follows a span's parents to the root,
+//                  halving the path on the way.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned int regionFind(unsigned int i)
+{
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       regionUnite
+//
+//  Arguments:      a, b:        Two spans
+//
+//  Returns:        void
+//
+//  Description:    This function merges the regions of two spans. The root
+//                  with the lower index becomes the root of both, so every
+//                  span's parent has a lower index than the span itself (or
+//                  is the span).
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline void regionUnite(unsigned int a, unsigned int b)
+{
+    a = regionFind(a);
+    b = regionFind(b);
+    if (a < b) {
+        parent[b] = a;
+    } else if (b < a) {
+        parent[a] = b;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       regionGroup
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function groups the current spans into regions. In
+//                  each row it unites neighbouring spans of the same colour,
+//                  and walks the spans of the row above along with it to
+//                  unite the overlapping ones. Then it points every span
+//                  straight at its root.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void regionGroup()
+{
+    const struct region_span *s = spans[current];
+    const unsigned int *start = rowStart[current];
+    unsigned int count = start[frameBufferHeight], a, b, i, y;
+
+    for (i = 0; i < count; i++) {
+        parent[i] = i;
+    }
+
+    for (y = 0; y < frameBufferHeight; y++) {
+        for (i = start[y] + 1; i < start[y + 1]; i++) {
+            if (s[i].colour == s[i - 1].colour) {
+                regionUnite(i - 1, i);
+            }
+        }
+        if (y == 0) {
+            continue;
+        }
+
+        // Both rows cover the whole width, so stepping past whichever span
+        // ends first visits every overlapping pair
+        a = start[y - 1];
+        b = start[y];
+        while (a < start[y] && b < start[y + 1]) {
+            if (s[a].colour == s[b].colour && s[a].x0 <= s[b].x1 && s[b].x0 <= s[a].x1) {
+                regionUnite(a, b);
+            }
+            if (s[a].x1 < s[b].x1) {
+                a++;
+            } else {
+                b++;
+            }
+        }
+    }
+
+    // Parents come before their children, so one pass flattens the forest
+    for (i = 0; i < count; i++) {
+        parent[i] = parent[parent[i]];
+    }
+
+    grouped = 1;
+    groupings++;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       regionCount
+//
+//  Arguments:      y:           A row
+//
+//  Returns:        The number of spans in the row
+//
+//  Description:    This function reads a row of the canvas back and counts
+//                  its spans, without keeping them.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned int regionCount(unsigned int y)
+{
+    unsigned int count = 1;
+    int x;
+
+    canvasRead(0, frameBufferWidth - 1, y, line);
+    rowsRead++;
+    for (x = 1; x < (int)frameBufferWidth; x++) {
+        if ((line[x] ^ line[x - 1]) & 0x00FFFFFF) {
+            count++;
+        }
+    }
+    return count;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       regionUpdate
+//
+//  Arguments:      none
+//
+//  Returns:        TRUE if the index is up to date, FALSE if the canvas has
+//                  too many spans to index
+//
+//  Description:    This function builds new spans from the current ones,
+//                  reading back the rows that have been written (or every
+//                  row, the first time) and copying the others with
+//                  neighbouring spans of the same colour joined. Then it
+//                  groups them, if anything changed. After the canvas had
+//                  too many spans, it only counts the spans of the rows
+//                  that have been written, until they fit again.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int regionUpdate()
+{
+    const struct region_span *from = spans[current];
+    struct region_span *to = spans[current ^ 1];
+    unsigned int *start = rowStart[current ^ 1];
+    unsigned int count = 0, colour, i, y;
+    int x, end;
+
+    if (!dirty) {
+        if (!built) {
+            return 0;
+        }
+        if (!grouped) {
+            regionGroup();
+        }
+        return 1;
+    }
+    dirty = 0;
+
+    if (tooMany) {
+        for (y = 0; y < frameBufferHeight; y++) {
+            if (dirtyRows[y]) {
+                dirtyRows[y] = 0;
+                totalSpans -= rowSpans[y];
+                rowSpans[y] = regionCount(y);
+                totalSpans += rowSpans[y];
+            }
+        }
+        if (totalSpans > REGION_MAX_SPANS) {
+            skippedRebuilds++;
+            return 0;
+        }
+
+        // The canvas fits again, so read every row
+        tooMany = 0;
+        built = 0;
+    }
+
+    for (y = 0; y < frameBufferHeight; y++) {
+        start[y] = count;
+
+        if (!built || dirtyRows[y]) {
+            dirtyRows[y] = 0;
+            canvasRead(0, frameBufferWidth - 1, y, line);
+            rowsRead++;
+            for (x = 0; x < (int)frameBufferWidth; x = end) {
+                colour = line[x] & 0x00FFFFFF;
+                for (end = x + 1; end < (int)frameBufferWidth &&
+                                  (line[end] & 0x00FFFFFF) == colour; end++) {
+                }
+                if (count == REGION_MAX_SPANS) {
+                    goto overflow;
+                }
+                to[count].x0 = x;
+                to[count].x1 = end - 1;
+                to[count].colour = colour;
+                count++;
+            }
+            continue;
+        }
+
+        for (i = rowStart[current][y]; i < rowStart[current][y + 1]; i++) {
+            if (count > start[y] && to[count - 1].colour == from[i].colour) {
+                to[count - 1].x1 = from[i].x1;
+                continue;
+            }
+            if (count == REGION_MAX_SPANS) {
+                goto overflow;
+            }
+            to[count++] = from[i];
+        }
+    }
+    start[frameBufferHeight] = count;
+
+    current ^= 1;
+    built = 1;
+    tooMany = 0;
+    regionGroup();
+    return 1;
+
+overflow:
+    // Count the spans of every row, those read so far and the rest, so
+    // that later updates only need to count the rows written since
+    totalSpans = 0;
+    for (i = 0; i < frameBufferHeight; i++) {
+        dirtyRows[i] = 0;
+        rowSpans[i] = i < y ? start[i + 1] - start[i] : regionCount(i);
+        totalSpans += rowSpans[i];
+    }
+    built = 0;
+    tooMany = 1;
+    wastedRebuilds++;
+    return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       regionDamage
+//
+//  Arguments:      y0, y1:      The first and last row that may have been
+//                               written
+//
+//  Returns:        void
+//
+//  Description:    This function is called by canvasSpan(),
+//                  canvasWrite(), canvasFill() and canvasFillTile(), and
+//                  marks rows to be read back by the next update. It is
+//                  cheap enough to be called per pixel, and cores may call
+//                  it at the same time.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void regionDamage(int y0, int y1)
+{
+    int y;
+
+    if (!REGION_INDEX) {
+        return;
+    }
+
+    if (y1 >= REGION_MAX_ROWS) {
+        y1 = REGION_MAX_ROWS - 1;
+    }
+    for (y = y0; y <= y1; y++) {
+        dirtyRows[y] = 1;
+    }
+    dirty = 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       regionDamageTile
+//
+//  Arguments:      ty:          The tile row of a tile made solid
+//
+//  Returns:        void
+//
+//  Description:    This function is called by canvasFillTile(). It marks
+//                  the tile's rows like regionDamage().
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void regionDamageTile(unsigned int ty)
+{
+    if (!REGION_INDEX) {
+        return;
+    }
+
+    regionDamage(ty << CANVAS_TILE_SHIFT, (ty << CANVAS_TILE_SHIFT) + CANVAS_TILE_SIZE - 1);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       regionReset
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function is called once every row of the canvas
+//                  has been rewritten, by a snapshot restore or a load. It
+//                  drops the index, and whether the canvas had too many
+//                  spans, so that the next update reads every row.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void regionReset()
+{
+    if (!REGION_INDEX) {
+        return;
+    }
+
+    built = 0;
+    grouped = 0;
+    tooMany = 0;
+    dirty = 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       regionComponent
+//
+//  Arguments:      x, y:        A pixel (on the screen)
+//                  visit:       Called for every span of the pixel's region
+//
+//  Returns:        TRUE if the region was found, FALSE if the index cannot
+//                  be used (and visit was not called)
+//
+//  Description:    This function brings the index up to date and lists the
+//                  spans of the region a pixel is in: the pixels an exact,
+//                  4-connected flood fill from it would replace. It takes
+//                  time in proportion to the number of spans on the canvas,
+//                  whatever the size of the region.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int regionComponent(int x, int y, void (*visit)(int x0, int x1, int y))
+{
+    const struct region_span *s;
+    const unsigned int *start;
+    unsigned int low, high, middle, root, i;
+
+    if (!REGION_INDEX || frameBufferHeight > REGION_MAX_ROWS ||
+        (unsigned int)x >= frameBufferWidth || (unsigned int)y >= frameBufferHeight) {
+        return 0;
+    }
+    if (!regionUpdate()) {
+        fallbacks++;
+        return 0;
+    }
+
+    s = spans[current];
+    start = rowStart[current];
+
+    // The last span of the row that starts at or before x
+    low = start[y];
+    high = start[y + 1] - 1;
+    while (low < high) {
+        middle = (low + high + 1) / 2;
+        if (s[middle].x0 <= x) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    root = parent[low];
+
+    // A span's parent is never after it, so the region starts at its root
+    for (y = 0; start[y + 1] <= root; y++) {
+    }
+    for (i = root; i < start[frameBufferHeight]; i++) {
+        while (i >= start[y + 1]) {
+            y++;
+        }
+        if (parent[i] == root) {
+            visit(s[i].x0, s[i].x1, y);
+        }
+    }
+
+    lastRoot = root;
+    lookups++;
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       regionRecolour
+//
+//  Arguments:      colour:      The colour the region was filled with
+//
+//  Returns:        void
+//
+//  Description:    This function is called after the region
+//                  regionComponent() returned has been filled, with
+//                  nothing else drawn in between. It changes the colour of
+//                  the region's spans, so the rows the fill wrote need not
+//                  be read back. The region may now touch others of the
+//                  new colour, so the spans are grouped again by the next
+//                  update.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void regionRecolour(unsigned int colour)
+{
+    struct region_span *s = spans[current];
+    unsigned int count = rowStart[current][frameBufferHeight], i, y;
+
+    if (!REGION_INDEX || !built) {
+        return;
+    }
+
+    for (i = lastRoot; i < count; i++) {
+        if (parent[i] == lastRoot) {
+            s[i].colour = colour & 0x00FFFFFF;
+        }
+    }
+
+    // The index was up to date before the fill, and the fill only wrote
+    // the region
+    for (y = 0; y < frameBufferHeight; y++) {
+        dirtyRows[y] = 0;
+    }
+    dirty = 0;
+    grouped = 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       regionReport
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes the index statistics to the console
+//                  terminal.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void regionReport()
+{
+    log_info("Regions: %u spans, %u fills looked up, %u explored instead, "
+             "%u rows read, %u groupings, %u rebuilds overflowed, %u skipped\n",
+             built ? rowStart[current][frameBufferHeight] : 0, lookups,
+             fallbacks, rowsRead, groupings, wastedRebuilds, skippedRebuilds);
+}
@@ -0,0 +1,19 @@
+// Set to 0 to leave the region index out: floodFill() then always
+// explores the region pixel by pixel
+#define REGION_INDEX                1
+
+// Most spans the index holds. A canvas with more (a noisy photograph,
+// say) is not indexed, and fills explore it as before, until the rows
+// written since bring it under the limit again (a clear, say).
+#define REGION_MAX_SPANS            131072
+
+// Most canvas rows
+#define REGION_MAX_ROWS             2048
+
+// Function prototypes
+void regionDamage(int y0, int y1);
+void regionDamageTile(unsigned int ty);
+void regionReset();
+int regionComponent(int x, int y, void (*visit)(int x0, int x1, int y));
+void regionRecolour(unsigned int colour);
+void regionReport();
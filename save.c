@@ -0,0 +1,666 @@
+// The functions in this file keep canvases on the SD card, in the save
+// slots described in save.h, so that a drawing survives a reboot. The
+// host asks for a save or a load with a COMMAND_FRAME_SAVE request
+// (tools/save.py sends them), and save_update() carries it out a piece
+// at a time, at most SAVE_BUDGET_US per frame, so the main loop keeps
+// reading the controller and drawing while it goes on.
+//
+// A save QOI encodes the canvas row by row, as snapshot.c does, into
+// blocks written through the block cache (see bcache.c), flushes them to
+// the card, and only then writes the slot's header. A load first reads
+// the slot's data and checks its CRC, and only then decodes it into the
+// canvas, so a half-written or damaged slot leaves the canvas alone.
+// Drawing is not paused during a save, so rows drawn meanwhile may be
+// saved in either state. A load cannot be undone, so it forgets the undo
+// journal.
+
+#include "systimer.h"
+#include "kprintf.h"
+#include "framebuffer.h"
+#include "canvas.h"
+#include "region.h"
+#include "crc32.h"
+#include "qoi.h"
+#include "command.h"
+#include "stream.h"
+#include "compose.h"
+#include "undo.h"
+#include "emmc.h"
+#include "bcache.h"
+#include "save.h"
+
+// What save_update() is doing
+#define SAVE_IDLE                   0
+#define SAVE_WAITING                1   // For the card to be ready
+#define SAVE_ENCODING               2   // Encoding the canvas into blocks
+#define SAVE_FLUSHING               3   // Writing the blocks to the card
+#define SAVE_FINISHING              4   // Writing the header to the card
+#define SAVE_CHECKING               5   // Checking the CRC of a slot
+#define SAVE_DECODING               6   // Decoding a slot into the canvas
+
+// The MBR: the partition table, its entries, and the signature
+#define MBR_PARTITIONS              446
+#define MBR_ENTRY_SIZE              16
+#define MBR_SIGNATURE               510
+
+// The request in progress, and when it was made
+static unsigned int phase, action, slot;
+static unsigned long startTime;
+
+// Where the save slots start on the card, and how many there are
+static int partitionChecked;
+static unsigned int partitionStart, slots;
+
+// The canvas being encoded or decoded: the next pixel, the QOI state, the
+// length and CRC of the QOI data, the next data block of the slot, and
+// the bytes of the data read or written so far
+static unsigned int pixel;
+static struct qoi_state qoi;
+static unsigned int dataLength, dataCrc, crc;
+static unsigned int dataBlock, position;
+
+// QOI data waiting to be written in a whole block (save), or to be
+// decoded (load), a block read from the card, and a row of the canvas
+static unsigned int staging[2 * EMMC_BLOCK_SIZE / 4];
+static unsigned int stagingLength;
+static unsigned int block[EMMC_BLOCK_SIZE / 4];
+static unsigned int line[CANVAS_MAX_TILE_COLUMNS * CANVAS_TILE_SIZE];
+
+// Statistics
+static unsigned int saves, loads, failures;
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       get32
+//
+//  Arguments:      p:           A pointer to four bytes
+//
+//  Returns:        The little-endian 32-bit value at p
+//
+//  Description:    This function reads an unaligned 32-bit value.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned int get32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       put32
+//
+//  Arguments:      p:           Where to store the value
+//                  value:       The 32-bit value
+//
+//  Returns:        void
+//
+//  Description:    This function stores a little-endian 32-bit value.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline void put32(unsigned char *p, unsigned int value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       fail
+//
+//  Arguments:      reason:      Why the request failed
+//
+//  Returns:        void
+//
+//  Description:    This function abandons the request in progress.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void fail(const char *reason)
+{
+    log_warn("Save: %s slot %u failed: %s\n",
+             (action == SAVE_STORE) ? "saving" : "loading", slot, reason);
+    failures++;
+    phase = SAVE_IDLE;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       find_partition
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function looks for the save partition in the
+//                  card's MBR, and works out how many slots it holds.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void find_partition()
+{
+    const unsigned char *mbr = (const unsigned char *)block;
+    const unsigned char *entry;
+    unsigned int i;
+
+    partitionChecked = 1;
+    slots = 0;
+
+    if (!bcache_read(0, block) ||
+        mbr[MBR_SIGNATURE] != 0x55 || mbr[MBR_SIGNATURE + 1] != 0xAA) {
+        log_warn("Save: the SD card has no MBR\n");
+        return;
+    }
+
+    for (i = 0; i < 4; i++) {
+        entry = mbr + MBR_PARTITIONS + i * MBR_ENTRY_SIZE;
+        if (entry[4] == SAVE_PARTITION_TYPE) {
+            partitionStart = get32(entry + 8);
+            slots = get32(entry + 12) / SAVE_SLOT_BLOCKS;
+            if (slots > SAVE_SLOTS) {
+                slots = SAVE_SLOTS;
+            }
+            log_info("Save: %u slots at block %u\n", slots, partitionStart);
+            return;
+        }
+    }
+
+    log_warn("Save: the SD card has no partition of type 0x%x\n",
+             SAVE_PARTITION_TYPE);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       slot_block
+//
+//  Arguments:      index:       A block of the slot being used, 0 for the
+//                               header
+//
+//  Returns:        The block's number on the card
+//
+//  Description:    This function finds a block of the current slot.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned int slot_block(unsigned int index)
+{
+    return partitionStart + slot * SAVE_SLOT_BLOCKS + index;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       store_block
+//
+//  Arguments:      none
+//
+//  Returns:        TRUE if the block was stored
+//
+//  Description:    This function writes the first block of QOI data
+//                  waiting in the staging buffer into the slot, and moves
+//                  the rest up.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int store_block()
+{
+    unsigned char *bytes = (unsigned char *)staging;
+    unsigned int i;
+
+    if (dataBlock + 1 >= SAVE_SLOT_BLOCKS) {
+        fail("the canvas does not fit");
+        return 0;
+    }
+    if (!bcache_write(slot_block(1 + dataBlock), staging)) {
+        fail("write error");
+        return 0;
+    }
+    dataBlock++;
+
+    stagingLength -= EMMC_BLOCK_SIZE;
+    for (i = 0; i < stagingLength; i++) {
+        bytes[i] = bytes[EMMC_BLOCK_SIZE + i];
+    }
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       encode_row
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function QOI encodes the next row of the canvas
+//                  into the slot. After the last row, it ends the data
+//                  and pads its last block with zeroes.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void encode_row()
+{
+    unsigned char *bytes = (unsigned char *)staging;
+    unsigned int width = frameBufferWidth, done = 0, length, consumed;
+
+    // Solid canvas tiles are read as their colour
+    canvasRead(0, width - 1, pixel / width, line);
+
+    // There is always at least a block of room in the staging buffer, so
+    // every call encodes something
+    while (done < width) {
+        length = qoi_encode(&qoi, line + done, width - done, &consumed,
+                            bytes + stagingLength, sizeof(staging) - stagingLength);
+        crc = crc32(crc, bytes + stagingLength, length);
+        stagingLength += length;
+        dataLength += length;
+        done += consumed;
+
+        if (stagingLength >= EMMC_BLOCK_SIZE && !store_block()) {
+            return;
+        }
+    }
+
+    pixel += width;
+    if (pixel < width * frameBufferHeight) {
+        return;
+    }
+
+    length = qoi_encode_flush(&qoi, bytes + stagingLength);
+    crc = crc32(crc, bytes + stagingLength, length);
+    stagingLength += length;
+    dataLength += length;
+
+    if (stagingLength) {
+        while (stagingLength < EMMC_BLOCK_SIZE) {
+            bytes[stagingLength++] = 0;
+        }
+        if (!store_block()) {
+            return;
+        }
+    }
+    phase = SAVE_FLUSHING;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       flush
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes one dirty cache line to the card.
+//                  Once the data is all on the card, it writes the
+//                  slot's header, and once that is too, the save is done.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void flush()
+{
+    unsigned char *header = (unsigned char *)block;
+    unsigned int i;
+    int result = bcache_flush_line();
+
+    if (result < 0) {
+        fail("write error");
+        return;
+    }
+    if (result > 0) {
+        return;
+    }
+
+    if (phase == SAVE_FLUSHING) {
+        for (i = 0; i < EMMC_BLOCK_SIZE; i++) {
+            header[i] = 0;
+        }
+        put32(header, SAVE_MAGIC);
+        header[4] = frameBufferWidth;
+        header[5] = frameBufferWidth >> 8;
+        header[6] = frameBufferHeight;
+        header[7] = frameBufferHeight >> 8;
+        put32(header + 8, dataLength);
+        put32(header + 12, crc);
+        if (!bcache_write(slot_block(0), block)) {
+            fail("write error");
+            return;
+        }
+        phase = SAVE_FINISHING;
+        return;
+    }
+
+    saves++;
+    phase = SAVE_IDLE;
+    log_info("Save: saved slot %u, %u bytes in %u ms\n", slot, dataLength,
+             (unsigned int)(ticks_to_us(timer_ticks() - startTime) / 1000));
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       read_header
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function reads the header of the slot to load, and
+//                  starts checking its data if it holds a canvas the size
+//                  of this one.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void read_header()
+{
+    const unsigned char *header = (const unsigned char *)block;
+    unsigned int width, height;
+
+    if (!bcache_read(slot_block(0), block)) {
+        fail("read error");
+        return;
+    }
+    if (get32(header) != SAVE_MAGIC) {
+        fail("the slot is empty");
+        return;
+    }
+
+    width = header[4] | (header[5] << 8);
+    height = header[6] | (header[7] << 8);
+    dataLength = get32(header + 8);
+    dataCrc = get32(header + 12);
+    if (width != frameBufferWidth || height != frameBufferHeight) {
+        fail("the slot holds a canvas of another size");
+        return;
+    }
+    if (dataLength == 0 || dataLength > (SAVE_SLOT_BLOCKS - 1) * EMMC_BLOCK_SIZE) {
+        fail("the slot is damaged");
+        return;
+    }
+
+    crc = 0;
+    position = 0;
+    dataBlock = 0;
+    phase = SAVE_CHECKING;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       check_block
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function adds the next block of the slot to the
+//                  CRC of its data. After the last, it starts decoding the
+//                  slot into the canvas if the CRC matches.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void check_block()
+{
+    unsigned int length = dataLength - position;
+
+    if (length > EMMC_BLOCK_SIZE) {
+        length = EMMC_BLOCK_SIZE;
+    }
+    if (!bcache_read(slot_block(1 + dataBlock), block)) {
+        fail("read error");
+        return;
+    }
+    crc = crc32(crc, (const unsigned char *)block, length);
+    position += length;
+    dataBlock++;
+
+    if (position < dataLength) {
+        return;
+    }
+    if (crc != dataCrc) {
+        fail("the slot is damaged");
+        return;
+    }
+
+    undo_reset();
+    qoi_reset(&qoi);
+    pixel = 0;
+    position = 0;
+    dataBlock = 0;
+    stagingLength = 0;
+    phase = SAVE_DECODING;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       decode_block
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function reads the next block of the slot and
+//                  decodes it a row at a time into the canvas. An
+//                  operation cut off at the end of the block is kept for
+//                  the next.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void decode_block()
+{
+    unsigned char *bytes = (unsigned char *)staging;
+    const unsigned char *data = (const unsigned char *)block;
+    unsigned int width = frameBufferWidth, total = width * frameBufferHeight;
+    unsigned int length = dataLength - position, offset = 0;
+    unsigned int x, y, count, decoded, used, i;
+
+    if (length > EMMC_BLOCK_SIZE) {
+        length = EMMC_BLOCK_SIZE;
+    }
+    if (length) {
+        if (!bcache_read(slot_block(1 + dataBlock), block)) {
+            fail("read error");
+            return;
+        }
+        for (i = 0; i < length; i++) {
+            bytes[stagingLength + i] = data[i];
+        }
+        stagingLength += length;
+        position += length;
+        dataBlock++;
+    }
+
+    while (pixel < total) {
+        y = pixel / width;
+        x = pixel - y * width;
+        count = width - x;
+
+        decoded = qoi_decode(&qoi, bytes + offset, stagingLength - offset, &used,
+                             line, count);
+        if (decoded) {
+            canvasWrite(x, x + decoded - 1, y, line);
+            stream_damage(x, x + decoded - 1, y);
+            compose_damage(x, x + decoded - 1, y);
+        }
+        offset += used;
+        pixel += decoded;
+
+        if (decoded < count) {
+            break;
+        }
+    }
+
+    stagingLength -= offset;
+    for (i = 0; i < stagingLength; i++) {
+        bytes[i] = bytes[offset + i];
+    }
+
+    if (pixel == total) {
+        regionReset();
+        loads++;
+        phase = SAVE_IDLE;
+        log_info("Save: loaded slot %u, %u bytes in %u ms\n", slot, dataLength,
+                 (unsigned int)(ticks_to_us(timer_ticks() - startTime) / 1000));
+    } else if (position == dataLength) {
+        fail("the slot is damaged");
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       save_control
+//
+//  Arguments:      request:     The request payload (see save.h)
+//                  length:      The payload length
+//
+//  Returns:        COMMAND_OK, COMMAND_BAD_COMMAND if the request is
+//                  malformed, or COMMAND_BUSY if a save or load is still in
+//                  progress
+//
+//  Description:    This function starts saving the canvas in a slot, or
+//                  loading it from one. save_update() does the work, once
+//                  the card is ready.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int save_control(const unsigned char *request, unsigned int length)
+{
+    if (length != SAVE_REQUEST_SIZE ||
+        (request[0] != SAVE_STORE && request[0] != SAVE_LOAD) ||
+        request[1] >= SAVE_SLOTS || !frameBuffer) {
+        return COMMAND_BAD_COMMAND;
+    }
+    if (phase != SAVE_IDLE) {
+        return COMMAND_BUSY;
+    }
+
+    action = request[0];
+    slot = request[1];
+    startTime = timer_ticks();
+    phase = SAVE_WAITING;
+
+    return COMMAND_OK;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       save_update
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function is called once per frame. It brings the
+//                  SD card up in the background after boot, and works on
+//                  the save or load in progress for up to SAVE_BUDGET_US.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void save_update()
+{
+    unsigned long start = timer_ticks();
+    unsigned int status = emmc_poll();
+
+    if (phase == SAVE_WAITING) {
+        if (status == EMMC_STARTING) {
+            return;
+        }
+        if (status == EMMC_FAILED) {
+            fail("no SD card");
+            return;
+        }
+        if (!partitionChecked) {
+            find_partition();
+        }
+        if (slot >= slots) {
+            fail("no such slot");
+            return;
+        }
+
+        crc = 0;
+        if (action == SAVE_STORE) {
+            qoi_reset(&qoi);
+            pixel = 0;
+            dataLength = 0;
+            dataBlock = 0;
+            stagingLength = 0;
+            phase = SAVE_ENCODING;
+        } else {
+            read_header();
+        }
+    }
+
+    while (phase != SAVE_IDLE &&
+           ticks_to_us(timer_ticks() - start) < SAVE_BUDGET_US) {
+        switch (phase) {
+        case SAVE_ENCODING:
+            encode_row();
+            break;
+
+        case SAVE_FLUSHING:
+        case SAVE_FINISHING:
+            flush();
+            break;
+
+        case SAVE_CHECKING:
+            check_block();
+            break;
+
+        case SAVE_DECODING:
+            decode_block();
+            break;
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       save_report
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes the save statistics to the console
+//                  terminal.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void save_report()
+{
+    static const char *const phases[] = {
+        "idle", "waiting for the card", "encoding", "flushing", "finishing",
+        "checking", "decoding"
+    };
+
+    log_info("Save: %s, %u slots, %u saves %u loads %u failures\n",
+             phases[phase], slots, saves, loads, failures);
+}
@@ -0,0 +1,32 @@
+// Save slots on the SD card. The first MBR partition of type
+// SAVE_PARTITION_TYPE ("non-FS data") holds up to SAVE_SLOTS slots of
+// SAVE_SLOT_BLOCKS blocks each. A slot's first block is its header (all
+// values little-endian):
+//
+//     magic           4 bytes, SAVE_MAGIC
+//     width, height   2 bytes each, the canvas size
+//     length          4 bytes, the length of the QOI data
+//     CRC-32          4 bytes, of the QOI data
+//
+// and the canvas follows as one stream of QOI operations (see qoi.c),
+// starting in the next block.
+#define SAVE_PARTITION_TYPE         0xDA
+#define SAVE_SLOTS                  8
+#define SAVE_SLOT_BLOCKS            16384
+#define SAVE_MAGIC                  0x31564153      // "SAV1"
+#define SAVE_HEADER_SIZE            16
+
+// COMMAND_FRAME_SAVE payload: an action (1 byte) and a slot number (1
+// byte). A save or load goes on in the background; the Pi reports on its
+// console terminal when it has finished.
+#define SAVE_STORE                  0   // Save the canvas in the slot
+#define SAVE_LOAD                   1   // Replace the canvas with the slot
+#define SAVE_REQUEST_SIZE           2
+
+// Most time save_update() spends on a save or load per frame
+#define SAVE_BUDGET_US              3000
+
+// Function prototypes
+unsigned int save_control(const unsigned char *request, unsigned int length);
+void save_update();
+void save_report();
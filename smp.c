@@ -0,0 +1,351 @@
+// The functions in this file start CPU cores 1 - 3, which otherwise sit in
+// a wfe loop in start.s, and let core 0 run a function on all four cores
+// at once.
+//
+// Depending on the firmware, cores 1 - 3 either start at _start with
+// core 0, or are parked by the firmware's ARM stub, waiting for an
+// address in the spin table at 0xD8. smp_init() handles both: it writes
+// the address of _start into the spin table, sets smp_release (which the
+// wfe loop in start.s checks) and sends an event. The waiting cores read
+// both with their caches off, so they are cleaned to RAM first. Each core
+// then drops to EL1 in start.s, turns on its MMU and caches (see mmu.c),
+// sets up its stacks (see stack.c) and calls smp_secondary(), which waits
+// for work from smp_run(). smp_wait() checks later in boot that they got
+// there.
+//
+// Cores communicate through ordinary loads and stores with data memory
+// barriers between them. The data caches are coherent between the cores,
+// so nothing needs cleaning once a core has its caches on.
+
+#include "systimer.h"
+#include "irq.h"
+#include "idle.h"
+#include "kprintf.h"
+#include "mmu.h"
+#include "smp.h"
+
+// The spin table: the ARM stub starts core n at the address it finds in
+// the 8 bytes at SPIN_TABLE_BASE + 8 * n
+#define SPIN_TABLE_BASE             0xD8
+
+// Defined in start.s
+extern void _start();
+extern volatile unsigned long smp_release;
+
+// When smp_init() released the cores, and which have reached
+// smp_secondary()
+static unsigned long releaseTime;
+static volatile unsigned int coreStarted[SMP_CORES];
+static unsigned int coresRunning = 1;
+
+// The function to run, a counter bumped for every run, and the last run
+// each core has finished
+static void (*volatile jobFunction)(unsigned int core);
+static volatile unsigned int jobGeneration;
+static volatile unsigned int jobFinished[SMP_CORES];
+
+// Statistics
+static unsigned int jobsRun;
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       smp_barrier
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function makes every memory access before it
+//                  visible to the other cores before any access after it.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void smp_barrier()
+{
+    asm volatile("dmb sy" ::: "memory");
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       smp_init
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function releases cores 1 - 3, and returns without
+//                  waiting for them, so they start while core 0 carries on
+//                  booting. Until smp_wait() has seen them start,
+//                  smp_run() only uses core 0. timer_init() must be called
+//                  first.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void smp_init()
+{
+    unsigned int core;
+
+    for (core = 1; core < SMP_CORES; core++) {
+        *(volatile unsigned long *)(unsigned long)(SPIN_TABLE_BASE + 8 * core) =
+            (unsigned long)_start;
+    }
+    smp_release = 1;
+    mmu_clean((void *)(unsigned long)SPIN_TABLE_BASE, 8 * SMP_CORES);
+    mmu_clean((void *)&smp_release, sizeof(smp_release));
+    asm volatile("sev" ::: "memory");
+
+    releaseTime = timer_ticks();
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       smp_wait
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function waits until cores 1 - 3 have started, or
+//                  until SMP_START_TIMEOUT_US after smp_init() released
+//                  them, and from then on lets smp_run() use them if they
+//                  all started. Called late in boot, it normally finds
+//                  them waiting already.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void smp_wait()
+{
+    unsigned int core, started;
+
+    do {
+        started = 1;
+        for (core = 1; core < SMP_CORES; core++) {
+            started += coreStarted[core];
+        }
+    } while (started < SMP_CORES &&
+             ticks_to_us(timer_ticks() - releaseTime) < SMP_START_TIMEOUT_US);
+
+    if (started == SMP_CORES) {
+        coresRunning = SMP_CORES;
+    }
+    log_info("SMP: %u of %u cores started\n", started, SMP_CORES);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       smp_cores
+//
+//  Arguments:      none
+//
+//  Returns:        The number of cores smp_run() runs a function on
+//
+//  Description:    This function tells callers how many ways to divide
+//                  their work: either 1 or SMP_CORES.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int smp_cores()
+{
+    return coresRunning;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       smp_run
+//
+//  Arguments:      function:    The function to run, which is passed the
+//                               number of the core it runs on
+//
+//  Returns:        void
+//
+//  Description:    This function runs a function on every running core,
+//                  including core 0, and returns when they have all
+//                  returned. Memory written before the call is visible to
+//                  the function, and memory it writes is visible to the
+//                  caller afterwards. Must only be called on core 0.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void smp_run(void (*function)(unsigned int core))
+{
+    unsigned int generation, core;
+
+    if (coresRunning == 1) {
+        function(0);
+        return;
+    }
+
+    jobFunction = function;
+    smp_barrier();
+    generation = ++jobGeneration;
+    asm volatile("dsb sy; sev" ::: "memory");
+
+    function(0);
+
+    for (core = 1; core < SMP_CORES; core++) {
+        while (jobFinished[core] != generation) {
+        }
+    }
+    smp_barrier();
+    jobsRun++;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       smp_secondary
+//
+//  Arguments:      core:        The number of the calling core (1 - 3)
+//
+//  Returns:        Never
+//
+//  Description:    This function is called by start.s on cores 1 - 3. It
+//                  waits for a function from smp_run(), runs it, reports
+//                  that it has finished, and waits again. The core sleeps
+//                  in wfe between runs, woken by the event smp_run() sends
+//                  or by the event stream. IRQs stay masked on these cores.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void smp_secondary(unsigned int core)
+{
+    unsigned int generation = jobGeneration;
+
+    idle_init();
+
+    smp_barrier();
+    coreStarted[core] = 1;
+
+    while (1) {
+        while (jobGeneration == generation) {
+            idle_wait_event();
+        }
+        generation = jobGeneration;
+        smp_barrier();
+
+        jobFunction(core);
+
+        smp_barrier();
+        jobFinished[core] = generation;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       smp_queue_reset
+//
+//  Arguments:      queue:       The queue
+//
+//  Returns:        void
+//
+//  Description:    This function empties a queue. Neither of the cores
+//                  using it may be running.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void smp_queue_reset(struct smp_queue *queue)
+{
+    queue->head = 0;
+    queue->tail = 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       smp_queue_put
+//
+//  Arguments:      queue:       The queue
+//                  item:        The item to add
+//
+//  Returns:        TRUE if the item was added, FALSE if the queue is full
+//
+//  Description:    This function adds an item to a queue. Only the
+//                  producing core may call it. The item is written before
+//                  the tail is advanced, so the consumer never sees an
+//                  item that is not there yet.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int smp_queue_put(struct smp_queue *queue, unsigned long item)
+{
+    unsigned int tail = queue->tail;
+
+    if (tail - queue->head == SMP_QUEUE_SIZE) {
+        return 0;
+    }
+
+    queue->items[tail & (SMP_QUEUE_SIZE - 1)] = item;
+    smp_barrier();
+    queue->tail = tail + 1;
+
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       smp_queue_get
+//
+//  Arguments:      queue:       The queue
+//                  item:        Where to store the item
+//
+//  Returns:        TRUE if an item was removed, FALSE if the queue is empty
+//
+//  Description:    This function removes the oldest item from a queue.
+//                  Only the consuming core may call it. The item is read
+//                  before the head is advanced, so the producer never
+//                  overwrites an item that is still being read.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int smp_queue_get(struct smp_queue *queue, unsigned long *item)
+{
+    unsigned int head = queue->head;
+
+    if (head == queue->tail) {
+        return 0;
+    }
+
+    smp_barrier();
+    *item = queue->items[head & (SMP_QUEUE_SIZE - 1)];
+    smp_barrier();
+    queue->head = head + 1;
+
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       smp_report
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes the number of parallel runs to the
+//                  console terminal.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void smp_report()
+{
+    log_info("SMP: %u cores, %u parallel runs\n", coresRunning, jobsRun);
+}
@@ -0,0 +1,29 @@
+// Number of CPU cores on the BCM2837
+#define SMP_CORES                   4
+
+// Cores 1 - 3 that have not started this long after smp_init() released
+// them are not used
+#define SMP_START_TIMEOUT_US        10000
+
+// Items a queue between two cores can hold (a power of two)
+#define SMP_QUEUE_SIZE              1024
+
+// A queue of 64-bit items from one core to another. Only the producer
+// writes tail and only the consumer writes head, and both only ever
+// increase, so no atomic read-modify-write instructions are needed.
+struct smp_queue {
+    volatile unsigned int head, tail;
+    unsigned long items[SMP_QUEUE_SIZE];
+};
+
+// Function prototypes
+void smp_init();
+void smp_wait();
+unsigned int smp_cores();
+void smp_run(void (*function)(unsigned int core));
+void smp_secondary(unsigned int core);
+void smp_barrier();
+void smp_queue_reset(struct smp_queue *queue);
+int smp_queue_put(struct smp_queue *queue, unsigned long item);
+int smp_queue_get(struct smp_queue *queue, unsigned long *item);
+void smp_report();
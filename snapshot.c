@@ -0,0 +1,315 @@
+// The functions in this file copy the canvas to and from the host over the
+// serial link. A raw 1024 x 768 x 32-bit canvas would take minutes to
+// send at 115200 Baud, so the pixels are QOI encoded (see qoi.c) in a
+// single pass over the framebuffer, which shrinks line art to a few
+// kilobytes.
+//
+// The image is sent as independent chunks (see snapshot.h), each with
+// the position of its first pixel and a CRC of its pixels, so the host
+// can check every chunk and ask again for just the ones it lost. Chunks
+// are only encoded when the UART transmit ring has room for them, so a
+// snapshot goes out in the background at the speed of the UART while
+// the main loop keeps running. Drawing is not paused, so rows drawn
+// during a snapshot may appear in either state.
+//
+// A restore works the other way: each chunk from the host is decoded a
+// row at a time and written into the canvas. A restore cannot be
+// undone, so it forgets the undo journal.
+
+#include "uart.h"
+#include "framebuffer.h"
+#include "crc32.h"
+#include "qoi.h"
+#include "command.h"
+#include "stream.h"
+#include "undo.h"
+#include "compose.h"
+#include "snapshot.h"
+#include "canvas.h"
+#include "region.h"
+
+// Most chunks encoded in one call to snapshot_update()
+#define SNAPSHOT_CHUNKS_PER_FRAME   4
+
+// The snapshot in progress: the next pixel to send, the pixel after the
+// last one, and the sequence number of the next chunk
+static int snapshotActive;
+static unsigned int snapshotNext, snapshotEnd;
+static unsigned int snapshotSequence;
+
+// The chunk being sent
+static unsigned char chunk[SNAPSHOT_HEADER_SIZE + SNAPSHOT_CHUNK_SIZE];
+
+// A row of the canvas being sent or restored
+static unsigned int line[CANVAS_MAX_TILE_COLUMNS * CANVAS_TILE_SIZE];
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       get32
+//
+//  Arguments:      p:           A pointer to four bytes
+//
+//  Returns:        The little-endian 32-bit value at p
+//
+//  Description:    This function reads an unaligned 32-bit value.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned int get32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       put32
+//
+//  Arguments:      p:           Where to store the value
+//                  value:       The 32-bit value
+//
+//  Returns:        void
+//
+//  Description:    This function stores a little-endian 32-bit value.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline void put32(unsigned char *p, unsigned int value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       snapshot_start
+//
+//  Arguments:      request:     The request payload: the first pixel and
+//                               the pixel count (0 for the rest of the
+//                               canvas), 4 bytes each
+//                  length:      The payload length
+//
+//  Returns:        COMMAND_OK, or COMMAND_BAD_COMMAND if the request is
+//                  malformed
+//
+//  Description:    This function starts sending a range of the canvas.
+//                  The host asks for the whole canvas first, and then for
+//                  any ranges whose chunks it did not receive intact. A
+//                  new request replaces one still in progress.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int snapshot_start(const unsigned char *request, unsigned int length)
+{
+    unsigned int total = frameBufferWidth * frameBufferHeight;
+    unsigned int first, count;
+
+    if (length != 8 || !frameBuffer) {
+        return COMMAND_BAD_COMMAND;
+    }
+
+    first = get32(request);
+    count = get32(request + 4);
+    if (first >= total) {
+        return COMMAND_BAD_COMMAND;
+    }
+    if (count == 0 || count > total - first) {
+        count = total - first;
+    }
+
+    snapshotNext = first;
+    snapshotEnd = first + count;
+    snapshotActive = 1;
+
+    return COMMAND_OK;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       send_chunk
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function encodes the next chunk of the snapshot,
+//                  row segment by row segment, until it has
+//                  SNAPSHOT_CHUNK_PIXELS pixels or its QOI data is full,
+//                  and sends it.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void send_chunk()
+{
+    struct qoi_state state;
+    unsigned char *data = chunk + SNAPSHOT_HEADER_SIZE;
+    unsigned int first = snapshotNext, position = first;
+    unsigned int limit = snapshotEnd;
+    unsigned int length = 0, crc = 0;
+    unsigned int x, y, count, consumed;
+
+    if (limit - first > SNAPSHOT_CHUNK_PIXELS) {
+        limit = first + SNAPSHOT_CHUNK_PIXELS;
+    }
+
+    qoi_reset(&state);
+
+    while (position < limit) {
+        y = position / frameBufferWidth;
+        x = position - y * frameBufferWidth;
+        count = frameBufferWidth - x;
+        if (count > limit - position) {
+            count = limit - position;
+        }
+
+        // Keep one byte for the final run. Solid canvas tiles are read as
+        // their colour.
+        canvasRead(x, x + count - 1, y, line);
+        length += qoi_encode(&state, line, count, &consumed,
+                             data + length, SNAPSHOT_CHUNK_SIZE - 1 - length);
+        crc = crc32(crc, (const unsigned char *)line, consumed * 4);
+        position += consumed;
+
+        if (consumed < count) {
+            break;
+        }
+    }
+    length += qoi_encode_flush(&state, data + length);
+
+    chunk[0] = frameBufferWidth;
+    chunk[1] = frameBufferWidth >> 8;
+    chunk[2] = frameBufferHeight;
+    chunk[3] = frameBufferHeight >> 8;
+    put32(chunk + 4, first);
+    put32(chunk + 8, position - first);
+    put32(chunk + 12, crc);
+
+    command_send_frame(COMMAND_FRAME_SNAPSHOT_DATA, snapshotSequence++,
+                       chunk, SNAPSHOT_HEADER_SIZE + length);
+
+    snapshotNext = position;
+    if (position == snapshotEnd) {
+        snapshotActive = 0;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       snapshot_update
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function is called once per frame. It sends the
+//                  next chunks of a snapshot in progress, but only as many
+//                  as fit in the UART transmit ring, so it never waits for
+//                  the UART.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void snapshot_update()
+{
+    int chunks = 0;
+
+    while (snapshotActive && chunks < SNAPSHOT_CHUNKS_PER_FRAME &&
+           uart_tx_space() >= COMMAND_HEADER_SIZE + SNAPSHOT_HEADER_SIZE +
+                              SNAPSHOT_CHUNK_SIZE + 4) {
+        send_chunk();
+        chunks++;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       snapshot_restore
+//
+//  Arguments:      payload:     A chunk payload from the host
+//                  length:      The payload length
+//
+//  Returns:        COMMAND_OK, COMMAND_BAD_COMMAND if the chunk does not
+//                  fit the canvas, or COMMAND_BAD_IMAGE if its pixels do
+//                  not decode to the expected count and CRC
+//
+//  Description:    This function decodes a chunk into the canvas rows it
+//                  covers.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int snapshot_restore(const unsigned char *payload, unsigned int length)
+{
+    struct qoi_state state;
+    const unsigned char *data = payload + SNAPSHOT_HEADER_SIZE;
+    unsigned int total = frameBufferWidth * frameBufferHeight;
+    unsigned int first, position, end, expected;
+    unsigned int x, y, count, decoded, used, crc = 0;
+
+    if (length < SNAPSHOT_HEADER_SIZE || !frameBuffer) {
+        return COMMAND_BAD_COMMAND;
+    }
+
+    first = get32(payload + 4);
+    count = get32(payload + 8);
+    expected = get32(payload + 12);
+    if ((payload[0] | (payload[1] << 8)) != frameBufferWidth ||
+        (payload[2] | (payload[3] << 8)) != frameBufferHeight ||
+        first >= total || count > total - first) {
+        return COMMAND_BAD_COMMAND;
+    }
+
+    undo_reset();
+
+    length -= SNAPSHOT_HEADER_SIZE;
+    position = first;
+    end = first + count;
+    qoi_reset(&state);
+
+    while (position < end) {
+        y = position / frameBufferWidth;
+        x = position - y * frameBufferWidth;
+        count = frameBufferWidth - x;
+        if (count > end - position) {
+            count = end - position;
+        }
+
+        decoded = qoi_decode(&state, data, length, &used, line, count);
+        if (decoded) {
+            canvasWrite(x, x + decoded - 1, y, line);
+            stream_damage(x, x + decoded - 1, y);
+            compose_damage(x, x + decoded - 1, y);
+        }
+        crc = crc32(crc, (const unsigned char *)line, decoded * 4);
+        data += used;
+        length -= used;
+        position += decoded;
+
+        if (decoded < count) {
+            break;
+        }
+    }
+
+    if (position != end || crc != expected) {
+        return COMMAND_BAD_IMAGE;
+    }
+
+    // The last chunk completes a restore of the whole canvas
+    if (end == total) {
+        regionReset();
+    }
+
+    return COMMAND_OK;
+}
@@ -0,0 +1,23 @@
+// Snapshot chunk payload (all values little-endian), sent by the Pi in
+// COMMAND_FRAME_SNAPSHOT_DATA frames and by the host in
+// COMMAND_FRAME_RESTORE frames:
+//
+//     width, height   2 bytes each, the canvas size
+//     first pixel     4 bytes, y * width + x of the chunk's first pixel
+//     pixel count     4 bytes
+//     CRC-32          4 bytes, of the chunk's pixels as 32-bit values
+//     QOI operations  the rest of the payload
+//
+// Each chunk starts from a reset QOI state, so chunks can be decoded
+// (and resent) independently.
+#define SNAPSHOT_HEADER_SIZE        16
+
+// The QOI data in one chunk sent by the Pi is at most this long, and
+// covers at most SNAPSHOT_CHUNK_PIXELS pixels
+#define SNAPSHOT_CHUNK_SIZE         2048
+#define SNAPSHOT_CHUNK_PIXELS       65536
+
+// Function prototypes
+unsigned int snapshot_start(const unsigned char *request, unsigned int length);
+void snapshot_update();
+unsigned int snapshot_restore(const unsigned char *payload, unsigned int length);
@@ -0,0 +1,252 @@
+// The functions in this file measure how much of its stacks each core
+// uses, and watch for a stack running past its end. link.ld gives every
+// core a stack for its own code and one for interrupts and exceptions,
+// each with a guard page below it, and start.s fills them all with
+// STACK_CANARY before any core starts. A stack grows down, so the canary
+// words left at the bottom of a stack are the part that has never been
+// used.
+//
+// mmu_init() leaves the guards unmapped, so a stack that overflows into
+// its guard faults there and then. A guard that could not be unmapped
+// (see mmu_mapped()) is checked instead: stack_check() reads every word
+// of it each frame, and reports the guard once if any is no longer the
+// canary. An overflow can skip the top of a guard, for a large stack
+// frame, so all of it is checked rather than the word below the stack.
+//
+// To measure one piece of code, call stack_mark() on the core that runs
+// it, run it, and call stack_used() for that core.
+
+#include "kprintf.h"
+#include "smp.h"
+#include "mmu.h"
+#include "stack.h"
+
+// Defined in link.ld. The sizes are symbols with no storage, whose
+// addresses are their values.
+extern unsigned char __stacks_start[];
+extern unsigned char STACK_GUARD_SIZE[], STACK_SIZE[], IRQ_STACK_SIZE[];
+extern unsigned char STACK_BLOCK_SIZE[];
+
+// The guards of each core found to have been written to: bit 0 for the
+// guard below its stack, bit 1 for the one below its interrupt stack
+static unsigned int overflowed[SMP_CORES];
+
+// The most stack each core had used when stack_mark() last cleared the
+// measurement
+static unsigned int markedUsed[SMP_CORES];
+
+// Statistics
+static unsigned int overflows;
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       stack_bottom
+//
+//  Arguments:      core:        A core number
+//                  irq:         TRUE for its interrupt stack
+//
+//  Returns:        The lowest address of the stack, just above its guard
+//
+//  Description:    This function finds a stack in the .stacks section.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static volatile unsigned int *stack_bottom(unsigned int core, int irq)
+{
+    unsigned long address = (unsigned long)__stacks_start +
+                            core * (unsigned long)STACK_BLOCK_SIZE +
+                            (unsigned long)STACK_GUARD_SIZE;
+
+    if (irq) {
+        address += (unsigned long)STACK_SIZE + (unsigned long)STACK_GUARD_SIZE;
+    }
+    return (volatile unsigned int *)address;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       used
+//
+//  Arguments:      bottom:      The lowest address of a stack
+//                  size:        Its size in bytes
+//
+//  Returns:        The bytes of the stack that have been written to
+//
+//  Description:    This function counts the canary words at the bottom of
+//                  a stack, which have never been written to.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned int used(volatile unsigned int *bottom, unsigned int size)
+{
+    unsigned int words = size / 4, i;
+
+    for (i = 0; i < words && bottom[i] == STACK_CANARY; i++) {
+    }
+    return size - 4 * i;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       stack_used
+//
+//  Arguments:      core:        A core number
+//
+//  Returns:        The most bytes of its stack the core has used since
+//                  stack_mark() was last called on it, or since it started
+//
+//  Description:    This function finds the high-water mark of a core's
+//                  stack. The core must have started.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int stack_used(unsigned int core)
+{
+    return used(stack_bottom(core, 0), (unsigned long)STACK_SIZE);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       stack_irq_used
+//
+//  Arguments:      core:        A core number
+//
+//  Returns:        The most bytes of its interrupt stack the core has used
+//                  since it started
+//
+//  Description:    This function finds the high-water mark of a core's
+//                  interrupt stack. The core must have started.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int stack_irq_used(unsigned int core)
+{
+    return used(stack_bottom(core, 1), (unsigned long)IRQ_STACK_SIZE);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       stack_mark
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function fills the calling core's stack below the
+//                  stack pointer with the canary again, so that
+//                  stack_used() measures from here on. The most it had
+//                  used is kept for stack_report().
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void stack_mark()
+{
+    volatile unsigned int *bottom, *p;
+    unsigned long core, sp;
+    unsigned int size;
+
+    asm volatile("mrs %0, mpidr_el1" : "=r" (core));
+    core &= 0x3;
+    asm volatile("mov %0, sp" : "=r" (sp));
+
+    size = stack_used(core);
+    if (size > markedUsed[core]) {
+        markedUsed[core] = size;
+    }
+
+    // Nothing below the stack pointer is in use
+    bottom = stack_bottom(core, 0);
+    for (p = bottom; (unsigned long)p < sp; p++) {
+        *p = STACK_CANARY;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       stack_check
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function is called once per frame. It reports a
+//                  stack of a running core that has been found to have
+//                  overflowed into the guard below it, once for each
+//                  guard. Unmapped guards are not read: an overflow into
+//                  one has already faulted.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void stack_check()
+{
+    volatile unsigned int *guard;
+    unsigned int core, irq, words, i;
+
+    words = (unsigned long)STACK_GUARD_SIZE / 4;
+    for (core = 0; core < smp_cores(); core++) {
+        for (irq = 0; irq < 2; irq++) {
+            guard = stack_bottom(core, irq) - words;
+            if ((overflowed[core] & (1 << irq)) != 0 ||
+                !mmu_mapped((const void *)guard)) {
+                continue;
+            }
+
+            for (i = 0; i < words && guard[i] == STACK_CANARY; i++) {
+            }
+            if (i < words) {
+                overflowed[core] |= 1 << irq;
+                overflows++;
+                log_error("Stack: core %u %sstack overflowed\n", core,
+                          irq ? "interrupt " : "");
+            }
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       stack_report
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes the most each running core has
+//                  used of its stack and of its interrupt stack, and the
+//                  number of overflows, to the console terminal.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void stack_report()
+{
+    unsigned int core, size;
+
+    for (core = 0; core < smp_cores(); core++) {
+        size = stack_used(core);
+        if (size < markedUsed[core]) {
+            size = markedUsed[core];
+        }
+        log_info("Stack: core %u used %u of %u bytes, interrupts %u of %u "
+                 "bytes\n", core, size, (unsigned int)(unsigned long)STACK_SIZE,
+                 stack_irq_used(core),
+                 (unsigned int)(unsigned long)IRQ_STACK_SIZE);
+    }
+    if (overflows) {
+        log_warn("Stack: %u overflows\n", overflows);
+    }
+}
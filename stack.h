@@ -0,0 +1,10 @@
+// The word start.s fills the stacks and their guards with (must match
+// start.s)
+#define STACK_CANARY                0x5354434b
+
+// Function prototypes
+unsigned int stack_used(unsigned int core);
+unsigned int stack_irq_used(unsigned int core);
+void stack_mark();
+void stack_check();
+void stack_report();
@@ -1,26 +1,122 @@
 // This routine is used to establish an environment in which
 // a C program can run. We create this environment only on
-// CPU Core 0. The other cores simply run an infinite loop.
+// CPU Core 0. The other cores wait in a loop until core 0
+// releases them (see smp.c), and then call smp_secondary()
+// on a stack of their own.
 //
-// The stack pointer register is initialized to point
-// just below the text section of the program. It grows
-// backwards (toward 0), so it uses memory addresses
-// below that of the _start routine.
+// Every core first drops from the exception level the firmware
+// started it in (EL3 or EL2) down to EL1, so that interrupts can
+// be taken through the vector table installed in VBAR_EL1. The
+// FP/SIMD unit is also enabled, since the C compiler is free to
+// use the SIMD registers.
+//
+// Each core has two stacks, in the .stacks section laid out by
+// link.ld: one for its own code, used through SP_EL0, and one for
+// interrupts and exceptions, which the core switches to SP_EL1 for
+// when it takes one. Below each stack is a guard region. Core 0
+// fills the whole section with STACK_CANARY first thing, while the
+// caches are still off, so that stack.c can tell how deep each stack
+// has been used, and mmu_init() then leaves the guards unmapped.
+//
+// Core 0 then builds the translation tables (see mmu.c), and every
+// core turns on the MMU and the data and instruction caches with
+// mmu_on, core 0 before it clears .bss and the others as soon as
+// they are released.
 //
 // We also zero out all bytes in the .bss section, and
 // then branch to the main() routine. The main() routine
 // should never return to this code (it should be in
 // an infinite loop), but if it does, we then put the
 // CPU Core 0 into an infinite loop.
-	
-	
-	// Put the machine code for this routine into the .text.boot section	
+
+
+	// The word unused stack is filled with (must match stack.h)
+	.equ	STACK_CANARY, 0x5354434b
+
+	// MAIR_EL1: attribute 0 Device-nGnRnE, 1 Normal write-back,
+	// 2 Normal non-cacheable (must match mmu.h)
+	.equ	MMU_MAIR, 0x44ff00
+
+	// TCR_EL1: 4 GB of TTBR0 space (T0SZ 32) with 4 KB pages, walks
+	// inner shareable and write-back cacheable, TTBR1 walks disabled,
+	// and a 32-bit physical address size
+	.equ	MMU_TCR, 0x80803520
+
+	// Put the machine code for this routine into the .text.boot section
 	.section ".text.boot"
 
 	// The _start symbol needs to be visible to the linker
 	// since this is where execution starts for bare metal code
 	.global _start
 _start:
+	// Read the current exception level (bits 3:2 of CurrentEL)
+	mrs	x0, CurrentEL
+	lsr	x0, x0, 2
+	and	x0, x0, 0x3
+	cmp	x0, 3
+	b.ne	el2_entry	// Skip forward if we are not in EL3
+
+	// If here, we are in EL3, with no firmware stub to have set
+	// CPUECTLR_EL1.SMPEN, which keeps the data cache coherent with the
+	// other cores once it is turned on
+	mrs	x2, s3_1_c15_c2_1
+	orr	x2, x2, (1 << 6)
+	msr	s3_1_c15_c2_1, x2
+
+	// Make the lower levels non-secure and AArch64, then return into
+	// EL2 with all interrupts masked.
+	mov	x2, 0x5b1	// SCR_EL3: RW, HCE, SMD, RES1, NS
+	msr	scr_el3, x2
+	mov	x2, 0x3c9	// SPSR: DAIF masked, return to EL2h
+	msr	spsr_el3, x2
+	adr	x2, el2_entry
+	msr	elr_el3, x2
+	eret
+
+el2_entry:
+	// Read the exception level again, since we may have just
+	// arrived here from EL3
+	mrs	x0, CurrentEL
+	lsr	x0, x0, 2
+	and	x0, x0, 0x3
+	cmp	x0, 2
+	b.ne	el1_entry	// Skip forward if we are already in EL1
+
+	// If here, we are in EL2. Give EL1 access to the physical
+	// counter and timer, and zero the virtual counter offset.
+	mrs	x2, cnthctl_el2
+	orr	x2, x2, 0x3	// EL1PCEN and EL1PCTEN
+	msr	cnthctl_el2, x2
+	msr	cntvoff_el2, xzr
+
+	// EL1 runs in AArch64 state, and nothing is trapped to EL2
+	mov	x2, (1 << 31)	// HCR_EL2.RW
+	msr	hcr_el2, x2
+	mov	x2, 0x33ff	// CPTR_EL2: RES1 bits only, no FP trap
+	msr	cptr_el2, x2
+	msr	hstr_el2, xzr
+
+	// Start EL1 with the MMU and caches off
+	ldr	x2, =0x30d00800	// SCTLR_EL1 RES1 bits
+	msr	sctlr_el1, x2
+
+	// Return into EL1h with all interrupts masked
+	mov	x2, 0x3c5	// SPSR: DAIF masked, return to EL1h
+	msr	spsr_el2, x2
+	adr	x2, el1_entry
+	msr	elr_el2, x2
+	eret
+
+el1_entry:
+	// Enable the FP/SIMD unit at EL1 (CPACR_EL1.FPEN = 11)
+	mov	x2, (3 << 20)
+	msr	cpacr_el1, x2
+
+	// Install the exception vector table (see vectors.s)
+	ldr	x2, =vectors
+	msr	vbar_el1, x2
+	isb
+
 	// Copy the contents of the multiprocessor affinity register
 	// into the x1 register. The rightmost 2 bits gives us the
 	// CPU Core number that this code is running on. We will
@@ -31,42 +127,176 @@ _start:
 	tst	x1, 0x3		// Bitwise AND rightmost 2 bits
 	b.eq	core_zero	// Skip forward if both bits are 0
 
-	//  If here, the CPU Core number is not 0, so loop forever
+	//  If here, the CPU Core number is not 0, so wait until
+	//  smp_init() sets smp_release
 loop:  	wfe			// Wait for event
-	b	loop		// Infinite loop
+	ldr	x2, =smp_release
+	ldr	x2, [x2]
+	cbz	x2, loop	// Keep waiting while smp_release is 0
+
+	// Core 0 has built the translation tables and filled our stacks
+	// before releasing us
+	bl	mmu_on
+
+	// Point at this core's stacks
+	and	x0, x1, 0x3	// Core number, the argument of smp_secondary
+	bl	stack_init
+
+	// smp_secondary() never returns
+	bl	smp_secondary
+	b	hang
 
   	// If here, the CPU Core is 0, and we run the rest of the program
 core_zero:
 
-	// Set the stack pointer to point to where the _start routine
-	// begins. The stack grows backwards (towards 0), so it uses memory
-	// that has lower addresses than the _start routine. We need to
-	// set this properly so that C functions and assembly routines
-	// can allocate stack frames.
-	adrp	x1, _start	// Put the _start address into x1
-	add	x1, x1, :lo12:_start
-	mov     sp, x1		// Copy the address into the sp register
-
-	// Clear the .bss section using a loop. The __bss_start
-	// symbol is provided by the linker, and is the address in
-	// RAM where the .bss starts. The __bss_size symbol is
-	// also provided by the linker, and gives the size (in doublewords)
-	// of the .bss section.
+	// Note the time boot reached here, for the boot timings (see
+	// boot.c). The variable is in .data, so clearing .bss keeps it.
+	mrs	x3, cntpct_el0
+	ldr	x2, =boot_start_ticks
+	str	x3, [x2]
+
+	// Fill the stacks of every core, and set up core 0's, so that C
+	// functions and assembly routines can allocate stack frames
+	bl	stack_fill
+	mov	x0, 0
+	bl	stack_init
+
+	// Build the translation tables, and turn on the MMU and caches,
+	// so that .bss is cleared through the data cache. mmu_init()
+	// keeps nothing in .bss.
+	bl	mmu_init
+	bl	mmu_on
+
+	// Clear the .bss section using a loop, 64 bytes at a time, with
+	// DC ZVA, which zeroes a whole cache line without reading it
+	// first. The __bss_start symbol is provided by the linker, and
+	// is the address in RAM where the .bss starts. The __bss_size
+	// symbol is also provided by the linker, and gives the size (in
+	// 64-byte blocks) of the .bss section, whose ends are 64-byte
+	// aligned. DCZID_EL0 gives the size DC ZVA zeroes (64 bytes on
+	// the Cortex-A53); if it is another size, or DC ZVA is not
+	// allowed, pairs of 128-bit stores of a zeroed SIMD register are
+	// used instead.
 	adrp	x1, __bss_start		// Put address of .bss into x1
 	add	x1, x1, :lo12:__bss_start
 	ldr     w2, =__bss_size		// Put the size of the .bss section
 					// into w2, using a literal pool.
 					// w2 is our counter.
+	cbz     w2, endloop		// Skip the loop if counter == 0
 
-top:	cbz     w2, endloop		// Exit loop if counter == 0
-	str     xzr, [x1], 8		// Write zeroes to RAM, x1 += 8
-	sub     w2, w2, 1		// Decrement counter (w2)
-	cbnz    w2, top			// Keep looping while counter != 0
-endloop:	
+	mrs	x3, dczid_el0		// DZP (bit 4) clear and a block
+	and	x3, x3, 0x1f		// size of 2^4 words, 64 bytes?
+	cmp	x3, 4
+	b.ne	stores
+
+top:	dc	zva, x1			// Zero 64 bytes of RAM
+	add	x1, x1, 64		// x1 += 64
+	subs    w2, w2, 1		// Decrement counter (w2)
+	b.ne    top			// Keep looping while counter != 0
+	b	endloop
+
+stores:	movi	v0.16b, 0		// The zeroes to store
+1:	stp	q0, q0, [x1], 32	// Write 64 zero bytes to RAM,
+	stp	q0, q0, [x1], 32	// x1 += 64
+	subs    w2, w2, 1		// Decrement counter (w2)
+	b.ne    1b			// Keep looping while counter != 0
+endloop:
+
+	// Note the time again, now that the stacks are filled, the
+	// caches are on and .bss is clear
+	mrs	x3, cntpct_el0
+	ldr	x2, =boot_bss_ticks
+	str	x3, [x2]
 
 	// Branch to the main() routine, which should never return
   	bl      main
 
 	// We should never arrive here, but if we do
-	// we branch to the infinite loop above
-	b       loop
+	// we halt the core
+hang:	wfe
+	b       hang
+
+
+	// Fill the stacks and guards of every core with STACK_CANARY.
+	// This is done before the MMU is on, since the guards are then
+	// unmapped, and before any cache is on, so the other cores find
+	// the canary in RAM. The section size is a multiple of 64. Uses
+	// x1 - x3 and v0, and no stack.
+stack_fill:
+	ldr	x1, =__stacks_start
+	ldr	x2, =__stacks_end
+	ldr	w3, =STACK_CANARY
+	dup	v0.4s, w3
+1:	stp	q0, q0, [x1], 32	// Fill 64 bytes at a time
+	stp	q0, q0, [x1], 32
+	cmp	x1, x2
+	b.ne	1b
+	ret
+
+	// Set up the stack pointers of core x0. link.ld gives each core
+	// a block of STACK_BLOCK_SIZE bytes holding, from the bottom up:
+	// a guard, its own stack, a guard, and its interrupt stack. Uses
+	// x1 - x5, and no stack.
+stack_init:
+	ldr	x1, =__stacks_start
+	ldr	x2, =STACK_BLOCK_SIZE
+	madd	x5, x0, x2, x1		// x5 = the bottom of the block
+	add	x4, x5, x2		// x4 = the top of the block
+
+	// The interrupt stack ends at the top of the block. Exceptions
+	// taken to EL1 always use SP_EL1, which is the stack pointer
+	// in use now (SPSel is 1).
+	mov	sp, x4
+
+	// The core's own stack ends a guard and a stack above the
+	// bottom. Switch to SP_EL0 and point it there.
+	ldr	x2, =STACK_GUARD_SIZE
+	ldr	x3, =STACK_SIZE
+	add	x5, x5, x2
+	add	x5, x5, x3
+	msr	sp_el0, x5
+	msr	spsel, 0
+	ret
+
+	// Turn on the MMU and the data and instruction caches, with the
+	// tables mmu_init() built. Uses x2 only, and no stack.
+mmu_on:
+	ldr	x2, =MMU_MAIR
+	msr	mair_el1, x2
+	ldr	x2, =MMU_TCR
+	msr	tcr_el1, x2
+	ldr	x2, =mmu_table
+	msr	ttbr0_el1, x2
+	isb
+	tlbi	vmalle1
+	ic	iallu
+	dsb	ish
+	isb
+
+	mrs	x2, sctlr_el1
+	orr	x2, x2, (1 << 0)	// M: the MMU
+	orr	x2, x2, (1 << 2)	// C: the data cache
+	orr	x2, x2, (1 << 12)	// I: the instruction cache
+	msr	sctlr_el1, x2
+	isb
+	ret
+
+	// Set to 1 by smp_init() to release cores 1 - 3. It lives in
+	// .data rather than .bss, so that it is 0 from the moment the
+	// image is loaded, before core 0 clears the .bss section. The
+	// waiting cores read it with their caches off, so smp_init()
+	// cleans it to RAM.
+	.section ".data"
+	.align	3
+	.global	smp_release
+smp_release:
+	.quad	0
+
+	// The generic timer count when core 0 reached core_zero, and when
+	// it had cleared .bss (see boot.c)
+	.global	boot_start_ticks
+boot_start_ticks:
+	.quad	0
+	.global	boot_bss_ticks
+boot_bss_ticks:
+	.quad	0
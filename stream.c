@@ -0,0 +1,338 @@
+// The functions in this file stream the canvas to a host viewer while it
+// is being drawn, without a monitor. Sending whole frames over the Mini
+// UART is hopeless (one frame takes minutes), so only the tiles that
+// changed since they were last sent are transmitted.
+//
+// The framebuffer drawing functions report every pixel they write with
+// stream_damage(), which marks the tiles the pixels fall in. Once per
+// frame, stream_update() QOI encodes as many changed tiles as the byte
+// allowance and the UART transmit ring permit, sends them in one
+// message, and marks them clean. Tiles that do not fit stay marked and
+// go out in a later frame with their latest contents, so when the
+// drawing changes faster than the UART can keep up, intermediate frames
+// are simply dropped. Tiles are visited round-robin, so none of them are
+// starved.
+
+#include "uart.h"
+#include "framebuffer.h"
+#include "systimer.h"
+#include "qoi.h"
+#include "command.h"
+#include "kprintf.h"
+#include "stream.h"
+#include "canvas.h"
+
+// TRUE while a viewer is connected
+static int streamActive;
+
+// The changed tiles: bit x of dirtyTiles[y] is set if tile (x, y) has
+// been written since it was last sent
+static unsigned long dirtyTiles[STREAM_MAX_TILE_ROWS];
+static unsigned int tileColumns, tileRows;
+
+// The tile to look at first next time
+static unsigned int nextTile;
+
+// The byte allowance, and when it was last topped up
+static unsigned int tokens;
+static unsigned long lastRefill;
+
+// The message being built
+static unsigned char message[COMMAND_MAX_PAYLOAD];
+static unsigned int messageSequence;
+
+// Statistics
+static unsigned int messagesSent, tilesSent, bytesSent, framesDeferred;
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       mark_all
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function marks every tile as changed, so the whole
+//                  canvas is sent to a newly connected viewer.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void mark_all()
+{
+    unsigned int y;
+
+    tileColumns = (frameBufferWidth + STREAM_TILE_SIZE - 1) >> STREAM_TILE_SHIFT;
+    tileRows = (frameBufferHeight + STREAM_TILE_SIZE - 1) >> STREAM_TILE_SHIFT;
+    if (tileColumns > 64) {
+        tileColumns = 64;
+    }
+    if (tileRows > STREAM_MAX_TILE_ROWS) {
+        tileRows = STREAM_MAX_TILE_ROWS;
+    }
+
+    for (y = 0; y < tileRows; y++) {
+        dirtyTiles[y] = (tileColumns == 64) ? ~0UL : (1UL << tileColumns) - 1;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       stream_control
+//
+//  Arguments:      request:     The request payload: 1 byte, TRUE to start
+//                               streaming and FALSE to stop
+//                  length:      The payload length
+//
+//  Returns:        COMMAND_OK, or COMMAND_BAD_COMMAND if the request is
+//                  malformed
+//
+//  Description:    This function starts or stops the stream. Starting it
+//                  (again) sends the whole canvas first.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int stream_control(const unsigned char *request, unsigned int length)
+{
+    if (length != 1 || !frameBuffer) {
+        return COMMAND_BAD_COMMAND;
+    }
+
+    if (request[0]) {
+        mark_all();
+        nextTile = 0;
+        tokens = STREAM_BURST;
+        lastRefill = timer_ticks();
+        streamActive = 1;
+    } else {
+        streamActive = 0;
+    }
+
+    return COMMAND_OK;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       stream_damage
+//
+//  Arguments:      x0, x1:      The first and last pixel written in the row
+//                  y:           The row
+//
+//  Returns:        void
+//
+//  Description:    This function is called by the framebuffer drawing
+//                  functions for every span of pixels they write (the
+//                  coordinates are already clipped to the screen). It marks
+//                  the tiles the span touches. It does nothing while no
+//                  viewer is connected.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void stream_damage(int x0, int x1, int y)
+{
+    unsigned int first, last;
+
+    if (!streamActive) {
+        return;
+    }
+
+    first = x0 >> STREAM_TILE_SHIFT;
+    last = x1 >> STREAM_TILE_SHIFT;
+
+    // Set bits first to last
+    dirtyTiles[y >> STREAM_TILE_SHIFT] |= (~0UL >> (63 - last)) & (~0UL << first);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       encode_tile
+//
+//  Arguments:      tx, ty:      The tile position, in tiles
+//                  out:         Where to write the tile
+//                  space:       The number of bytes available at out
+//
+//  Returns:        The number of bytes written, or 0 if the tile does not
+//                  fit
+//
+//  Description:    This function writes a tile header and the tile's
+//                  pixels, QOI encoded row by row. A solid canvas tile is
+//                  read as its colour (see canvas.c).
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned int encode_tile(unsigned int tx, unsigned int ty,
+                                unsigned char *out, unsigned int space)
+{
+    struct qoi_state state;
+    unsigned int pixels[STREAM_TILE_SIZE];
+    unsigned int x = tx << STREAM_TILE_SHIFT, y = ty << STREAM_TILE_SHIFT;
+    unsigned int width = STREAM_TILE_SIZE, height = STREAM_TILE_SIZE;
+    unsigned int length = STREAM_TILE_HEADER_SIZE, consumed, row;
+
+    if (space < STREAM_TILE_HEADER_SIZE + 1) {
+        return 0;
+    }
+    if (x + width > frameBufferWidth) {
+        width = frameBufferWidth - x;
+    }
+    if (y + height > frameBufferHeight) {
+        height = frameBufferHeight - y;
+    }
+
+    qoi_reset(&state);
+
+    // Keep one byte for the final run
+    for (row = 0; row < height; row++) {
+        canvasRead(x, x + width - 1, y + row, pixels);
+        length += qoi_encode(&state, pixels, width,
+                             &consumed, out + length, space - 1 - length);
+        if (consumed < width) {
+            return 0;
+        }
+    }
+    length += qoi_encode_flush(&state, out + length);
+
+    out[0] = tx;
+    out[1] = ty;
+    out[2] = length - STREAM_TILE_HEADER_SIZE;
+    out[3] = (length - STREAM_TILE_HEADER_SIZE) >> 8;
+
+    return length;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       stream_update
+//
+//  Arguments:      frame:       The current frame number
+//
+//  Returns:        void
+//
+//  Description:    This function is called once per frame, after drawing.
+//                  It sends the changed tiles that fit in the byte
+//                  allowance and the free space of the UART transmit ring,
+//                  in one message, and never waits for the UART.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void stream_update(unsigned int frame)
+{
+    unsigned long now;
+    unsigned int budget, space, length, tileLength, count = 0;
+    unsigned int total, i, tile, tx, ty;
+
+    if (!streamActive) {
+        return;
+    }
+
+    // Top up the byte allowance for the time since the last frame
+    now = timer_ticks();
+    tokens += ticks_to_us(now - lastRefill) * STREAM_BYTES_PER_SECOND / 1000000;
+    lastRefill = now;
+    if (tokens > STREAM_BURST) {
+        tokens = STREAM_BURST;
+    }
+
+    // Leave room in the transmit ring for the frame header and an ACK
+    budget = tokens;
+    space = uart_tx_space();
+    space = (space > 64) ? space - 64 : 0;
+    if (budget > space) {
+        budget = space;
+    }
+    if (budget > COMMAND_MAX_PAYLOAD) {
+        budget = COMMAND_MAX_PAYLOAD;
+    }
+
+    length = STREAM_HEADER_SIZE;
+    total = tileColumns * tileRows;
+
+    for (i = 0; i < total; i++) {
+        tile = nextTile + i;
+        if (tile >= total) {
+            tile -= total;
+        }
+        ty = tile / tileColumns;
+        tx = tile - ty * tileColumns;
+
+        if (!(dirtyTiles[ty] & (1UL << tx))) {
+            continue;
+        }
+        if (length >= budget) {
+            break;
+        }
+
+        tileLength = encode_tile(tx, ty, message + length, budget - length);
+        if (tileLength == 0) {
+            break;
+        }
+
+        dirtyTiles[ty] &= ~(1UL << tx);
+        length += tileLength;
+        count++;
+    }
+
+    if (count == 0) {
+        // Count frames where changed tiles had to wait
+        if (i < total) {
+            framesDeferred++;
+        }
+        return;
+    }
+    if (i < total) {
+        framesDeferred++;
+        nextTile = tile;
+    } else {
+        nextTile = 0;
+    }
+
+    message[0] = frame;
+    message[1] = frame >> 8;
+    message[2] = frame >> 16;
+    message[3] = frame >> 24;
+    message[4] = count;
+    message[5] = count >> 8;
+
+    command_send_frame(COMMAND_FRAME_STREAM_DATA, messageSequence++,
+                       message, length);
+
+    tokens -= (length < tokens) ? length : tokens;
+    messagesSent++;
+    tilesSent += count;
+    bytesSent += length;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       stream_report
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes the stream statistics to the
+//                  console terminal while a viewer is connected.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void stream_report()
+{
+    if (!streamActive) {
+        return;
+    }
+
+    log_info("Stream: messages %u tiles %u bytes %u deferred frames %u\n",
+             messagesSent, tilesSent, bytesSent, framesDeferred);
+}
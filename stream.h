@@ -0,0 +1,32 @@
+// Tile size for change tracking, in pixels (a power of two)
+#define STREAM_TILE_SHIFT           5
+#define STREAM_TILE_SIZE            (1 << STREAM_TILE_SHIFT)
+
+// Most tile rows and columns tracked (enough for 2048 x 2048)
+#define STREAM_MAX_TILE_ROWS        64
+
+// The stream is limited to this many bytes per second, which leaves
+// about a fifth of the 11520 bytes per second a 115200 Baud UART can
+// carry for ACKs and console output. Unused allowance accumulates up to
+// STREAM_BURST bytes, enough for the largest possible tile.
+#define STREAM_BYTES_PER_SECOND     9216
+#define STREAM_BURST                8192
+
+// Stream message payload (all values little-endian), sent by the Pi in
+// COMMAND_FRAME_STREAM_DATA frames:
+//
+//     frame number    4 bytes, the frame the tiles were taken in
+//     tile count      2 bytes
+//     tiles           tile count times:
+//         tile x, y   1 byte each, in tiles
+//         length      2 bytes, of the QOI data that follows
+//         QOI data    the tile's pixels, row by row, clipped to the
+//                     screen, from a reset QOI state
+#define STREAM_HEADER_SIZE          6
+#define STREAM_TILE_HEADER_SIZE     4
+
+// Function prototypes
+unsigned int stream_control(const unsigned char *request, unsigned int length);
+void stream_damage(int x0, int x1, int y);
+void stream_update(unsigned int frame);
+void stream_report();
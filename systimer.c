@@ -1,4 +1,19 @@
 //Source: Manzara's examples
+// The functions in this file provide timestamps, delays and timer
+// interrupt deadlines. They are based on the ARM generic timer: the
+// CNTPCT_EL0 counter is read with a single system register access, and
+// (unlike the BCM System Timer) it is also emulated by Qemu, so timing
+// behaves the same on hardware and under emulation.
+//
+// Counter ticks are converted to and from nanoseconds and microseconds
+// with 32.32 fixed-point multipliers, computed once from the counter
+// frequency in timer_init(), so no division is needed at run time.
+
+#include "gpio.h"
+#include "irq.h"
+#include "systimer.h"
+#include "idle.h"
+
 // The addresses of the BCM System Timer registers.
 //
 // These are defined on page 172 of the Broadcom BCM2837 ARM Peripherals
@@ -6,9 +21,9 @@
 // peripherals, which have the address range 0x3F000000 to 0x3FFFFFFF.
 // These addresses are mapped by the VideoCore Memory Management Unit (MMU)
 // onto the bus addresses in the range 0x7E000000 to 0x7EFFFFFF.
-
-#include "gpio.h"
-
+//
+// The System Timer counts microseconds. It is only used to calibrate the
+// generic timer if the firmware did not set the counter frequency.
 #define SYSTEM_TIMER_CS	    ((volatile unsigned int *)(MMIO_BASE + 0x00003000))
 #define SYSTEM_TIMER_CLO    ((volatile unsigned int *)(MMIO_BASE + 0x00003004))
 #define SYSTEM_TIMER_CHI    ((volatile unsigned int *)(MMIO_BASE + 0x00003008))
@@ -17,12 +32,35 @@
 #define SYSTEM_TIMER_C2     ((volatile unsigned int *)(MMIO_BASE + 0x00003014))
 #define SYSTEM_TIMER_C3     ((volatile unsigned int *)(MMIO_BASE + 0x00003018))
 
+// The counter frequency the Raspberry Pi 3 firmware normally programs
+#define DEFAULT_FREQUENCY   19200000
+
+// Bits of the CNTP_CTL_EL0 timer control register
+#define CNTP_CTL_ENABLE     0x1
+#define CNTP_CTL_IMASK      0x2
+
+// A pending timer deadline
+struct deadline {
+    unsigned long ticks;
+    void (*callback)(void *);
+    void *context;
+    int active;
+};
+
+// The generic timer frequency, and the 32.32 fixed-point multipliers used
+// to convert between counter ticks and nanoseconds or microseconds
+static unsigned int frequency;
+static unsigned long nsPerTick, ticksPerNs, usPerTick, ticksPerUs;
+
+// The pending deadlines (serviced on core 0)
+static struct deadline deadlines[TIMER_DEADLINES];
+
 
 
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  Function:       get_timer_counter
+//  Function:       get_system_timer
 //
 //  Arguments:      none
 //
@@ -33,28 +71,221 @@
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-unsigned long get_timer_counter()
+static unsigned long get_system_timer()
 {
     unsigned int high, low;
-    
+
     // Read the system timer counter, by reading its higher and lower 32 bits
     high = *SYSTEM_TIMER_CHI;
     low = *SYSTEM_TIMER_CLO;
-    
+
     // We repeat the read if the high 32 bits changed when reading the low
     // 32 bits. This may happen when the low order bits roll over.
     if (high != *SYSTEM_TIMER_CHI) {
         high = *SYSTEM_TIMER_CHI;
         low = *SYSTEM_TIMER_CLO;
     }
-    
+
     // Form the complete 64-bit value, and return it to calling code
     return ( ((unsigned long)high << 32) | low );
 }
 
 
 
- 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       scale
+//
+//  Arguments:      value:       The value to convert
+//                  multiplier:  A 32.32 fixed-point conversion factor
+//
+//  Returns:        value * multiplier, as an integer
+//
+//  Description:    This function multiplies by a fixed-point factor, using
+//                  a 64 x 64 -> 128-bit multiply so that large counter
+//                  values do not overflow.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned long scale(unsigned long value, unsigned long multiplier)
+{
+    return (unsigned long)(((unsigned __int128)value * multiplier) >> 32);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       timer_init
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function reads the generic timer frequency from
+//                  CNTFRQ_EL0 and computes the conversion factors. If the
+//                  firmware did not program the frequency, it is measured
+//                  against the BCM System Timer, or assumed to be 19.2 MHz
+//                  if that timer is not running either. It also sets up
+//                  the timer interrupt used for deadlines.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void timer_init()
+{
+    unsigned long start, ticks, systemStart;
+    unsigned int freq;
+
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+
+    if (freq == 0) {
+        // Count generic timer ticks over 10 ms of the System Timer
+        systemStart = get_system_timer();
+        if (systemStart) {
+            start = timer_ticks();
+            while (get_system_timer() - systemStart < 10000)
+                ;
+            ticks = timer_ticks() - start;
+            freq = ticks * 100;
+        } else {
+            freq = DEFAULT_FREQUENCY;
+        }
+    }
+
+    frequency = freq;
+    nsPerTick = (1000000000UL << 32) / freq;
+    ticksPerNs = ((unsigned long)freq << 32) / 1000000000UL;
+    usPerTick = (1000000UL << 32) / freq;
+    ticksPerUs = ((unsigned long)freq << 32) / 1000000UL;
+
+    // Deadlines are delivered through the non-secure physical timer
+    // interrupt of core 0. The timer stays disabled until one is set.
+    asm volatile("msr cntp_ctl_el0, %0" :: "r"((unsigned long)CNTP_CTL_IMASK));
+    irq_register(IRQ_LOCAL_CNTPNS, timer_service);
+    irq_enable(IRQ_LOCAL_CNTPNS);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       timer_ticks
+//
+//  Arguments:      none
+//
+//  Returns:        The current value of the generic timer counter
+//
+//  Description:    This function reads CNTPCT_EL0. The isb makes sure the
+//                  counter is not read early, ahead of preceding code.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned long timer_ticks()
+{
+    unsigned long ticks;
+
+    asm volatile("isb; mrs %0, cntpct_el0" : "=r"(ticks) :: "memory");
+
+    return ticks;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       timer_frequency
+//
+//  Arguments:      none
+//
+//  Returns:        The generic timer frequency in Hz
+//
+//  Description:    This function returns the counter frequency found by
+//                  timer_init().
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int timer_frequency()
+{
+    return frequency;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       ticks_to_ns / ns_to_ticks / ticks_to_us / us_to_ticks
+//
+//  Arguments:      The value to convert
+//
+//  Returns:        The converted value
+//
+//  Description:    These functions convert between generic timer ticks and
+//                  nanoseconds or microseconds.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned long ticks_to_ns(unsigned long ticks)
+{
+    return scale(ticks, nsPerTick);
+}
+
+unsigned long ns_to_ticks(unsigned long ns)
+{
+    return scale(ns, ticksPerNs);
+}
+
+unsigned long ticks_to_us(unsigned long ticks)
+{
+    return scale(ticks, usPerTick);
+}
+
+unsigned long us_to_ticks(unsigned long us)
+{
+    return scale(us, ticksPerUs);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       timer_ns
+//
+//  Arguments:      none
+//
+//  Returns:        The current time in nanoseconds
+//
+//  Description:    This function returns a nanosecond timestamp. Its
+//                  resolution is one counter tick (52 ns at 19.2 MHz).
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned long timer_ns()
+{
+    return scale(timer_ticks(), nsPerTick);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       get_timer_counter
+//
+//  Arguments:      none
+//
+//  Returns:        The current time in microseconds
+//
+//  Description:    This function returns a microsecond timestamp, taken from
+//                  the generic timer counter.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned long get_timer_counter()
+{
+    return scale(timer_ticks(), usPerTick);
+}
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  Function:       microsecond_delay
@@ -63,37 +294,193 @@ unsigned long get_timer_counter()
 //
 //  Returns:        void
 //
-//  Description:    This function uses the BCM System Timer peripheral device
-//                  to delay the specified number of microseconds. This timer
-//                  is not emulated in Qemu, so this function returns
-//                  immediately (without delay) if this code is run under Qemu.
+//  Description:    This function uses the generic timer to delay the
+//                  specified number of microseconds. The generic timer is
+//                  emulated by Qemu, so the delay is the same there. Longer
+//                  delays sleep between polls of the counter (woken by the
+//                  event stream), while short ones spin for accuracy.
 //
 ////////////////////////////////////////////////////////////////////////////////
 
 void microsecond_delay(unsigned int interval)
 {
-    unsigned long current_counter, target_counter;
-	
-	
-    // Get the current value of the system timer counter
-    current_counter = get_timer_counter();
-	
-    // Because Qemu does not emulate the system counter, the timer counter will
-    // always be 0 and we cannot use it to do timing (it will result in an
-    // infinite loop). In this case, we return immediately (without any delay).
-    if (current_counter == 0) {
-        return;
-    }
-	
-    // Calculate the target value of the system timer counter. This will be
+    unsigned long target_counter;
+
+    // Calculate the target value of the counter. This will be
     // the specified number of microseconds into the future.
-    target_counter = current_counter + interval;
-	    
-    // Keep polling the system timer counter until we reach the target value
-    while (get_timer_counter() < target_counter)
+    target_counter = timer_ticks() + scale(interval, ticksPerUs);
+
+    // Sleep until we are close to the target value
+    if (interval > IDLE_SPIN_THRESHOLD_US) {
+        target_counter -= scale(IDLE_SPIN_THRESHOLD_US, ticksPerUs);
+        while (timer_ticks() < target_counter) {
+            idle_wait_event();
+        }
+        target_counter += scale(IDLE_SPIN_THRESHOLD_US, ticksPerUs);
+    }
+
+    // Keep polling the counter until we reach the target value
+    while (timer_ticks() < target_counter)
         ;
-    	
-    // Once we have reached this point, we have delayed the specified number
-    // of microseconds, so return
-    return;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       nanosecond_delay
+//
+//  Arguments:      interval:     The time to delay in nanoseconds
+//
+//  Returns:        void
+//
+//  Description:    This function delays the specified number of
+//                  nanoseconds, rounded up to a whole counter tick.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void nanosecond_delay(unsigned int interval)
+{
+    unsigned long target_counter;
+
+    target_counter = timer_ticks() + scale(interval, ticksPerNs) + 1;
+
+    while (timer_ticks() < target_counter)
+        ;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       program_timer
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function sets the timer compare value to the
+//                  earliest active deadline, or masks the timer interrupt
+//                  if there is none. It must be called with IRQs masked.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void program_timer()
+{
+    unsigned long earliest = ~0UL;
+    int i;
+
+    for (i = 0; i < TIMER_DEADLINES; i++) {
+        if (deadlines[i].active && deadlines[i].ticks < earliest) {
+            earliest = deadlines[i].ticks;
+        }
+    }
+
+    if (earliest == ~0UL) {
+        asm volatile("msr cntp_ctl_el0, %0" :: "r"((unsigned long)CNTP_CTL_IMASK));
+    } else {
+        asm volatile("msr cntp_cval_el0, %0" :: "r"(earliest));
+        asm volatile("msr cntp_ctl_el0, %0" :: "r"((unsigned long)CNTP_CTL_ENABLE));
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       timer_add_deadline
+//
+//  Arguments:      ticks:       The counter value at which to fire
+//                  callback:    The function to call (from the timer
+//                               interrupt, with IRQs masked)
+//                  context:     Passed unchanged to the callback
+//
+//  Returns:        A deadline id for timer_cancel_deadline(), or -1 if
+//                  all TIMER_DEADLINES deadlines are in use
+//
+//  Description:    This function arranges for the callback to be called
+//                  once the generic timer counter reaches the given value.
+//                  Use timer_ticks() + ns_to_ticks(...) for a relative
+//                  deadline. A deadline in the past fires immediately.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int timer_add_deadline(unsigned long ticks, void (*callback)(void *), void *context)
+{
+    unsigned long flags = irq_save();
+    int i;
+
+    for (i = 0; i < TIMER_DEADLINES; i++) {
+        if (!deadlines[i].active) {
+            deadlines[i].ticks = ticks;
+            deadlines[i].callback = callback;
+            deadlines[i].context = context;
+            deadlines[i].active = 1;
+            program_timer();
+            irq_restore(flags);
+            return i;
+        }
+    }
+
+    irq_restore(flags);
+    return -1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       timer_cancel_deadline
+//
+//  Arguments:      id:          A deadline id from timer_add_deadline()
+//
+//  Returns:        void
+//
+//  Description:    This function cancels a deadline that has not fired yet.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void timer_cancel_deadline(int id)
+{
+    unsigned long flags;
+
+    if (id < 0 || id >= TIMER_DEADLINES) {
+        return;
+    }
+
+    flags = irq_save();
+    deadlines[id].active = 0;
+    program_timer();
+    irq_restore(flags);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       timer_service
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This is the generic timer interrupt handler. It calls the
+//                  callback of every deadline that has been reached, and
+//                  reprograms the timer for the next one.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void timer_service()
+{
+    unsigned long now = timer_ticks();
+    int i;
+
+    for (i = 0; i < TIMER_DEADLINES; i++) {
+        if (deadlines[i].active && deadlines[i].ticks <= now) {
+            deadlines[i].active = 0;
+            deadlines[i].callback(deadlines[i].context);
+        }
+    }
+
+    program_timer();
 }
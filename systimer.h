@@ -1,3 +1,18 @@
+// Number of timer deadlines that can be pending at the same time
+#define TIMER_DEADLINES  8
+
 // Function prototypes
+void timer_init();
+unsigned long timer_ticks();
+unsigned int timer_frequency();
+unsigned long ticks_to_ns(unsigned long ticks);
+unsigned long ns_to_ticks(unsigned long ns);
+unsigned long ticks_to_us(unsigned long ticks);
+unsigned long us_to_ticks(unsigned long us);
+unsigned long timer_ns();
 unsigned long get_timer_counter();
 void microsecond_delay(unsigned int interval);
+void nanosecond_delay(unsigned int interval);
+int timer_add_deadline(unsigned long ticks, void (*callback)(void *), void *context);
+void timer_cancel_deadline(int id);
+void timer_service();
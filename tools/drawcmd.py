@@ -0,0 +1,252 @@
+#!/usr/bin/env python3
+#
+# Draws on the Raspberry Pi's canvas over the serial link, using the
+# command protocol in command.c. Commands are packed into batches, so many
+# primitives arrive in one frame and are drawn in the same video frame.
+#
+# Usage:
+#   drawcmd.py PORT clear
+#   drawcmd.py PORT line X0 Y0 X1 Y1 [--colour RRGGBB]
+#   drawcmd.py PORT rect X Y WIDTH HEIGHT [--colour RRGGBB]
+#   drawcmd.py PORT point X Y [--colour RRGGBB]
+#   drawcmd.py PORT flood X Y
+#   drawcmd.py PORT fill X Y --target RRGGBB [--colour RRGGBB]
+#                        [--tolerance N] [--connectivity 4|8]
+#   drawcmd.py PORT circle X Y RADIUS [--colour RRGGBB]
+#   drawcmd.py PORT roundrect X Y WIDTH HEIGHT RADIUS [--colour RRGGBB]
+#   drawcmd.py PORT polygon X0 Y0 X1 Y1 X2 Y2 ... [--colour RRGGBB]
+#                           [--nonzero]
+#   drawcmd.py PORT image background|stamp X Y
+#   drawcmd.py PORT query X Y
+#   drawcmd.py PORT undo [STEPS]
+#   drawcmd.py PORT redo [STEPS]
+#   drawcmd.py PORT loadtest [--seconds N] [--batch N] [--window N]
+#
+# The opcodes must match command.h.
+
+import argparse
+import random
+import struct
+import sys
+import time
+
+import pilink
+
+CLEAR = 0x01
+SET_COLOUR = 0x02
+POINT = 0x03
+LINE = 0x04
+FILL_RECT = 0x05
+FLOOD = 0x06
+QUERY_PIXEL = 0x07
+UNDO = 0x08
+REDO = 0x09
+FILL = 0x0A
+CIRCLE = 0x0B
+ROUND_RECT = 0x0C
+POLYGON = 0x0D
+IMAGE = 0x0E
+
+# Images built into the kernel, as numbered in asset.h
+IMAGES = {"background": 0, "stamp": 1}
+
+WIDTH = 1024
+HEIGHT = 768
+
+
+def op_clear():
+    return bytes([CLEAR])
+
+
+def op_colour(colour):
+    return struct.pack("<BI", SET_COLOUR, colour)
+
+
+def op_point(x, y):
+    return struct.pack("<Bhh", POINT, x, y)
+
+
+def op_line(x0, y0, x1, y1):
+    return struct.pack("<Bhhhh", LINE, x0, y0, x1, y1)
+
+
+def op_rect(x, y, width, height):
+    return struct.pack("<BhhHH", FILL_RECT, x, y, width, height)
+
+
+def op_flood(x, y):
+    return struct.pack("<Bhh", FLOOD, x, y)
+
+
+def op_fill(x, y, target, tolerance=0, connectivity=4):
+    return struct.pack("<BhhIBB", FILL, x, y, target, tolerance, connectivity)
+
+
+def op_circle(x, y, radius):
+    return struct.pack("<BhhH", CIRCLE, x, y, radius)
+
+
+def op_round_rect(x, y, width, height, radius):
+    return struct.pack("<BhhHHH", ROUND_RECT, x, y, width, height, radius)
+
+
+def op_polygon(points, nonzero=False):
+    """points is a flat list x0, y0, x1, y1, ..."""
+    return (struct.pack("<BBH", POLYGON, 1 if nonzero else 0, len(points) // 2)
+            + struct.pack("<%dh" % len(points), *points))
+
+
+def op_image(image, x, y):
+    return struct.pack("<BBhh", IMAGE, image, x, y)
+
+
+def op_query(x, y):
+    return struct.pack("<Bhh", QUERY_PIXEL, x, y)
+
+
+def op_undo(steps):
+    return struct.pack("<BH", UNDO, steps)
+
+
+def op_redo(steps):
+    return struct.pack("<BH", REDO, steps)
+
+
+def batches(ops, limit):
+    """Packs encoded commands into payloads of at most limit bytes."""
+    payload = bytearray()
+    for op in ops:
+        if len(payload) + len(op) > limit:
+            yield bytes(payload)
+            payload = bytearray()
+        payload += op
+    if payload:
+        yield bytes(payload)
+
+
+def run(link, ops, limit=pilink.MAX_PAYLOAD):
+    sequences = [link.send(payload) for payload in batches(ops, limit)]
+    link.flush()
+    return [link.results[s] for s in sequences]
+
+
+def load_test(link, seconds, batch):
+    """Sends random lines and rectangles for a while, and reports the
+    command rate the Pi sustained."""
+    rng = random.Random(359)
+    commands = frames = 0
+    start = time.monotonic()
+
+    while time.monotonic() - start < seconds:
+        ops = [op_colour(rng.randrange(0x1000000))]
+        for _ in range(batch):
+            if rng.random() < 0.8:
+                ops.append(op_line(rng.randrange(WIDTH), rng.randrange(HEIGHT),
+                                   rng.randrange(WIDTH), rng.randrange(HEIGHT)))
+            else:
+                ops.append(op_rect(rng.randrange(WIDTH), rng.randrange(HEIGHT),
+                                   rng.randrange(64), rng.randrange(64)))
+        link.send(b"".join(ops))
+        commands += len(ops)
+        frames += 1
+
+    link.flush()
+    elapsed = time.monotonic() - start
+    print("%d commands in %d batches in %.1f s: %.0f commands/s, %d resends"
+          % (commands, frames, elapsed, commands / elapsed, link.resends))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Draw on the Pi over UART")
+    parser.add_argument("port")
+    parser.add_argument("command", choices=["clear", "point", "line", "rect",
+                                            "flood", "fill", "circle",
+                                            "roundrect", "polygon", "image",
+                                            "query",
+                                            "undo", "redo",
+                                            "loadtest"])
+    parser.add_argument("args", nargs="*")
+    parser.add_argument("--colour", default="000000",
+                        help="colour as RRGGBB hex (default black)")
+    parser.add_argument("--target", default="FFFFFF",
+                        help="colour replaced by fill, as RRGGBB hex")
+    parser.add_argument("--tolerance", type=int, default=0,
+                        help="per-channel difference fill still replaces")
+    parser.add_argument("--connectivity", type=int, choices=[4, 8],
+                        default=4)
+    parser.add_argument("--nonzero", action="store_true",
+                        help="fill polygons by the non-zero winding rule "
+                             "instead of even-odd")
+    parser.add_argument("--seconds", type=float, default=10)
+    parser.add_argument("--batch", type=int, default=64,
+                        help="commands per batch in the load test")
+    parser.add_argument("--window", type=int, default=4,
+                        help="batches in flight before waiting for an ACK")
+    parser.add_argument("--verbose", action="store_true",
+                        help="show the Pi's console output")
+    options = parser.parse_args()
+
+    # Images are given by name, everything else by number
+    if options.command == "image" and options.args:
+        if options.args[0] not in IMAGES:
+            parser.error("image takes one of %s, then X Y"
+                         % ", ".join(sorted(IMAGES)))
+        options.args[0] = IMAGES[options.args[0]]
+    try:
+        options.args = [int(v) for v in options.args]
+    except ValueError:
+        parser.error("%s takes numbers" % options.command)
+
+    arity = {"clear": 0, "point": 2, "line": 4, "rect": 4, "flood": 2,
+             "fill": 2, "circle": 3, "roundrect": 5, "image": 3,
+             "query": 2, "loadtest": 0}
+    if options.command in ("undo", "redo") and len(options.args) <= 1:
+        options.args = options.args or [1]
+    elif options.command == "polygon":
+        if len(options.args) < 6 or len(options.args) % 2:
+            parser.error("polygon takes at least 3 X Y pairs")
+    elif len(options.args) != arity[options.command]:
+        parser.error("%s takes %d numbers" % (options.command,
+                                              arity[options.command]))
+
+    on_text = None
+    if options.verbose:
+        on_text = lambda text: sys.stderr.write(text.decode("ascii", "replace"))
+
+    port = pilink.Serial(options.port)
+    link = pilink.Link(port, window=options.window, on_text=on_text)
+    link.reset()
+
+    colour = op_colour(int(options.colour, 16))
+    a = options.args
+    if options.command == "loadtest":
+        load_test(link, options.seconds, options.batch)
+        return
+
+    ops = {
+        "clear": lambda: [op_clear()],
+        "point": lambda: [colour, op_point(*a)],
+        "line": lambda: [colour, op_line(*a)],
+        "rect": lambda: [colour, op_rect(*a)],
+        "flood": lambda: [op_flood(*a)],
+        "fill": lambda: [colour, op_fill(a[0], a[1], int(options.target, 16),
+                                         options.tolerance,
+                                         options.connectivity)],
+        "circle": lambda: [colour, op_circle(*a)],
+        "roundrect": lambda: [colour, op_round_rect(*a)],
+        "polygon": lambda: [colour, op_polygon(a, options.nonzero)],
+        "image": lambda: [op_image(*a)],
+        "query": lambda: [op_query(*a)],
+        "undo": lambda: [op_undo(*a)],
+        "redo": lambda: [op_redo(*a)],
+    }[options.command]()
+
+    for status, results in run(link, ops):
+        if status != pilink.OK:
+            print("error: %s" % pilink.STATUS_NAMES.get(status, status))
+        for (pixel,) in struct.iter_unpack("<I", results):
+            print("%06X" % pixel)
+
+
+if __name__ == "__main__":
+    main()
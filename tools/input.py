@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+#
+# Records the SNES controller's buttons on the Raspberry Pi and replays
+# them, using the input recorder described in input.h, so that a session
+# can be run again exactly to measure it.
+#
+# Usage:
+#   input.py PORT record
+#   input.py PORT stop
+#   input.py PORT save session.rec
+#   input.py PORT load session.rec
+#   input.py PORT replay [session.rec]
+#   input.py show session.rec
+#
+# record and replay start at the Pi's next frame, from a cleared canvas;
+# the Pi reports how many frames a replay took, and how long, on its
+# console when it ends. save stops a recording in progress. show prints a
+# recording as the frames where buttons were pressed and released.
+#
+# The actions must match input.h.
+
+import struct
+import sys
+
+import pilink
+
+STOP = 0
+RECORD = 1
+REPLAY = 2
+EXPORT = 3
+LOAD = 4
+
+LOAD_CHUNK_SIZE = 1024
+DATA_HEADER = struct.Struct("<II")
+
+# SNES button numbers, as get_SNES() returns them
+BUTTONS = ["B", "Y", "Select", "Start", "Up", "Down", "Left", "Right",
+           "A", "X", "L", "R"]
+
+
+def changes(data):
+    """Yields (frame, buttons pressed, buttons released) for a recording."""
+    frame, state, pos = 0, 0, 0
+    while pos < len(data):
+        count, shift = 0, 0
+        while True:
+            byte = data[pos]
+            pos += 1
+            count |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+        (changed,) = struct.unpack_from("<H", data, pos)
+        pos += 2
+        frame += count
+        if changed == 0:
+            yield frame, 0, 0
+            return
+        yield frame, changed & ~state, changed & state
+        state ^= changed
+
+
+def names(buttons):
+    return " ".join(name for bit, name in enumerate(BUTTONS)
+                    if buttons & (1 << bit))
+
+
+def show(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    for frame, pressed, released in changes(data):
+        if not pressed and not released:
+            print("%8d  end" % frame)
+            break
+        text = []
+        if pressed:
+            text.append("+ " + names(pressed))
+        if released:
+            text.append("- " + names(released))
+        print("%8d  %s" % (frame, "  ".join(text)))
+
+
+def control(link, payload):
+    sequence = link.send(payload, pilink.FRAME_INPUT)
+    link.flush()
+    status = link.results[sequence][0]
+    if status != pilink.OK:
+        sys.exit("error: %s" % pilink.STATUS_NAMES.get(status, status))
+
+
+def save(link, path):
+    for _ in range(3):
+        control(link, bytes([EXPORT]))
+
+        data, total = bytearray(), None
+        while total is None or len(data) < total:
+            frames = link.receive(2.0)
+            if not frames:
+                break
+            for frame_type, _, payload in frames:
+                if frame_type != pilink.FRAME_INPUT_DATA:
+                    continue
+                offset, total = DATA_HEADER.unpack_from(payload)
+                if offset == len(data):
+                    data += payload[DATA_HEADER.size:]
+
+        if total is not None and len(data) == total:
+            with open(path, "wb") as f:
+                f.write(data)
+            print("%d bytes" % total)
+            return
+        print("recording incomplete, asking again")
+
+    sys.exit("could not fetch the recording")
+
+
+def load(link, path):
+    with open(path, "rb") as f:
+        data = f.read()
+    for offset in range(0, max(len(data), 1), LOAD_CHUNK_SIZE):
+        control(link, bytes([LOAD]) + struct.pack("<I", offset) +
+                data[offset:offset + LOAD_CHUNK_SIZE])
+
+
+def main():
+    if len(sys.argv) == 3 and sys.argv[1] == "show":
+        show(sys.argv[2])
+        return
+
+    if len(sys.argv) < 3 or sys.argv[2] not in ("record", "stop", "save",
+                                                 "load", "replay"):
+        sys.exit("usage: input.py PORT record|stop|save|load|replay [FILE]\n"
+                 "       input.py show FILE")
+
+    port, command, args = sys.argv[1], sys.argv[2], sys.argv[3:]
+    if command in ("save", "load") and len(args) != 1:
+        sys.exit("%s needs a file" % command)
+
+    link = pilink.Link(pilink.Serial(port))
+    link.reset()
+
+    if command == "record":
+        control(link, bytes([RECORD]))
+    elif command == "stop":
+        control(link, bytes([STOP]))
+    elif command == "save":
+        save(link, args[0])
+    elif command == "load":
+        load(link, args[0])
+    else:
+        if args:
+            load(link, args[0])
+        control(link, bytes([REPLAY]))
+
+
+if __name__ == "__main__":
+    main()
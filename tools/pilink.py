@@ -0,0 +1,221 @@
+#!/usr/bin/env python3
+#
+# Host side of the serial frame protocol implemented in command.c. The
+# frame layout and the status codes must match command.h.
+#
+# The serial port is opened with termios, so only the standard library is
+# needed. Console text printed by the Pi is passed to a callback (or
+# dropped); frames are found by their sync byte and checked by CRC.
+
+import os
+import select
+import struct
+import termios
+import time
+import zlib
+
+SYNC = 0xA5
+HEADER = struct.Struct("<BBHH")
+MAX_PAYLOAD = 8192
+
+FRAME_RESET = ord("R")
+FRAME_BATCH = ord("C")
+FRAME_SNAPSHOT = ord("S")
+FRAME_RESTORE = ord("W")
+FRAME_STREAM = ord("V")
+FRAME_INPUT = ord("I")
+FRAME_SAVE = ord("F")
+FRAME_ACK = ord("A")
+FRAME_SNAPSHOT_DATA = ord("D")
+FRAME_STREAM_DATA = ord("T")
+FRAME_INPUT_DATA = ord("N")
+
+OK = 0
+DUPLICATE = 1
+BAD_CRC = 2
+BAD_SEQUENCE = 3
+BAD_COMMAND = 4
+BAD_IMAGE = 5
+BUSY = 6
+
+STATUS_NAMES = {
+    OK: "ok",
+    DUPLICATE: "duplicate",
+    BAD_CRC: "bad crc",
+    BAD_SEQUENCE: "bad sequence",
+    BAD_COMMAND: "bad command",
+    BAD_IMAGE: "bad image",
+    BUSY: "busy",
+}
+
+
+def encode_frame(frame_type, sequence, payload):
+    header = HEADER.pack(SYNC, frame_type, sequence & 0xFFFF, len(payload))
+    crc = zlib.crc32(header[1:] + payload) & 0xFFFFFFFF
+    return header + payload + struct.pack("<I", crc)
+
+
+class FrameParser:
+    """Splits a byte stream into frames and console text."""
+
+    def __init__(self, on_text=None):
+        self.buffer = bytearray()
+        self.on_text = on_text
+        self.crc_errors = 0
+
+    def feed(self, data):
+        """Adds bytes; returns a list of (type, sequence, payload)."""
+        self.buffer += data
+        frames = []
+
+        while True:
+            start = self.buffer.find(bytes([SYNC]))
+            if start < 0:
+                self._text(self.buffer)
+                self.buffer.clear()
+                break
+            if start:
+                self._text(self.buffer[:start])
+                del self.buffer[:start]
+
+            if len(self.buffer) < HEADER.size:
+                break
+            _, frame_type, sequence, length = HEADER.unpack_from(self.buffer)
+            if length > MAX_PAYLOAD:
+                del self.buffer[:1]
+                continue
+
+            size = HEADER.size + length + 4
+            if len(self.buffer) < size:
+                break
+
+            (crc,) = struct.unpack_from("<I", self.buffer, size - 4)
+            if zlib.crc32(self.buffer[1:size - 4]) & 0xFFFFFFFF != crc:
+                # Not a frame after all, or a corrupted one: resync on
+                # the next sync byte
+                self.crc_errors += 1
+                del self.buffer[:1]
+                continue
+
+            frames.append((frame_type, sequence,
+                           bytes(self.buffer[HEADER.size:size - 4])))
+            del self.buffer[:size]
+
+        return frames
+
+    def _text(self, data):
+        if data and self.on_text:
+            self.on_text(bytes(data))
+
+
+class Serial:
+    """A raw serial port, opened with termios."""
+
+    def __init__(self, path, baud=115200):
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        attrs = termios.tcgetattr(self.fd)
+        attrs[0] = 0                                    # iflag
+        attrs[1] = 0                                    # oflag
+        attrs[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+        attrs[3] = 0                                    # lflag
+        speed = getattr(termios, "B%d" % baud)
+        attrs[4] = attrs[5] = speed
+        attrs[6][termios.VMIN] = 0
+        attrs[6][termios.VTIME] = 0
+        termios.tcsetattr(self.fd, termios.TCSANOW, attrs)
+        termios.tcflush(self.fd, termios.TCIOFLUSH)
+
+    def write(self, data):
+        view = memoryview(data)
+        while view:
+            written = os.write(self.fd, view)
+            view = view[written:]
+
+    def read(self, timeout):
+        ready, _, _ = select.select([self.fd], [], [], timeout)
+        if not ready:
+            return b""
+        return os.read(self.fd, 65536)
+
+    def close(self):
+        os.close(self.fd)
+
+
+class Link:
+    """Sends frames with a go-back-N window and collects their ACKs."""
+
+    def __init__(self, port, window=4, timeout=1.0, on_text=None):
+        self.port = port
+        self.window = window
+        self.timeout = timeout
+        self.parser = FrameParser(on_text)
+        self.sequence = 0
+        self.pending = []           # [(sequence, frame bytes, send time)]
+        self.results = {}           # sequence -> (status, payload)
+        self.resends = 0
+        self.other_frames = []      # Frames that are not ACKs
+
+    def reset(self):
+        """Resynchronizes the sequence numbers with the Pi."""
+        self.sequence = int(time.time()) & 0xFFFF
+        self._send(FRAME_RESET, b"")
+        self.flush()
+
+    def send(self, payload, frame_type=FRAME_BATCH):
+        """Queues a frame; returns its sequence number."""
+        while len(self.pending) >= self.window:
+            self._receive()
+        return self._send(frame_type, payload)
+
+    def receive(self, timeout):
+        """Waits up to timeout seconds for frames that are not ACKs, and
+        returns the ones that have arrived as (type, sequence, payload)."""
+        deadline = time.monotonic() + timeout
+        while not self.other_frames and time.monotonic() < deadline:
+            self._receive()
+        frames, self.other_frames = self.other_frames, []
+        return frames
+
+    def flush(self):
+        """Waits until every frame sent has been acknowledged."""
+        while self.pending:
+            self._receive()
+
+    def _send(self, frame_type, payload):
+        sequence = self.sequence
+        self.sequence = (self.sequence + 1) & 0xFFFF
+        frame = encode_frame(frame_type, sequence, payload)
+        self.pending.append([sequence, frame, time.monotonic()])
+        self.port.write(frame)
+        return sequence
+
+    def _resend_all(self):
+        self.resends += len(self.pending)
+        now = time.monotonic()
+        for entry in self.pending:
+            entry[2] = now
+            self.port.write(entry[1])
+
+    def _receive(self):
+        data = self.port.read(0.05)
+        for frame_type, sequence, payload in self.parser.feed(data):
+            if frame_type != FRAME_ACK:
+                self.other_frames.append((frame_type, sequence, payload))
+                continue
+            self._ack(sequence, payload)
+
+        if self.pending and time.monotonic() - self.pending[0][2] > self.timeout:
+            self._resend_all()
+
+    def _ack(self, sequence, payload):
+        status = payload[0]
+        if not self.pending or sequence != self.pending[0][0]:
+            # An ACK for a frame we are not waiting for (a repeat)
+            return
+
+        if status in (BAD_CRC, BAD_SEQUENCE):
+            self._resend_all()
+            return
+
+        self.pending.pop(0)
+        self.results[sequence] = (status, payload[4:])
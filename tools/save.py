@@ -0,0 +1,42 @@
+#!/usr/bin/env python3
+#
+# Saves the Raspberry Pi's canvas to a slot on its SD card, or loads it
+# back, using the save slots described in save.h.
+#
+# Usage:
+#   save.py PORT save SLOT
+#   save.py PORT load SLOT
+#
+# The Pi saves or loads in the background, and reports on its console
+# when it has finished, or why it could not. The SD card needs an MBR
+# partition of type 0xda to hold the slots (see README.md).
+#
+# The actions must match save.h.
+
+import sys
+
+import pilink
+
+STORE = 0
+LOAD = 1
+
+
+def main():
+    if len(sys.argv) != 4 or sys.argv[2] not in ("save", "load"):
+        sys.exit("usage: save.py PORT save|load SLOT")
+
+    port, command, slot = sys.argv[1], sys.argv[2], int(sys.argv[3])
+    action = STORE if command == "save" else LOAD
+
+    link = pilink.Link(pilink.Serial(port))
+    link.reset()
+
+    sequence = link.send(bytes([action, slot]), pilink.FRAME_SAVE)
+    link.flush()
+    status = link.results[sequence][0]
+    if status != pilink.OK:
+        sys.exit("error: %s" % pilink.STATUS_NAMES.get(status, status))
+
+
+if __name__ == "__main__":
+    main()
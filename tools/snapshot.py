@@ -0,0 +1,358 @@
+#!/usr/bin/env python3
+#
+# Copies the Raspberry Pi's canvas to or from a PNG file over the serial
+# link, using the QOI-encoded chunks described in snapshot.h, and converts
+# between PNG and QOI files offline.
+#
+# Usage:
+#   snapshot.py save PORT canvas.png
+#   snapshot.py restore PORT canvas.png
+#   snapshot.py encode image.png image.qoi
+#   snapshot.py decode image.qoi image.png
+#
+# PNG files are read and written with zlib alone (8-bit greyscale, RGB or
+# RGBA, not interlaced), so only the standard library is needed.
+
+import struct
+import sys
+import time
+import zlib
+
+import pilink
+
+CHUNK_HEADER = struct.Struct("<HHIII")
+RESTORE_CHUNK_SIZE = 2048
+MAX_CHUNK_PIXELS = 65536
+
+
+# ---------------------------------------------------------------------------
+# QOI operations, matching qoi.c. Pixels are 0xAARRGGBB integers.
+
+QOI_OP_INDEX = 0x00
+QOI_OP_DIFF = 0x40
+QOI_OP_LUMA = 0x80
+QOI_OP_RUN = 0xC0
+QOI_OP_RGB = 0xFE
+QOI_OP_RGBA = 0xFF
+
+
+def qoi_hash(p):
+    return (((p >> 16) & 255) * 3 + ((p >> 8) & 255) * 5 + (p & 255) * 7 +
+            (p >> 24) * 11) & 63
+
+
+def qoi_encode(pixels):
+    out = bytearray()
+    index = [0] * 64
+    previous = 0xFF000000
+    run = 0
+
+    for p in pixels:
+        if p == previous:
+            run += 1
+            if run == 62:
+                out.append(QOI_OP_RUN | (run - 1))
+                run = 0
+            continue
+        if run:
+            out.append(QOI_OP_RUN | (run - 1))
+            run = 0
+
+        h = qoi_hash(p)
+        if index[h] == p:
+            out.append(QOI_OP_INDEX | h)
+        else:
+            index[h] = p
+            r, g, b, a = (p >> 16) & 255, (p >> 8) & 255, p & 255, p >> 24
+            if a == previous >> 24:
+                dr = ((r - ((previous >> 16) & 255) + 128) & 255) - 128
+                dg = ((g - ((previous >> 8) & 255) + 128) & 255) - 128
+                db = ((b - (previous & 255) + 128) & 255) - 128
+                if -2 <= dr <= 1 and -2 <= dg <= 1 and -2 <= db <= 1:
+                    out.append(QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2))
+                elif -32 <= dg <= 31 and -8 <= dr - dg <= 7 and -8 <= db - dg <= 7:
+                    out += bytes([QOI_OP_LUMA | (dg + 32),
+                                  (dr - dg + 8) << 4 | (db - dg + 8)])
+                else:
+                    out += bytes([QOI_OP_RGB, r, g, b])
+            else:
+                out += bytes([QOI_OP_RGBA, r, g, b, a])
+        previous = p
+
+    if run:
+        out.append(QOI_OP_RUN | (run - 1))
+    return bytes(out)
+
+
+def qoi_decode(data, count):
+    pixels = []
+    index = [0] * 64
+    p = 0xFF000000
+    i = 0
+
+    while len(pixels) < count and i < len(data):
+        b = data[i]
+        run = 1
+        if b == QOI_OP_RGB:
+            p = (p & 0xFF000000) | data[i + 1] << 16 | data[i + 2] << 8 | data[i + 3]
+            i += 4
+        elif b == QOI_OP_RGBA:
+            p = data[i + 4] << 24 | data[i + 1] << 16 | data[i + 2] << 8 | data[i + 3]
+            i += 5
+        elif b & 0xC0 == QOI_OP_INDEX:
+            p = index[b]
+            i += 1
+        elif b & 0xC0 == QOI_OP_DIFF:
+            r = ((p >> 16) + (b >> 4 & 3) - 2) & 255
+            g = ((p >> 8) + (b >> 2 & 3) - 2) & 255
+            bl = (p + (b & 3) - 2) & 255
+            p = (p & 0xFF000000) | r << 16 | g << 8 | bl
+            i += 1
+        elif b & 0xC0 == QOI_OP_LUMA:
+            b2 = data[i + 1]
+            dg = (b & 0x3F) - 32
+            r = ((p >> 16) + dg + (b2 >> 4) - 8) & 255
+            g = ((p >> 8) + dg) & 255
+            bl = (p + dg + (b2 & 15) - 8) & 255
+            p = (p & 0xFF000000) | r << 16 | g << 8 | bl
+            i += 2
+        else:
+            run = (b & 0x3F) + 1
+            i += 1
+        index[qoi_hash(p)] = p
+        pixels.extend([p] * run)
+
+    return pixels[:count]
+
+
+def qoi_write(path, width, height, pixels):
+    header = b"qoif" + struct.pack(">IIBB", width, height, 4, 0)
+    with open(path, "wb") as f:
+        f.write(header + qoi_encode(pixels) + bytes(7) + b"\x01")
+
+
+def qoi_read(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:4] != b"qoif":
+        raise ValueError("%s is not a QOI file" % path)
+    width, height = struct.unpack_from(">II", data, 4)
+    return width, height, qoi_decode(data[14:], width * height)
+
+
+# ---------------------------------------------------------------------------
+# PNG
+
+def png_chunk(kind, data):
+    body = kind + data
+    return struct.pack(">I", len(data)) + body + struct.pack(">I", zlib.crc32(body))
+
+
+def png_write(path, width, height, pixels):
+    """Writes 0xAARRGGBB pixels as an 8-bit RGB PNG (alpha is dropped,
+    since the framebuffer does not use it)."""
+    raw = bytearray()
+    for y in range(height):
+        raw.append(0)
+        for p in pixels[y * width:(y + 1) * width]:
+            raw += bytes(((p >> 16) & 255, (p >> 8) & 255, p & 255))
+    with open(path, "wb") as f:
+        f.write(b"\x89PNG\r\n\x1a\n")
+        f.write(png_chunk(b"IHDR", struct.pack(">IIBBBBB", width, height,
+                                                8, 2, 0, 0, 0)))
+        f.write(png_chunk(b"IDAT", zlib.compress(bytes(raw), 9)))
+        f.write(png_chunk(b"IEND", b""))
+
+
+def paeth(a, b, c):
+    p = a + b - c
+    pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+    if pa <= pb and pa <= pc:
+        return a
+    return b if pb <= pc else c
+
+
+def png_read(path, alpha=0):
+    """Reads an 8-bit PNG; returns width, height and 0xAARRGGBB pixels,
+    with the alpha byte set to alpha unless the image has its own."""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:8] != b"\x89PNG\r\n\x1a\n":
+        raise ValueError("%s is not a PNG file" % path)
+
+    pos, idat = 8, bytearray()
+    while pos < len(data):
+        (length,) = struct.unpack_from(">I", data, pos)
+        kind = data[pos + 4:pos + 8]
+        body = data[pos + 8:pos + 8 + length]
+        if kind == b"IHDR":
+            width, height, depth, colour, _, _, interlace = \
+                struct.unpack(">IIBBBBB", body)
+        elif kind == b"IDAT":
+            idat += body
+        pos += length + 12
+
+    channels = {0: 1, 2: 3, 4: 2, 6: 4}.get(colour)
+    if depth != 8 or channels is None or interlace:
+        raise ValueError("only 8-bit, non-interlaced grey/RGB/RGBA PNGs "
+                         "are supported")
+
+    raw = zlib.decompress(bytes(idat))
+    stride = width * channels
+    previous = bytearray(stride)
+    pixels = []
+    pos = 0
+    for _ in range(height):
+        kind = raw[pos]
+        line = bytearray(raw[pos + 1:pos + 1 + stride])
+        pos += 1 + stride
+        for i in range(stride):
+            a = line[i - channels] if i >= channels else 0
+            b = previous[i]
+            c = previous[i - channels] if i >= channels else 0
+            if kind == 1:
+                line[i] = (line[i] + a) & 255
+            elif kind == 2:
+                line[i] = (line[i] + b) & 255
+            elif kind == 3:
+                line[i] = (line[i] + ((a + b) >> 1)) & 255
+            elif kind == 4:
+                line[i] = (line[i] + paeth(a, b, c)) & 255
+        for x in range(width):
+            v = line[x * channels:(x + 1) * channels]
+            if channels <= 2:
+                r = g = b = v[0]
+            else:
+                r, g, b = v[0], v[1], v[2]
+            a = v[-1] if channels in (2, 4) else alpha
+            pixels.append(a << 24 | r << 16 | g << 8 | b)
+        previous = line
+
+    return width, height, pixels
+
+
+# ---------------------------------------------------------------------------
+# Serial transfers
+
+def missing_ranges(received, total):
+    """Returns the (first, count) ranges not covered by received chunks."""
+    ranges, position = [], 0
+    for first, count in sorted(received):
+        if first > position:
+            ranges.append((position, first - position))
+        position = max(position, first + count)
+    if position < total:
+        ranges.append((position, total - position))
+    return ranges
+
+
+def save(port_path, png_path):
+    link = pilink.Link(pilink.Serial(port_path))
+    link.reset()
+
+    chunks = {}             # first pixel -> (count, pixels)
+    width = height = None
+    requests = [(0, 0)]     # First ask for the whole canvas
+    start = time.monotonic()
+    received_bytes = 0
+
+    while requests:
+        for first, count in requests:
+            link.send(struct.pack("<II", first, count), pilink.FRAME_SNAPSHOT)
+        link.flush()
+
+        # Collect chunks until the Pi goes quiet
+        while True:
+            frames = link.receive(2.0)
+            if not frames:
+                break
+            for frame_type, _, payload in frames:
+                if frame_type != pilink.FRAME_SNAPSHOT_DATA:
+                    continue
+                w, h, first, count, crc = CHUNK_HEADER.unpack_from(payload)
+                pixels = qoi_decode(payload[CHUNK_HEADER.size:], count)
+                data = struct.pack("<%dI" % len(pixels), *pixels)
+                if len(pixels) != count or zlib.crc32(data) & 0xFFFFFFFF != crc:
+                    print("chunk at pixel %d is damaged" % first)
+                    continue
+                width, height = w, h
+                chunks[first] = (count, pixels)
+                received_bytes += len(payload)
+            sys.stderr.write("\r%d chunks" % len(chunks))
+
+        if width is None:
+            sys.exit("\nno snapshot data received")
+        requests = missing_ranges([(f, c) for f, (c, _) in chunks.items()],
+                                  width * height)
+        if requests:
+            print("\nasking again for %d missing ranges" % len(requests))
+
+    pixels = []
+    for first in sorted(chunks):
+        pixels.extend(chunks[first][1])
+    png_write(png_path, width, height, pixels)
+    print("\n%dx%d canvas, %d bytes in %.1f s" % (width, height, received_bytes,
+                                                 time.monotonic() - start))
+
+
+def restore(port_path, png_path):
+    width, height, pixels = png_read(png_path)
+    link = pilink.Link(pilink.Serial(port_path), window=2, timeout=3.0)
+    link.reset()
+
+    # Start each chunk at one row, halve it until its QOI data fits, or
+    # double it while the bigger chunk still fits
+    sequences, first, sent = [], 0, 0
+    start = time.monotonic()
+    while first < len(pixels):
+        remaining = len(pixels) - first
+        count = min(width, remaining)
+        data = qoi_encode(pixels[first:first + count])
+        while len(data) > RESTORE_CHUNK_SIZE and count > 1:
+            count //= 2
+            data = qoi_encode(pixels[first:first + count])
+        while count < min(remaining, MAX_CHUNK_PIXELS):
+            bigger = min(count * 2, remaining, MAX_CHUNK_PIXELS)
+            bigger_data = qoi_encode(pixels[first:first + bigger])
+            if len(bigger_data) > RESTORE_CHUNK_SIZE:
+                break
+            count, data = bigger, bigger_data
+
+        piece = pixels[first:first + count]
+        crc = zlib.crc32(struct.pack("<%dI" % count, *piece)) & 0xFFFFFFFF
+        payload = CHUNK_HEADER.pack(width, height, first, count, crc) + data
+        sequences.append(link.send(payload, pilink.FRAME_RESTORE))
+        first += count
+        sent += len(payload)
+        sys.stderr.write("\r%d%%" % (100 * first // len(pixels)))
+
+    link.flush()
+    failed = [s for s in sequences if link.results[s][0] not in
+              (pilink.OK, pilink.DUPLICATE)]
+    if failed:
+        sys.exit("\n%d chunks were rejected (is the canvas %dx%d?)"
+                 % (len(failed), width, height))
+    print("\n%d bytes in %.1f s" % (sent, time.monotonic() - start))
+
+
+def main():
+    if len(sys.argv) != 4 or sys.argv[1] not in ("save", "restore",
+                                                  "encode", "decode"):
+        sys.exit("usage: snapshot.py save|restore PORT image.png\n"
+                 "       snapshot.py encode|decode IN OUT")
+
+    command, a, b = sys.argv[1:]
+    if command == "save":
+        save(a, b)
+    elif command == "restore":
+        restore(a, b)
+    elif command == "encode":
+        width, height, pixels = png_read(a, alpha=255)
+        qoi_write(b, width, height, pixels)
+    else:
+        width, height, pixels = qoi_read(a)
+        png_write(b, width, height, pixels)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+#
+# Converts a binary trace dump captured from the Raspberry Pi's UART into
+# Chrome trace JSON, which can be loaded in chrome://tracing or Perfetto.
+#
+# Usage:  trace2json.py capture.bin [trace.json]
+#
+# The capture may contain ordinary console text around the dump; the dump
+# is found by its "TRC1" magic. See trace.c for the frame layout. The
+# event names must match the ids in trace.h.
+
+import json
+import struct
+import sys
+import zlib
+
+EVENTS = {
+    1: "frame",
+    2: "input",
+    3: "clear_begin",
+    4: "clear_end",
+    5: "fill_begin",
+    6: "fill_end",
+    7: "present",
+    8: "vsync",
+    9: "mailbox_submit",
+    10: "mailbox_done",
+    11: "clock_change",
+    12: "temperature",
+    13: "command_begin",
+    14: "command_end",
+    15: "compose_begin",
+    16: "compose_end",
+    17: "latency",
+}
+
+RECORD = struct.Struct("<QIIII")
+
+
+def decode(data):
+    start = data.find(b"TRC1")
+    if start < 0:
+        raise ValueError("no trace dump found")
+
+    frequency, count = struct.unpack_from("<II", data, start + 4)
+    body = start + 12
+    end = body + count * RECORD.size
+    if len(data) < end + 4:
+        raise ValueError("trace dump is truncated")
+
+    (crc,) = struct.unpack_from("<I", data, end)
+    if zlib.crc32(data[body:end]) & 0xFFFFFFFF != crc:
+        raise ValueError("trace dump CRC mismatch")
+
+    records = [RECORD.unpack_from(data, body + i * RECORD.size)
+               for i in range(count)]
+    records.sort(key=lambda r: r[0])
+
+    events = []
+    for timestamp, event, core, arg0, arg1 in records:
+        name = EVENTS.get(event, "event_%d" % event)
+        entry = {
+            "ts": timestamp * 1e6 / frequency,
+            "pid": 0,
+            "tid": core,
+            "args": {"arg0": arg0, "arg1": arg1},
+        }
+        if name.endswith("_begin"):
+            entry.update(name=name[:-6], ph="B")
+        elif name.endswith("_end"):
+            entry.update(name=name[:-4], ph="E")
+        else:
+            entry.update(name=name, ph="i", s="t")
+        events.append(entry)
+
+    return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.exit("usage: trace2json.py capture.bin [trace.json]")
+
+    with open(sys.argv[1], "rb") as f:
+        trace = decode(f.read())
+
+    out = open(sys.argv[2], "w") if len(sys.argv) == 3 else sys.stdout
+    json.dump(trace, out)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+#
+# Shows the Raspberry Pi's canvas live, from the tile stream described in
+# stream.h. The Pi first sends every tile, and from then on only the
+# tiles that change.
+#
+# Usage:
+#   viewer.py PORT [--png canvas.png] [--size 1024x768]
+#
+# The canvas is shown in a Tk window if tkinter is available. With --png
+# (or without tkinter) it is written to a PNG file every few seconds
+# instead.
+
+import argparse
+import base64
+import struct
+import sys
+import time
+
+import pilink
+import snapshot
+
+TILE = 32
+
+
+class Canvas:
+    def __init__(self, width, height):
+        self.width = width
+        self.height = height
+        self.pixels = [0] * (width * height)
+        self.frame = 0
+        self.tiles = 0
+
+    def apply(self, payload):
+        """Applies a stream message; returns the rectangles it changed."""
+        frame, count = struct.unpack_from("<IH", payload)
+        self.frame = frame
+        pos = 6
+        changed = []
+
+        for _ in range(count):
+            tx, ty, length = struct.unpack_from("<BBH", payload, pos)
+            pos += 4
+            x, y = tx * TILE, ty * TILE
+            w = min(TILE, self.width - x)
+            h = min(TILE, self.height - y)
+            pixels = snapshot.qoi_decode(payload[pos:pos + length], w * h)
+            pos += length
+            if len(pixels) != w * h:
+                continue
+            for row in range(h):
+                start = (y + row) * self.width + x
+                self.pixels[start:start + w] = pixels[row * w:(row + 1) * w]
+            changed.append((x, y, w, h))
+            self.tiles += 1
+
+        return changed
+
+    def ppm(self, x, y, w, h):
+        data = bytearray(b"P6 %d %d 255\n" % (w, h))
+        for row in range(y, y + h):
+            for p in self.pixels[row * self.width + x:row * self.width + x + w]:
+                data += bytes(((p >> 16) & 255, (p >> 8) & 255, p & 255))
+        return bytes(data)
+
+
+def run(link, canvas, on_change, on_idle):
+    link.send(b"\x01", pilink.FRAME_STREAM)
+    link.flush()
+    try:
+        while True:
+            for frame_type, _, payload in link.receive(0.1):
+                if frame_type == pilink.FRAME_STREAM_DATA:
+                    for rect in canvas.apply(payload):
+                        on_change(rect)
+            on_idle()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        link.send(b"\x00", pilink.FRAME_STREAM)
+        link.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Live view of the Pi canvas")
+    parser.add_argument("port")
+    parser.add_argument("--png", help="write the canvas to this PNG file")
+    parser.add_argument("--size", default="1024x768")
+    options = parser.parse_args()
+
+    width, height = (int(v) for v in options.size.split("x"))
+    canvas = Canvas(width, height)
+    link = pilink.Link(pilink.Serial(options.port))
+    link.reset()
+
+    tk = None
+    if not options.png:
+        try:
+            import tkinter as tk
+        except ImportError:
+            options.png = "canvas.png"
+            print("tkinter is not available; writing %s" % options.png)
+
+    if tk is None:
+        last = [time.monotonic()]
+
+        def save():
+            if time.monotonic() - last[0] > 5:
+                snapshot.png_write(options.png, width, height, canvas.pixels)
+                sys.stderr.write("\rframe %d, %d tiles" % (canvas.frame,
+                                                           canvas.tiles))
+                last[0] = time.monotonic()
+
+        run(link, canvas, lambda rect: None, save)
+        snapshot.png_write(options.png, width, height, canvas.pixels)
+        return
+
+    root = tk.Tk()
+    root.title("Pi canvas")
+    photo = tk.PhotoImage(width=width, height=height)
+    tk.Label(root, image=photo).pack()
+
+    def change(rect):
+        tile = tk.PhotoImage(data=base64.b64encode(canvas.ppm(*rect)),
+                              format="PPM")
+        photo.tk.call(photo, "copy", tile, "-to", rect[0], rect[1])
+
+    def idle():
+        root.title("Pi canvas - frame %d" % canvas.frame)
+        root.update()
+
+    run(link, canvas, change, idle)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,158 @@
+// The functions in this file implement a low-overhead event trace. Each
+// call to trace() stores a fixed-size binary record (a generic timer
+// timestamp, an event id and two arguments) in an in-RAM ring buffer.
+// Each core has its own ring, so recording takes a few dozen cycles and
+// never waits for another core or for the UART.
+//
+// trace_dump() writes the rings over the UART in a compact binary frame:
+//
+//     "TRC1"                       4 bytes, magic
+//     counter frequency (Hz)       4 bytes
+//     number of records            4 bytes
+//     records                      24 bytes each
+//     CRC-32 of the records        4 bytes
+//
+// Each record holds the 64-bit timestamp (in ticks), the event id, the
+// core number and the two arguments, all little-endian. The host tool
+// tools/trace2json.py converts a captured dump to Chrome trace JSON.
+
+#include "uart.h"
+#include "irq.h"
+#include "systimer.h"
+#include "crc32.h"
+#include "trace.h"
+
+// A trace record, as stored in RAM and sent over the UART
+struct trace_record {
+    unsigned long timestamp;
+    unsigned int event;
+    unsigned int core;
+    unsigned int arg0;
+    unsigned int arg1;
+};
+
+// The ring buffers, and the number of records ever written to each
+static struct trace_record traceRings[4][TRACE_RECORDS];
+static unsigned long traceHead[4];
+
+// TRUE while the rings are being dumped
+static volatile int tracePaused;
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       trace
+//
+//  Arguments:      event:       The event id (see trace.h)
+//                  arg0, arg1:  Event specific arguments
+//
+//  Returns:        void
+//
+//  Description:    This function appends a record to the calling core's
+//                  ring buffer, overwriting the oldest record once the ring
+//                  is full. IRQs are masked while the slot is claimed, so
+//                  interrupt handlers can also record events.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void trace(unsigned int event, unsigned int arg0, unsigned int arg1)
+{
+    unsigned int core = get_core_id();
+    struct trace_record *record;
+    unsigned long flags;
+
+    if (tracePaused) {
+        return;
+    }
+
+    flags = irq_save();
+    record = &traceRings[core][traceHead[core]++ & (TRACE_RECORDS - 1)];
+    irq_restore(flags);
+
+    record->timestamp = timer_ticks();
+    record->event = event;
+    record->core = core;
+    record->arg0 = arg0;
+    record->arg1 = arg1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       put_word
+//
+//  Arguments:      value:       The 32-bit value to write
+//
+//  Returns:        void
+//
+//  Description:    This function writes a 32-bit value to the UART as four
+//                  little-endian bytes.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void put_word(unsigned int value)
+{
+    unsigned char bytes[4];
+
+    bytes[0] = value;
+    bytes[1] = value >> 8;
+    bytes[2] = value >> 16;
+    bytes[3] = value >> 24;
+    uart_write(bytes, 4);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       trace_dump
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes the contents of every ring buffer,
+//                  oldest record first, to the UART in the binary frame
+//                  described above, and then empties the rings. Recording
+//                  is paused while the dump is in progress.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void trace_dump()
+{
+    const unsigned char *bytes;
+    unsigned long first, i;
+    unsigned int count = 0, crc = 0;
+    int core;
+
+    tracePaused = 1;
+
+    for (core = 0; core < 4; core++) {
+        count += (traceHead[core] < TRACE_RECORDS) ?
+                 traceHead[core] : TRACE_RECORDS;
+    }
+
+    uart_write((const unsigned char *)"TRC1", 4);
+    put_word(timer_frequency());
+    put_word(count);
+
+    for (core = 0; core < 4; core++) {
+        first = (traceHead[core] < TRACE_RECORDS) ?
+                0 : traceHead[core] - TRACE_RECORDS;
+
+        for (i = first; i < traceHead[core]; i++) {
+            bytes = (const unsigned char *)&traceRings[core][i & (TRACE_RECORDS - 1)];
+            crc = crc32(crc, bytes, sizeof(struct trace_record));
+            uart_write(bytes, sizeof(struct trace_record));
+        }
+
+        traceHead[core] = 0;
+    }
+
+    put_word(crc);
+
+    tracePaused = 0;
+}
@@ -0,0 +1,27 @@
+// Number of trace records kept per core (must be a power of two)
+#define TRACE_RECORDS         1024
+
+// Trace event ids. These must match the names in tools/trace2json.py.
+// Events ending in _BEGIN and _END mark the start and end of a span.
+#define TRACE_FRAME            1   // arg0: frame number
+#define TRACE_INPUT            2   // arg0: SNES button state
+#define TRACE_CLEAR_BEGIN      3
+#define TRACE_CLEAR_END        4
+#define TRACE_FILL_BEGIN       5   // arg0, arg1: seed x, y
+#define TRACE_FILL_END         6
+#define TRACE_PRESENT          7   // arg0: frame number
+#define TRACE_VSYNC            8   // arg0: present time (us)
+#define TRACE_MAILBOX_SUBMIT   9   // arg0: message, arg1: token
+#define TRACE_MAILBOX_DONE     10  // arg0: message, arg1: status
+#define TRACE_CLOCK_CHANGE     11  // arg0: new ARM clock rate (Hz)
+#define TRACE_TEMPERATURE      12  // arg0: temperature (millidegrees C)
+#define TRACE_COMMAND_BEGIN    13  // arg0: sequence, arg1: payload length
+#define TRACE_COMMAND_END      14  // arg0: sequence, arg1: status
+#define TRACE_COMPOSE_BEGIN    15  // arg0: frame number
+#define TRACE_COMPOSE_END      16
+#define TRACE_LATENCY          17  // arg0: press to frame buffer write,
+                                   // arg1: press to vsync (us)
+
+// Function prototypes
+void trace(unsigned int event, unsigned int arg0, unsigned int arg1);
+void trace_dump();
@@ -8,6 +8,9 @@
 // This file is needed since it defines the memory mapped I/O base address.
 // Note that MMIO_BASE = 0x3F000000 is the ARM physical address.
 #include "gpio.h"
+#include "idle.h"
+#include "irq.h"
+#include "uart.h"
 
 // The addresses of the Auxilary Mini UART registers.
 //
@@ -32,6 +35,57 @@
 
 
 
+// The Mini UART Baud rate, and the core (VPU) clock rate that drives
+// the Mini UART when the firmware starts us
+#define UART_BAUD_RATE      115200
+#define UART_DEFAULT_CLOCK  250000000
+
+// The receive ring buffer, filled by uart_service() in the AUX
+// interrupt. rxHead is only written by the interrupt handler and rxTail
+// only by the reader, so no lock is needed.
+static volatile unsigned char rxRing[UART_RX_RING_SIZE];
+static volatile unsigned int rxHead, rxTail;
+static volatile unsigned int rxDropped;
+
+// The transmit ring buffer, drained into the 8-byte transmit FIFO by
+// uart_service() whenever the FIFO empties. Both ends are only changed
+// with IRQs masked, since the interrupt handler also refills the FIFO.
+static volatile unsigned char txRing[UART_TX_RING_SIZE];
+static volatile unsigned int txHead, txTail;
+
+// TRUE once uart_enable_interrupts() has been called
+static int interruptDriven;
+
+// Mini UART Interrupt Enable Register values. Bit 0 enables the receive
+// interrupt and bit 1 the transmit interrupt (the manual has the two
+// bits swapped), and bits 3:2 must also be set for the interrupt to
+// reach the interrupt controller.
+#define UART_IER_RX         0xD
+#define UART_IER_TX         0x2
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       uart_baud_divisor
+//
+//  Arguments:      clockRate:   The core clock rate in Hz
+//
+//  Returns:        The value for the Mini UART Baud Register
+//
+//  Description:    This function calculates the Baud rate divisor for a
+//                  115200 Baud rate, using the formula
+//                  rint((clockRate / (8 * 115200)) - 1).
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned int uart_baud_divisor(unsigned int clockRate)
+{
+    return (clockRate + 4 * UART_BAUD_RATE) / (8 * UART_BAUD_RATE) - 1;
+}
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  Function:       uart_init
@@ -138,8 +192,9 @@ void uart_init()
     // Set the Baud rate to 115200. We do this by putting the value 270
     // into bits 15:0 of the Mini UART Baud Register. This value is calculated
     // with the formula:  rint((systemClockRate / (8 * 115200)) - 1)
-    // where the systemClockRate is 250 MHz.
-    *AUX_MU_BAUD = 270;
+    // where the systemClockRate is 250 MHz. If the core clock is changed
+    // later, uart_set_clock() recalculates the value.
+    *AUX_MU_BAUD = uart_baud_divisor(UART_DEFAULT_CLOCK);
 
     // Enable the Mini UART's transmitter and receiver by setting bits 1:0
     // in the Mini UART Control Register to the bit pattern 11
@@ -148,6 +203,171 @@ void uart_init()
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       tx_fill
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function moves characters from the transmit ring
+//                  into the transmit FIFO until one of them is full or
+//                  empty. The transmit interrupt is left enabled only while
+//                  the ring still holds characters. It must be called with
+//                  IRQs masked.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void tx_fill()
+{
+    unsigned int tail = txTail;
+
+    while (tail != txHead && (*AUX_MU_LSR & 0x20)) {
+        *AUX_MU_IO = txRing[tail & (UART_TX_RING_SIZE - 1)];
+        tail++;
+    }
+    txTail = tail;
+
+    *AUX_MU_IER = (tail != txHead) ? (UART_IER_RX | UART_IER_TX) : UART_IER_RX;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       tx_enqueue
+//
+//  Arguments:      buffer:   The bytes to send
+//                  length:   The number of bytes
+//
+//  Returns:        void
+//
+//  Description:    This function copies bytes into the transmit ring,
+//                  sleeping while the ring is full. If the caller has IRQs
+//                  masked (the exception handler, for example), the ring is
+//                  drained by polling instead, since the interrupt handler
+//                  cannot run.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void tx_enqueue(const unsigned char *buffer, unsigned int length)
+{
+    unsigned long flags = irq_save();
+    int masked = flags & 0x80;     // The DAIF I bit
+    unsigned int head;
+
+    while (length) {
+        head = txHead;
+        while (length && head - txTail < UART_TX_RING_SIZE) {
+            txRing[head & (UART_TX_RING_SIZE - 1)] = *buffer++;
+            head++;
+            length--;
+        }
+        txHead = head;
+        tx_fill();
+
+        // Wait for room in the ring
+        while (length && txHead - txTail == UART_TX_RING_SIZE) {
+            if (masked) {
+                tx_fill();
+            } else {
+                irq_restore(flags);
+                idle_wait_event();
+                flags = irq_save();
+            }
+        }
+    }
+
+    // Nothing will drain the ring for a caller that keeps IRQs masked
+    while (masked && txHead != txTail) {
+        tx_fill();
+    }
+
+    irq_restore(flags);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       uart_tx_space
+//
+//  Arguments:      none
+//
+//  Returns:        The number of bytes that can be written without waiting
+//
+//  Description:    This function lets streaming code produce output only as
+//                  fast as the UART can send it.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int uart_tx_space()
+{
+    if (!interruptDriven) {
+        return 0;
+    }
+
+    return UART_TX_RING_SIZE - (txHead - txTail);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       uart_flush
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function waits until every character written to the
+//                  UART has been shifted out on the TXD line. This is
+//                  needed before the core clock (and with it the Baud rate)
+//                  is changed.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void uart_flush()
+{
+    // Wait for the transmit ring to drain into the FIFO
+    while (txHead != txTail) {
+        idle_wait_event();
+    }
+
+    // The Transmitter Idle bit (bit 6) in the Mini UART Line Status
+    // Register is a 1 value once the transmit FIFO and the shift
+    // register are both empty
+    while ( !(*AUX_MU_LSR & 0x40) ) {
+        idle_wait_event();
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       uart_set_clock
+//
+//  Arguments:      clockRate:   The new core clock rate in Hz
+//
+//  Returns:        void
+//
+//  Description:    This function reprograms the Mini UART Baud Register so
+//                  that the Baud rate stays at 115200 after the core clock
+//                  has been changed to the given rate.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void uart_set_clock(unsigned int clockRate)
+{
+    if (clockRate) {
+        *AUX_MU_BAUD = uart_baud_divisor(clockRate);
+    }
+}
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  Function:       uart_putc
@@ -157,7 +377,7 @@ void uart_init()
 //  Returns:        void
 //
 //  Description:    This function polls the UART1 peripheral, waiting until
-//                  it is able to accept a new character into its buffer. 
+//                  it is able to accept a new character into its buffer.
 //                  The character c is then sent to the console terminal
 //                  over the TXD line.
 //
@@ -165,13 +385,21 @@ void uart_init()
 
 void uart_putc(unsigned int c)
 {
+    unsigned char byte = c;
+
+    // Once the transmitter is interrupt driven, queue the character
+    if (interruptDriven) {
+        tx_enqueue(&byte, 1);
+        return;
+    }
+
     // Loop until the transmit FIFO buffer is able to accept a character for
     // transmission. This will be true when the Transmitter Empty bit
-    // (bit 5) in the Mini UART Line Status Register is a 1 value.
-    do {
-    	// Use the NOP assembly language instruction in the loop body
-      	asm volatile("nop");
-    } while ( !(*AUX_MU_LSR & 0x20) );
+    // (bit 5) in the Mini UART Line Status Register is a 1 value. The
+    // core sleeps until the next event between polls.
+    while ( !(*AUX_MU_LSR & 0x20) ) {
+        idle_wait_event();
+    }
     
     // Write the character to the mini UART I/O register
     *AUX_MU_IO = c;
@@ -197,14 +425,23 @@ void uart_putc(unsigned int c)
 char uart_getc()
 {
     char r;
+    unsigned char c;
+
+    // If the receiver is interrupt driven, the characters are in the ring
+    if (interruptDriven) {
+        while (uart_read(&c, 1) == 0) {
+            idle_wait_event();
+        }
+        return c == '\r' ? '\n' : (char)c;
+    }
     
     // Loop until an input character is available in the receive FIFO buffer.
     // At least one character is available when the Data Ready bit (bit 0)
-    // in the Mini UART Line Status Register is a 1 value.
-    do {
-    	// Use the NOP assembly language instruction in the loop body
-        asm volatile("nop");
-    } while ( !(*AUX_MU_LSR & 0x1) );
+    // in the Mini UART Line Status Register is a 1 value. The core sleeps
+    // until the next event between polls.
+    while ( !(*AUX_MU_LSR & 0x1) ) {
+        idle_wait_event();
+    }
 
     // Read the character from the Mini UART I/O register
     r = (char)(*AUX_MU_IO);
@@ -246,6 +483,36 @@ void uart_puts(char *s)
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       uart_write
+//
+//  Arguments:      buffer:   A pointer to the bytes to write
+//                  length:   The number of bytes to write
+//
+//  Returns:        void
+//
+//  Description:    This function writes raw bytes to the console terminal
+//                  using the TXD function of the UART1 peripheral. Unlike
+//                  uart_puts(), no characters are translated, so it can be
+//                  used for binary data.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void uart_write(const unsigned char *buffer, unsigned int length)
+{
+    if (interruptDriven) {
+        tx_enqueue(buffer, length);
+        return;
+    }
+
+    while (length--) {
+        uart_putc(*buffer++);
+    }
+}
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  Function:       uart_puthex
@@ -262,26 +529,154 @@ void uart_puts(char *s)
 ////////////////////////////////////////////////////////////////////////////////
 
 void uart_puthex(unsigned int value) {
-    register unsigned int digit;
-    register int i;
-
-    // Loop 8 times, isolating each 4-bit unit in turn,
-    // starting with the leftmost unit
-    for (i = 28 ; i >= 0; i -= 4) {
-        // Shift and mask the 4-bit unit so that it lays
-        // in the right most part of the register
-        digit = (value >> i) & 0xF;
-
-        // Convert the integer value into corresponding hexadecimal digit
-        if (digit > 9) {
-            // Convert the value into the digits A - F
-            digit += 0x37;
+    static const char digits[] = "0123456789ABCDEF";
+    unsigned char text[8];
+    int i;
+
+    // Look up the 8 digits, starting with the rightmost 4-bit unit,
+    // and then write them all with a single call
+    for (i = 7; i >= 0; i--) {
+        text[i] = digits[value & 0xF];
+        value >>= 4;
+    }
+
+    uart_write(text, 8);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       uart_service
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This is the AUX interrupt handler. It drains the Mini
+//                  UART receive FIFO (which only holds 8 characters) into
+//                  the receive ring, and refills the transmit FIFO from the
+//                  transmit ring. If the receive ring is full, the
+//                  characters are dropped and counted.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void uart_service()
+{
+    unsigned int head = rxHead;
+    unsigned char c;
+
+    // Bit 0 of the Auxiliary Interrupt Status Register is set while the
+    // Mini UART has an interrupt pending (the SPI masters share the line)
+    if (!(*AUX_IRQ & 0x1)) {
+        return;
+    }
+
+    // Reading the I/O register pops the FIFO, which also clears the
+    // receive interrupt once the FIFO is empty
+    while (*AUX_MU_LSR & 0x1) {
+        c = (unsigned char)*AUX_MU_IO;
+
+        if (head - rxTail < UART_RX_RING_SIZE) {
+            rxRing[head & (UART_RX_RING_SIZE - 1)] = c;
+            head++;
         } else {
-            // Convert the value into the digits 0 - 9
-            digit += 0x30;
+            rxDropped++;
         }
+    }
 
-        // Write the digit to the console terminal
-        uart_putc(digit);
+    rxHead = head;
+
+    tx_fill();
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       uart_enable_interrupts
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function switches the Mini UART to interrupt driven
+//                  operation. Received characters are stored in a ring
+//                  buffer as they arrive, so none are lost while the main
+//                  loop is busy drawing, and written characters are queued
+//                  in a ring buffer and sent from the interrupt handler, so
+//                  writers only wait when that ring is full. irq_init()
+//                  must have been called first.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void uart_enable_interrupts()
+{
+    irq_register(IRQ_AUX, uart_service);
+
+    // Let the FIFO drain, so the transmit ring starts out empty
+    uart_flush();
+
+    *AUX_MU_IER = UART_IER_RX;
+
+    interruptDriven = 1;
+    irq_enable(IRQ_AUX);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       uart_read
+//
+//  Arguments:      buffer:   Where to store the received bytes
+//                  length:   The maximum number of bytes to read
+//
+//  Returns:        The number of bytes read, which may be 0
+//
+//  Description:    This function copies the bytes received so far out of
+//                  the receive ring without waiting. No characters are
+//                  translated, so it can be used for binary data.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int uart_read(unsigned char *buffer, unsigned int length)
+{
+    unsigned int tail = rxTail;
+    unsigned int count = rxHead - tail;
+    unsigned int i;
+
+    if (count > length) {
+        count = length;
     }
+
+    for (i = 0; i < count; i++) {
+        buffer[i] = rxRing[(tail + i) & (UART_RX_RING_SIZE - 1)];
+    }
+
+    // Make sure the bytes have been read before the slots are released
+    asm volatile("dmb ish" ::: "memory");
+    rxTail = tail + count;
+
+    return count;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       uart_rx_dropped
+//
+//  Arguments:      none
+//
+//  Returns:        The number of received bytes dropped because the receive
+//                  ring was full
+//
+//  Description:    This function is used to report receive overruns.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int uart_rx_dropped()
+{
+    return rxDropped;
 }
@@ -1,3 +1,8 @@
+// Sizes of the interrupt driven receive and transmit rings (must be
+// powers of two)
+#define UART_RX_RING_SIZE   4096
+#define UART_TX_RING_SIZE   8192
+
 // These are the function prototypes for reading/writing the Mini UART
 
 void uart_init();
@@ -5,3 +10,10 @@ void uart_putc(unsigned int c);
 char uart_getc();
 void uart_puts(char *s);
 void uart_puthex(unsigned int value);
+void uart_write(const unsigned char *buffer, unsigned int length);
+void uart_flush();
+void uart_set_clock(unsigned int clockRate);
+void uart_enable_interrupts();
+unsigned int uart_read(unsigned char *buffer, unsigned int length);
+unsigned int uart_rx_dropped();
+unsigned int uart_tx_space();
@@ -0,0 +1,851 @@
+// The functions in this file keep an undo/redo journal of the drawing on
+// the canvas. Keeping a copy of the whole frame per step would cost 3 MB
+// each, so instead a step records what it needs to be reversed and
+// repeated:
+//
+//   - the drawing operations themselves (a point, a line, a clear, a
+//     fill from a seed point, a shape, an image built into the kernel),
+//     which are small and are replayed by redo;
+//   - the pixels each operation overwrote, captured by setPixel(),
+//     fillSpan() and asset_draw() through undo_record() and
+//     undo_record_pixels() just before they write. Adjacent pixels in a
+//     row are gathered into spans, and each span is stored QOI encoded,
+//     so a clear or a fill over a plain area takes a few bytes per row.
+//     Pixels that already have the new colour are left out.
+//
+// Undo writes the saved spans back, newest first, and redo replays the
+// operations on the restored canvas. Both take time proportional to the
+// size of the change, not of the screen. The entries are kept in a ring
+// arena; when it fills up, the oldest steps are forgotten.
+//
+// Drawing that does not go through the journal (a snapshot restore, for
+// example) cannot be reversed, so it forgets the journal.
+
+#include "framebuffer.h"
+#include "raster.h"
+#include "qoi.h"
+#include "kprintf.h"
+#include "stream.h"
+#include "undo.h"
+#include "compose.h"
+#include "canvas.h"
+#include "asset.h"
+
+// A step: its entries occupy the arena bytes start to end (byte positions
+// only ever increase, and are reduced modulo the arena size when used)
+struct undo_step {
+    unsigned long start, end;
+    unsigned int spans;
+};
+
+static unsigned char arena[UNDO_ARENA_SIZE];
+static unsigned long head;
+
+// Steps firstStep to position - 1 can be undone, and steps position to
+// lastStep - 1 can be redone. While a step is being recorded, it is step
+// lastStep.
+static struct undo_step steps[UNDO_MAX_STEPS];
+static unsigned int firstStep, position, lastStep;
+static int stepOpen, overflowed, replaying;
+
+// The span being gathered, not yet written to the arena
+static int spanX, spanY;
+static unsigned int spanCount;
+static unsigned int spanPixels[UNDO_MAX_SPAN];
+
+// The pixels of the span being recorded, read from the canvas, or of the
+// span being restored
+static unsigned int oldPixels[CANVAS_MAX_TILE_COLUMNS * CANVAS_TILE_SIZE];
+
+// One entry, assembled before it is copied into the arena
+static unsigned char entry[UNDO_ENTRY_OVERHEAD + UNDO_SPAN_HEADER_SIZE +
+                           UNDO_MAX_SPAN * QOI_MAX_OP + QOI_MAX_OP + 1];
+
+// The vertices of a polygon being replayed
+static int polygonPoints[2 * RASTER_MAX_POINTS];
+
+// Statistics
+static unsigned int stepsRecorded, stepsUndone, stepsRedone;
+static unsigned int stepsForgotten, overflows;
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       get16
+//
+//  Arguments:      p:           A pointer to two bytes
+//
+//  Returns:        The little-endian 16-bit value at p
+//
+//  Description:    This function reads an unaligned 16-bit value.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned int get16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       get32
+//
+//  Arguments:      p:           A pointer to four bytes
+//
+//  Returns:        The little-endian 32-bit value at p
+//
+//  Description:    This function reads an unaligned 32-bit value.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned int get32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       put16
+//
+//  Arguments:      p:           Where to store the value
+//                  value:       The 16-bit value
+//
+//  Returns:        void
+//
+//  Description:    This function stores a little-endian 16-bit value.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline void put16(unsigned char *p, unsigned int value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       put32
+//
+//  Arguments:      p:           Where to store the value
+//                  value:       The 32-bit value
+//
+//  Returns:        void
+//
+//  Description:    This function stores a little-endian 32-bit value.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline void put32(unsigned char *p, unsigned int value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       arena_read
+//
+//  Arguments:      position:    The arena byte position to read from
+//                  data:        Where to copy the bytes
+//                  length:      The number of bytes
+//
+//  Returns:        void
+//
+//  Description:    This function copies bytes out of the ring arena,
+//                  wrapping around its end.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void arena_read(unsigned long position, unsigned char *data,
+                       unsigned int length)
+{
+    unsigned int i;
+
+    for (i = 0; i < length; i++) {
+        data[i] = arena[(position + i) & (UNDO_ARENA_SIZE - 1)];
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       append
+//
+//  Arguments:      data:        The entry to add to the open step
+//                  length:      The entry length
+//
+//  Returns:        void
+//
+//  Description:    This function copies an entry to the head of the arena,
+//                  forgetting the oldest steps to make room. If the open
+//                  step alone does not fit in the arena, it cannot be
+//                  undone: it is abandoned, and since every earlier step
+//                  has been forgotten by then, the journal is empty.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void append(const unsigned char *data, unsigned int length)
+{
+    unsigned int i;
+
+    while (head + length - steps[firstStep % UNDO_MAX_STEPS].start > UNDO_ARENA_SIZE) {
+        if (firstStep == lastStep) {
+            overflowed = 1;
+            overflows++;
+            head = steps[lastStep % UNDO_MAX_STEPS].start;
+            return;
+        }
+        firstStep++;
+        stepsForgotten++;
+    }
+
+    for (i = 0; i < length; i++) {
+        arena[(head + i) & (UNDO_ARENA_SIZE - 1)] = data[i];
+    }
+    head += length;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       flush_span
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function QOI encodes the span being gathered and
+//                  adds it to the open step.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void flush_span()
+{
+    struct qoi_state state;
+    unsigned int length = 3 + UNDO_SPAN_HEADER_SIZE, consumed;
+
+    if (spanCount == 0) {
+        return;
+    }
+
+    entry[2] = UNDO_ENTRY_SPAN;
+    put16(entry + 3, spanY);
+    put16(entry + 5, spanX);
+    put16(entry + 7, spanCount);
+
+    // The entry buffer has room for the worst case, so every pixel is
+    // consumed
+    qoi_reset(&state);
+    length += qoi_encode(&state, spanPixels, spanCount, &consumed,
+                         entry + length, sizeof(entry) - 2 - length);
+    length += qoi_encode_flush(&state, entry + length);
+
+    length += 2;
+    put16(entry, length);
+    put16(entry + length - 2, length);
+
+    spanCount = 0;
+    if (!overflowed) {
+        append(entry, length);
+        steps[lastStep % UNDO_MAX_STEPS].spans++;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       perform
+//
+//  Arguments:      op:          The operation, UNDO_OP_*
+//                  x0, y0, x1, y1, colour:
+//                               Its arguments, as described in undo.h
+//
+//  Returns:        void
+//
+//  Description:    This function carries out a drawing operation.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void perform(unsigned int op, int x0, int y0, int x1, int y1,
+                    unsigned int colour)
+{
+    switch (op) {
+    case UNDO_OP_CLEAR:
+        clearScreen();
+        break;
+    case UNDO_OP_POINT:
+        setPixel(x0, y0, colour);
+        break;
+    case UNDO_OP_LINE:
+        drawLine(x0, y0, x1, y1, colour);
+        break;
+    case UNDO_OP_RECT:
+        fillRect(x0, y0, x1, y1, colour);
+        break;
+    case UNDO_OP_FLOOD:
+        floodFill(x0, y0, x1, colour, y1 & 0xFF, y1 >> 8);
+        break;
+    case UNDO_OP_CIRCLE:
+        fillCircle(x0, y0, x1, colour);
+        break;
+    case UNDO_OP_ROUND_RECT:
+        fillRoundRect(x0, y0, x1 & 0xFFFF, (unsigned int)x1 >> 16, y1, colour);
+        break;
+    case UNDO_OP_IMAGE:
+        asset_draw(x1, x0, y0);
+        break;
+    default:
+        break;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       undo_begin
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function starts recording a step. Every drawing
+//                  operation until undo_end() belongs to it, and is undone
+//                  and redone with it. Steps that were undone can no longer
+//                  be redone after this. A step still open is ended first.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void undo_begin()
+{
+    undo_end();
+
+    // Drop the steps that were undone
+    if (position != lastStep) {
+        head = steps[position % UNDO_MAX_STEPS].start;
+        lastStep = position;
+    }
+
+    if (lastStep - firstStep == UNDO_MAX_STEPS) {
+        firstStep++;
+        stepsForgotten++;
+    }
+
+    steps[lastStep % UNDO_MAX_STEPS].start = head;
+    steps[lastStep % UNDO_MAX_STEPS].spans = 0;
+    stepOpen = 1;
+    overflowed = 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       undo_end
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function finishes the step being recorded. A step
+//                  that changed no pixels is dropped. It does nothing if no
+//                  step is open.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void undo_end()
+{
+    struct undo_step *step = &steps[lastStep % UNDO_MAX_STEPS];
+
+    if (!stepOpen) {
+        return;
+    }
+
+    flush_span();
+    stepOpen = 0;
+
+    if (overflowed || step->spans == 0) {
+        head = step->start;
+        return;
+    }
+
+    step->end = head;
+    lastStep++;
+    position = lastStep;
+    stepsRecorded++;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       undo_active
+//
+//  Arguments:      none
+//
+//  Returns:        TRUE if a step is being recorded
+//
+//  Description:    This function lets a caller keep a step open over
+//                  several frames (a pen stroke, for example), and notice
+//                  when something else has ended it.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int undo_active()
+{
+    return stepOpen;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       undo_draw
+//
+//  Arguments:      op:          The operation, UNDO_OP_*
+//                  x0, y0, x1, y1, colour:
+//                               Its arguments, as described in undo.h
+//
+//  Returns:        void
+//
+//  Description:    This function records a drawing operation in the open
+//                  step and carries it out. If no step is open, the
+//                  operation is recorded as a step of its own.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void undo_draw(unsigned int op, int x0, int y0, int x1, int y1,
+               unsigned int colour)
+{
+    int own = !stepOpen;
+    unsigned int length = UNDO_ENTRY_OVERHEAD + UNDO_COMMAND_SIZE;
+
+    if (own) {
+        undo_begin();
+    }
+
+    if (!overflowed) {
+        // The operation goes after the pixels overwritten so far
+        flush_span();
+
+        entry[2] = UNDO_ENTRY_COMMAND;
+        entry[3] = op;
+        put32(entry + 4, x0);
+        put32(entry + 8, y0);
+        put32(entry + 12, x1);
+        put32(entry + 16, y1);
+        put32(entry + 20, colour);
+        put16(entry, length);
+        put16(entry + length - 2, length);
+        append(entry, length);
+    }
+
+    perform(op, x0, y0, x1, y1, colour);
+
+    if (own) {
+        undo_end();
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       undo_polygon
+//
+//  Arguments:      points, count, rule, colour:
+//                               The arguments of fillPolygon()
+//
+//  Returns:        void
+//
+//  Description:    This function records a polygon fill in the open step
+//                  and carries it out, like undo_draw(). The vertices are
+//                  stored as 16-bit values.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void undo_polygon(const int *points, unsigned int count, unsigned int rule,
+                  unsigned int colour)
+{
+    int own = !stepOpen;
+    unsigned int length, i;
+
+    if (count > RASTER_MAX_POINTS) {
+        return;
+    }
+
+    if (own) {
+        undo_begin();
+    }
+
+    if (!overflowed) {
+        flush_span();
+
+        length = UNDO_ENTRY_OVERHEAD + UNDO_POLYGON_HEADER_SIZE + 4 * count;
+        entry[2] = UNDO_ENTRY_POLYGON;
+        entry[3] = rule;
+        put32(entry + 4, colour);
+        put16(entry + 8, count);
+        for (i = 0; i < 2 * count; i++) {
+            put16(entry + 10 + 2 * i, points[i]);
+        }
+        put16(entry, length);
+        put16(entry + length - 2, length);
+        append(entry, length);
+    }
+
+    fillPolygon(points, count, rule, colour);
+
+    if (own) {
+        undo_end();
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       record
+//
+//  Arguments:      x0, x1:      The first and last pixel about to be written
+//                               in the row (already clipped to the screen)
+//                  y:           The row
+//                  pixels:      The pixels about to be written, or 0 if
+//                               they are all colour
+//                  colour:      Their colour, if pixels is 0
+//
+//  Returns:        void
+//
+//  Description:    This function saves the pixels of a span that will
+//                  change in the open step, for undo_record() and
+//                  undo_record_pixels(). A span that continues the one
+//                  being gathered is added to it. Writes made while no step
+//                  is open cannot be undone, so they forget the journal.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void record(int x0, int x1, int y, const unsigned int *pixels,
+                   unsigned int colour)
+{
+    const unsigned int *row;
+    unsigned int count, i;
+
+    if (replaying) {
+        return;
+    }
+    if (!stepOpen) {
+        if (lastStep != firstStep) {
+            undo_reset();
+        }
+        return;
+    }
+    if (overflowed) {
+        return;
+    }
+
+    // Solid tiles are read as their colour, without writing them out.
+    // row[x] is the pixel at x, and so is pixels[x] from here on.
+    canvasRead(x0, x1, y, oldPixels);
+    row = oldPixels - x0;
+    if (pixels) {
+        pixels -= x0;
+    }
+
+    // Leave out pixels that already have the new value at either end
+    while (x0 <= x1 && row[x0] == (pixels ? pixels[x0] : colour)) {
+        x0++;
+    }
+    while (x1 >= x0 && row[x1] == (pixels ? pixels[x1] : colour)) {
+        x1--;
+    }
+
+    while (x0 <= x1) {
+        if (spanCount && (y != spanY || x0 != spanX + (int)spanCount ||
+                          spanCount == UNDO_MAX_SPAN)) {
+            flush_span();
+        }
+        if (spanCount == 0) {
+            spanX = x0;
+            spanY = y;
+        }
+
+        count = x1 - x0 + 1;
+        if (count > UNDO_MAX_SPAN - spanCount) {
+            count = UNDO_MAX_SPAN - spanCount;
+        }
+        for (i = 0; i < count; i++) {
+            spanPixels[spanCount + i] = row[x0 + i];
+        }
+        spanCount += count;
+        x0 += count;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       undo_record
+//
+//  Arguments:      x0, x1:      The first and last pixel about to be written
+//                               in the row (already clipped to the screen)
+//                  y:           The row
+//                  colour:      The colour they are about to be set to
+//
+//  Returns:        void
+//
+//  Description:    This function is called by setPixel() and fillSpan()
+//                  before they write a span, and saves the pixels that will
+//                  change in the open step.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void undo_record(int x0, int x1, int y, unsigned int colour)
+{
+    record(x0, x1, y, 0, colour);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       undo_record_pixels
+//
+//  Arguments:      x0, x1:      The first and last pixel about to be written
+//                               in the row (already clipped to the screen)
+//                  y:           The row
+//                  pixels:      The x1 - x0 + 1 pixels about to be written
+//
+//  Returns:        void
+//
+//  Description:    This function is undo_record() for a span of different
+//                  pixels, such as a row of an image (see asset.c).
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void undo_record_pixels(int x0, int x1, int y, const unsigned int *pixels)
+{
+    record(x0, x1, y, pixels, 0);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       restore_span
+//
+//  Arguments:      length:      The length of the span entry in entry[]
+//
+//  Returns:        void
+//
+//  Description:    This function writes the saved pixels of a span entry
+//                  back to the canvas.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void restore_span(unsigned int length)
+{
+    struct qoi_state state;
+    unsigned int y = get16(entry + 3), x = get16(entry + 5);
+    unsigned int count = get16(entry + 7), used, decoded;
+
+    if (y >= frameBufferHeight || x + count > frameBufferWidth) {
+        return;
+    }
+
+    qoi_reset(&state);
+    decoded = qoi_decode(&state, entry + 3 + UNDO_SPAN_HEADER_SIZE,
+                         length - UNDO_ENTRY_OVERHEAD - UNDO_SPAN_HEADER_SIZE,
+                         &used, oldPixels, count);
+    if (decoded) {
+        canvasWrite(x, x + decoded - 1, y, oldPixels);
+        stream_damage(x, x + decoded - 1, y);
+        compose_damage(x, x + decoded - 1, y);
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       undo_step
+//
+//  Arguments:      none
+//
+//  Returns:        TRUE if a step was undone, FALSE if there was none left
+//
+//  Description:    This function undoes the most recent step that has not
+//                  been undone, by writing back the pixels it overwrote,
+//                  newest first. A step still being recorded is ended (and
+//                  so undone) first.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int undo_step()
+{
+    struct undo_step *step;
+    unsigned long p;
+    unsigned char bytes[2];
+    unsigned int length;
+
+    undo_end();
+    if (position == firstStep) {
+        return 0;
+    }
+
+    step = &steps[(position - 1) % UNDO_MAX_STEPS];
+    for (p = step->end; p != step->start; p -= length) {
+        arena_read(p - 2, bytes, 2);
+        length = get16(bytes);
+        arena_read(p - length, entry, length);
+        if (entry[2] == UNDO_ENTRY_SPAN) {
+            restore_span(length);
+        }
+    }
+
+    position--;
+    stepsUndone++;
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       redo_step
+//
+//  Arguments:      none
+//
+//  Returns:        TRUE if a step was redone, FALSE if there was none
+//
+//  Description:    This function redoes the oldest step that was undone,
+//                  by replaying its drawing operations. The canvas is back
+//                  in the state the step was recorded in, so they draw the
+//                  same pixels, and its saved spans still apply.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int redo_step()
+{
+    struct undo_step *step;
+    unsigned long p;
+    unsigned char bytes[2];
+    unsigned int length, i;
+
+    undo_end();
+    if (position == lastStep) {
+        return 0;
+    }
+
+    step = &steps[position % UNDO_MAX_STEPS];
+    replaying = 1;
+    for (p = step->start; p != step->end; p += length) {
+        arena_read(p, bytes, 2);
+        length = get16(bytes);
+        arena_read(p, entry, length);
+        if (entry[2] == UNDO_ENTRY_COMMAND) {
+            perform(entry[3], get32(entry + 4), get32(entry + 8),
+                    get32(entry + 12), get32(entry + 16), get32(entry + 20));
+        } else if (entry[2] == UNDO_ENTRY_POLYGON) {
+            for (i = 0; i < 2 * get16(entry + 8); i++) {
+                polygonPoints[i] = (short)get16(entry + 10 + 2 * i);
+            }
+            fillPolygon(polygonPoints, get16(entry + 8), entry[3],
+                        get32(entry + 4));
+        }
+    }
+    replaying = 0;
+
+    position++;
+    stepsRedone++;
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       undo_moves
+//
+//  Arguments:      none
+//
+//  Returns:        The number of steps undone and redone so far
+//
+//  Description:    This function lets a caller tell whether undo_step() or
+//                  redo_step() ran in between two calls, from whichever
+//                  source (the controller or the host).
+//
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned int undo_moves()
+{
+    return stepsUndone + stepsRedone;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       undo_reset
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function forgets the journal, including a step
+//                  being recorded. It is called when the canvas is changed
+//                  in a way that cannot be undone.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void undo_reset()
+{
+    stepOpen = 0;
+    spanCount = 0;
+    firstStep = position = lastStep;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       undo_report
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes the journal statistics to the
+//                  console terminal.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void undo_report()
+{
+    unsigned long used = 0;
+
+    if (lastStep != firstStep) {
+        used = steps[(lastStep - 1) % UNDO_MAX_STEPS].end -
+               steps[firstStep % UNDO_MAX_STEPS].start;
+    }
+
+    log_info("Undo: steps %u (%u undone) bytes %u recorded %u undo %u redo %u forgotten %u overflows %u\n",
+             lastStep - firstStep, lastStep - position, (unsigned int)used,
+             stepsRecorded, stepsUndone, stepsRedone, stepsForgotten,
+             overflows);
+}
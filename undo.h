@@ -0,0 +1,77 @@
+// Size of the journal arena in bytes (a power of two). The oldest steps
+// are forgotten when it fills up.
+#define UNDO_ARENA_SIZE             (1 << 20)
+
+// Most steps kept in the journal
+#define UNDO_MAX_STEPS              256
+
+// Longest run of overwritten pixels kept as one span; longer ones are split
+#define UNDO_MAX_SPAN               2048
+
+// Drawing operations, replayed by redo. The arguments of undo_draw() are
+// used as follows:
+//
+//     UNDO_OP_CLEAR      (none), clears the screen to white
+//     UNDO_OP_POINT      x0, y0, colour
+//     UNDO_OP_LINE       x0, y0, x1, y1, colour
+//     UNDO_OP_RECT       x0, y0, x1 = width, y1 = height, colour
+//     UNDO_OP_FLOOD      x0, y0 = seed, x1 = target colour,
+//                        y1 = tolerance + (connectivity << 8), colour
+//                        (connectivity may include FILL_BOUNDARY, see
+//                        framebuffer.h)
+//     UNDO_OP_CIRCLE     x0, y0 = centre, x1 = radius, colour
+//     UNDO_OP_ROUND_RECT x0, y0, x1 = width + (height << 16),
+//                        y1 = radius, colour
+//     UNDO_OP_IMAGE      x0, y0 = top left corner, x1 = asset (see asset.h)
+//
+// Polygons have too many arguments for undo_draw() and are recorded with
+// undo_polygon() instead.
+#define UNDO_OP_CLEAR               1
+#define UNDO_OP_POINT               2
+#define UNDO_OP_LINE                3
+#define UNDO_OP_RECT                4
+#define UNDO_OP_FLOOD               5
+#define UNDO_OP_CIRCLE              6
+#define UNDO_OP_ROUND_RECT          7
+#define UNDO_OP_IMAGE               8
+
+// The y1 of an exact, 4-connected UNDO_OP_FLOOD that fills up to a
+// boundary of the x1 colour
+#define UNDO_FLOOD_4_BOUNDARY       ((4 | FILL_BOUNDARY) << 8)
+
+// Journal entry layout in the arena (all values little-endian). Every
+// entry starts and ends with its own length, so the journal can be walked
+// in both directions.
+//
+//     length      2 bytes, of the whole entry
+//     tag         1 byte, UNDO_ENTRY_*
+//     body        SPAN:    y, x, count (2 bytes each), then the count
+//                          overwritten pixels, QOI encoded
+//                 COMMAND: op (1 byte), x0, y0, x1, y1, colour (4 bytes
+//                          each)
+//                 POLYGON: rule (1 byte), colour (4 bytes), vertex count
+//                          (2 bytes), then x, y (2 bytes each) per vertex
+//     length      2 bytes, the same as above
+#define UNDO_ENTRY_SPAN             'P'
+#define UNDO_ENTRY_COMMAND          'O'
+#define UNDO_ENTRY_POLYGON          'G'
+#define UNDO_ENTRY_OVERHEAD         5
+#define UNDO_SPAN_HEADER_SIZE       6
+#define UNDO_COMMAND_SIZE           21
+#define UNDO_POLYGON_HEADER_SIZE    7
+
+// Function prototypes
+void undo_begin();
+void undo_end();
+int undo_active();
+void undo_draw(unsigned int op, int x0, int y0, int x1, int y1,
+               unsigned int colour);
+void undo_polygon(const int *points, unsigned int count, unsigned int rule,
+                  unsigned int colour);
+void undo_record(int x0, int x1, int y, unsigned int colour);
+void undo_record_pixels(int x0, int x1, int y, const unsigned int *pixels);
+int undo_step();
+int redo_step();
+unsigned int undo_moves();
+void undo_reset();
+void undo_report();
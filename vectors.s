@@ -0,0 +1,161 @@
+// This file contains the EL1 exception vector table. Its address is
+// loaded into VBAR_EL1 by start.s. The table has 16 entries, each
+// 128 bytes long, grouped by where the exception was taken from
+// (current EL using SP_EL0, current EL using SP_ELx, lower EL in
+// AArch64, lower EL in AArch32), and by exception type (synchronous,
+// IRQ, FIQ and SError).
+//
+// Code runs at EL1 on SP_EL0, so exceptions arrive through the
+// "current EL with SP_EL0" entries, and are handled on the core's
+// interrupt stack in SP_EL1 (see start.s). IRQs taken from the
+// current exception level save the interrupted context on that
+// stack, call the irq_handler() C routine (see irq.c), restore the
+// context and return with eret. All other exceptions are
+// fatal: they are reported by the exception_handler() C routine,
+// which never returns.
+
+
+	// Size of the saved context frame, in bytes. It holds x0 - x30,
+	// ELR_EL1, SPSR_EL1, FPCR, FPSR and the caller-saved SIMD registers
+	// q0 - q7 and q16 - q31. C code called from the interrupt handler
+	// may use any of these registers.
+	.equ	CONTEXT_SIZE, 672
+
+
+	// Save the interrupted context on the stack
+	.macro	save_context
+	sub	sp, sp, CONTEXT_SIZE
+	stp	x0, x1, [sp, 0]
+	stp	x2, x3, [sp, 16]
+	stp	x4, x5, [sp, 32]
+	stp	x6, x7, [sp, 48]
+	stp	x8, x9, [sp, 64]
+	stp	x10, x11, [sp, 80]
+	stp	x12, x13, [sp, 96]
+	stp	x14, x15, [sp, 112]
+	stp	x16, x17, [sp, 128]
+	stp	x18, x19, [sp, 144]
+	stp	x20, x21, [sp, 160]
+	stp	x22, x23, [sp, 176]
+	stp	x24, x25, [sp, 192]
+	stp	x26, x27, [sp, 208]
+	stp	x28, x29, [sp, 224]
+	mrs	x0, elr_el1
+	mrs	x1, spsr_el1
+	mrs	x2, fpcr
+	mrs	x3, fpsr
+	stp	x30, x0, [sp, 240]
+	stp	x1, x2, [sp, 256]
+	str	x3, [sp, 272]
+	stp	q0, q1, [sp, 288]
+	stp	q2, q3, [sp, 320]
+	stp	q4, q5, [sp, 352]
+	stp	q6, q7, [sp, 384]
+	stp	q16, q17, [sp, 416]
+	stp	q18, q19, [sp, 448]
+	stp	q20, q21, [sp, 480]
+	stp	q22, q23, [sp, 512]
+	stp	q24, q25, [sp, 544]
+	stp	q26, q27, [sp, 576]
+	stp	q28, q29, [sp, 608]
+	stp	q30, q31, [sp, 640]
+	.endm
+
+
+	// Restore the interrupted context from the stack
+	.macro	restore_context
+	ldp	q0, q1, [sp, 288]
+	ldp	q2, q3, [sp, 320]
+	ldp	q4, q5, [sp, 352]
+	ldp	q6, q7, [sp, 384]
+	ldp	q16, q17, [sp, 416]
+	ldp	q18, q19, [sp, 448]
+	ldp	q20, q21, [sp, 480]
+	ldp	q22, q23, [sp, 512]
+	ldp	q24, q25, [sp, 544]
+	ldp	q26, q27, [sp, 576]
+	ldp	q28, q29, [sp, 608]
+	ldp	q30, q31, [sp, 640]
+	ldp	x30, x0, [sp, 240]
+	ldp	x1, x2, [sp, 256]
+	ldr	x3, [sp, 272]
+	msr	elr_el1, x0
+	msr	spsr_el1, x1
+	msr	fpcr, x2
+	msr	fpsr, x3
+	ldp	x0, x1, [sp, 0]
+	ldp	x2, x3, [sp, 16]
+	ldp	x4, x5, [sp, 32]
+	ldp	x6, x7, [sp, 48]
+	ldp	x8, x9, [sp, 64]
+	ldp	x10, x11, [sp, 80]
+	ldp	x12, x13, [sp, 96]
+	ldp	x14, x15, [sp, 112]
+	ldp	x16, x17, [sp, 128]
+	ldp	x18, x19, [sp, 144]
+	ldp	x20, x21, [sp, 160]
+	ldp	x22, x23, [sp, 176]
+	ldp	x24, x25, [sp, 192]
+	ldp	x26, x27, [sp, 208]
+	ldp	x28, x29, [sp, 224]
+	add	sp, sp, CONTEXT_SIZE
+	.endm
+
+
+	// A vector table entry that branches to an interrupt routine
+	.macro	vector_entry label
+	.align	7
+	b	\label
+	.endm
+
+
+	// A vector table entry for a fatal exception. The exception
+	// type (the entry number) and the syndrome, link and fault
+	// address registers are passed to exception_handler().
+	.macro	fatal_entry type
+	.align	7
+	mov	x0, \type
+	mrs	x1, esr_el1
+	mrs	x2, elr_el1
+	mrs	x3, far_el1
+	b	exception_handler
+	.endm
+
+
+	// The vector table must be aligned on a 2 KB boundary
+	.section ".text"
+	.align	11
+	.global vectors
+vectors:
+	// Current EL with SP_EL0
+	fatal_entry	0		// Synchronous
+	vector_entry	irq_entry	// IRQ
+	fatal_entry	2		// FIQ
+	fatal_entry	3		// SError
+
+	// Current EL with SP_ELx
+	fatal_entry	4		// Synchronous
+	vector_entry	irq_entry	// IRQ
+	fatal_entry	6		// FIQ
+	fatal_entry	7		// SError
+
+	// Lower EL using AArch64
+	fatal_entry	8
+	fatal_entry	9
+	fatal_entry	10
+	fatal_entry	11
+
+	// Lower EL using AArch32
+	fatal_entry	12
+	fatal_entry	13
+	fatal_entry	14
+	fatal_entry	15
+
+
+	// The IRQ routine. The C handler dispatches to the handlers
+	// registered for each pending interrupt source.
+irq_entry:
+	save_context
+	bl	irq_handler
+	restore_context
+	eret
@@ -0,0 +1,338 @@
+// The functions in this file draw the magnifier: a window in a corner of
+// the screen that shows the canvas around the pen scaled up 2, 4, 8 or 16
+// times, nearest neighbour, with the pen's pixel outlined. It is the
+// compositor's zoom layer, so it never touches the drawing.
+//
+// The view is only drawn again when it would change: when the pen moves,
+// or when compose_dirty() says something in the area it shows has been
+// drawn since the last frame. The window moves to the bottom corner when
+// the pen comes near the top one, so it never hides the area it shows.
+// The pen only draws when the pixel under it changes colour (see
+// main.c), so a pen that stands still leaves the view alone.
+//
+// A canvas row is scaled with 128-bit vector stores (NEON on the Pi): a
+// magnified pixel is its colour repeated in scale / 4 vectors, or at 2x
+// two of them are spread over one vector. The first screen row of each
+// canvas row is scaled, and then copied to the scale - 1 rows below it a
+// vector at a time. The layer's rows and the view inside its frame are
+// 16-byte aligned for this, so that no store is split across two cache
+// lines.
+
+#include "framebuffer.h"
+#include "systimer.h"
+#include "kprintf.h"
+#include "compose.h"
+#include "canvas.h"
+#include "zoom.h"
+
+// Four pixels, in a 128-bit vector register
+typedef unsigned int zoom_vector __attribute__((vector_size(16)));
+
+// The zoom level (0 while the magnifier is off), and what the view shows:
+// the canvas area's top left corner and the pen
+static unsigned int scale;
+static int sourceX, sourceY, penX, penY;
+
+// Set when the view must be drawn whatever changed
+static int stale;
+
+// Set once the frame around the view has been drawn
+static int framed;
+
+// A canvas row being scaled
+static unsigned int source[ZOOM_VIEW_SIZE / ZOOM_MIN_SCALE]
+    __attribute__((aligned(16)));
+
+// Statistics
+static unsigned int renders, unchanged;
+static unsigned long lastRenderTicks, longestRenderTicks;
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       draw_frame
+//
+//  Arguments:      layer:       The zoom layer
+//
+//  Returns:        void
+//
+//  Description:    This function fills the border of the layer around the
+//                  view.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void draw_frame(struct compose_layer *layer)
+{
+    unsigned int x, y;
+
+    for (y = 0; y < COMPOSE_ZOOM_SIZE; y++) {
+        for (x = 0; x < COMPOSE_ZOOM_SIZE; x++) {
+            if (x < ZOOM_BORDER || x >= ZOOM_BORDER + ZOOM_VIEW_SIZE ||
+                y < ZOOM_BORDER || y >= ZOOM_BORDER + ZOOM_VIEW_SIZE) {
+                layer->pixels[y * COMPOSE_ZOOM_SIZE + x] = ZOOM_BORDER_COLOUR;
+            }
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       scale_row
+//
+//  Arguments:      to:          The first screen row of the magnified row,
+//                               16-byte aligned
+//                  count:       The number of pixels in source[], a
+//                               multiple of 4
+//
+//  Returns:        void
+//
+//  Description:    This function repeats each pixel of source[] scale
+//                  times, filling ZOOM_VIEW_SIZE pixels at to.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void scale_row(zoom_vector *to, unsigned int count)
+{
+    const zoom_vector *from = (const zoom_vector *)source;
+    zoom_vector pixels;
+    unsigned int i, k, p;
+
+    if (scale == 2) {
+        // Four pixels make two vectors: a a b b, c c d d
+        for (i = 0; i < count / 4; i++) {
+            pixels = from[i];
+            *to++ = __builtin_shuffle(pixels, (zoom_vector){ 0, 0, 1, 1 });
+            *to++ = __builtin_shuffle(pixels, (zoom_vector){ 2, 2, 3, 3 });
+        }
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        p = source[i];
+        pixels = (zoom_vector){ p, p, p, p };
+        for (k = 0; k < scale / 4; k++) {
+            *to++ = pixels;
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       render
+//
+//  Arguments:      layer:       The zoom layer
+//
+//  Returns:        void
+//
+//  Description:    This function draws the view of the canvas area at
+//                  sourceX, sourceY, and outlines the pen's pixel in the
+//                  inverse of its colour.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void render(struct compose_layer *layer)
+{
+    unsigned int size = ZOOM_VIEW_SIZE / scale, row, k, i, colour;
+    zoom_vector *first, *to;
+    unsigned int *pixels;
+    int x, y;
+
+    for (row = 0; row < size; row++) {
+        canvasRead(sourceX, sourceX + size - 1, sourceY + row, source);
+
+        first = (zoom_vector *)(layer->pixels +
+                                (ZOOM_BORDER + row * scale) * COMPOSE_ZOOM_SIZE +
+                                ZOOM_BORDER);
+        scale_row(first, size);
+
+        to = first;
+        for (k = 1; k < scale; k++) {
+            to += COMPOSE_ZOOM_SIZE / 4;
+            for (i = 0; i < ZOOM_VIEW_SIZE / 4; i++) {
+                to[i] = first[i];
+            }
+        }
+    }
+
+    // Outline the pen
+    x = ZOOM_BORDER + (penX - sourceX) * scale;
+    y = ZOOM_BORDER + (penY - sourceY) * scale;
+    pixels = layer->pixels + y * COMPOSE_ZOOM_SIZE + x;
+    colour = pixels[0] ^ 0x00FFFFFF;
+    for (i = 0; i < scale; i++) {
+        pixels[i] = colour;
+        pixels[(scale - 1) * COMPOSE_ZOOM_SIZE + i] = colour;
+        pixels[i * COMPOSE_ZOOM_SIZE] = colour;
+        pixels[i * COMPOSE_ZOOM_SIZE + scale - 1] = colour;
+    }
+
+    compose_damage_layer(COMPOSE_LAYER_ZOOM, ZOOM_BORDER, ZOOM_BORDER,
+                         ZOOM_VIEW_SIZE, ZOOM_VIEW_SIZE);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       zoom_set
+//
+//  Arguments:      level:       The zoom level (a power of two from
+//                               ZOOM_MIN_SCALE to ZOOM_MAX_SCALE), or 0 to
+//                               turn the magnifier off
+//
+//  Returns:        TRUE if the level is valid
+//
+//  Description:    This function shows the magnifier at a zoom level, or
+//                  hides it. The view is drawn by the next zoom_update().
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int zoom_set(unsigned int level)
+{
+    struct compose_layer *layer = compose_layer(COMPOSE_LAYER_ZOOM);
+
+    if (level && (level < ZOOM_MIN_SCALE || level > ZOOM_MAX_SCALE ||
+                  (level & (level - 1)))) {
+        return 0;
+    }
+    if (!layer->pixels) {
+        return 0;
+    }
+
+    if (level && !framed) {
+        draw_frame(layer);
+        framed = 1;
+    }
+
+    scale = level;
+    stale = 1;
+    compose_show(COMPOSE_LAYER_ZOOM, level != 0);
+    return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       zoom_cycle
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function steps to the next zoom level: off, then
+//                  each level from the lowest to the highest, then off
+//                  again.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void zoom_cycle()
+{
+    if (scale == 0) {
+        zoom_set(ZOOM_MIN_SCALE);
+    } else if (scale == ZOOM_MAX_SCALE) {
+        zoom_set(0);
+    } else {
+        zoom_set(scale * 2);
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       zoom_update
+//
+//  Arguments:      x, y:        The pen position
+//
+//  Returns:        void
+//
+//  Description:    This function is called once per frame, before
+//                  compose_frame(). It centres the view on the pen (as
+//                  far as the edges of the canvas allow), places the
+//                  window, and draws the view again if it has changed.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void zoom_update(int x, int y)
+{
+    struct compose_layer *layer = compose_layer(COMPOSE_LAYER_ZOOM);
+    int size, left, top, windowX, windowY;
+    unsigned long start;
+
+    if (!scale) {
+        return;
+    }
+
+    size = ZOOM_VIEW_SIZE / scale;
+    left = x - size / 2;
+    top = y - size / 2;
+    if (left > (int)frameBufferWidth - size) {
+        left = frameBufferWidth - size;
+    }
+    if (top > (int)frameBufferHeight - size) {
+        top = frameBufferHeight - size;
+    }
+    if (left < 0) {
+        left = 0;
+    }
+    if (top < 0) {
+        top = 0;
+    }
+
+    // Top right, unless that would cover the area shown
+    windowX = frameBufferWidth - COMPOSE_ZOOM_SIZE - ZOOM_MARGIN;
+    windowY = ZOOM_MARGIN;
+    if (left + size > windowX && top < windowY + COMPOSE_ZOOM_SIZE) {
+        windowY = frameBufferHeight - COMPOSE_ZOOM_SIZE - ZOOM_MARGIN;
+    }
+    compose_move(COMPOSE_LAYER_ZOOM, windowX, windowY);
+
+    if (!stale && left == sourceX && top == sourceY && x == penX && y == penY &&
+        !compose_dirty(left, top, left + size - 1, top + size - 1)) {
+        unchanged++;
+        return;
+    }
+
+    start = timer_ticks();
+    sourceX = left;
+    sourceY = top;
+    penX = x;
+    penY = y;
+    stale = 0;
+    render(layer);
+
+    lastRenderTicks = timer_ticks() - start;
+    if (lastRenderTicks > longestRenderTicks) {
+        longestRenderTicks = lastRenderTicks;
+    }
+    renders++;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Function:       zoom_report
+//
+//  Arguments:      none
+//
+//  Returns:        void
+//
+//  Description:    This function writes the magnifier statistics to the
+//                  console terminal.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void zoom_report()
+{
+    log_info("Zoom: %ux, %u renders, %u frames unchanged, last render %lu us, "
+             "longest %lu us\n", scale, renders, unchanged,
+             ticks_to_us(lastRenderTicks), ticks_to_us(longestRenderTicks));
+}
@@ -0,0 +1,21 @@
+// Size of the magnified view, in screen pixels. It is a multiple of 16,
+// so every zoom level shows a whole number of canvas pixels.
+#define ZOOM_VIEW_SIZE              256
+
+// Width of the frame around the view, in pixels (the view and the frame
+// make up the COMPOSE_ZOOM_SIZE layer)
+#define ZOOM_BORDER                 4
+#define ZOOM_BORDER_COLOUR          0x00404040
+
+// Distance of the magnifier from the edges of the screen
+#define ZOOM_MARGIN                 8
+
+// Zoom levels, powers of two from ZOOM_MIN_SCALE to ZOOM_MAX_SCALE
+#define ZOOM_MIN_SCALE              2
+#define ZOOM_MAX_SCALE              16
+
+// Function prototypes
+int zoom_set(unsigned int level);
+void zoom_cycle();
+void zoom_update(int x, int y);
+void zoom_report();